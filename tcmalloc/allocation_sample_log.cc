@@ -0,0 +1,143 @@
+// Copyright 2019 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/allocation_sample_log.h"
+
+#include <algorithm>
+#include <iterator>
+#include <limits>
+#include <tuple>
+
+#include "absl/hash/hash.h"
+#include "tcmalloc/internal/percpu.h"
+#include "tcmalloc/static_vars.h"
+
+namespace tcmalloc {
+
+// Like a constructor and hence we disable thread safety analysis.
+void AllocationSampleLog::Init(Arena* arena) NO_THREAD_SAFETY_ANALYSIS {
+  epoch_ = 0;
+  num_sessions_.store(0, std::memory_order_relaxed);
+  sessions_ = nullptr;
+  for (Shard& shard : shards_) {
+    std::fill(std::begin(shard.buckets), std::end(shard.buckets), nullptr);
+  }
+  entry_allocator_.Init(arena, kMetadataSampling);
+}
+
+void AllocationSampleLog::Append(const SampleRecord& r, uint64_t epoch) {
+  int cpu = subtle::percpu::GetCurrentCpu();
+  if (cpu < 0) cpu = 0;
+  Shard& shard = shards_[cpu % kNumShards];
+  const size_t h =
+      absl::Hash<std::tuple<uint32_t, size_t, size_t, size_t, uint64_t>>()(
+          std::make_tuple(r.stack_id, r.requested_size, r.requested_alignment,
+                          r.allocated_size, epoch));
+
+  absl::base_internal::SpinLockHolder l(&shard.lock);
+  Entry*& bucket = shard.buckets[h % kShardBuckets];
+  for (Entry* e = bucket; e != nullptr; e = e->next) {
+    if (e->epoch == epoch && e->sample.stack_id == r.stack_id &&
+        e->sample.requested_size == r.requested_size &&
+        e->sample.requested_alignment == r.requested_alignment &&
+        e->sample.allocated_size == r.allocated_size &&
+        e->count < std::numeric_limits<uint32_t>::max()) {
+      ++e->count;
+      e->total_weight += r.weight;
+      return;
+    }
+  }
+
+  Entry* e;
+  {
+    absl::base_internal::SpinLockHolder h(&pageheap_lock);
+    e = entry_allocator_.New();
+  }
+  e->sample = r;
+  e->epoch = epoch;
+  e->count = 1;
+  e->total_weight = r.weight;
+  e->next = bucket;
+  bucket = e;
+}
+
+void AllocationSampleLog::StartSession(Session* s) {
+  absl::base_internal::SpinLockHolder h(&sessions_lock_);
+  {
+    absl::base_internal::SpinLockHolder l(&pageheap_lock);
+    s->start = ++epoch_;
+    num_sessions_.fetch_add(1, std::memory_order_relaxed);
+  }
+  s->next = sessions_;
+  sessions_ = s;
+}
+
+void AllocationSampleLog::StopSession(
+    Session* s, absl::FunctionRef<void(const SampleRecord&, size_t)> f) {
+  // Read our entries while we are still registered, so that concurrent
+  // StopSession() calls do not trim them.
+  for (Shard& shard : shards_) {
+    absl::base_internal::SpinLockHolder l(&shard.lock);
+    absl::base_internal::SpinLockHolder h(&pageheap_lock);
+    for (const Entry* bucket : shard.buckets) {
+      for (const Entry* e = bucket; e != nullptr; e = e->next) {
+        if (e->epoch < s->start) continue;
+        SampleRecord r = e->sample;
+        r.weight = (e->total_weight + e->count / 2) / e->count;
+        f(r, e->count);
+      }
+    }
+  }
+
+  // Entries older than every remaining session can be freed.  Once no session
+  // is running, all of them can.
+  uint64_t min_start = std::numeric_limits<uint64_t>::max();
+  {
+    absl::base_internal::SpinLockHolder h(&sessions_lock_);
+    Session** link = &sessions_;
+    while (*link != s) {
+      CHECK_CONDITION(*link != nullptr);
+      link = &(*link)->next;
+    }
+    *link = s->next;
+    num_sessions_.fetch_sub(1, std::memory_order_relaxed);
+    for (const Session* cur = sessions_; cur != nullptr; cur = cur->next) {
+      min_start = std::min(min_start, cur->start);
+    }
+  }
+
+  for (Shard& shard : shards_) {
+    absl::base_internal::SpinLockHolder l(&shard.lock);
+    absl::base_internal::SpinLockHolder h(&pageheap_lock);
+    Trim(&shard, min_start);
+  }
+}
+
+void AllocationSampleLog::Trim(Shard* shard, uint64_t min_start) {
+  for (Entry*& bucket : shard->buckets) {
+    Entry** link = &bucket;
+    while (*link != nullptr) {
+      Entry* e = *link;
+      if (e->epoch >= min_start) {
+        link = &e->next;
+        continue;
+      }
+      Static::stack_depot()->Unref(e->sample.stack_id, e->count);
+      *link = e->next;
+      entry_allocator_.Delete(e);
+    }
+  }
+}
+
+}  // namespace tcmalloc
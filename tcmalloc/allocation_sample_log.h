@@ -0,0 +1,123 @@
+// Copyright 2019 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef TCMALLOC_ALLOCATION_SAMPLE_LOG_H_
+#define TCMALLOC_ALLOCATION_SAMPLE_LOG_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+
+#include "absl/base/internal/spinlock.h"
+#include "absl/base/optimization.h"
+#include "absl/base/thread_annotations.h"
+#include "absl/functional/function_ref.h"
+#include "tcmalloc/arena.h"
+#include "tcmalloc/common.h"
+#include "tcmalloc/internal/logging.h"
+#include "tcmalloc/page_heap_allocator.h"
+
+namespace tcmalloc {
+
+// A log of sampled allocations shared by all running allocation profiling
+// sessions (MallocExtension::StartAllocationProfiling).
+//
+// Each sampled allocation is logged once, in a per-CPU shard, however many
+// sessions are running.  Samples are tagged with an epoch that is advanced
+// when a session starts, and merged as they arrive into one entry per stack,
+// sizes and epoch, so that the log grows with the number of distinct
+// allocation sites rather than with the number of samples.  A session reads
+// the entries with an epoch at least its own when it stops, and entries older
+// than every running session are then freed.  Thus the cost of a sampled
+// allocation does not depend on the number of sessions, and none of it
+// happens under pageheap_lock unless a new entry is needed.
+//
+// The epoch of a sample is read, and the epoch advanced, under pageheap_lock,
+// so a session collects exactly the samples taken after it started, however
+// late they are appended.
+class AllocationSampleLog {
+ public:
+  // Constructor should do nothing since we rely on explicit Init()
+  // call, which may or may not be called before the constructor runs.
+  AllocationSampleLog() {}
+
+  void Init(Arena* arena) EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+
+  struct Session {
+    uint64_t start;
+    Session* next;
+  };
+
+  // True if any session is running.
+  bool active() const {
+    return num_sessions_.load(std::memory_order_relaxed) > 0;
+  }
+
+  // Epoch to tag a sample taken now with, for Append().
+  uint64_t epoch() const EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
+    return epoch_;
+  }
+
+  // Appends a sampled allocation, taken in "epoch".  The caller must hold a
+  // reference on r.stack_id in Static::stack_depot(), which the log takes
+  // over.
+  void Append(const SampleRecord& r, uint64_t epoch)
+      LOCKS_EXCLUDED(pageheap_lock);
+
+  void StartSession(Session* s) LOCKS_EXCLUDED(pageheap_lock);
+
+  // Ends session "s", calling f(r, count) for every distinct sample appended
+  // since it started, where count is the number of times it was and r.weight
+  // their mean weight.  f is called with pageheap_lock held.
+  void StopSession(Session* s,
+                   absl::FunctionRef<void(const SampleRecord&, size_t)> f)
+      LOCKS_EXCLUDED(pageheap_lock);
+
+ private:
+  static constexpr int kNumShards = 64;
+  static constexpr int kShardBuckets = 64;
+
+  // The samples of one stack, sizes and epoch.  Each holds a reference on
+  // sample.stack_id.
+  struct Entry {
+    SampleRecord sample;  // weight is unused.
+    uint64_t epoch;
+    uint32_t count;
+    size_t total_weight;
+    Entry* next;  // Hash chain.
+  };
+
+  struct ABSL_CACHELINE_ALIGNED Shard {
+    Shard() : lock(absl::base_internal::kLinkerInitialized) {}
+
+    absl::base_internal::SpinLock lock;
+    Entry* buckets[kShardBuckets] GUARDED_BY(lock);
+  };
+
+  // Frees the entries of "shard" that predate "min_start".
+  void Trim(Shard* shard, uint64_t min_start)
+      EXCLUSIVE_LOCKS_REQUIRED(shard->lock, pageheap_lock);
+
+  uint64_t epoch_ GUARDED_BY(pageheap_lock);
+  std::atomic<int> num_sessions_;
+  absl::base_internal::SpinLock sessions_lock_;
+  Session* sessions_ GUARDED_BY(sessions_lock_);
+  Shard shards_[kNumShards];
+  PageHeapAllocator<Entry> entry_allocator_ GUARDED_BY(pageheap_lock);
+};
+
+}  // namespace tcmalloc
+
+#endif  // TCMALLOC_ALLOCATION_SAMPLE_LOG_H_
@@ -19,29 +19,70 @@
 
 namespace tcmalloc {
 
-void* Arena::Alloc(size_t bytes) {
-  char* result;
+const char* MetadataTypeName(MetadataType type) {
+  switch (type) {
+    case kMetadataSpans:
+      return "spans";
+    case kMetadataPageMap:
+      return "pagemap";
+    case kMetadataStackTraces:
+      return "stack_traces";
+    case kMetadataSampling:
+      return "sampling";
+    case kMetadataThreadCaches:
+      return "thread_caches";
+    case kMetadataPerCpuCaches:
+      return "per_cpu_caches";
+    case kMetadataTransferCaches:
+      return "transfer_caches";
+    case kMetadataHugePageAware:
+      return "huge_page_aware";
+    case kMetadataGuardedPages:
+      return "guarded_pages";
+    case kMetadataDeferredFree:
+      return "deferred_free";
+    case kNumMetadataTypes:
+      break;
+  }
+  return "unknown";
+}
+
+void Arena::Grow(size_t bytes) {
+  size_t ask = bytes > alloc_increment_ ? bytes : alloc_increment_;
+  size_t actual_size;
+  free_area_ = reinterpret_cast<char*>(
+      SystemAlloc(ask, &actual_size, alignment_, /*tagged=*/false));
+  if (ABSL_PREDICT_FALSE(free_area_ == nullptr)) {
+    Log(kCrash, __FILE__, __LINE__,
+        "FATAL ERROR: Out of memory trying to allocate internal tcmalloc "
+        "data (bytes, object-size)",
+        alloc_increment_, bytes);
+  }
+  SystemBack(free_area_, actual_size);
+  free_avail_ = actual_size;
+}
+
+void Arena::Reserve(size_t bytes) {
   bytes = ((bytes + kAlignment - 1) / kAlignment) * kAlignment;
-  if (free_avail_ < bytes) {
-    size_t ask = bytes > kAllocIncrement ? bytes : kAllocIncrement;
-    size_t actual_size;
-    free_area_ = reinterpret_cast<char*>(
-        SystemAlloc(ask, &actual_size, kPageSize, /*tagged=*/false));
-    if (ABSL_PREDICT_FALSE(free_area_ == nullptr)) {
-      Log(kCrash, __FILE__, __LINE__,
-          "FATAL ERROR: Out of memory trying to allocate internal tcmalloc "
-          "data (bytes, object-size)",
-          kAllocIncrement, bytes);
-    }
-    SystemBack(free_area_, actual_size);
-    free_avail_ = actual_size;
+  if (free_avail_ < bytes) Grow(bytes);
+  // SystemBack is only a hint; touch the pages ourselves.
+  static const size_t kHardwarePageSize = 4 * 1024;
+  for (size_t offset = 0; offset < free_avail_; offset += kHardwarePageSize) {
+    reinterpret_cast<volatile char*>(free_area_)[offset] = 0;
   }
+}
+
+void* Arena::Alloc(size_t bytes, MetadataType type) {
+  char* result;
+  bytes = ((bytes + kAlignment - 1) / kAlignment) * kAlignment;
+  if (free_avail_ < bytes) Grow(bytes);
 
   ASSERT(reinterpret_cast<uintptr_t>(free_area_) % kAlignment == 0);
   result = free_area_;
   free_area_ += bytes;
   free_avail_ -= bytes;
   bytes_allocated_ += bytes;
+  bytes_by_type_[type] += bytes;
   return reinterpret_cast<void*>(result);
 }
 
@@ -23,6 +23,24 @@
 
 namespace tcmalloc {
 
+// The consumers of metadata, whose arena usage is accounted separately.
+enum MetadataType {
+  kMetadataSpans,
+  kMetadataPageMap,
+  kMetadataStackTraces,
+  kMetadataSampling,
+  kMetadataThreadCaches,
+  kMetadataPerCpuCaches,
+  kMetadataTransferCaches,
+  kMetadataHugePageAware,
+  kMetadataGuardedPages,
+  kMetadataDeferredFree,
+  kNumMetadataTypes,
+};
+
+// Returns the name of "type" in stats, e.g. "stack_traces".
+const char* MetadataTypeName(MetadataType type);
+
 // Arena allocation; designed for use by tcmalloc internal data structures like
 // spans, profiles, etc.  Always expands.
 class Arena {
@@ -33,15 +51,31 @@ class Arena {
   // We use an explicit Init function because these variables are statically
   // allocated and their constructors might not have run by the time some other
   // static variable tries to allocate memory.
-  void Init() EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
+  //
+  // Memory is obtained from the system in aligned slabs of at least
+  // "alloc_increment" bytes.  By default these are whole hugepages, so that
+  // metadata which is touched on every allocation (spans, pagemap leaves) is
+  // covered by few TLB entries.
+  void Init(size_t alloc_increment = kHugePageSize,
+            size_t alignment = kHugePageSize)
+      EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
     free_area_ = nullptr;
     free_avail_ = 0;
     bytes_allocated_ = 0;
+    for (uint64_t& b : bytes_by_type_) b = 0;
+    alloc_increment_ = alloc_increment;
+    alignment_ = alignment;
   }
 
-  // Return a properly aligned byte array of length "bytes".  Crashes if
-  // allocation fails.  Requires pageheap_lock is held.
-  void* Alloc(size_t bytes) EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+  // Return a properly aligned byte array of length "bytes", charged to
+  // "type".  Crashes if allocation fails.  Requires pageheap_lock is held.
+  void* Alloc(size_t bytes, MetadataType type)
+      EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+
+  // Makes sure the next "bytes" of allocations are served from memory that is
+  // already mapped and faulted in.  Crashes if allocation fails.  Requires
+  // pageheap_lock is held.
+  void Reserve(size_t bytes) EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
 
   // Returns the total number of bytes allocated from this arena.  Requires
   // pageheap_lock is held.
@@ -49,9 +83,19 @@ class Arena {
     return bytes_allocated_;
   }
 
+  // Returns the number of bytes allocated from this arena for "type".
+  // Requires pageheap_lock is held.
+  uint64_t bytes_allocated(MetadataType type) const
+      EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
+    return bytes_by_type_[type];
+  }
+
  private:
-  // How much to allocate from system at a time
-  static const int kAllocIncrement = 128 << 10;
+  // Replaces the free area with a fresh one of at least "bytes".
+  void Grow(size_t bytes) EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+
+  size_t alloc_increment_;
+  size_t alignment_;
 
   // Free area from which to carve new objects
   char* free_area_ GUARDED_BY(pageheap_lock);
@@ -59,6 +103,7 @@ class Arena {
 
   // Total number of bytes allocated from this arena
   uint64_t bytes_allocated_ GUARDED_BY(pageheap_lock);
+  uint64_t bytes_by_type_[kNumMetadataTypes] GUARDED_BY(pageheap_lock);
 
   Arena(const Arena&) = delete;
   Arena& operator=(const Arena&) = delete;
@@ -25,14 +25,21 @@
 namespace tcmalloc {
 
 // Like a constructor and hence we disable thread safety analysis.
-void CentralFreeList::Init(size_t cl) NO_THREAD_SAFETY_ANALYSIS {
+void CentralFreeList::Init(size_t cl, bool cold) NO_THREAD_SAFETY_ANALYSIS {
   size_class_ = cl;
+  cold_ = cold;
   object_size_ = Static::sizemap()->class_to_size(cl);
   objects_per_span_ = Static::sizemap()->class_to_pages(cl) * kPageSize /
                       (cl ? object_size_ : 1);
   nonempty_.Init();
   num_spans_.Clear();
   counter_.Clear();
+  low_water_mark_.store(0, std::memory_order_relaxed);
+}
+
+void CentralFreeList::ResetLowWaterMark() {
+  absl::base_internal::SpinLockHolder h(&lock_);
+  low_water_mark_.store(counter_.value(), std::memory_order_relaxed);
 }
 
 static Span* MapObjectToSpan(void* object) {
@@ -85,15 +92,18 @@ void CentralFreeList::InsertRange(void** batch, int N) {
       }
     }
     counter_.LossyAdd(N);
+    if (free_count) {
+      UpdateLowWaterMark();
+    }
   }
 
   // Then, release all free spans into page heap under its mutex.
   if (free_count) {
     absl::base_internal::SpinLockHolder h(&pageheap_lock);
     for (int i = 0; i < free_count; ++i) {
-      ASSERT(!IsTaggedMemory(free_spans[i]->start_address()));
+      ASSERT(IsTaggedMemory(free_spans[i]->start_address()) == cold_);
       Static::pagemap()->UnregisterSizeClass(free_spans[i]);
-      Static::page_allocator()->Delete(free_spans[i], /*tagged=*/false);
+      Static::page_allocator()->Delete(free_spans[i], cold_);
     }
   }
 }
@@ -102,6 +112,8 @@ int CentralFreeList::RemoveRange(void** batch, int N) {
   ASSERT(N > 0);
   absl::base_internal::SpinLockHolder h(&lock_);
   if (nonempty_.empty()) {
+    // Objects of a fresh span were not idle before this call.
+    UpdateLowWaterMark();
     Populate();
   }
 
@@ -116,6 +128,7 @@ int CentralFreeList::RemoveRange(void** batch, int N) {
     result += here;
   }
   counter_.LossyAdd(-result);
+  UpdateLowWaterMark();
   return result;
 }
 
@@ -125,7 +138,7 @@ void CentralFreeList::Populate() NO_THREAD_SAFETY_ANALYSIS {
   lock_.Unlock();
   const size_t npages = Static::sizemap()->class_to_pages(size_class_);
 
-  Span* span = Static::page_allocator()->New(npages, /*tagged=*/false);
+  Span* span = Static::page_allocator()->New(npages, cold_);
   if (span == nullptr) {
     Log(kLog, __FILE__, __LINE__,
         "tcmalloc: allocation failed", npages << kPageShift);
@@ -134,7 +147,11 @@ void CentralFreeList::Populate() NO_THREAD_SAFETY_ANALYSIS {
   }
   ASSERT(span->num_pages() == npages);
 
-  Static::pagemap()->RegisterSizeClass(span, size_class_);
+  if (cold_) {
+    Static::pagemap()->RegisterColdSizeClass(span, size_class_);
+  } else {
+    Static::pagemap()->RegisterSizeClass(span, size_class_);
+  }
   span->BuildFreelist(object_size_, objects_per_span_);
 
   // Add span to list of non-empty spans
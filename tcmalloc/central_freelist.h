@@ -16,6 +16,10 @@
 #define TCMALLOC_CENTRAL_FREELIST_H_
 
 #include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <atomic>
 
 #include "absl/base/internal/spinlock.h"
 #include "absl/base/macros.h"
@@ -35,7 +39,11 @@ class CentralFreeList {
         counter_(absl::base_internal::kLinkerInitialized),
         num_spans_(absl::base_internal::kLinkerInitialized) {}
 
-  void Init(size_t cl) LOCKS_EXCLUDED(lock_);
+  // If "cold" is true, spans are carved from tagged memory, apart from the
+  // hugepages of hot objects, and registered with RegisterColdSizeClass() so
+  // that frees of their objects reach do_free_pages(), which returns them
+  // here.  Used to hold cold objects (see tcmalloc_hot_cold_new()).
+  void Init(size_t cl, bool cold = false) LOCKS_EXCLUDED(lock_);
 
   // These methods all do internal locking.
 
@@ -50,6 +58,17 @@ class CentralFreeList {
   // Returns the number of free objects in cache.
   size_t length() { return static_cast<size_t>(counter_.value()); }
 
+  // Returns the smallest number of free objects the cache has held since
+  // the last call to ResetLowWaterMark(), i.e. the part of the cache that was
+  // never drawn on in that time.
+  size_t low_water_mark() {
+    return static_cast<size_t>(std::min<int64_t>(
+        low_water_mark_.load(std::memory_order_relaxed), counter_.value()));
+  }
+
+  // Starts a new low water mark interval at the current length.
+  void ResetLowWaterMark() LOCKS_EXCLUDED(lock_);
+
   // Returns the memory overhead (internal fragmentation) attributable
   // to the freelist.  This is memory lost when the size of elements
   // in a freelist doesn't exactly divide the page-size (an 8192-byte
@@ -71,12 +90,22 @@ class CentralFreeList {
   // May temporarily release lock_.
   void Populate() EXCLUSIVE_LOCKS_REQUIRED(lock_);
 
+  // Lowers low_water_mark_ to the current length, if needed.  Called whenever
+  // objects leave the cache.
+  void UpdateLowWaterMark() EXCLUSIVE_LOCKS_REQUIRED(lock_) {
+    const int64_t length = counter_.value();
+    if (length < low_water_mark_.load(std::memory_order_relaxed)) {
+      low_water_mark_.store(length, std::memory_order_relaxed);
+    }
+  }
+
   // This lock protects all the mutable data members.
   absl::base_internal::SpinLock lock_;
 
   size_t size_class_;  // My size class (immutable after Init())
   size_t object_size_;
   size_t objects_per_span_;
+  bool cold_;
 
   // Following are kept as a StatsCounter so that they can read without
   // acquiring a lock. Updates to these variables are guarded by lock_ so writes
@@ -86,6 +115,9 @@ class CentralFreeList {
   tcmalloc_internal::StatsCounter counter_;
   // Num spans in empty_ plus nonempty_
   tcmalloc_internal::StatsCounter num_spans_;
+  // Min of counter_ since the last ResetLowWaterMark().  Updated under lock_
+  // but can be read without it.
+  std::atomic<int64_t> low_water_mark_;
 
   SpanList nonempty_ GUARDED_BY(lock_);  // Dummy header for non-empty spans
 
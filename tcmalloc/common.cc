@@ -157,6 +157,18 @@ void SizeMap::Init() {
       break;
     }
   }
+
+  for (int i = 0; i < kNumAlignedClassMaps; i++) {
+    const size_t mask = (kAlignment << (i + 1)) - 1;
+    unsigned char aligned = 0;
+    for (int c = kNumClasses - 1; c > 0; c--) {
+      if ((class_to_size_[c] & mask) == 0) {
+        aligned = c;
+      }
+      aligned_class_[i][c] = aligned;
+    }
+    aligned_class_[i][0] = 0;
+  }
 }
 
 }  // namespace tcmalloc
@@ -188,13 +188,26 @@ static const int kMaxDynamicFreeListLength = 8192;
 
 static const Length kMaxValidPages = (~static_cast<Length>(0)) >> kPageShift;
 
+// kAddressBits is the largest address space tcmalloc supports on this
+// architecture, and kLowAddressBits the one every host provides.  Which of the
+// two is in use is decided at runtime, see AddressBits() in system-alloc.h.
 #if defined __x86_64__
-// All current and planned x86_64 processors only look at the lower 48 bits
-// in virtual to physical address translation.  The top 16 are thus unused.
+// x86_64 processors look at the lower 48 bits in virtual to physical address
+// translation, or at the lower 57 with 5-level paging (LA57).  Linux only
+// hands out addresses above the lower 47 bits to mmap() calls that ask for
+// them with a hint, so the top bits stay unused unless we do.  Builds with
+// TCMALLOC_57BIT_ADDRESSES use them where the host has them; other builds pay
+// nothing for the larger range.
 // TODO(b/134686025): Under what operating systems can we increase it safely to
 // 17? This lets us use smaller page maps.  On first allocation, a 36-bit page
 // map uses only 96 KB instead of the 4.5 MB used by a 52-bit page map.
+#ifdef TCMALLOC_57BIT_ADDRESSES
+static const int kAddressBits = (sizeof(void*) < 8 ? (8 * sizeof(void*)) : 57);
+#else
 static const int kAddressBits = (sizeof(void*) < 8 ? (8 * sizeof(void*)) : 48);
+#endif
+static const int kLowAddressBits =
+    (sizeof(void*) < 8 ? (8 * sizeof(void*)) : 48);
 #elif defined __powerpc64__ && defined __linux__
 // Linux(4.12 and above) on powerpc64 supports 128TB user virtual address space
 // by default, and up to 512TB if user space opts in by specifing hint in mmap.
@@ -208,6 +221,9 @@ static const int kAddressBits = (sizeof(void*) < 8 ? (8 * sizeof(void*)) : 48);
 #else
 static const int kAddressBits = 8 * sizeof(void*);
 #endif
+#if !defined __x86_64__
+static const int kLowAddressBits = kAddressBits;
+#endif
 
 namespace tcmalloc {
 #if defined(__x86_64__)
@@ -225,8 +241,10 @@ static const size_t kHugePageShift = 21;
 static const size_t kHugePageSize = static_cast<size_t>(1) << kHugePageShift;
 static const size_t kPagesPerHugePage = static_cast<size_t>(1)
                                         << (kHugePageShift - kPageShift);
+// The tag bit lies below the lower 47 bits, so that it is part of every
+// address the kernel hands out, however many address bits are in use.
 static constexpr uintptr_t kTagMask = uintptr_t{1}
-                                      << std::min(kAddressBits - 4, 42);
+                                      << std::min(kLowAddressBits - 4, 42);
 
 #if !defined(TCMALLOC_SMALL_BUT_SLOW) && __WORDSIZE != 32
 // Always allocate at least a huge page
@@ -338,6 +356,15 @@ class SizeMap {
   // Mapping from size class to max size storable in that class
   uint32_t class_to_size_[kNumClasses];
 
+  // Number of alignments strictly between kAlignment and kPageSize.
+  static const size_t kNumAlignedClassMaps = kPageShift - kAlignmentShift - 1;
+
+  // aligned_class_[i][cl] is the smallest size class >= cl whose size is a
+  // multiple of (kAlignment << (i + 1)), or 0 if there is none.  Spans are
+  // page-aligned, so every object of such a class has that alignment.  This
+  // lets aligned allocations find their class with a single lookup.
+  unsigned char aligned_class_[kNumAlignedClassMaps][kNumClasses];
+
   // If environment variable defined, use it to override sizes classes.
   // Returns true if all classes defined correctly.
   bool MaybeRunTimeSizeClasses();
@@ -402,17 +429,14 @@ class SizeMap {
     if (ABSL_PREDICT_FALSE(!GetSizeClass(size, cl))) {
       return false;
     }
+    // All size classes are multiples of kAlignment.
+    if (align <= kAlignment) {
+      return true;
+    }
 
-    // Predict that size aligned allocs most often directly map to a proper
-    // size class, i.e., multiples of 32, 64, etc, matching our class sizes.
-    const size_t mask = (align - 1);
-    do {
-      if (ABSL_PREDICT_TRUE((class_to_size(*cl) & mask) == 0)) {
-        return true;
-      }
-    } while (++*cl < kNumClasses);
-
-    return false;
+    const size_t i = __builtin_ctzll(align) - kAlignmentShift - 1;
+    *cl = aligned_class_[i][*cl];
+    return *cl != 0;
   }
 
   // Returns size class for given size, or 0 if this instance has not been
@@ -86,7 +86,7 @@ static size_t MaxCapacity(size_t cl) {
 }
 
 static void *SlabAlloc(size_t size) EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
-  return Static::arena()->Alloc(size);
+  return Static::arena()->Alloc(size, kMetadataPerCpuCaches);
 }
 
 void CPUCache::Activate() {
@@ -96,23 +96,49 @@ void CPUCache::Activate() {
   absl::base_internal::SpinLockHolder h(&pageheap_lock);
 
   resize_ = reinterpret_cast<ResizeInfo *>(
-      Static::arena()->Alloc(sizeof(ResizeInfo) * num_cpus));
+      Static::arena()->Alloc(sizeof(ResizeInfo) * num_cpus,
+                             kMetadataPerCpuCaches));
   lazy_slabs_ = Parameters::lazy_per_cpu_caches();
 
-  auto max_cache_size = Parameters::max_per_cpu_cache_size();
-
-  for (int cpu = 0; cpu < num_cpus; ++cpu) {
-    for (int cl = 1; cl < kNumClasses; ++cl) {
-      resize_[cpu].per_class[cl].Init();
+  // With lazy slabs, a CPU's resizing state is only touched once the CPU is
+  // first used (see InitCPUIfNecessary), so that cores the process never runs
+  // on cost no page faults.
+  if (!lazy_slabs_) {
+    for (int cpu = 0; cpu < num_cpus; ++cpu) {
+      InitResizeInfo(cpu);
     }
-    resize_[cpu].available.store(max_cache_size, std::memory_order_relaxed);
-    resize_[cpu].last_steal.store(1, std::memory_order_relaxed);
   }
 
   freelist_.Init(SlabAlloc, MaxCapacity, lazy_slabs_);
   Static::ActivateCPUCache();
 }
 
+void CPUCache::InitResizeInfo(int cpu) {
+  resize_[cpu].available.store(Parameters::max_per_cpu_cache_size(),
+                               std::memory_order_relaxed);
+  resize_[cpu].last_steal.store(1, std::memory_order_relaxed);
+  for (int cl = 1; cl < kNumClasses; ++cl) {
+    resize_[cpu].per_class[cl].Init();
+  }
+}
+
+void CPUCache::InitCPUIfNecessary(int cpu) {
+  absl::base_internal::LowLevelCallOnce(
+      &resize_[cpu].initialized,
+      [](CPUCache *cache, int cpu) {
+        if (cache->lazy_slabs_) {
+          absl::base_internal::SpinLockHolder h(&cache->resize_[cpu].lock);
+          cache->InitResizeInfo(cpu);
+          cache->freelist_.InitCPU(cpu, MaxCapacity);
+        }
+
+        // While we could unconditionally store, a lazy slab population
+        // implementation will require evaluating a branch.
+        cache->resize_[cpu].populated.store(true, std::memory_order_relaxed);
+      },
+      this, cpu);
+}
+
 // Fetch more items from the central cache, refill our local cache,
 // and try to grow it if necessary.
 //
@@ -174,6 +200,32 @@ void *CPUCache::Refill(int cpu, size_t cl) {
   return result;
 }
 
+size_t CPUCache::WarmUp(size_t cl, void **batch, size_t n) {
+  ASSERT(n > 0);
+  const int cpu = subtle::percpu::GetCurrentCpu();
+  if (cpu < 0) return 0;
+  InitCPUIfNecessary(cpu);
+
+  const size_t capacity = freelist_.Capacity(cpu, cl);
+  const size_t length = freelist_.Length(cpu, cl);
+  if (length + n > capacity) {
+    // Without a to_return buffer Steal skips full lists, so warming up one
+    // size class never evicts the objects we just put into another.
+    Grow(cpu, cl, length + n - capacity, nullptr, nullptr);
+  }
+  // If we were migrated since reading cpu, the objects simply land (or fail
+  // to land) on the new CPU's list; both are fine.
+  return freelist_.PushBatch(cl, batch, n);
+}
+
+size_t CPUCache::DeallocateBatch(size_t cl, void **batch, size_t n) {
+  ASSERT(n > 0);
+  const int cpu = subtle::percpu::GetCurrentCpu();
+  if (cpu < 0) return 0;
+  InitCPUIfNecessary(cpu);
+  return freelist_.PushBatch(cl, batch, n);
+}
+
 size_t CPUCache::UpdateCapacity(int cpu, size_t cl, size_t batch_length,
                                 bool overflow, ObjectClass *to_return,
                                 size_t *returned) {
@@ -201,19 +253,7 @@ size_t CPUCache::UpdateCapacity(int cpu, size_t cl, size_t batch_length,
   // We assert that the return value, target, is non-zero, so starting from an
   // initial capacity of zero means we may be populating this core for the
   // first time.
-  absl::base_internal::LowLevelCallOnce(
-      &resize_[cpu].initialized,
-      [](CPUCache *cache, int cpu) {
-        if (cache->lazy_slabs_) {
-          absl::base_internal::SpinLockHolder h(&cache->resize_[cpu].lock);
-          cache->freelist_.InitCPU(cpu, MaxCapacity);
-        }
-
-        // While we could unconditionally store, a lazy slab population
-        // implementation will require evaluating a branch.
-        cache->resize_[cpu].populated.store(true, std::memory_order_relaxed);
-      },
-      this, cpu);
+  InitCPUIfNecessary(cpu);
   const bool grow_by_one = capacity < 2 * batch_length;
   uint32_t successive = 0;
   bool grow_by_batch =
@@ -463,6 +503,10 @@ uint64_t CPUCache::TotalObjectsOfClass(size_t cl) const {
 }
 
 uint64_t CPUCache::Unallocated(int cpu) const {
+  // A lazily initialized CPU that was never used has its whole limit left.
+  if (lazy_slabs_ && !resize_[cpu].populated.load(std::memory_order_relaxed)) {
+    return CacheLimit();
+  }
   return resize_[cpu].available.load(std::memory_order_relaxed);
 }
 
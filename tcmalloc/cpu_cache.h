@@ -56,6 +56,17 @@ class CPUCache {
   // Free an object of the given class.
   void Deallocate(void *ptr, size_t cl);
 
+  // Makes room on the current CPU's freelist for <cl> (up to its maximum
+  // capacity and the CPU's cache limit) and pushes as many of batch[0...n)
+  // as fit.  Returns the number pushed; the rest are left at the start of
+  // <batch> for the caller to return.  Used by MallocExtension::WarmUp.
+  size_t WarmUp(size_t cl, void **batch, size_t n);
+
+  // Pushes as many of batch[0...n) as fit onto the current CPU's freelist for
+  // <cl>, without growing it.  Returns the number pushed; the rest are left at
+  // the start of <batch> for the caller to return.
+  size_t DeallocateBatch(size_t cl, void **batch, size_t n);
+
   // Give the number of bytes in <cpu>'s cache
   uint64_t UsedBytes(int cpu) const;
 
@@ -152,6 +163,12 @@ class CPUCache {
 
   void *Refill(int cpu, size_t cl);
 
+  // Initializes the resizing state of <cpu>.
+  void InitResizeInfo(int cpu);
+
+  // Populates <cpu>'s slab and resizing state the first time it is used.
+  void InitCPUIfNecessary(int cpu);
+
   // This is called after finding a full freelist when attempting to push <ptr>
   // on the freelist for sizeclass <cl>.  The last arg should indicate which
   // CPU's list was full.  Returns 1.
@@ -0,0 +1,162 @@
+// Copyright 2019 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/deferred_free.h"
+
+#include <algorithm>
+
+#include "absl/types/span.h"
+#include "tcmalloc/cpu_cache.h"
+#include "tcmalloc/internal/percpu.h"
+#include "tcmalloc/static_vars.h"
+#include "tcmalloc/tcmalloc.h"
+#include "tcmalloc/transfer_cache.h"
+
+namespace tcmalloc {
+
+int DeferredFreeList::CurrentShard() {
+  return std::max(subtle::percpu::GetCurrentCpu(), 0) % kShards;
+}
+
+uint64_t DeferredFreeList::Enter() {
+  std::atomic<int64_t>* count = readers_[CurrentShard()].count;
+  while (true) {
+    const uint64_t epoch = epoch_.load(std::memory_order_seq_cst);
+    count[epoch & 1].fetch_add(1, std::memory_order_seq_cst);
+    // If the epoch moved on before we were counted, Advance() may not have
+    // seen us: count ourselves in the new one instead.
+    if (epoch_.load(std::memory_order_seq_cst) == epoch) return epoch;
+    count[epoch & 1].fetch_sub(1, std::memory_order_release);
+  }
+}
+
+void DeferredFreeList::Exit(uint64_t epoch) {
+  readers_[CurrentShard()].count[epoch & 1].fetch_sub(
+      1, std::memory_order_release);
+}
+
+void DeferredFreeList::Retire(void* ptr, size_t cl) {
+  Shard& shard = shards_[CurrentShard()];
+  bool advance;
+  {
+    absl::base_internal::SpinLockHolder h(&shard.lock);
+    // Read under the lock, so that Free() never misses an object of the
+    // epoch it frees.
+    const int slot = epoch_.load(std::memory_order_seq_cst) % kSlots;
+    Chunk* chunk = shard.lists[slot][cl];
+    if (chunk == nullptr || chunk->length == Chunk::kCapacity) {
+      Chunk* fresh = shard.free_chunks;
+      if (fresh != nullptr) {
+        shard.free_chunks = fresh->next;
+      } else {
+        absl::base_internal::SpinLockHolder l(&pageheap_lock);
+        fresh = static_cast<Chunk*>(
+            Static::arena()->Alloc(sizeof(Chunk), kMetadataDeferredFree));
+      }
+      fresh->next = chunk;
+      fresh->length = 0;
+      shard.lists[slot][cl] = chunk = fresh;
+    }
+    chunk->objects[chunk->length++] = ptr;
+    if (cl != 0) shard.bytes[slot] += Static::sizemap()->class_to_size(cl);
+    advance = ++shard.objects[slot] % kAdvanceObjects == 0;
+  }
+  if (advance) Advance();
+}
+
+bool DeferredFreeList::Advance() {
+  if (!advance_lock_.TryLock()) return false;
+  const uint64_t epoch = epoch_.load(std::memory_order_seq_cst);
+  // Readers of the epoch before this one share the parity of the next.
+  int64_t readers = 0;
+  for (const Readers& r : readers_) {
+    readers += r.count[(epoch + 1) & 1].load(std::memory_order_seq_cst);
+  }
+  if (readers != 0) {
+    advance_lock_.Unlock();
+    return false;
+  }
+  epoch_.store(epoch + 1, std::memory_order_seq_cst);
+  // Nobody who entered in epoch - 1 or earlier is left, and later readers
+  // cannot reach what was retired then.
+  if (epoch >= 1) Free((epoch - 1) % kSlots);
+  advance_lock_.Unlock();
+  return true;
+}
+
+size_t DeferredFreeList::pending_bytes() {
+  size_t bytes = 0;
+  for (Shard& shard : shards_) {
+    absl::base_internal::SpinLockHolder h(&shard.lock);
+    for (size_t b : shard.bytes) bytes += b;
+  }
+  return bytes;
+}
+
+void DeferredFreeList::Free(int slot) {
+  // Retire() does not add to "slot" until the epoch after next, which cannot
+  // begin while we hold advance_lock_.
+  for (Shard& shard : shards_) {
+    Chunk* lists[kNumClasses];
+    {
+      absl::base_internal::SpinLockHolder h(&shard.lock);
+      if (shard.objects[slot] == 0) continue;
+      std::copy(shard.lists[slot], shard.lists[slot] + kNumClasses, lists);
+      std::fill(shard.lists[slot], shard.lists[slot] + kNumClasses, nullptr);
+    }
+    for (size_t cl = 0; cl < kNumClasses; ++cl) {
+      if (lists[cl] != nullptr) FreeClass(cl, lists[cl]);
+    }
+    absl::base_internal::SpinLockHolder h(&shard.lock);
+    for (Chunk* chunk : lists) {
+      while (chunk != nullptr) {
+        Chunk* next = chunk->next;
+        chunk->next = shard.free_chunks;
+        shard.free_chunks = chunk;
+        chunk = next;
+      }
+    }
+    shard.objects[slot] = 0;
+    shard.bytes[slot] = 0;
+  }
+}
+
+void DeferredFreeList::FreeClass(size_t cl, Chunk* chunk) {
+  if (cl == 0) {
+    for (; chunk != nullptr; chunk = chunk->next) {
+      for (size_t i = 0; i < chunk->length; ++i) {
+        TCMallocInternalFree(chunk->objects[i]);
+      }
+    }
+    return;
+  }
+
+  const size_t batch_length = Static::sizemap()->num_objects_to_move(cl);
+  for (; chunk != nullptr; chunk = chunk->next) {
+    for (size_t i = 0; i < chunk->length; i += batch_length) {
+      void** batch = chunk->objects + i;
+      const size_t n = std::min(batch_length, chunk->length - i);
+      size_t pushed = 0;
+      if (UsePerCpuCache()) {
+        pushed = Static::cpu_cache()->DeallocateBatch(cl, batch, n);
+      }
+      if (pushed < n) {
+        Static::transfer_cache()[cl].InsertRange(absl::Span<void*>(batch, n),
+                                                 n - pushed);
+      }
+    }
+  }
+}
+
+}  // namespace tcmalloc
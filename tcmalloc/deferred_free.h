@@ -0,0 +1,123 @@
+// Copyright 2019 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef TCMALLOC_DEFERRED_FREE_H_
+#define TCMALLOC_DEFERRED_FREE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+
+#include "absl/base/internal/spinlock.h"
+#include "absl/base/optimization.h"
+#include "absl/base/thread_annotations.h"
+#include "tcmalloc/common.h"
+
+namespace tcmalloc {
+
+// Epoch-based reclamation for MallocExtension::DeferredFree().
+//
+// Readers announce themselves in the current epoch with Enter() and leave
+// with Exit().  Objects passed to Retire() are kept until no reader that
+// entered at or before the epoch they were retired in remains, i.e. until the
+// epoch has been advanced twice past it.  Readers are counted by the parity of
+// their epoch, in per-CPU counters that Advance() sums, so Advance() may only
+// move on once the readers of the epoch before the current one have all left.
+// A reader may leave on another CPU than it entered on: the counters of single
+// CPUs can go negative, but their sum cannot.
+//
+// Retired objects are never written to before their grace period ends, since
+// readers may still be using them.  Their pointers are kept in chunks from the
+// metadata arena, in shards chosen by CPU, by size class (objects that are not
+// in a size class, such as large or sampled ones, in class 0).  When their
+// grace period ends, each size class is returned in batches: onto the per-CPU
+// cache of the calling thread with PushBatch(), and what does not fit to the
+// transfer cache.
+//
+// Like the other members of Static, a DeferredFreeList is zero-initialized,
+// and its constructor does nothing.
+class DeferredFreeList {
+ public:
+  DeferredFreeList()
+      : advance_lock_(absl::base_internal::kLinkerInitialized) {}
+
+  // Returns the epoch the calling thread entered, to be passed to Exit().
+  uint64_t Enter();
+  void Exit(uint64_t epoch);
+
+  // Defers the free of "ptr" until the readers that may still see it have
+  // left.  "cl" is its size class, or 0 to free it with free().
+  void Retire(void* ptr, size_t cl);
+
+  // Advances the epoch if the grace period of the previous one has ended, and
+  // frees the objects that can no longer be reached.  Returns false if
+  // readers still hold the epoch back, or another thread is advancing it.
+  bool Advance();
+
+  // Bytes of retired objects in size classes not yet freed.
+  size_t pending_bytes();
+
+ private:
+  static constexpr int kShards = 16;
+  // An epoch's objects are freed when the epoch two later begins, so three
+  // epochs' worth of objects are held at a time.
+  static constexpr int kSlots = 3;
+  // A shard that holds this many objects of the current epoch tries to
+  // advance it.
+  static constexpr size_t kAdvanceObjects = 1024;
+
+  // Pointers to retired objects, kCapacity to the 1KiB chunk.
+  struct Chunk {
+    static constexpr size_t kCapacity = 126;
+
+    Chunk* next;
+    size_t length;
+    void* objects[kCapacity];
+  };
+
+  struct alignas(ABSL_CACHELINE_SIZE) Readers {
+    std::atomic<int64_t> count[2];
+  };
+
+  struct alignas(ABSL_CACHELINE_SIZE) Shard {
+    Shard() : lock(absl::base_internal::kLinkerInitialized) {}
+
+    absl::base_internal::SpinLock lock;
+    // Objects retired in epochs e with e % kSlots == slot, by size class.
+    Chunk* lists[kSlots][kNumClasses] GUARDED_BY(lock);
+    size_t objects[kSlots] GUARDED_BY(lock);
+    size_t bytes[kSlots] GUARDED_BY(lock);
+    // Chunks whose objects have been freed, for reuse.
+    Chunk* free_chunks GUARDED_BY(lock);
+  };
+
+  static int CurrentShard();
+
+  // Frees the lists of "slot" in every shard.
+  void Free(int slot);
+  // Frees the objects of size class "cl" in "chunk" and the chunks after it.
+  void FreeClass(size_t cl, Chunk* chunk);
+
+  alignas(ABSL_CACHELINE_SIZE) std::atomic<uint64_t> epoch_;
+  // Held across advancing the epoch and freeing the slot it ends, so that
+  // the slot is not reused by a later epoch while it is being freed.
+  absl::base_internal::SpinLock advance_lock_;
+  Readers readers_[kShards];
+  Shard shards_[kShards];
+};
+
+}  // namespace tcmalloc
+
+#endif  // TCMALLOC_DEFERRED_FREE_H_
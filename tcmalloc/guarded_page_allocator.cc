@@ -63,8 +63,9 @@ void GuardedPageAllocator::Init(size_t max_alloced_pages, size_t total_pages) {
 void GuardedPageAllocator::Destroy() {
   absl::base_internal::SpinLockHolder h(&guarded_page_lock);
   if (initialized_) {
-    size_t len = pages_end_addr_ - pages_base_addr_;
-    int err = munmap(reinterpret_cast<void *>(pages_base_addr_), len);
+    uintptr_t base = pages_base_addr_.load(std::memory_order_relaxed);
+    size_t len = pages_end_addr_.load(std::memory_order_relaxed) - base;
+    int err = munmap(reinterpret_cast<void *>(base), len);
     ASSERT(err != -1);
     (void)err;
     initialized_ = false;
@@ -162,7 +163,7 @@ GuardedPageAllocator::ErrorType GuardedPageAllocator::GetStackTraces(
 // mean number of profiled samples made for every guarded sample.
 static int GetChainedRate() {
   auto guarded_rate = Parameters::guarded_sampling_rate();
-  auto sample_rate = Parameters::profile_sampling_rate();
+  auto sample_rate = Sampler::GetSamplePeriod();
   if (guarded_rate < 0 || sample_rate <= 0) {
     return guarded_rate;
   } else {
@@ -225,16 +226,19 @@ void GuardedPageAllocator::MapPages() {
 
   // Allocate memory for slot metadata.
   data_ = reinterpret_cast<SlotMetadata *>(
-      Static::arena()->Alloc(sizeof(*data_) * total_pages_));
-
-  pages_base_addr_ = base_addr;
-  pages_end_addr_ = pages_base_addr_ + len;
+      Static::arena()->Alloc(sizeof(*data_) * total_pages_,
+                             kMetadataGuardedPages));
 
   // Align first page to page_size_.
-  first_page_addr_ = GetPageAddr(pages_base_addr_ + page_size_);
+  first_page_addr_ = GetPageAddr(base_addr + page_size_);
 
   std::fill_n(free_pages_, total_pages_, true);
   initialized_ = true;
+
+  // Publish the range last: PointerIsMine() may be called concurrently, from
+  // the free path or the SEGV handler, and then relies on the state above.
+  pages_base_addr_.store(base_addr, std::memory_order_relaxed);
+  pages_end_addr_.store(base_addr + len, std::memory_order_release);
 }
 
 // Selects a random slot in O(total_pages_) time.
@@ -502,6 +506,15 @@ ABSL_ATTRIBUTE_WEAK void SetDefaultGuardedSamplingRate();
 extern "C" void MallocExtension_Internal_ActivateGuardedSampling() {
   static absl::once_flag flag;
   absl::call_once(flag, []() {
+    // The guarded pages are only mapped now, rather than when TCMalloc is
+    // initialized, so that processes which never sample guarded allocations
+    // do not pay for them at startup.
+    Static::InitIfNecessary();
+    {
+      absl::base_internal::SpinLockHolder h(&pageheap_lock);
+      Static::guardedpage_allocator()->Init(/*max_alloced_pages=*/64,
+                                            /*total_pages=*/128);
+    }
     struct sigaction action = {};
     action.sa_sigaction = SegvHandler;
     sigemptyset(&action.sa_mask);
@@ -19,6 +19,7 @@
 #include <stdint.h>
 #include <sys/types.h>
 
+#include <atomic>
 #include <utility>
 
 #include "absl/base/attributes.h"
@@ -177,7 +178,11 @@ class GuardedPageAllocator {
   inline bool ABSL_ATTRIBUTE_ALWAYS_INLINE
   PointerIsMine(const void *ptr) const {
     uintptr_t addr = reinterpret_cast<uintptr_t>(ptr);
-    return pages_base_addr_ <= addr && addr < pages_end_addr_;
+    // The end is published last, after the rest of the pool is set up, and
+    // is 0 until then.
+    uintptr_t end = pages_end_addr_.load(std::memory_order_acquire);
+    return pages_base_addr_.load(std::memory_order_relaxed) <= addr &&
+           addr < end;
   }
 
   // Allows Allocate() to start returning allocations.
@@ -272,8 +277,10 @@ class GuardedPageAllocator {
   // is detected.
   SlotMetadata *data_;
 
-  uintptr_t pages_base_addr_;  // Points to start of mapped region.
-  uintptr_t pages_end_addr_;   // Points to the end of mapped region.
+  // The mapped region.  Set when guarded sampling is activated, and read by
+  // PointerIsMine() without the lock.
+  std::atomic<uintptr_t> pages_base_addr_;  // Points to start of region.
+  std::atomic<uintptr_t> pages_end_addr_;   // Points to the end of region.
   uintptr_t first_page_addr_;  // Points to first page returnable by Allocate.
   size_t max_alloced_pages_;   // Max number of pages to allocate at once.
   size_t total_pages_;         // Size of the page pool to allocate from.
@@ -0,0 +1,153 @@
+// Copyright 2019 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/heap_delta_tracker.h"
+
+#include <math.h>
+#include <string.h>
+
+#include "absl/base/internal/spinlock.h"
+#include "absl/memory/memory.h"
+#include "tcmalloc/malloc_extension.h"
+#include "tcmalloc/sampler.h"
+#include "tcmalloc/static_vars.h"
+
+namespace tcmalloc {
+namespace {
+
+class HeapDeltaProfile : public tcmalloc_internal::ProfileBase {
+ public:
+  HeapDeltaProfile(int64_t period, HeapDeltaTracker::Bucket* buckets)
+      : period_(period), buckets_(buckets) {}
+
+  ~HeapDeltaProfile() override {
+    Static::heap_delta_tracker()->DeleteBuckets(buckets_);
+  }
+
+  void Iterate(absl::FunctionRef<void(const Profile::Sample&)> func)
+      const override {
+    for (const HeapDeltaTracker::Bucket* b = buckets_; b != nullptr;
+         b = b->next) {
+      const size_t allocated_size = b->trace.allocated_size;
+      Profile::Sample e;
+      // Like StackTraceTable, report a whole number of objects, but allow
+      // negative counts: these are net changes.
+      e.count = llround(b->bytes / allocated_size);
+      if (e.count == 0) continue;
+      e.sum = e.count * static_cast<int64_t>(allocated_size);
+      e.requested_size = b->trace.requested_size;
+      e.requested_alignment = b->trace.requested_alignment;
+      e.allocated_size = allocated_size;
+      e.depth = b->trace.depth;
+      static_assert(kMaxStackDepth <= Profile::Sample::kMaxStackDepth,
+                    "Profile stack size smaller than internal stack sizes");
+      memcpy(e.stack, b->trace.stack, sizeof(e.stack[0]) * e.depth);
+      func(e);
+    }
+  }
+
+  int64_t Period() const override { return period_; }
+
+  ProfileType Type() const override { return ProfileType::kHeapDelta; }
+
+ private:
+  int64_t period_;
+  HeapDeltaTracker::Bucket* buckets_;
+};
+
+}  // namespace
+
+// Like a constructor and hence we disable thread safety analysis.
+void HeapDeltaTracker::Init(Arena* arena) NO_THREAD_SAFETY_ANALYSIS {
+  active_ = false;
+  memset(table_, 0, sizeof(table_));
+  changed_ = nullptr;
+  entry_allocator_.Init(arena, kMetadataSampling);
+  bucket_allocator_.Init(arena, kMetadataSampling);
+}
+
+size_t HeapDeltaTracker::Hash(const SampleRecord& r) {
+  uint64_t h = r.stack_id;
+  h = (h ^ r.requested_size) * UINT64_C(0x9E3779B97F4A7C15);
+  h = (h ^ r.requested_alignment) * UINT64_C(0x9E3779B97F4A7C15);
+  h = (h ^ r.allocated_size) * UINT64_C(0x9E3779B97F4A7C15);
+  return h >> (64 - kHashBits);
+}
+
+void HeapDeltaTracker::Add(const SampleRecord& r, int sign) {
+  Entry** bucket = &table_[Hash(r)];
+  Entry* e = *bucket;
+  while (e != nullptr &&
+         (e->key.stack_id != r.stack_id ||
+          e->key.requested_size != r.requested_size ||
+          e->key.requested_alignment != r.requested_alignment ||
+          e->key.allocated_size != r.allocated_size)) {
+    e = e->next;
+  }
+  if (e == nullptr) {
+    e = entry_allocator_.New();
+    e->key = r;
+    e->samples = 0;
+    e->bytes = 0;
+    e->next = *bucket;
+    *bucket = e;
+    e->next_changed = changed_;
+    changed_ = e;
+    Static::stack_depot()->Ref(r.stack_id);
+  }
+  e->samples += sign;
+  e->bytes += sign * AllocatedBytes(r, true);
+}
+
+std::unique_ptr<tcmalloc_internal::ProfileBase> HeapDeltaTracker::Checkpoint() {
+  Bucket* buckets = nullptr;
+  {
+    absl::base_internal::SpinLockHolder h(&pageheap_lock);
+    if (!active_) {
+      active_ = true;
+      Static::sampled_allocations()->ForEach(
+          [&](void*, const SampleRecord& r) { Add(r, 1); });
+    }
+
+    for (Entry* e = changed_; e != nullptr;) {
+      Entry* next = e->next_changed;
+      if (e->samples != 0 || e->bytes != 0) {
+        Bucket* b = bucket_allocator_.New();
+        Static::stack_depot()->Expand(e->key, &b->trace);
+        b->samples = e->samples;
+        b->bytes = e->bytes;
+        b->next = buckets;
+        buckets = b;
+      }
+      table_[Hash(e->key)] = nullptr;
+      Static::stack_depot()->Unref(e->key.stack_id);
+      entry_allocator_.Delete(e);
+      e = next;
+    }
+    changed_ = nullptr;
+  }
+  return absl::make_unique<HeapDeltaProfile>(Sampler::GetSamplePeriod(),
+                                             buckets);
+}
+
+void HeapDeltaTracker::DeleteBuckets(Bucket* b) {
+  absl::base_internal::SpinLockHolder h(&pageheap_lock);
+  while (b != nullptr) {
+    Bucket* next = b->next;
+    bucket_allocator_.Delete(b);
+    b = next;
+  }
+}
+
+}  // namespace tcmalloc
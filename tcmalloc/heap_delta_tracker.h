@@ -0,0 +1,101 @@
+// Copyright 2019 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef TCMALLOC_HEAP_DELTA_TRACKER_H_
+#define TCMALLOC_HEAP_DELTA_TRACKER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+
+#include "absl/base/thread_annotations.h"
+#include "tcmalloc/arena.h"
+#include "tcmalloc/common.h"
+#include "tcmalloc/internal/logging.h"
+#include "tcmalloc/internal_malloc_extension.h"
+#include "tcmalloc/page_heap_allocator.h"
+
+namespace tcmalloc {
+
+// Keeps per-stack counters of sampled allocations minus sampled frees since
+// the last checkpoint, for ProfileType::kHeapDelta profiles.  Only stacks that
+// changed since the last checkpoint are kept, so a checkpoint costs time
+// proportional to their number rather than to the size of the heap.
+class HeapDeltaTracker {
+ public:
+  // Constructor should do nothing since we rely on explicit Init()
+  // call, which may or may not be called before the constructor runs.
+  HeapDeltaTracker() {}
+
+  void Init(Arena* arena) EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+
+  // Records that sample "r" was allocated or freed.  Does nothing until the
+  // first checkpoint.
+  void ReportMalloc(const SampleRecord& r)
+      EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
+    if (active_) Add(r, 1);
+  }
+  void ReportFree(const SampleRecord& r)
+      EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
+    if (active_) Add(r, -1);
+  }
+
+  // Returns the net change of the sampled heap since the previous checkpoint
+  // and starts a new window.  The first checkpoint starts tracking and reports
+  // the whole sampled heap, i.e. the change since an empty heap.
+  std::unique_ptr<tcmalloc_internal::ProfileBase> Checkpoint()
+      LOCKS_EXCLUDED(pageheap_lock);
+
+  // Counters for one <stack, sizes> key.  Holds a reference on the stack in
+  // Static::stack_depot().
+  struct Entry {
+    SampleRecord key;  // weight is unused.
+    int64_t samples;   // Sampled allocations minus sampled frees.
+    double bytes;      // The same, weighted to estimate unsampled bytes.
+    Entry* next;       // Hash chain.
+    Entry* next_changed;
+  };
+
+  // A stack trace with its counters, as reported in a profile.
+  struct Bucket {
+    StackTrace trace;
+    int64_t samples;
+    double bytes;
+    Bucket* next;
+  };
+
+  // Frees a list of buckets handed out by Checkpoint().
+  void DeleteBuckets(Bucket* b) LOCKS_EXCLUDED(pageheap_lock);
+
+ private:
+  static constexpr int kHashBits = 10;
+  static constexpr int kHashTableSize = 1 << kHashBits;
+
+  static size_t Hash(const SampleRecord& r);
+
+  void Add(const SampleRecord& r, int sign)
+      EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+
+  bool active_ GUARDED_BY(pageheap_lock);
+  Entry* table_[kHashTableSize] GUARDED_BY(pageheap_lock);
+  // All entries, i.e. every key that changed since the last checkpoint.
+  Entry* changed_ GUARDED_BY(pageheap_lock);
+  PageHeapAllocator<Entry> entry_allocator_ GUARDED_BY(pageheap_lock);
+  PageHeapAllocator<Bucket> bucket_allocator_ GUARDED_BY(pageheap_lock);
+};
+
+}  // namespace tcmalloc
+
+#endif  // TCMALLOC_HEAP_DELTA_TRACKER_H_
@@ -0,0 +1,453 @@
+// Copyright 2019 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/heap_instance.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <new>
+#include <tuple>
+
+#include "tcmalloc/internal/logging.h"
+#include "tcmalloc/memfd_region.h"
+#include "tcmalloc/pagemap.h"
+#include "tcmalloc/static_vars.h"
+#include "tcmalloc/system-alloc.h"
+
+namespace tcmalloc {
+
+static_assert(HeapInstance::kRegionBytes % kHugePageSize == 0,
+              "regions must be made of whole hugepages");
+static_assert(HeapInstance::kRegionBytes % kMinSystemAlloc == 0,
+              "regions must be made of whole system allocations");
+
+struct HeapInstance::Region {
+  static constexpr uint64_t kMagic = 0x48656170526567ULL;  // "HeapReg"
+
+  uint64_t magic;
+  HeapInstance* heap;  // nullptr while in the pool.
+  Region* next;
+  size_t bytes;        // Of the whole region, header included.
+  uintptr_t data;      // The first page after the header.
+  uintptr_t next_page;
+  int fd;              // Of the memfd backing the region, or -1.
+  size_t file_offset;  // Of the start of the region in the memfd.
+
+  uintptr_t start() const { return reinterpret_cast<uintptr_t>(this); }
+  uintptr_t end() const { return start() + bytes; }
+  bool Fits(size_t n) const { return end() - next_page >= (n << kPageShift); }
+
+  // The page table follows the header.
+  uint32_t* pages() { return reinterpret_cast<uint32_t*>(this + 1); }
+
+  static size_t HeaderBytes(size_t bytes) {
+    const size_t header =
+        sizeof(Region) + sizeof(uint32_t) * (bytes >> kPageShift);
+    return (header + kPageSize - 1) & ~(kPageSize - 1);
+  }
+};
+
+// A run of free pages, from a large allocation or the rest of one.
+struct HeapInstance::FreeRun {
+  FreeRun* next;
+  size_t pages;
+};
+
+struct HeapInstance::Cage {
+  AddressRegion* region;  // Covers the cage; regions are allocated from it.
+  uintptr_t base;
+  Region* regions;  // Of the last heap that used the cage, while pooled.
+  bool shared;
+  Cage* next;
+};
+
+ABSL_CONST_INIT absl::base_internal::SpinLock HeapInstance::pool_lock_(
+    absl::base_internal::kLinkerInitialized);
+HeapInstance::Region* HeapInstance::pool_ = nullptr;
+HeapInstance::Region* HeapInstance::shared_pool_ = nullptr;
+HeapInstance::Cage* HeapInstance::cage_pool_ = nullptr;
+
+HeapInstance::HeapInstance(const Heap::Options& options)
+    : limit_(options.limit),
+      cage_(nullptr),
+      caged_(options.caged),
+      shared_(options.shared),
+      regions_(nullptr),
+      current_(nullptr),
+      free_lists_{},
+      free_runs_(nullptr),
+      allocated_bytes_(0),
+      free_bytes_(0),
+      mapped_bytes_(0),
+      reserved_bytes_(0),
+      num_regions_(0) {
+  // A cage must be addressable by 32-bit offsets from its base.
+  if (!caged_ || sizeof(uintptr_t) < sizeof(uint64_t)) return;
+
+  absl::base_internal::SpinLockHolder h(&lock_);
+  {
+    absl::base_internal::SpinLockHolder p(&pool_lock_);
+    for (Cage** link = &cage_pool_; *link != nullptr; link = &(*link)->next) {
+      if ((*link)->shared == shared_) {
+        cage_ = *link;
+        *link = cage_->next;
+        break;
+      }
+    }
+  }
+  if (cage_ != nullptr) {
+    AdoptRegions(cage_);
+    return;
+  }
+
+  AddressRegionFactory* factory = nullptr;
+  if (shared_) {
+    factory = MemfdRegionFactory::Get();
+    if (factory == nullptr) return;
+  }
+  void* base;
+  AddressRegion* region = SystemReserveRegion(
+      Heap::kCageBytes, Heap::kCageBytes, /*tagged=*/true, factory, &base);
+  if (region == nullptr) return;
+  cage_ = new Cage;
+  cage_->region = region;
+  cage_->base = reinterpret_cast<uintptr_t>(base);
+  cage_->regions = nullptr;
+  cage_->shared = shared_;
+  cage_->next = nullptr;
+}
+
+HeapInstance::~HeapInstance() {
+  absl::base_internal::SpinLockHolder h(&lock_);
+  Clear();
+  absl::base_internal::SpinLockHolder p(&pool_lock_);
+  // The regions of a cage stay with it.
+  Region*& pool = cage_ != nullptr ? cage_->regions
+                  : shared_         ? shared_pool_
+                                    : pool_;
+  while (regions_ != nullptr) {
+    Region* r = regions_;
+    regions_ = r->next;
+    r->heap = nullptr;
+    r->next = pool;
+    pool = r;
+  }
+  if (cage_ != nullptr) {
+    cage_->next = cage_pool_;
+    cage_pool_ = cage_;
+  }
+}
+
+void HeapInstance::AdoptRegions(Cage* cage) {
+  while (cage->regions != nullptr) {
+    Region* r = cage->regions;
+    cage->regions = r->next;
+    r->heap = this;
+    r->next = regions_;
+    regions_ = r;
+    mapped_bytes_ += r->data - r->start();
+    reserved_bytes_ += r->bytes;
+    ++num_regions_;
+  }
+  current_ = regions_;
+}
+
+HeapInstance::Region* HeapInstance::RegionOf(const void* ptr) {
+  if (!IsTaggedMemory(ptr)) return nullptr;
+  const PageID p = reinterpret_cast<uintptr_t>(ptr) >> kPageShift;
+  // Other hugepage entries belong to the huge page aware allocator, and point
+  // at its metadata.
+  Region* r = static_cast<Region*>(Static::pagemap()->GetHugepage(p));
+  if (r == nullptr || r->magic != Region::kMagic) return nullptr;
+  return r;
+}
+
+uint32_t* HeapInstance::PageEntry(Region* r, const void* ptr) {
+  return &r->pages()[(reinterpret_cast<uintptr_t>(ptr) - r->start()) >>
+                     kPageShift];
+}
+
+HeapInstance* HeapInstance::Owner(const void* ptr) {
+  Region* r = RegionOf(ptr);
+  return r != nullptr ? r->heap : nullptr;
+}
+
+bool HeapInstance::GetSharedMemoryLocation(const void* ptr, int* fd,
+                                           size_t* offset) {
+  Region* r = RegionOf(ptr);
+  if (r == nullptr || r->heap == nullptr || r->fd < 0) return false;
+  *fd = r->fd;
+  *offset = r->file_offset + (reinterpret_cast<uintptr_t>(ptr) - r->start());
+  return true;
+}
+
+bool HeapInstance::Owns(const void* ptr) const { return Owner(ptr) == this; }
+
+void* HeapInstance::CageBase() const {
+  return cage_ != nullptr ? reinterpret_cast<void*>(cage_->base) : nullptr;
+}
+
+size_t HeapInstance::GetAllocatedSize(const void* ptr) const {
+  Region* r = RegionOf(ptr);
+  ASSERT(r != nullptr && r->heap == this);
+  const uint32_t entry = *PageEntry(r, ptr);
+  if (entry & kLargeAllocation) {
+    return static_cast<size_t>(entry & ~kLargeAllocation) << kPageShift;
+  }
+  return Static::sizemap()->class_to_size(entry);
+}
+
+void* HeapInstance::Allocate(size_t size) {
+  absl::base_internal::SpinLockHolder h(&lock_);
+  if (size <= kMaxSize) {
+    const size_t cl = Static::sizemap()->SizeClass(std::max<size_t>(size, 1));
+    if (free_lists_[cl] == nullptr && !Refill(cl)) return nullptr;
+    void* result = free_lists_[cl];
+    free_lists_[cl] = *static_cast<void**>(result);
+    const size_t bytes = Static::sizemap()->class_to_size(cl);
+    allocated_bytes_ += bytes;
+    free_bytes_ -= bytes;
+    return result;
+  }
+
+  const size_t n = (size >> kPageShift) + ((size & (kPageSize - 1)) != 0);
+  if (n >= kLargeAllocation) return nullptr;
+  void* result = AllocatePages(n, kLargeAllocation | n);
+  if (result != nullptr) allocated_bytes_ += n << kPageShift;
+  return result;
+}
+
+void HeapInstance::Deallocate(void* ptr) {
+  Region* r = RegionOf(ptr);
+  if (ABSL_PREDICT_FALSE(r == nullptr || r->heap != this)) {
+    Log(kCrash, __FILE__, __LINE__, "Pointer not allocated by this heap", ptr);
+  }
+  const uint32_t entry = *PageEntry(r, ptr);
+  if (ABSL_PREDICT_FALSE(entry == 0)) {
+    Log(kCrash, __FILE__, __LINE__, "Invalid pointer freed to heap", ptr);
+  }
+
+  absl::base_internal::SpinLockHolder h(&lock_);
+  if (entry & kLargeAllocation) {
+    ASSERT(reinterpret_cast<uintptr_t>(ptr) % kPageSize == 0);
+    const size_t bytes = static_cast<size_t>(entry & ~kLargeAllocation)
+                         << kPageShift;
+    FreeRun* run = static_cast<FreeRun*>(ptr);
+    run->next = free_runs_;
+    run->pages = bytes >> kPageShift;
+    free_runs_ = run;
+    allocated_bytes_ -= bytes;
+    free_bytes_ += bytes;
+    return;
+  }
+
+  *static_cast<void**>(ptr) = free_lists_[entry];
+  free_lists_[entry] = ptr;
+  const size_t bytes = Static::sizemap()->class_to_size(entry);
+  allocated_bytes_ -= bytes;
+  free_bytes_ += bytes;
+}
+
+void HeapInstance::Reset() {
+  absl::base_internal::SpinLockHolder h(&lock_);
+  Clear();
+}
+
+Heap::Stats HeapInstance::GetStats() const {
+  absl::base_internal::SpinLockHolder h(&lock_);
+  Heap::Stats stats;
+  stats.allocated_bytes = allocated_bytes_;
+  stats.free_bytes = free_bytes_;
+  stats.mapped_bytes = mapped_bytes_;
+  stats.reserved_bytes = reserved_bytes_;
+  stats.regions = num_regions_;
+  return stats;
+}
+
+bool HeapInstance::Refill(size_t cl) {
+  const size_t size = Static::sizemap()->class_to_size(cl);
+  const size_t n = Static::sizemap()->class_to_pages(cl);
+  char* span = static_cast<char*>(AllocatePages(n, cl));
+  if (span == nullptr) return false;
+
+  // Link the objects in address order.
+  const size_t objects = (n << kPageShift) / size;
+  for (size_t i = objects; i-- > 0;) {
+    void* object = span + i * size;
+    *static_cast<void**>(object) = free_lists_[cl];
+    free_lists_[cl] = object;
+  }
+  free_bytes_ += objects * size;
+  return true;
+}
+
+void* HeapInstance::AllocatePages(size_t n, uint32_t entry) {
+  const size_t bytes = n << kPageShift;
+  void* result = nullptr;
+
+  for (FreeRun** link = &free_runs_; *link != nullptr; link = &(*link)->next) {
+    FreeRun* run = *link;
+    if (run->pages < n) continue;
+    if (run->pages > n) {
+      FreeRun* rest = reinterpret_cast<FreeRun*>(
+          reinterpret_cast<uintptr_t>(run) + bytes);
+      rest->next = run->next;
+      rest->pages = run->pages - n;
+      *link = rest;
+    } else {
+      *link = run->next;
+    }
+    free_bytes_ -= bytes;
+    result = run;
+    break;
+  }
+
+  if (result == nullptr) {
+    if (limit_ != 0 && mapped_bytes_ + bytes > limit_) return nullptr;
+    Region* r = current_;
+    if (r == nullptr || !r->Fits(n)) {
+      // Regions emptied by Reset() come first.
+      r = nullptr;
+      for (Region* it = regions_; it != nullptr; it = it->next) {
+        if (it->next_page == it->data && it->Fits(n)) {
+          r = it;
+          break;
+        }
+      }
+      if (r == nullptr) {
+        r = AddRegion(n);
+        if (r == nullptr) return nullptr;
+      }
+      // A region made for one large allocation does not replace a current
+      // region that still has room.
+      if (current_ == nullptr || r->bytes <= kRegionBytes) current_ = r;
+    }
+    result = reinterpret_cast<void*>(r->next_page);
+    r->next_page += bytes;
+    mapped_bytes_ += bytes;
+  }
+
+  uint32_t* pages = PageEntry(RegionOf(result), result);
+  pages[0] = entry;
+  // Interior pages of large allocations are not valid to free.
+  const uint32_t rest = (entry & kLargeAllocation) ? 0 : entry;
+  for (size_t i = 1; i < n; ++i) {
+    pages[i] = rest;
+  }
+  return result;
+}
+
+HeapInstance::Region* HeapInstance::AddRegion(size_t n) {
+  // Stay within what SystemAlloc() can provide.
+  if (n > (kTagMask >> kPageShift) / 2) return nullptr;
+  size_t bytes = kRegionBytes;
+  while (Region::HeaderBytes(bytes) + (n << kPageShift) > bytes) {
+    bytes += kRegionBytes;
+  }
+  if (limit_ != 0 &&
+      mapped_bytes_ + Region::HeaderBytes(bytes) + (n << kPageShift) > limit_) {
+    return nullptr;
+  }
+
+  Region* r = nullptr;
+  if (!caged_) {
+    absl::base_internal::SpinLockHolder h(&pool_lock_);
+    Region** pool = shared_ ? &shared_pool_ : &pool_;
+    for (Region** link = pool; *link != nullptr; link = &(*link)->next) {
+      if ((*link)->bytes >= bytes) {
+        r = *link;
+        *link = r->next;
+        break;
+      }
+    }
+  }
+  if (r == nullptr) {
+    r = NewRegion(bytes);
+    if (r == nullptr) return nullptr;
+  }
+
+  r->heap = this;
+  r->next = regions_;
+  r->next_page = r->data;
+  regions_ = r;
+  mapped_bytes_ += r->data - r->start();
+  reserved_bytes_ += r->bytes;
+  ++num_regions_;
+  return r;
+}
+
+HeapInstance::Region* HeapInstance::NewRegion(size_t bytes) {
+  void* base;
+  size_t actual;
+  // The region that backs the new one, if it was made by the memfd factory.
+  MemfdRegion* memfd = nullptr;
+  if (caged_) {
+    if (cage_ == nullptr) return nullptr;
+    std::tie(base, actual) = cage_->region->Alloc(bytes, kRegionBytes);
+    if (shared_) memfd = static_cast<MemfdRegion*>(cage_->region);
+  } else if (shared_) {
+    MemfdRegionFactory* factory = MemfdRegionFactory::Get();
+    if (factory == nullptr) return nullptr;
+    void* start;
+    AddressRegion* region = SystemReserveRegion(bytes, kRegionBytes,
+                                                /*tagged=*/true, factory,
+                                                &start);
+    if (region == nullptr) return nullptr;
+    std::tie(base, actual) = region->Alloc(bytes, kRegionBytes);
+    memfd = static_cast<MemfdRegion*>(region);
+  } else {
+    base = SystemAlloc(bytes, &actual, kRegionBytes, /*tagged=*/true);
+  }
+  if (base == nullptr) return nullptr;
+  ASSERT(actual >= bytes);
+  ASSERT(IsTaggedMemory(base));
+  {
+    absl::base_internal::SpinLockHolder h(&pageheap_lock);
+    const PageID first = reinterpret_cast<uintptr_t>(base) >> kPageShift;
+    // Like the page heap, we lose the memory if the pagemap cannot grow.
+    if (!Static::pagemap()->Ensure(first, actual >> kPageShift)) {
+      return nullptr;
+    }
+    for (size_t offset = 0; offset < actual; offset += kHugePageSize) {
+      Static::pagemap()->SetHugepage(first + (offset >> kPageShift), base);
+    }
+  }
+  Region* r = new (base) Region;
+  r->magic = Region::kMagic;
+  r->bytes = actual;
+  r->data = r->start() + Region::HeaderBytes(actual);
+  r->fd = memfd != nullptr ? memfd->fd() : -1;
+  r->file_offset = memfd != nullptr ? memfd->FileOffset(base) : 0;
+  return r;
+}
+
+void HeapInstance::Clear() {
+  // The headers of the regions stay, and nothing else.
+  mapped_bytes_ = 0;
+  for (Region* r = regions_; r != nullptr; r = r->next) {
+    if (r->next_page > r->data) {
+      SystemRelease(reinterpret_cast<void*>(r->data), r->next_page - r->data);
+    }
+    r->next_page = r->data;
+    mapped_bytes_ += r->data - r->start();
+  }
+  current_ = regions_;
+  memset(free_lists_, 0, sizeof(free_lists_));
+  free_runs_ = nullptr;
+  allocated_bytes_ = 0;
+  free_bytes_ = 0;
+}
+
+}  // namespace tcmalloc
@@ -0,0 +1,135 @@
+// Copyright 2019 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef TCMALLOC_HEAP_INSTANCE_H_
+#define TCMALLOC_HEAP_INSTANCE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "absl/base/internal/spinlock.h"
+#include "absl/base/thread_annotations.h"
+#include "tcmalloc/common.h"
+#include "tcmalloc/malloc_extension.h"
+
+namespace tcmalloc {
+
+// The implementation of tcmalloc::Heap.
+//
+// A HeapInstance takes tagged memory from SystemAlloc() in regions of
+// kRegionBytes (more for large allocations), aligned to kRegionBytes.  Each
+// region starts with a header and a table of the size class of its pages, and
+// hands out the rest from a bump pointer: spans of class_to_pages(cl) pages
+// are cut into objects for per-size-class free lists, and larger allocations
+// take whole pages.  Freed large allocations are kept on a first-fit list of
+// page runs, which also feeds new spans.
+//
+// The pages of a region are Ensure()d in the pagemap but have no Span, and
+// their hugepage entries point at the region header.  Tagged memory is always
+// freed through do_free_pages(), which looks there when it finds no Span, so
+// free() and operator delete hand memory from a HeapInstance back to it.
+//
+// A caged heap takes its regions from one reservation of Heap::kCageBytes
+// instead, made through SystemReserveRegion().  A shared heap makes its
+// reservations through the MemfdRegionFactory, so that its regions are
+// mappings of the process memfd, and records the fd and file offset of each
+// region in its header.
+//
+// Regions are never returned to the address space: Reset() releases their
+// pages, and a destroyed heap leaves its regions (or its cage) in a pool for
+// later heaps.
+class HeapInstance final : public tcmalloc_internal::HeapBase {
+ public:
+  static constexpr size_t kRegionBytes = size_t{32} << 20;
+
+  explicit HeapInstance(const Heap::Options& options);
+  ~HeapInstance() override;
+
+  void* Allocate(size_t size) override;
+  void Deallocate(void* ptr) override;
+  void Reset() override;
+  Heap::Stats GetStats() const override;
+  bool Owns(const void* ptr) const override;
+  void* CageBase() const override;
+
+  // Returns the usable size of "ptr", which this heap allocated.
+  size_t GetAllocatedSize(const void* ptr) const;
+
+  // Returns the heap that owns "ptr", or nullptr if it is not in a region of
+  // a live heap.  The page of "ptr" must be mapped by the pagemap.
+  static HeapInstance* Owner(const void* ptr);
+
+  // If "ptr" lies in a region of a shared heap, stores the memfd and the file
+  // offset of "ptr" in *fd and *offset and returns true.
+  static bool GetSharedMemoryLocation(const void* ptr, int* fd,
+                                      size_t* offset);
+
+ private:
+  struct Region;
+  struct FreeRun;
+  struct Cage;
+
+  // The table entry of the first page of a large allocation holds its length
+  // in pages, tagged with kLargeAllocation.  Other entries hold a size class.
+  static constexpr uint32_t kLargeAllocation = uint32_t{1} << 31;
+
+  static Region* RegionOf(const void* ptr);
+  static uint32_t* PageEntry(Region* r, const void* ptr);
+
+  // Returns "n" pages, tagging their table entries with "entry", or nullptr
+  // if out of memory or at the limit.
+  void* AllocatePages(size_t n, uint32_t entry)
+      EXCLUSIVE_LOCKS_REQUIRED(lock_);
+  // Adds a region with room for at least "n" pages.
+  Region* AddRegion(size_t n) EXCLUSIVE_LOCKS_REQUIRED(lock_);
+  // Maps a new region of "bytes", from the cage if the heap has one, and from
+  // the memfd if the heap is shared.
+  Region* NewRegion(size_t bytes) EXCLUSIVE_LOCKS_REQUIRED(lock_);
+  // Takes over the regions of "cage", from a destroyed heap.
+  void AdoptRegions(Cage* cage) EXCLUSIVE_LOCKS_REQUIRED(lock_);
+  // Cuts a new span into objects of size class "cl".
+  bool Refill(size_t cl) EXCLUSIVE_LOCKS_REQUIRED(lock_);
+  // Releases the pages of all regions, and forgets what was allocated.
+  void Clear() EXCLUSIVE_LOCKS_REQUIRED(lock_);
+
+  mutable absl::base_internal::SpinLock lock_;
+  const size_t limit_;
+  // nullptr unless the heap is caged and its cage could be reserved.
+  Cage* cage_;
+  const bool caged_;
+  const bool shared_;
+
+  Region* regions_ GUARDED_BY(lock_);
+  // The region new pages are taken from.
+  Region* current_ GUARDED_BY(lock_);
+  void* free_lists_[kNumClasses] GUARDED_BY(lock_);
+  FreeRun* free_runs_ GUARDED_BY(lock_);
+
+  size_t allocated_bytes_ GUARDED_BY(lock_);
+  size_t free_bytes_ GUARDED_BY(lock_);
+  size_t mapped_bytes_ GUARDED_BY(lock_);
+  size_t reserved_bytes_ GUARDED_BY(lock_);
+  size_t num_regions_ GUARDED_BY(lock_);
+
+  // Regions and cages of destroyed heaps, for reuse.  Shared regions are
+  // only reused by shared heaps.
+  static absl::base_internal::SpinLock pool_lock_;
+  static Region* pool_ GUARDED_BY(pool_lock_);
+  static Region* shared_pool_ GUARDED_BY(pool_lock_);
+  static Cage* cage_pool_ GUARDED_BY(pool_lock_);
+};
+
+}  // namespace tcmalloc
+
+#endif  // TCMALLOC_HEAP_INSTANCE_H_
@@ -87,5 +87,32 @@ TEST(HeapProfilingTest, PeakHeapTracking) {
   }
 }
 
+TEST(HeapProfilingTest, HeapDelta) {
+  // Start a new window.
+  MallocExtension::SnapshotCurrent(ProfileType::kHeapDelta);
+
+  void *ptr = malloc(50 << 20);
+  EXPECT_NEAR(ProfileSize(ProfileType::kHeapDelta), 50 << 20, 10 << 20);
+
+  // Nothing (much) has changed since the previous snapshot.
+  EXPECT_NEAR(ProfileSize(ProfileType::kHeapDelta), 0, 10 << 20);
+
+  free(ptr);
+  bool saw_free = false;
+  int64_t total = 0;
+  const Profile profile =
+      MallocExtension::SnapshotCurrent(ProfileType::kHeapDelta);
+  EXPECT_EQ(profile.Type(), ProfileType::kHeapDelta);
+  profile.Iterate([&](const Profile::Sample &e) {
+    total += e.sum;
+    if (e.requested_size == 50 << 20) {
+      EXPECT_LT(e.count, 0);
+      saw_free = true;
+    }
+  });
+  EXPECT_TRUE(saw_free);
+  EXPECT_NEAR(total, -(50 << 20), 10 << 20);
+}
+
 }  // namespace
 }  // namespace tcmalloc
@@ -140,6 +140,7 @@ HugeRange HugeCache::DoGet(HugeLength n, bool *from_released) {
   if (!node) {
     misses_++;
     weighted_misses_ += n.raw_num();
+    if (realtime_) return HugeRange::Nil();
     HugeRange res = allocator_->Get(n);
     if (res.valid()) {
       *from_released = true;
@@ -311,6 +312,7 @@ HugeLength HugeCache::MaybeShrinkCacheLimit() {
 
 HugeLength HugeCache::ShrinkCache(HugeLength target) {
   HugeLength removed = NHugePages(0);
+  if (realtime_) return removed;
   while (size_ > target) {
     if (respect_mincache_limit_ && size_ <= MinCacheLimit()) break;
     // Remove smallest-ish nodes, to avoid fragmentation where possible.
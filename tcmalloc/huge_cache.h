@@ -184,6 +184,10 @@ class HugeCache {
   // the number of hugepages released.
   HugeLength ReleaseCachedPages(HugeLength n);
 
+  // From now on, only hand out ranges we have cached and never unback them
+  // (see PageAllocatorInterface::EnterRealTimeMode).
+  void EnterRealTimeMode() { realtime_ = true; }
+
   // Backed memory available.
   HugeLength size() const { return size_; }
   // Total memory cached (in HugeLength * nanoseconds)
@@ -290,6 +294,7 @@ class HugeCache {
   const bool ignore_oncepersec_release_;
 
   MemoryModifyFunction unback_;
+  bool realtime_{false};
 };
 
 }  // namespace tcmalloc
@@ -86,8 +86,8 @@ HugePageAwareAllocator::HugePageAwareAllocator(bool tagged)
       alloc_(tagged ? AllocAndReport<true> : AllocAndReport<false>,
              MetaDataAlloc),
       cache_(HugeCache{&alloc_, MetaDataAlloc, UnbackWithoutLock}) {
-  tracker_allocator_.Init(Static::arena());
-  region_allocator_.Init(Static::arena());
+  tracker_allocator_.Init(Static::arena(), kMetadataHugePageAware);
+  region_allocator_.Init(Static::arena(), kMetadataHugePageAware);
 }
 
 HugePageAwareAllocator::FillerType::Tracker *HugePageAwareAllocator::GetTracker(
@@ -174,8 +174,9 @@ Span *HugePageAwareAllocator::AllocLarge(Length n, bool *from_released) {
   }
 
   // If we're using regions in this binary (see below comment), is
-  // there currently available space there?
-  if (regions_.MaybeGet(n, &page, from_released)) {
+  // there currently available space there?  (In real-time mode, the space
+  // might not be backed; stay with the cache, which only has backed memory.)
+  if (!realtime_ && regions_.MaybeGet(n, &page, from_released)) {
     return Finalize(n, page);
   }
 
@@ -303,6 +304,8 @@ void HugePageAwareAllocator::DeleteFromHugepage(FillerType::Tracker *pt,
 }
 
 bool HugePageAwareAllocator::AddRegion() {
+  // A new region is carved from unbacked address space.
+  if (realtime_) return false;
   HugeRange r = alloc_.Get(Region::size());
   if (!r.valid()) return false;
   Region *region = region_allocator_.New();
@@ -333,19 +336,23 @@ void HugePageAwareAllocator::Delete(Span *span) {
 
   // b) We got put into a region, possibly crossing hugepages -
   //    return our allocation to the region.
-  if (regions_.MaybePut(p, n)) return;
+  if (regions_.MaybePut(p, n, /*release=*/!realtime_)) return;
 
   // c) we came straight from the HugeCache - return straight there.  (We
   //    might have had slack put into the filler - if so, return that virtual
   //    allocation to the filler too!)
   ASSERT(n >= kPagesPerHugePage);
+  DeleteRawHugepages(hp, n);
+}
+
+void HugePageAwareAllocator::DeleteRawHugepages(HugePage hp, Length n) {
   HugeLength hl = HLFromPages(n);
   HugePage last = hp + hl - NHugePages(1);
   Length slack = hl.in_pages() - n;
   if (slack == 0) {
     ASSERT(GetTracker(last) == nullptr);
   } else {
-    pt = GetTracker(last);
+    FillerType::Tracker *pt = GetTracker(last);
     CHECK_CONDITION(pt != nullptr);
     // We put the slack into the filler (see AllocEnormous.)
     // Handle this page separately as a virtual allocation
@@ -377,6 +384,50 @@ void HugePageAwareAllocator::Delete(Span *span) {
   cache_.Release({hp, hl});
 }
 
+bool HugePageAwareAllocator::Resize(Span *span, Length n) {
+  ASSERT(IsTaggedMemory(span->start_address()) == tagged_);
+  ASSERT(!span->sampled());
+  ASSERT(n > 0);
+  const PageID p = span->first_page();
+  const Length old = span->num_pages();
+  if (n == old) return true;
+  if (n > old) return false;
+
+  // As in Delete(), find where the span came from.  Only the first page of a
+  // span is in the pagemap, so the tail needs no pagemap updates.
+  HugePage hp = HugePageContaining(p);
+  FillerType::Tracker *pt = GetTracker(hp);
+  if (pt != nullptr) {
+    // a) On a single hugepage of the filler, which the head keeps in use.
+    CHECK_CONDITION(filler_.Put(pt, p + n, old - n) == nullptr);
+  } else if (!regions_.MaybePut(p + n, old - n, /*release=*/!realtime_)) {
+    // b) would have returned the tail to its region, so this is c), a run of
+    //    hugepages from the cache.  Return the hugepages the span no longer
+    //    reaches, then make sure the slack of its new last hugepage is in the
+    //    filler, as AllocRawHugepages() would have put it there.
+    const HugeLength keep = HLFromPages(n);
+    const HugePage last = hp + keep - NHugePages(1);
+    const Length here = n - (keep - NHugePages(1)).in_pages();
+    if (keep < HLFromPages(old)) {
+      DeleteRawHugepages(hp + keep, old - keep.in_pages());
+      pt = nullptr;
+    } else {
+      pt = GetTracker(last);
+    }
+    if (pt != nullptr) {
+      CHECK_CONDITION(filler_.Put(pt, p + n, old - n) == nullptr);
+    } else if (here < kPagesPerHugePage) {
+      ++donated_huge_pages_;
+      AllocAndContribute(last, here, /*donated=*/true);
+    }
+  }
+
+  span->set_num_pages(n);
+  info_.RecordFree(p, old);
+  info_.RecordAlloc(p, n);
+  return true;
+}
+
 void HugePageAwareAllocator::ReleaseHugepage(FillerType::Tracker *pt) {
   ASSERT(pt->used_pages() == 0);
   HugeRange r = {pt->location(), NHugePages(1)};
@@ -431,8 +482,16 @@ void HugePageAwareAllocator::GetSpanStats(SmallSpanStats *small,
   cache_.AddSpanStats(small, large, ages);
 }
 
+// public
+void HugePageAwareAllocator::EnterRealTimeMode() {
+  realtime_ = true;
+  filler_.EnterRealTimeMode();
+  cache_.EnterRealTimeMode();
+}
+
 // public
 Length HugePageAwareAllocator::ReleaseAtLeastNPages(Length num_pages) {
+  if (realtime_) return 0;
   Length released = 0;
   released += cache_.ReleaseCachedPages(HLFromPages(num_pages)).in_pages();
 
@@ -595,13 +654,14 @@ void *HugePageAwareAllocator::AllocAndReport(size_t bytes, size_t *actual,
 
 void *HugePageAwareAllocator::MetaDataAlloc(size_t bytes)
     EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
-  return Static::arena()->Alloc(bytes);
+  return Static::arena()->Alloc(bytes, kMetadataHugePageAware);
 }
 
 Length HugePageAwareAllocator::ReleaseAtLeastNPagesBreakingHugepages(Length n) {
   // We desparately need to release memory, and are willing to
   // compromise on hugepage usage. That means releasing from the filler.
   Length ret = 0;
+  if (realtime_) return ret;
 
   while (ret < n) {
     Length got = filler_.ReleasePages();
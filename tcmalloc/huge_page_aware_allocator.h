@@ -58,6 +58,11 @@ class HugePageAwareAllocator : public PageAllocatorInterface {
   //           has not yet been deleted.
   void Delete(Span* span) EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) override;
 
+  // Spans only shrink: their tail goes back to the filler, region or cache it
+  // came from.  The pages that follow a span are rarely free to grow into.
+  bool Resize(Span* span, Length n)
+      EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) override;
+
   BackingStats stats() const EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) override;
 
   void GetSmallSpanStats(SmallSpanStats* result)
@@ -78,6 +83,8 @@ class HugePageAwareAllocator : public PageAllocatorInterface {
   Length ReleaseAtLeastNPagesBreakingHugepages(Length n)
       EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
 
+  void EnterRealTimeMode() EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) override;
+
   // Prints stats about the page heap to *out.
   void Print(TCMalloc_Printer* out) LOCKS_EXCLUDED(pageheap_lock) override;
 
@@ -126,6 +133,9 @@ class HugePageAwareAllocator : public PageAllocatorInterface {
   // get stuck in the filler).
   HugeLength donated_huge_pages_ GUARDED_BY(pageheap_lock);
 
+  // Set by EnterRealTimeMode().
+  bool realtime_ GUARDED_BY(pageheap_lock) = false;
+
   void GetSpanStats(SmallSpanStats* small, LargeSpanStats* large,
                     PageAgeHistograms* ages);
 
@@ -158,6 +168,10 @@ class HugePageAwareAllocator : public PageAllocatorInterface {
   // Return an allocation from a single hugepage.
   void DeleteFromHugepage(FillerType::Tracker* pt, PageID p, Length n)
       EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+  // Return the <n> pages at the start of a run of hugepages from the cache,
+  // starting at <hp>, along with the slack donated to the filler.
+  void DeleteRawHugepages(HugePage hp, Length n)
+      EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
 
   // Finish an allocation request - give it a span and mark it in the pagemap.
   Span* Finalize(Length n, PageID page);
@@ -0,0 +1,128 @@
+// Copyright 2019 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/huge_page_aware_allocator.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+
+#include <new>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "absl/base/internal/spinlock.h"
+#include "tcmalloc/common.h"
+#include "tcmalloc/malloc_extension.h"
+#include "tcmalloc/page_allocator_test_util.h"
+#include "tcmalloc/pagemap.h"
+#include "tcmalloc/span.h"
+#include "tcmalloc/static_vars.h"
+#include "tcmalloc/stats.h"
+
+namespace tcmalloc {
+namespace {
+
+class HugePageAwareAllocatorTest : public ::testing::Test {
+ protected:
+  HugePageAwareAllocatorTest() {
+    // If this test is not linked against TCMalloc, the global arena used for
+    // metadata will not be initialized.
+    Static::InitIfNecessary();
+
+    before_ = MallocExtension::GetRegionFactory();
+    extra_ = new ExtraRegionFactory(before_);
+    MallocExtension::SetRegionFactory(extra_);
+    void* p = malloc(sizeof(HugePageAwareAllocator));
+    allocator_ = new (p) HugePageAwareAllocator(/*tagged=*/false);
+  }
+
+  ~HugePageAwareAllocatorTest() override {
+    MallocExtension::SetRegionFactory(before_);
+    delete extra_;
+    free(allocator_);
+  }
+
+  Span* New(Length n) { return allocator_->New(n); }
+
+  void Delete(Span* s) {
+    absl::base_internal::SpinLockHolder h(&pageheap_lock);
+    allocator_->Delete(s);
+  }
+
+  bool Resize(Span* s, Length n) {
+    absl::base_internal::SpinLockHolder h(&pageheap_lock);
+    return allocator_->Resize(s, n);
+  }
+
+  // The pages of live spans, as the allocator accounts for them.
+  Length UsedPages() {
+    BackingStats stats;
+    {
+      absl::base_internal::SpinLockHolder h(&pageheap_lock);
+      stats = allocator_->stats();
+    }
+    return (stats.system_bytes - stats.free_bytes - stats.unmapped_bytes) >>
+           kPageShift;
+  }
+
+  HugePageAwareAllocator* allocator_;
+  AddressRegionFactory* before_;
+  ExtraRegionFactory* extra_;
+};
+
+TEST_F(HugePageAwareAllocatorTest, Resize) {
+  // Spans from the filler, from regions and from the hugepage cache, with
+  // and without slack on their last hugepage.
+  const std::vector<Length> lengths = {
+      2,
+      kPagesPerHugePage / 2,
+      kPagesPerHugePage + 1,
+      3 * kPagesPerHugePage / 2,
+      4 * kPagesPerHugePage,
+      10 * kPagesPerHugePage + 3,
+  };
+  for (const Length n : lengths) {
+    Span* s = New(n);
+    ASSERT_NE(s, nullptr) << n;
+    const PageID first = s->first_page();
+    ASSERT_EQ(UsedPages(), n);
+
+    // Resizing to the same length, or growing, leaves the span as it was.
+    EXPECT_TRUE(Resize(s, n));
+    EXPECT_FALSE(Resize(s, n + 1));
+    EXPECT_EQ(s->num_pages(), n);
+    EXPECT_EQ(UsedPages(), n);
+
+    // Shrinking returns the tail, whatever it came from.
+    for (const Length m : {n - 1, n / 2, Length{1}}) {
+      if (m == 0 || m > s->num_pages()) continue;
+      ASSERT_TRUE(Resize(s, m)) << n << " " << m;
+      EXPECT_EQ(s->first_page(), first);
+      EXPECT_EQ(s->num_pages(), m);
+      EXPECT_EQ(Static::pagemap()->GetDescriptor(first), s);
+      EXPECT_EQ(UsedPages(), m) << n << " " << m;
+    }
+
+    // The returned tail can be allocated again.
+    Span* t = New(n - 1);
+    ASSERT_NE(t, nullptr) << n;
+    EXPECT_EQ(UsedPages(), n);
+    Delete(t);
+    Delete(s);
+    EXPECT_EQ(UsedPages(), 0) << n;
+  }
+}
+
+}  // namespace
+}  // namespace tcmalloc
@@ -181,6 +181,13 @@ class HugePageFiller {
   // Currently our implementation doesn't really use this (no need!)
   Length ReleasePages() EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
 
+  // From now on, never allocate from hugepages that have been subreleased
+  // (their free pages may be unbacked and would fault when touched) and never
+  // unback pages on Put.  There is no way back.
+  void EnterRealTimeMode() EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
+    realtime_ = true;
+  }
+
   void AddSpanStats(SmallSpanStats *small, LargeSpanStats *large,
                     PageAgeHistograms *ages) const;
 
@@ -293,6 +300,9 @@ class HugePageFiller {
   // How much have we eagerly unmapped (in already released hugepages), but
   // not reported to ReleasePages calls?
   Length unmapping_unaccounted_{0};
+
+  // Set by EnterRealTimeMode().
+  bool realtime_{false};
 };
 
 template <MemoryModifyFunction Unback>
@@ -472,7 +482,10 @@ inline bool HugePageFiller<TrackerType>::TryGet(Length n,
     if (pt) {
       break;
     }
-    pt = regular_alloc_released_.GetLeast(ListFor(n, 0));
+    // In real-time mode, released hugepages are off limits: faulting their
+    // unbacked pages back in is exactly what the mode promises not to do.
+    pt = realtime_ ? nullptr
+                   : regular_alloc_released_.GetLeast(ListFor(n, 0));
     if (pt) {
       ASSERT(!pt->donated());
       was_released = true;
@@ -516,7 +529,12 @@ inline TrackerType *HugePageFiller<TrackerType>::Put(TrackerType *pt, PageID p,
   //   size() doesn't exist (it'd be O(n) while holding the pageheap_lock).
   //   We do this before removing pt from our lists, since another thread may
   //   encounter our post-Remove() update to n_released_ while encountering pt.
-  pt->MaybeRelease(p, n);
+  // In real-time mode we skip the unback: TryGet no longer hands out pages of
+  // released hugepages, so [p, p+n) stays resident but unused until the
+  // hugepage empties out.
+  if (!realtime_) {
+    pt->MaybeRelease(p, n);
+  }
 
   Remove(pt);
 
@@ -525,7 +543,9 @@ inline TrackerType *HugePageFiller<TrackerType>::Put(TrackerType *pt, PageID p,
   allocated_ -= n;
   if (pt->released()) {
     unmapped_ += n;
-    unmapping_unaccounted_ += n;
+    if (!realtime_) {
+      unmapping_unaccounted_ += n;
+    }
   }
   if (pt->longest_free_range() == kPagesPerHugePage) {
     --size_;
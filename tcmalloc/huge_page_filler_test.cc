@@ -963,6 +963,33 @@ TEST_F(FillerTest, ReleaseWithReuse) {
   EXPECT_EQ(0, filler_.unmapped_pages());
 }
 
+TEST_F(FillerTest, RealTimeModeAvoidsReleased) {
+  const Length N = kPagesPerHugePage;
+  auto half = Allocate(N / 2);
+  auto tiny = Allocate(N / 4);
+
+  Delete(half);
+  EXPECT_EQ(3 * N / 4, ReleasePages());
+  EXPECT_EQ(3 * N / 4, filler_.unmapped_pages());
+
+  {
+    absl::base_internal::SpinLockHolder l(&pageheap_lock);
+    filler_.EnterRealTimeMode();
+  }
+
+  // The released hugepage has room, but its free pages are unbacked: we must
+  // get a fresh hugepage instead.
+  auto other = Allocate(N / 4);
+  EXPECT_NE(tiny.pt, other.pt);
+  EXPECT_EQ(NHugePages(2), filler_.size());
+  EXPECT_EQ(3 * N / 4, filler_.unmapped_pages());
+
+  Delete(other);
+  Delete(tiny);
+  EXPECT_EQ(NHugePages(0), filler_.size());
+  EXPECT_EQ(0, filler_.unmapped_pages());
+}
+
 TEST_F(FillerTest, AvoidArbitraryQuarantineVMGrowth) {
   const Length N = kPagesPerHugePage;
   // Guarantee we have a ton of released pages go empty.
@@ -136,8 +136,9 @@ class HugeRegionSet {
   // Returns false if no range available.
   bool MaybeGet(Length n, PageID *page, bool *from_released);
 
-  // Return an allocation to a region (if one matches!)
-  bool MaybePut(PageID p, Length n);
+  // Return an allocation to a region (if one matches!)  If release is true,
+  // unback any hugepage that becomes empty.
+  bool MaybePut(PageID p, Length n, bool release = true);
 
   // Add region to the set.
   void Contribute(Region *region);
@@ -465,10 +466,11 @@ inline bool HugeRegionSet<Region>::MaybeGet(Length n, PageID *page,
 
 // Return an allocation to a region (if one matches!)
 template <typename Region>
-inline bool HugeRegionSet<Region>::MaybePut(PageID p, Length n) {
+inline bool HugeRegionSet<Region>::MaybePut(PageID p, Length n,
+                                            bool release) {
   for (Region *region : list_) {
     if (region->contains(p)) {
-      region->Put(p, n, true);
+      region->Put(p, n, release);
       Fix(region);
       return true;
     }
@@ -41,15 +41,6 @@ static constexpr int kMaxStackDepth = 64;
 // code below can conveniently cast them back and forth to void*.
 struct StackTrace {
 
-  // For small sampled objects, we allocate a full span to hold the
-  // sampled object.  However to avoid disturbing fragmentation
-  // profiles, in such cases we also allocate a small proxy object
-  // using the normal mechanism.
-  //
-  // proxy field is defined only for heap sample stack traces.
-  // For heap samples, proxy==NULL iff size > kMaxSize.
-  void* proxy;
-
   uintptr_t requested_size;
   uintptr_t requested_alignment;
   uintptr_t allocated_size;  // size after sizeclass/page rounding
@@ -70,6 +61,21 @@ struct StackTrace {
   }
 };
 
+// What is kept for each live sampled allocation.  Rather than a full
+// StackTrace, it refers to its call stack by an id into the stack depot (see
+// tcmalloc/stack_depot.h), so that samples from the same call site share it.
+struct SampleRecord {
+  uintptr_t requested_size;
+  uintptr_t requested_alignment;
+  uintptr_t allocated_size;
+  size_t weight;
+  uint32_t stack_id;
+  // Size class the allocation was served from, or 0 for page allocations.
+  // Not derivable from allocated_size: guarded samples report their requested
+  // size there.
+  uint32_t cl;
+};
+
 enum LogMode {
   kLog,                       // Just print the message
   kLogWithStack,              // Print the message and a stack trace
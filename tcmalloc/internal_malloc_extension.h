@@ -59,6 +59,9 @@ TCMalloc_Internal_GetRegionFactory();
 ABSL_ATTRIBUTE_WEAK void TCMalloc_Internal_SetRegionFactory(
     tcmalloc::AddressRegionFactory* factory);
 
+ABSL_ATTRIBUTE_WEAK tcmalloc::tcmalloc_internal::HeapBase*
+TCMalloc_Internal_NewHeap(const tcmalloc::Heap::Options* options);
+
 ABSL_ATTRIBUTE_WEAK const tcmalloc::tcmalloc_internal::ProfileBase*
 TCMalloc_Internal_SnapshotCurrent(tcmalloc::ProfileType type);
 
@@ -66,22 +69,47 @@ ABSL_ATTRIBUTE_WEAK tcmalloc::tcmalloc_internal::AllocationProfilingTokenBase*
 TCMalloc_Internal_StartAllocationProfiling();
 
 ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_ActivateGuardedSampling();
+ABSL_ATTRIBUTE_WEAK bool MallocExtension_Internal_AddSampleHook(
+    tcmalloc::MallocExtension::SampleHook hook);
+ABSL_ATTRIBUTE_WEAK bool MallocExtension_Internal_AdvanceEpoch();
+ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_DeferredFree(void* p,
+                                                               size_t size);
+ABSL_ATTRIBUTE_WEAK uint64_t MallocExtension_Internal_EnterEpoch();
+ABSL_ATTRIBUTE_WEAK bool MallocExtension_Internal_EnterRealTimeMode(
+    const tcmalloc::MallocExtension::RealTimeConfig* config);
+ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_ExitEpoch(uint64_t epoch);
 ABSL_ATTRIBUTE_WEAK tcmalloc::MallocExtension::Ownership
 MallocExtension_Internal_GetOwnership(const void* ptr);
 ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_GetMemoryLimit(
     tcmalloc::MallocExtension::MemoryLimit* limit);
 ABSL_ATTRIBUTE_WEAK bool MallocExtension_Internal_GetPerCpuCachesActive();
 ABSL_ATTRIBUTE_WEAK int32_t MallocExtension_Internal_GetMaxPerCpuCacheSize();
+ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_GetProfileDumpPolicy(
+    tcmalloc::MallocExtension::ProfileDumpPolicy* policy);
+ABSL_ATTRIBUTE_WEAK int64_t
+MallocExtension_Internal_GetProfileSamplingTargetRate();
 ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_GetProperties(
     std::map<std::string, tcmalloc::MallocExtension::Property>* ret);
+ABSL_ATTRIBUTE_WEAK bool MallocExtension_Internal_GetSharedMemoryLocation(
+    const void* ptr, tcmalloc::MallocExtension::SharedMemoryLocation* location);
 ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_GetStats(std::string* ret);
 ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_SetMaxPerCpuCacheSize(
     int32_t value);
 ABSL_ATTRIBUTE_WEAK size_t MallocExtension_Internal_ReleaseCpuMemory(int cpu);
 ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_ReleaseMemoryToSystem(
     size_t bytes);
+ABSL_ATTRIBUTE_WEAK bool MallocExtension_Internal_RemoveSampleHook(
+    tcmalloc::MallocExtension::SampleHook hook);
+ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_ResetMemoryWaterfall();
 ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_SetMemoryLimit(
     const tcmalloc::MallocExtension::MemoryLimit* limit);
+ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_SetProfileDumpPolicy(
+    const tcmalloc::MallocExtension::ProfileDumpPolicy* policy);
+ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_SetProfileSamplingTargetRate(
+    int64_t rate);
+ABSL_ATTRIBUTE_WEAK void MallocExtension_Internal_WarmUp(
+    const tcmalloc::MallocExtension::WarmUpSize* sizes, size_t num_sizes,
+    size_t num_bytes);
 
 ABSL_ATTRIBUTE_WEAK size_t MallocExtension_GetAllocatedSize(const void* ptr);
 ABSL_ATTRIBUTE_WEAK void MallocExtension_MarkThreadBusy();
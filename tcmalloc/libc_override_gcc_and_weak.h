@@ -87,6 +87,18 @@ void* malloc(size_t size) noexcept TCMALLOC_ALIAS(TCMallocInternalMalloc);
 void free(void* ptr) noexcept TCMALLOC_ALIAS(TCMallocInternalFree);
 void sdallocx(void* ptr, size_t size, int flags) noexcept
     TCMALLOC_ALIAS(TCMallocInternalSdallocx);
+void free_sized(void* ptr, size_t size) noexcept
+    TCMALLOC_ALIAS(TCMallocInternalFreeSized);
+void free_aligned_sized(void* ptr, size_t align, size_t size) noexcept
+    TCMALLOC_ALIAS(TCMallocInternalFreeAlignedSized);
+void* mallocx(size_t size, int flags) noexcept
+    TCMALLOC_ALIAS(TCMallocInternalMallocx);
+void* rallocx(void* ptr, size_t size, int flags) noexcept
+    TCMALLOC_ALIAS(TCMallocInternalRallocx);
+size_t xallocx(void* ptr, size_t size, size_t extra, int flags) noexcept
+    TCMALLOC_ALIAS(TCMallocInternalXallocx);
+size_t sallocx(const void* ptr, int flags) noexcept
+    TCMALLOC_ALIAS(TCMallocInternalSallocx);
 void* realloc(void* ptr, size_t size) noexcept
     TCMALLOC_ALIAS(TCMallocInternalRealloc);
 void* calloc(size_t n, size_t size) noexcept
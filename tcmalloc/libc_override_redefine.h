@@ -52,6 +52,22 @@ void free(void* p) noexcept { TCMallocInternalFree(p); }
 void sdallocx(void* p, size_t s, int flags) {
   TCMallocInternalSdallocx(p, s, flags);
 }
+void free_sized(void* p, size_t s) noexcept { TCMallocInternalFreeSized(p, s); }
+void free_aligned_sized(void* p, size_t a, size_t s) noexcept {
+  TCMallocInternalFreeAlignedSized(p, a, s);
+}
+void* mallocx(size_t s, int flags) noexcept {
+  return TCMallocInternalMallocx(s, flags);
+}
+void* rallocx(void* p, size_t s, int flags) noexcept {
+  return TCMallocInternalRallocx(p, s, flags);
+}
+size_t xallocx(void* p, size_t s, size_t extra, int flags) noexcept {
+  return TCMallocInternalXallocx(p, s, extra, flags);
+}
+size_t sallocx(const void* p, int flags) noexcept {
+  return TCMallocInternalSallocx(p, flags);
+}
 void* realloc(void* p, size_t s) noexcept {
   return TCMallocInternalRealloc(p, s);
 }
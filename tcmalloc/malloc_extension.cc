@@ -17,6 +17,7 @@
 #include <assert.h>
 #include <string.h>
 
+#include <algorithm>
 #include <atomic>
 #include <cstdlib>
 #include <memory>
@@ -139,6 +140,14 @@ std::string MallocExtension::GetStats() {
   return ret;
 }
 
+void MallocExtension::ResetMemoryWaterfall() {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (&MallocExtension_Internal_ResetMemoryWaterfall != nullptr) {
+    MallocExtension_Internal_ResetMemoryWaterfall();
+  }
+#endif
+}
+
 void MallocExtension::ReleaseMemoryToSystem(size_t num_bytes) {
 #if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
   if (&MallocExtension_Internal_ReleaseMemoryToSystem != nullptr) {
@@ -147,6 +156,16 @@ void MallocExtension::ReleaseMemoryToSystem(size_t num_bytes) {
 #endif
 }
 
+void MallocExtension::WarmUp(absl::Span<const WarmUpSize> size_distribution,
+                             size_t num_bytes) {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (&MallocExtension_Internal_WarmUp != nullptr) {
+    MallocExtension_Internal_WarmUp(size_distribution.data(),
+                                    size_distribution.size(), num_bytes);
+  }
+#endif
+}
+
 AddressRegionFactory* MallocExtension::GetRegionFactory() {
 #if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
   if (&TCMalloc_Internal_GetRegionFactory == nullptr) {
@@ -170,6 +189,60 @@ void MallocExtension::SetRegionFactory(AddressRegionFactory* factory) {
   // Default implementation does nothing
 }
 
+Heap::Heap(size_t limit) : Heap(Options{limit, false}) {}
+
+Heap::Heap(const Options& options) {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (&TCMalloc_Internal_NewHeap != nullptr) {
+    impl_.reset(TCMalloc_Internal_NewHeap(&options));
+    cage_base_ = static_cast<char*>(impl_->CageBase());
+  }
+#endif
+  static_cast<void>(options);
+}
+
+Heap::~Heap() {}
+
+void* Heap::Allocate(size_t size) {
+  if (!impl_) {
+    return nullptr;
+  }
+
+  return impl_->Allocate(size);
+}
+
+void Heap::Deallocate(void* ptr) {
+  if (!impl_ || ptr == nullptr) {
+    return;
+  }
+
+  impl_->Deallocate(ptr);
+}
+
+void Heap::Reset() {
+  if (!impl_) {
+    return;
+  }
+
+  impl_->Reset();
+}
+
+Heap::Stats Heap::GetStats() const {
+  if (!impl_) {
+    return {};
+  }
+
+  return impl_->GetStats();
+}
+
+bool Heap::Owns(const void* ptr) const {
+  if (!impl_) {
+    return false;
+  }
+
+  return impl_->Owns(ptr);
+}
+
 Profile MallocExtension::SnapshotCurrent(tcmalloc::ProfileType type) {
 #if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
   if (&TCMalloc_Internal_SnapshotCurrent == nullptr) {
@@ -238,6 +311,15 @@ void MallocExtension::SetMemoryLimit(
 #endif
 }
 
+bool MallocExtension::EnterRealTimeMode(const RealTimeConfig& config) {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (&MallocExtension_Internal_EnterRealTimeMode != nullptr) {
+    return MallocExtension_Internal_EnterRealTimeMode(&config);
+  }
+#endif
+  return false;
+}
+
 int64_t MallocExtension::GetProfileSamplingRate() {
 #if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
   if (&TCMalloc_GetProfileSamplingRate != nullptr) {
@@ -256,6 +338,69 @@ void MallocExtension::SetProfileSamplingRate(int64_t rate) {
   (void) rate;
 }
 
+int64_t MallocExtension::GetProfileSamplingTargetRate() {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (MallocExtension_Internal_GetProfileSamplingTargetRate == nullptr) {
+    return -1;
+  }
+
+  return MallocExtension_Internal_GetProfileSamplingTargetRate();
+#else
+  return -1;
+#endif
+}
+
+void MallocExtension::SetProfileSamplingTargetRate(int64_t rate) {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (MallocExtension_Internal_SetProfileSamplingTargetRate == nullptr) {
+    return;
+  }
+
+  MallocExtension_Internal_SetProfileSamplingTargetRate(rate);
+#else
+  (void) rate;
+#endif
+}
+
+MallocExtension::ProfileDumpPolicy MallocExtension::GetProfileDumpPolicy() {
+  ProfileDumpPolicy ret;
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (&MallocExtension_Internal_GetProfileDumpPolicy != nullptr) {
+    MallocExtension_Internal_GetProfileDumpPolicy(&ret);
+  }
+#endif
+  return ret;
+}
+
+void MallocExtension::SetProfileDumpPolicy(
+    const MallocExtension::ProfileDumpPolicy& policy) {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (&MallocExtension_Internal_SetProfileDumpPolicy != nullptr) {
+    MallocExtension_Internal_SetProfileDumpPolicy(&policy);
+  }
+#endif
+}
+
+bool MallocExtension::AddSampleHook(SampleHook hook) {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (&MallocExtension_Internal_AddSampleHook != nullptr) {
+    return MallocExtension_Internal_AddSampleHook(hook);
+  }
+#endif
+  (void)hook;
+  return false;
+}
+
+bool MallocExtension::RemoveSampleHook(SampleHook hook) {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (&MallocExtension_Internal_RemoveSampleHook != nullptr) {
+    return MallocExtension_Internal_RemoveSampleHook(hook);
+  }
+#endif
+  (void)hook;
+  return false;
+}
+
 int64_t MallocExtension::GetGuardedSamplingRate() {
 #if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
   if (TCMalloc_GetGuardedSamplingRate == nullptr) {
@@ -384,6 +529,53 @@ MallocExtension::Ownership MallocExtension::GetOwnership(const void* p) {
   return MallocExtension::Ownership::kUnknown;
 }
 
+absl::optional<MallocExtension::SharedMemoryLocation>
+MallocExtension::GetSharedMemoryLocation(const void* p) {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (&MallocExtension_Internal_GetSharedMemoryLocation != nullptr) {
+    SharedMemoryLocation location;
+    if (MallocExtension_Internal_GetSharedMemoryLocation(p, &location)) {
+      return location;
+    }
+  }
+#endif
+  return absl::nullopt;
+}
+
+uint64_t MallocExtension::EnterEpoch() {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (&MallocExtension_Internal_EnterEpoch != nullptr) {
+    return MallocExtension_Internal_EnterEpoch();
+  }
+#endif
+  return 0;
+}
+
+void MallocExtension::ExitEpoch(uint64_t epoch) {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (&MallocExtension_Internal_ExitEpoch != nullptr) {
+    MallocExtension_Internal_ExitEpoch(epoch);
+  }
+#endif
+}
+
+bool MallocExtension::AdvanceEpoch() {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (&MallocExtension_Internal_AdvanceEpoch != nullptr) {
+    return MallocExtension_Internal_AdvanceEpoch();
+  }
+#endif
+  return false;
+}
+
+void MallocExtension::DeferredFree(void* p, size_t size) {
+#if ABSL_INTERNAL_HAVE_WEAK_MALLOCEXTENSION_STUBS
+  if (&MallocExtension_Internal_DeferredFree != nullptr) {
+    MallocExtension_Internal_DeferredFree(p, size);
+  }
+#endif
+}
+
 std::map<std::string, MallocExtension::Property>
 MallocExtension::GetProperties() {
   std::map<std::string, MallocExtension::Property> ret;
@@ -422,6 +614,52 @@ ABSL_ATTRIBUTE_WEAK ABSL_ATTRIBUTE_NOINLINE void sdallocx(void* ptr, size_t,
   free(ptr);
 }
 
+ABSL_ATTRIBUTE_WEAK ABSL_ATTRIBUTE_NOINLINE void free_sized(void* ptr,
+                                                            size_t) noexcept {
+  free(ptr);
+}
+
+ABSL_ATTRIBUTE_WEAK ABSL_ATTRIBUTE_NOINLINE void free_aligned_sized(
+    void* ptr, size_t, size_t) noexcept {
+  free(ptr);
+}
+
+ABSL_ATTRIBUTE_WEAK ABSL_ATTRIBUTE_NOINLINE void* mallocx(size_t size,
+                                                          int flags) noexcept {
+  const int lg_align = flags & 0x3f;
+  void* ptr;
+  if (lg_align == 0) {
+    ptr = malloc(size);
+  } else if (posix_memalign(&ptr, std::max(size_t{1} << lg_align,
+                                           sizeof(void*)),
+                            size) != 0) {
+    ptr = nullptr;
+  }
+  if (ptr != nullptr && (flags & MALLOCX_ZERO)) memset(ptr, 0, size);
+  return ptr;
+}
+
+ABSL_ATTRIBUTE_WEAK ABSL_ATTRIBUTE_NOINLINE void* rallocx(void* ptr,
+                                                          size_t size,
+                                                          int flags) noexcept {
+  if ((flags & MALLOCX_ZERO) ||
+      (size_t{1} << (flags & 0x3f)) > alignof(std::max_align_t)) {
+    return nullptr;
+  }
+  return realloc(ptr, size);
+}
+
+ABSL_ATTRIBUTE_WEAK ABSL_ATTRIBUTE_NOINLINE size_t xallocx(void*, size_t,
+                                                           size_t,
+                                                           int) noexcept {
+  return 0;
+}
+
+ABSL_ATTRIBUTE_WEAK ABSL_ATTRIBUTE_NOINLINE size_t sallocx(const void*,
+                                                           int) noexcept {
+  return 0;
+}
+
 ABSL_ATTRIBUTE_WEAK ABSL_ATTRIBUTE_NOINLINE tcmalloc::sized_ptr_t
 tcmalloc_size_returning_operator_new(size_t size) {
   return {::operator new(size), size};
@@ -449,3 +687,8 @@ tcmalloc_size_returning_operator_new_aligned_nothrow(
 }
 
 #endif  // _LIBCPP_VERSION && __cpp_aligned_new
+
+ABSL_ATTRIBUTE_WEAK ABSL_ATTRIBUTE_NOINLINE void* tcmalloc_hot_cold_new(
+    size_t size, uint8_t hint) {
+  return ::operator new(size);
+}
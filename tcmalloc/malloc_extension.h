@@ -38,6 +38,7 @@
 #include "absl/base/port.h"
 #include "absl/functional/function_ref.h"
 #include "absl/strings/string_view.h"
+#include "absl/time/time.h"
 #include "absl/types/optional.h"
 #include "absl/types/span.h"
 
@@ -45,6 +46,7 @@ namespace tcmalloc {
 namespace tcmalloc_internal {
 class AllocationProfilingTokenAccessor;
 class AllocationProfilingTokenBase;
+class HeapBase;
 class ProfileAccessor;
 class ProfileBase;
 }  // namespace tcmalloc_internal
@@ -64,6 +66,13 @@ enum class ProfileType {
   // the profile was terminated with Stop().
   kAllocations,
 
+  // Net change of the sampled heap (allocations minus frees, both weighted as
+  // in kHeap) since the previous kHeapDelta snapshot.  Counts of a sample may
+  // be negative.  The first snapshot starts tracking and reports the change
+  // since an empty heap, i.e. the whole heap.  Snapshots take time
+  // proportional to the number of call stacks that changed.
+  kHeapDelta,
+
   // Only present to prevent switch statements without a default clause so that
   // we can extend this enumeration without breaking code.
   kDoNotUse,
@@ -168,6 +177,103 @@ class AddressRegionFactory {
   static void* MallocInternal(size_t size);
 };
 
+// A heap independent of the global one.  It takes its own memory from the
+// system, through the current AddressRegionFactory, and keeps its own
+// size-classed free lists, statistics and (optional) limit.  Reset() drops
+// everything allocated from it at once, in time proportional to the number of
+// regions it holds rather than to the number of allocations.
+//
+// Memory from a Heap may also be passed to free(), operator delete and
+// realloc() (which moves it to the global heap): TCMalloc finds its owner
+// through its page map.  Allocations from a Heap are not sampled, and are not
+// part of the global statistics.
+//
+// A Heap is thread-safe.  Without TCMalloc, Allocate() always fails.
+class Heap {
+ public:
+  struct Stats {
+    size_t allocated_bytes = 0;  // In live allocations, by size class.
+    size_t free_bytes = 0;       // On the heap's free lists.
+    size_t mapped_bytes = 0;     // Handed out of its regions, incl. metadata.
+    size_t reserved_bytes = 0;   // Address space of its regions.
+    size_t regions = 0;
+  };
+
+  // The size of the address space reservation of a caged heap.
+  static constexpr uint64_t kCageBytes = uint64_t{1} << 32;
+
+  struct Options {
+    // If nonzero, caps the mapped bytes of the heap: allocations that need
+    // more fail.
+    size_t limit = 0;
+
+    // Places all memory of the heap in one reservation of kCageBytes, aligned
+    // to its size (a "cage"), so that pointers into the heap can be stored as
+    // 32-bit offsets: see Compress().  If the cage cannot be reserved,
+    // Allocate() always fails and cage_base() is nullptr.
+    bool caged = false;
+
+    // Backs the memory of the heap with a memfd shared by all such heaps of
+    // the process, instead of anonymous memory, so that another process that
+    // receives the fd can map an allocation in place rather than copy it: see
+    // MallocExtension::GetSharedMemoryLocation().  If the memfd cannot be
+    // created, Allocate() always fails.  A child made by fork() does not
+    // inherit the memory of shared heaps, so it must not use them or their
+    // allocations; it can still map the memfd itself.
+    bool shared = false;
+  };
+
+  explicit Heap(size_t limit = 0);
+  explicit Heap(const Options& options);
+  Heap(const Heap&) = delete;
+  Heap& operator=(const Heap&) = delete;
+
+  // Drops all memory of the heap, as Reset() does.  Its address space is kept
+  // for later heaps.
+  ~Heap();
+
+  // Returns at least "size" bytes aligned as by malloc(), or nullptr if the
+  // heap is out of memory or at its limit.
+  void* Allocate(size_t size);
+
+  // Frees "ptr", which must have been returned by Allocate() on this heap.
+  // nullptr is ignored.
+  void Deallocate(void* ptr);
+
+  // Frees everything allocated from the heap and returns its memory to the
+  // system.  Pointers into the heap must not be used afterwards.
+  void Reset();
+
+  Stats GetStats() const;
+
+  // Returns true if "ptr" points into memory of this heap.
+  bool Owns(const void* ptr) const;
+
+  // The start of the cage of a caged heap, or nullptr.
+  void* cage_base() const { return cage_base_; }
+
+  // Converts between pointers into the cage of a caged heap and their 32-bit
+  // offsets from cage_base().  No allocation has offset 0, which stands for
+  // nullptr.
+  uint32_t Compress(const void* ptr) const {
+    return ptr == nullptr ? 0
+                          : static_cast<uint32_t>(
+                                static_cast<const char*>(ptr) - cage_base_);
+  }
+  void* Decompress(uint32_t offset) const {
+    return offset == 0 ? nullptr : cage_base_ + offset;
+  }
+
+  // Like Allocate() and Deallocate(), with offsets into the cage of a caged
+  // heap.  AllocateCompressed() returns 0 on failure.
+  uint32_t AllocateCompressed(size_t size) { return Compress(Allocate(size)); }
+  void DeallocateCompressed(uint32_t offset) { Deallocate(Decompress(offset)); }
+
+ private:
+  std::unique_ptr<tcmalloc_internal::HeapBase> impl_;
+  char* cage_base_ = nullptr;
+};
+
 class MallocExtension {
  public:
 
@@ -177,6 +283,12 @@ class MallocExtension {
   // See /tcmalloc/docs/stats.md for how to interpret these statistics.
   static std::string GetStats();
 
+  // Starts a new interval over which GetStats() measures the idle bytes of
+  // the transfer caches and central freelists.  Reading the stats leaves the
+  // interval running, so that several readers see consistent numbers; a
+  // monitoring agent that wants per-scrape figures resets it after each one.
+  static void ResetMemoryWaterfall();
+
   // -------------------------------------------------------------------
   // Control operations for getting malloc implementation specific parameters.
   // Some currently useful properties:
@@ -219,6 +331,18 @@ class MallocExtension {
   //
   //  "tcmalloc.per_cpu_caches_active"
   //      Whether tcmalloc is using per-CPU caches (1 or 0 respectively).
+  //
+  //  "tcmalloc.deferred_free_bytes"
+  //      Number of bytes passed to DeferredFree() that have not been freed
+  //      yet, not counting allocations larger than the largest size class.
+  //
+  //  "tcmalloc.cold_bytes_in_use"
+  //      Number of bytes in cold allocations from tcmalloc_hot_cold_new().
+  //      Included in generic.current_allocated_bytes.
+  //
+  //  "tcmalloc.cold_bytes_mapped"
+  //      Number of bytes of memory backing cold spans, including their free
+  //      objects.  Included in generic.physical_memory_used.
   // -------------------------------------------------------------------
 
   // Gets the named property's value or a nullopt if the property is not valid.
@@ -276,6 +400,29 @@ class MallocExtension {
   //   back in.
   static void ReleaseMemoryToSystem(size_t num_bytes);
 
+  // One entry of the size mix passed to WarmUp().
+  struct WarmUpSize {
+    size_t size;
+    // Relative share of WarmUp()'s bytes that goes to this size.
+    double weight;
+  };
+
+  // Prepares the allocator for an expected mix of allocation sizes, so that
+  // the first allocations after startup (or a failover) take the fast path.
+  //
+  // num_bytes are split between the sizes by weight.  The memory for them is
+  // faulted in, their spans are carved and the per-CPU cache of every CPU the
+  // calling thread may run on is filled up to its capacity.  What is left over
+  // goes to the transfer caches; spans whose objects do not fit there return
+  // to the page heap, still backed.  Sizes too large for a size class are
+  // ignored.
+  //
+  // To reach each CPU's cache, the calling thread is moved onto each CPU in
+  // turn; its affinity mask is restored before returning.  This is slow, and
+  // meant to be called once, before serving traffic.
+  static void WarmUp(absl::Span<const WarmUpSize> size_distribution,
+                     size_t num_bytes);
+
   struct MemoryLimit {
     // Make a best effort attempt to prevent more than limit bytes of memory
     // from being allocated by the system. In particular, if satisfying a given
@@ -293,12 +440,113 @@ class MallocExtension {
   static MemoryLimit GetMemoryLimit();
   static void SetMemoryLimit(const MemoryLimit& limit);
 
+  struct RealTimeConfig {
+    // Bytes of heap to reserve.  Once they are used up, allocations fail.
+    size_t heap_bytes = 0;
+    // mlock() the reserved heap, so that it cannot be swapped out.
+    bool lock_memory = false;
+    // Crash, rather than fail the allocation, when the heap is used up.
+    // Otherwise, failed allocations take the usual out-of-memory path:
+    // malloc() returns nullptr and operator new calls the new_handler.
+    bool crash_on_exhaustion = false;
+  };
+
+  // Fixes the heap at config.heap_bytes, for programs that cannot afford a
+  // system call or page fault in malloc() once they are running.
+  //
+  // The heap is reserved and faulted in (and optionally locked) up front.
+  // From then on TCMalloc never maps or releases memory for it:
+  // ReleaseMemoryToSystem, subrelease, background release and cache shrinking
+  // are all disabled, and an allocation that does not fit in the reserved heap
+  // fails rather than grow it.  A small extra share is reserved for sampled
+  // allocations.
+  //
+  // There is no way back.  Returns false, changing nothing, if the heap could
+  // not be reserved or locked, or if real-time mode is already on.
+  //
+  // Call WarmUp() afterwards to also populate the caches.  The
+  // "tcmalloc.realtime_system_calls" and "tcmalloc.realtime_page_faults"
+  // properties count what happened since; the latter covers the whole process.
+  static bool EnterRealTimeMode(const RealTimeConfig& config);
+
   // Gets the sampling rate.  Returns a value < 0 if unknown.
   static int64_t GetProfileSamplingRate();
   // Sets the sampling rate for heap profiles.  TCMalloc samples approximately
   // every rate bytes allocated.
   static void SetProfileSamplingRate(int64_t rate);
 
+  // Gets the target number of sampled allocations per second.  Returns 0 if
+  // adaptive sampling is disabled, or a value < 0 if unknown.
+  static int64_t GetProfileSamplingTargetRate();
+  // Enables adaptive sampling if rate > 0: TCMalloc periodically adjusts the
+  // mean sampling interval, starting from the profile sampling rate, so that
+  // about rate allocations are sampled per second regardless of how fast the
+  // program allocates.  Sample weights account for the interval in effect
+  // when each sample was taken, so profiles remain unbiased.  rate <= 0
+  // restores the fixed profile sampling rate.
+  static void SetProfileSamplingTargetRate(int64_t rate);
+
+  // Policy for writing heap profiles to disk from within the allocator.
+  //
+  // Each dump writes the kHeap and kPeakHeap profiles to
+  // <prefix>.<pid>.<seq>.heap and <prefix>.<pid>.<seq>.peakheap in a compact
+  // binary format (see tcmalloc/profile_dumper.h).  Periodic and heap growth
+  // dumps are written by a background thread, so allocating threads never
+  // block on I/O.
+  //
+  // The policy may also be set at startup with the environment variables
+  // TCMALLOC_PROFILE_DUMP_PREFIX, TCMALLOC_PROFILE_DUMP_INTERVAL_SECONDS,
+  // TCMALLOC_PROFILE_DUMP_HEAP_GROWTH_BYTES and TCMALLOC_PROFILE_DUMP_AT_EXIT.
+  struct ProfileDumpPolicy {
+    // Path prefix of the dump files.  Dumping is disabled if empty.
+    std::string prefix;
+    // Dump every interval, if positive.
+    absl::Duration interval = absl::ZeroDuration();
+    // Dump whenever the sampled heap has grown by this many bytes since the
+    // previous dump, if positive.
+    int64_t heap_growth_bytes = 0;
+    // Dump when the process exits normally.
+    bool at_exit = false;
+  };
+
+  static ProfileDumpPolicy GetProfileDumpPolicy();
+  static void SetProfileDumpPolicy(const ProfileDumpPolicy& policy);
+
+  // A sampled allocation or the free of one, as reported to sample hooks.
+  struct SampleEvent {
+    enum Type { kAllocation, kFree };
+    Type type;
+
+    void* ptr;
+    size_t requested_size;
+    size_t requested_alignment;
+    size_t allocated_size;
+    // Expected number of bytes allocated per sample like this one, which
+    // converts samples into estimates of the unsampled allocations.
+    size_t weight;
+
+    // Stack of the allocation, for both allocations and frees.  Only valid
+    // during the callback.
+    int depth;
+    void* const* stack;
+  };
+
+  using SampleHook = void (*)(const SampleEvent& event);
+
+  // Registers hook to be called on every sampled allocation and on every free
+  // of a sampled allocation.  Hooks run on the thread doing the allocation or
+  // free, after the allocator has dropped its locks, and only on the sampling
+  // slow path, so they cost nothing for unsampled allocations.  Hooks are not
+  // called again for allocations they make themselves.
+  //
+  // Returns false if hook is already registered, too many hooks are
+  // registered, or hooks are not supported.
+  static bool AddSampleHook(SampleHook hook);
+  // Unregisters hook.  Calls of hook that are already running in other
+  // threads may still complete after this returns.  Returns false if hook was
+  // not registered.
+  static bool RemoveSampleHook(SampleHook hook);
+
   // Gets the guarded sampling rate.  Returns a value < 0 if unknown.
   static int64_t GetGuardedSamplingRate();
   // Sets the guarded sampling rate for sampled allocations.  Guarded samples
@@ -362,6 +610,48 @@ class MallocExtension {
   };
   static Ownership GetOwnership(const void* p);
 
+  // Where an allocation lives in the memfd backing it: "offset" is the
+  // position of the first byte of the allocation in file "fd".
+  struct SharedMemoryLocation {
+    int fd;
+    size_t offset;
+  };
+
+  // Returns the location of "p" in shared memory if it was allocated from a
+  // Heap with Options::shared set, and nullopt otherwise.  The fd stays owned
+  // by TCMalloc; it may be passed to another process (for instance over a
+  // Unix socket), which can mmap() the page-aligned range around "offset" to
+  // see the same memory.
+  static absl::optional<SharedMemoryLocation> GetSharedMemoryLocation(
+      const void* p);
+
+  // Epoch-based reclamation, for lock-free data structures that cannot free
+  // an object they unlink while a concurrent reader may still be using it.
+  //
+  // Readers bracket each access to the structure with EnterEpoch() and
+  // ExitEpoch().  Writers pass the objects they unlink to DeferredFree()
+  // instead of free().  TCMalloc frees an object once the epoch has advanced
+  // twice since it was deferred, which AdvanceEpoch() only does after every
+  // reader that may have seen it has exited.  Objects are freed in batches of
+  // the same size class, straight into the per-CPU cache of the thread that
+  // advances the epoch.  DeferredFree() also tries to advance the epoch every
+  // so often, so calling AdvanceEpoch() only speeds up reclamation.
+  //
+  // Without TCMalloc, EnterEpoch() returns 0 and AdvanceEpoch() returns false,
+  // and DeferredFree() leaks "p", since nothing can tell when freeing it is
+  // safe.
+
+  // Returns the epoch entered, to be passed to ExitEpoch().
+  static uint64_t EnterEpoch();
+  static void ExitEpoch(uint64_t epoch);
+
+  // Returns false if readers still hold the epoch back.
+  static bool AdvanceEpoch();
+
+  // Frees "p", which was allocated with "size" bytes, once no reader can see
+  // it.  nullptr is ignored.
+  static void DeferredFree(void* p, size_t size);
+
   // Type used by GetProperties.  See comment on GetProperties.
   struct Property {
     size_t value;
@@ -438,6 +728,42 @@ extern "C" size_t nallocx(size_t size, int flags) noexcept;
 // uses the size to improve deallocation performance.
 extern "C" void sdallocx(void* ptr, size_t size, int flags) noexcept;
 
+// The C23 free_sized and free_aligned_sized functions deallocate memory with
+// the size passed to malloc, calloc or realloc (or, for free_aligned_sized,
+// the alignment and size passed to aligned_alloc) that returned it.
+//
+// The default weak implementations call free(), but TCMalloc overrides them
+// and uses the size like sdallocx does.
+extern "C" void free_sized(void* ptr, size_t size) noexcept;
+extern "C" void free_aligned_sized(void* ptr, size_t alignment,
+                                   size_t size) noexcept;
+
+// The remaining functions of jemalloc's extended API.  "flags" may combine
+// MALLOCX_LG_ALIGN() (or MALLOCX_ALIGN()) and MALLOCX_ZERO; other jemalloc
+// flags are ignored.  See http://jemalloc.net/jemalloc.3.html for details.
+//
+// mallocx allocates at least "size" bytes.
+//
+// rallocx resizes the allocation at "ptr" to at least "size" bytes, moving it
+// if needed, and returns nullptr (leaving "ptr" allocated) on failure.
+//
+// xallocx resizes the allocation at "ptr" in place to at least "size" and if
+// possible "size + extra" bytes, and returns its resulting real size, which is
+// less than "size" on failure.  TCMalloc only resizes allocations larger than
+// its largest size class, to sizes that are too, and only when it does not use
+// huge page aware allocation.
+//
+// sallocx returns the real size of the allocation at "ptr".
+//
+// The default weak implementations only support what the C library can do:
+// rallocx fails for MALLOCX_ZERO or an alignment above malloc's, and xallocx
+// and sallocx return 0.
+extern "C" void* mallocx(size_t size, int flags) noexcept;
+extern "C" void* rallocx(void* ptr, size_t size, int flags) noexcept;
+extern "C" size_t xallocx(void* ptr, size_t size, size_t extra,
+                          int flags) noexcept;
+extern "C" size_t sallocx(const void* ptr, int flags) noexcept;
+
 namespace tcmalloc {
 
 // Pointer / capacity information as returned by
@@ -496,12 +822,34 @@ tcmalloc::sized_ptr_t tcmalloc_size_returning_operator_new_aligned_nothrow(
 
 #endif  // _LIBCPP_VERSION && __cpp_aligned_new
 
+// Allocates memory of at least the requested size, like ::operator new, with
+// a hint of how often it will be accessed, from 0 (coldest) to 255 (hottest).
+// The returned pointer must be freed with ::operator delete or free().
+//
+// TCMalloc serves hints below 128 from separate cold spans, so that
+// long-lived, rarely touched objects do not share cache lines, pages or
+// hugepages with hot ones.  Cold allocations are sampled and accounted like
+// any others.  The bytes requested with each hint are reported by
+// MallocExtension::GetProperties() and GetStats().
+//
+// The default weak implementation ignores the hint and calls
+// ::operator new(size_t).
+void* tcmalloc_hot_cold_new(size_t size, uint8_t hint);
+
 }  // extern "C"
 
 #ifndef MALLOCX_LG_ALIGN
 #define MALLOCX_LG_ALIGN(la) (la)
 #endif
 
+#ifndef MALLOCX_ALIGN
+#define MALLOCX_ALIGN(a) (__builtin_ctzll(a))
+#endif
+
+#ifndef MALLOCX_ZERO
+#define MALLOCX_ZERO 0x40
+#endif
+
 namespace tcmalloc {
 namespace tcmalloc_internal {
 
@@ -521,6 +869,23 @@ class AllocationProfilingTokenBase {
   virtual Profile Stop() && = 0;
 };
 
+// HeapBase implements a Heap.
+//
+// This decouples the implementation details (of TCMalloc) from the interface,
+// allowing non-TCMalloc allocators (such as libc and sanitizers) to be provided
+// while allowing the library to compile and link.
+class HeapBase {
+ public:
+  virtual ~HeapBase() = default;
+
+  virtual void* Allocate(size_t size) = 0;
+  virtual void Deallocate(void* ptr) = 0;
+  virtual void Reset() = 0;
+  virtual Heap::Stats GetStats() const = 0;
+  virtual bool Owns(const void* ptr) const = 0;
+  virtual void* CageBase() const = 0;
+};
+
 // ProfileBase contains a profile of allocations.
 //
 // This decouples the implementation details (of TCMalloc) from the interface,
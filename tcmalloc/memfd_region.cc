@@ -0,0 +1,100 @@
+// Copyright 2019 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/memfd_region.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <new>
+#include <type_traits>
+
+#include "absl/base/call_once.h"
+#include "tcmalloc/internal/logging.h"
+
+namespace tcmalloc {
+
+std::pair<void*, size_t> MemfdRegion::Alloc(size_t size, size_t alignment) {
+  uintptr_t result = start_ + used_;
+  result = (result + alignment - 1) & ~(alignment - 1);
+  const uintptr_t end = start_ + size_;
+  if (result < start_ || result > end || end - result < size) {
+    return {nullptr, 0};
+  }
+
+  void* result_ptr = reinterpret_cast<void*>(result);
+  if (mmap(result_ptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+           fd_, FileOffset(result_ptr)) == MAP_FAILED) {
+    Log(kLogWithStack, __FILE__, __LINE__,
+        "mmap() of memfd failed (ptr, size, error)", result_ptr, size,
+        strerror(errno));
+    return {nullptr, 0};
+  }
+  // A child inherits MAP_SHARED mappings as they are, so its copy of the
+  // heap would hand out the same pages as ours.  Leave them out of the child
+  // instead: there, the shared heaps have no memory, and any use of them
+  // faults.  MADV_WIPEONFORK would not do, since it only applies to private
+  // anonymous mappings.
+  if (madvise(result_ptr, size, MADV_DONTFORK) != 0) {
+    Log(kLogWithStack, __FILE__, __LINE__,
+        "madvise(MADV_DONTFORK) of memfd failed (ptr, size, error)",
+        result_ptr, size, strerror(errno));
+    return {nullptr, 0};
+  }
+  used_ = result + size - start_;
+  return {result_ptr, size};
+}
+
+namespace {
+
+std::aligned_storage<sizeof(MemfdRegionFactory),
+                     alignof(MemfdRegionFactory)>::type factory_space;
+MemfdRegionFactory* factory = nullptr;
+
+}  // namespace
+
+MemfdRegionFactory* MemfdRegionFactory::Get() {
+  static absl::once_flag flag;
+  absl::call_once(flag, []() {
+    const int fd = memfd_create("tcmalloc_shared", MFD_CLOEXEC);
+    if (fd < 0) {
+      Log(kLog, __FILE__, __LINE__, "memfd_create() failed (error)",
+          strerror(errno));
+      return;
+    }
+    factory = new (&factory_space) MemfdRegionFactory(fd);
+  });
+  return factory;
+}
+
+AddressRegion* MemfdRegionFactory::Create(void* start, size_t size,
+                                          UsageHint hint) {
+  // The file stays sparse until the pages are touched.
+  if (ftruncate(fd_, file_size_ + size) != 0) {
+    Log(kLogWithStack, __FILE__, __LINE__,
+        "ftruncate() of memfd failed (size, error)", file_size_ + size,
+        strerror(errno));
+    return nullptr;
+  }
+  void* region_space = MallocInternal(sizeof(MemfdRegion));
+  if (!region_space) return nullptr;
+  AddressRegion* region = new (region_space) MemfdRegion(
+      fd_, reinterpret_cast<uintptr_t>(start), size, file_size_);
+  file_size_ += size;
+  return region;
+}
+
+}  // namespace tcmalloc
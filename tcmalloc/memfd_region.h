@@ -0,0 +1,77 @@
+// Copyright 2019 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef TCMALLOC_MEMFD_REGION_H_
+#define TCMALLOC_MEMFD_REGION_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <utility>
+
+#include "tcmalloc/malloc_extension.h"
+
+namespace tcmalloc {
+
+// An address region backed by a range of a memfd, rather than by anonymous
+// memory, so that another process that receives the fd can map the same
+// pages.  Memory is handed out from the start of the region, and the page at
+// "start + n" is at "file_offset + n" in the file.
+class MemfdRegion : public AddressRegion {
+ public:
+  MemfdRegion(int fd, uintptr_t start, size_t size, size_t file_offset)
+      : fd_(fd),
+        start_(start),
+        size_(size),
+        used_(0),
+        file_offset_(file_offset) {}
+
+  std::pair<void*, size_t> Alloc(size_t size, size_t alignment) override;
+
+  int fd() const { return fd_; }
+
+  // REQUIRES: "p" lies within the region.
+  size_t FileOffset(const void* p) const {
+    return file_offset_ + (reinterpret_cast<uintptr_t>(p) - start_);
+  }
+
+ private:
+  const int fd_;
+  const uintptr_t start_;
+  const size_t size_;
+  size_t used_;
+  const size_t file_offset_;
+};
+
+// Creates MemfdRegions over consecutive ranges of a single memfd, which the
+// file grows to cover.  Calls to Create() must be serialized; SystemAlloc()
+// and SystemReserveRegion() do so.
+class MemfdRegionFactory : public AddressRegionFactory {
+ public:
+  // Returns the factory of the process, creating its memfd on first use, or
+  // nullptr if the memfd cannot be created.
+  static MemfdRegionFactory* Get();
+
+  AddressRegion* Create(void* start, size_t size, UsageHint hint) override;
+
+ private:
+  explicit MemfdRegionFactory(int fd) : fd_(fd), file_size_(0) {}
+
+  const int fd_;
+  size_t file_size_;
+};
+
+}  // namespace tcmalloc
+
+#endif  // TCMALLOC_MEMFD_REGION_H_
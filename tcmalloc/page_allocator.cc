@@ -121,6 +121,27 @@ void PageAllocator::ShrinkToUsageLimit() {
       limit_, "and OOM is likely to follow.");
 }
 
+void PageAllocator::EnterRealTimeMode(bool crash_on_failure) {
+  untagged_impl_->EnterRealTimeMode();
+  tagged_impl_->EnterRealTimeMode();
+  realtime_ = true;
+  realtime_crash_on_failure_ = crash_on_failure;
+}
+
+void PageAllocator::RecordFailure(Length n) {
+  bool crash;
+  {
+    absl::base_internal::SpinLockHolder h(&pageheap_lock);
+    if (!realtime_) return;
+    realtime_failures_++;
+    crash = realtime_crash_on_failure_;
+  }
+  if (crash) {
+    Log(kCrash, __FILE__, __LINE__,
+        "Real-time heap exhausted allocating pages", n);
+  }
+}
+
 bool PageAllocator::ShrinkHardBy(Length pages) {
   Length ret = ReleaseAtLeastNPages(pages);
   if (alg_ == HPAA) {
@@ -20,6 +20,7 @@
 
 #include <utility>
 
+#include "absl/base/optimization.h"
 #include "absl/base/thread_annotations.h"
 #include "tcmalloc/common.h"
 #include "tcmalloc/huge_page_aware_allocator.h"
@@ -35,7 +36,8 @@ class PageAllocator {
  public:
   PageAllocator();
   ~PageAllocator() = delete;
-  // Allocate a run of "n" pages.  Returns zero if out of memory.
+  // Allocate a run of "n" pages.  Returns zero if out of memory, or if "n"
+  // exceeds Span::kMaxPages.
   // Caller should not pass "n == 0" -- instead, n should have
   // been rounded up already.
   // Any address in the returned Span is guaranteed to satisfy
@@ -52,7 +54,15 @@ class PageAllocator {
   //           "tagged" and has not yet been deleted.
   void Delete(Span* span, bool tagged) EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
 
+  // Resizes "span" to "n" pages in place, if possible.
+  // REQUIRES: span was returned by earlier call to New() with the same value of
+  //           "tagged" and has not yet been deleted.
+  bool Resize(Span* span, Length n, bool tagged)
+      EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+
   BackingStats stats() const EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+  // The stats of the tagged or the untagged heap alone.
+  BackingStats stats(bool tagged) const EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
 
   void GetSmallSpanStats(SmallSpanStats* result)
       EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
@@ -82,6 +92,20 @@ class PageAllocator {
   // allocation.
   void ShrinkToUsageLimit() EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
 
+  // Puts both heaps into real-time mode (see
+  // PageAllocatorInterface::EnterRealTimeMode).  If crash_on_failure is true,
+  // a page allocation that fails from then on crashes instead of returning
+  // nullptr.
+  void EnterRealTimeMode(bool crash_on_failure)
+      EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+  bool realtime() const EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
+    return realtime_;
+  }
+  // The number of page allocations that failed in real-time mode.
+  int64_t realtime_failures() const EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
+    return realtime_failures_;
+  }
+
   const PageAllocInfo& info(bool tagged) const
       EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
 
@@ -95,6 +119,9 @@ class PageAllocator {
  private:
   bool ShrinkHardBy(Length pages) EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
 
+  // Called when New() or NewAligned() of n pages fails.
+  void RecordFailure(Length n) LOCKS_EXCLUDED(pageheap_lock);
+
   PageAllocatorInterface* impl(bool tagged) const;
 
   union Choices {
@@ -113,6 +140,10 @@ class PageAllocator {
   size_t limit_{std::numeric_limits<size_t>::max()};
   // The number of times the limit has been hit.
   int64_t limit_hits_{0};
+
+  bool realtime_{false};
+  bool realtime_crash_on_failure_{false};
+  int64_t realtime_failures_{0};
 };
 
 inline PageAllocatorInterface* PageAllocator::impl(bool tagged) const {
@@ -120,21 +151,35 @@ inline PageAllocatorInterface* PageAllocator::impl(bool tagged) const {
 }
 
 inline Span* PageAllocator::New(Length n, bool tagged) {
-  return impl(tagged)->New(n);
+  if (ABSL_PREDICT_FALSE(n > Span::kMaxPages)) return nullptr;
+  Span* span = impl(tagged)->New(n);
+  if (ABSL_PREDICT_FALSE(span == nullptr)) RecordFailure(n);
+  return span;
 }
 
 inline Span* PageAllocator::NewAligned(Length n, Length align, bool tagged) {
-  return impl(tagged)->NewAligned(n, align);
+  if (ABSL_PREDICT_FALSE(n > Span::kMaxPages)) return nullptr;
+  Span* span = impl(tagged)->NewAligned(n, align);
+  if (ABSL_PREDICT_FALSE(span == nullptr)) RecordFailure(n);
+  return span;
 }
 
 inline void PageAllocator::Delete(Span* span, bool tagged) {
   impl(tagged)->Delete(span);
 }
 
+inline bool PageAllocator::Resize(Span* span, Length n, bool tagged) {
+  return impl(tagged)->Resize(span, n);
+}
+
 inline BackingStats PageAllocator::stats() const {
   return untagged_impl_->stats() + tagged_impl_->stats();
 }
 
+inline BackingStats PageAllocator::stats(bool tagged) const {
+  return impl(tagged)->stats();
+}
+
 inline void PageAllocator::GetSmallSpanStats(SmallSpanStats* result) {
   SmallSpanStats untagged, tagged;
   untagged_impl_->GetSmallSpanStats(&untagged);
@@ -51,6 +51,12 @@ class PageAllocatorInterface {
   //           has not yet been deleted.
   virtual void Delete(Span* span) EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) = 0;
 
+  // Resizes "span", which New() returned, to "n" pages without moving it:
+  // shrinking frees its tail, and growing takes the free pages that follow
+  // it.  Returns false, leaving "span" as it was, if that is not possible.
+  virtual bool Resize(Span* span, Length n)
+      EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) = 0;
+
   virtual BackingStats stats() const
       EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) = 0;
 
@@ -69,6 +75,11 @@ class PageAllocatorInterface {
   virtual Length ReleaseAtLeastNPages(Length num_pages)
       EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) = 0;
 
+  // Stops taking memory from the system and returning memory to it: from now
+  // on allocations are only served from free memory that is already backed,
+  // and fail otherwise.  There is no way back.
+  virtual void EnterRealTimeMode() EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) = 0;
+
   // Prints stats about the page heap to *out.
   virtual void Print(TCMalloc_Printer* out) LOCKS_EXCLUDED(pageheap_lock) = 0;
 
@@ -44,7 +44,8 @@ PageHeap::PageHeap(PageMap* map, bool tagged)
     : PageAllocatorInterface("PageHeap", map, tagged),
       scavenge_counter_(0),
       // Start scavenging at kMaxPages list
-      release_index_(kMaxPages) {
+      release_index_(kMaxPages),
+      realtime_(false) {
   large_.normal.Init();
   large_.returned.Init();
   for (int i = 0; i < kMaxPages; i++) {
@@ -66,7 +67,9 @@ Span* PageHeap::SearchFreeAndLargeLists(Length n, bool* from_returned) {
       *from_returned = false;
       return Carve(ll->first(), n);
     }
-    // Alternatively, maybe there's a usable returned span.
+    // Alternatively, maybe there's a usable returned span.  In real-time mode
+    // backing it would take page faults, so we would rather fail.
+    if (realtime_) continue;
     ll = &free_[s].returned;
     if (!ll->empty()) {
       ASSERT(ll->first()->location() == Span::ON_RETURNED_FREELIST);
@@ -84,7 +87,7 @@ Span* PageHeap::AllocateSpan(Length n, bool* from_returned) {
   if (result != nullptr) return result;
 
   // Grow the heap and try again.
-  if (!GrowHeap(n)) {
+  if (realtime_ || !GrowHeap(n)) {
     ASSERT(Check());
     return nullptr;
   }
@@ -207,6 +210,7 @@ Span* PageHeap::AllocLarge(Length n, bool* from_returned) {
   }
 
   // Search through released list in case it has a better fit
+  if (realtime_) return best == nullptr ? nullptr : Carve(best, n);
   for (Span* span : large_.returned) {
     ASSERT(span->location() == Span::ON_RETURNED_FREELIST);
     if (IsSpanBetter(span, best, n)) {
@@ -280,6 +284,52 @@ void PageHeap::Delete(Span* span) {
   ASSERT(Check());
 }
 
+bool PageHeap::Resize(Span* span, Length n) {
+  ASSERT(IsTaggedMemory(span->start_address()) == tagged_);
+  ASSERT(span->location() == Span::IN_USE);
+  ASSERT(!span->sampled());
+  ASSERT(n > 0);
+  ASSERT(Check());
+  const PageID p = span->first_page();
+  const Length old = span->num_pages();
+  if (n == old) return true;
+
+  if (n < old) {
+    Span* tail = Span::New(p + n, old - n);
+    tail->set_location(Span::ON_NORMAL_FREELIST);
+    span->set_num_pages(n);
+    RecordSpan(span);
+    RecordSpan(tail);
+    MergeIntoFreeList(tail);  // Coalesces if possible
+    IncrementalScavenge(old - n);
+  } else {
+    // Only backed free pages are taken, so that the span stays backed.
+    Span* next = pagemap_->GetDescriptor(p + old);
+    if (next == nullptr || next->location() != Span::ON_NORMAL_FREELIST ||
+        next->num_pages() < n - old) {
+      return false;
+    }
+    ASSERT(next->first_page() == p + old);
+    RemoveFromFreeList(next);
+    const Length extra = next->num_pages() - (n - old);
+    if (extra > 0) {
+      Span* leftover = Span::New(p + n, extra);
+      leftover->set_location(Span::ON_NORMAL_FREELIST);
+      leftover->set_freelist_added_time(next->freelist_added_time());
+      RecordSpan(leftover);
+      PrependToFreeList(leftover);  // Skip coalescing - no candidates possible
+    }
+    Span::Delete(next);
+    span->set_num_pages(n);
+    RecordSpan(span);
+  }
+
+  info_.RecordFree(p, old);
+  info_.RecordAlloc(p, n);
+  ASSERT(Check());
+  return true;
+}
+
 void PageHeap::MergeIntoFreeList(Span* span) {
   ASSERT(span->location() != Span::IN_USE);
   span->set_freelist_added_time(absl::base_internal::CycleClock::Now());
@@ -383,6 +433,7 @@ Length PageHeap::ReleaseLastNormalSpan(SpanListPair* slist) {
 }
 
 Length PageHeap::ReleaseAtLeastNPages(Length num_pages) {
+  if (realtime_) return 0;
   Length released_pages = 0;
   Length prev_released_pages = -1;
 
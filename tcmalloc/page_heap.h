@@ -55,6 +55,9 @@ class PageHeap : public PageAllocatorInterface {
   //           has not yet been deleted.
   void Delete(Span* span) EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) override;
 
+  bool Resize(Span* span, Length n)
+      EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) override;
+
   inline BackingStats stats() const
       EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) override {
     return stats_;
@@ -75,6 +78,10 @@ class PageHeap : public PageAllocatorInterface {
   Length ReleaseAtLeastNPages(Length num_pages)
       EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) override;
 
+  void EnterRealTimeMode() EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) override {
+    realtime_ = true;
+  }
+
   // Prints stats about the page heap to *out.
   void Print(TCMalloc_Printer* out) LOCKS_EXCLUDED(pageheap_lock) override;
 
@@ -172,6 +179,10 @@ class PageHeap : public PageAllocatorInterface {
   // Index of last free list where we released memory to the OS.
   int release_index_ GUARDED_BY(pageheap_lock);
 
+  // In real-time mode we neither grow the heap nor use returned spans (which
+  // would take page faults), nor release anything.
+  bool realtime_ GUARDED_BY(pageheap_lock);
+
   Span* AllocateSpan(Length n, bool* from_returned)
       EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
 
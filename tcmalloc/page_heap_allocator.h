@@ -40,8 +40,12 @@ class PageHeapAllocator {
   // We use an explicit Init function because these variables are statically
   // allocated and their constructors might not have run by the time some
   // other static variable tries to allocate memory.
-  void Init(Arena* arena) EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
+  //
+  // Memory is charged to "type" in the arena's accounting.
+  void Init(Arena* arena, MetadataType type)
+      EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
     arena_ = arena;
+    type_ = type;
     stats_ = {0, 0};
     free_list_ = nullptr;
     // Reserve some space at the beginning to avoid fragmentation.
@@ -54,7 +58,7 @@ class PageHeapAllocator {
     stats_.in_use++;
     if (ABSL_PREDICT_FALSE(result == nullptr)) {
       stats_.total++;
-      return reinterpret_cast<T*>(arena_->Alloc(sizeof(T)));
+      return reinterpret_cast<T*>(arena_->Alloc(sizeof(T), type_));
     }
     free_list_ = *(reinterpret_cast<T**>(free_list_));
     return result;
@@ -73,6 +77,7 @@ class PageHeapAllocator {
  private:
   // Arena from which to allocate memory
   Arena* arena_;
+  MetadataType type_;
 
   // Free list of already carved objects
   T* free_list_ GUARDED_BY(pageheap_lock);
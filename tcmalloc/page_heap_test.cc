@@ -106,5 +106,47 @@ TEST_F(PageHeapTest, Stats) {
   free(memory);
 }
 
+static bool Resize(tcmalloc::PageHeap* ph, tcmalloc::Span* s, Length n)
+    LOCKS_EXCLUDED(tcmalloc::pageheap_lock) {
+  absl::base_internal::SpinLockHolder h(&tcmalloc::pageheap_lock);
+  return ph->Resize(s, n);
+}
+
+TEST_F(PageHeapTest, Resize) {
+  auto pagemap = absl::make_unique<tcmalloc::PageMap>();
+  void* memory = calloc(1, sizeof(tcmalloc::PageHeap));
+  tcmalloc::PageHeap* ph = new (memory) tcmalloc::PageHeap(pagemap.get(),
+                                                           /*tagged=*/false);
+
+  tcmalloc::Span* s = ph->New(kMinSpanLength);
+  const PageID first = s->first_page();
+  CheckStats(ph, kMinSpanLength, 0, 0);
+
+  // Shrinking frees the tail.
+  static const Length kHalf = kMinSpanLength / 2;
+  ASSERT_TRUE(Resize(ph, s, kHalf));
+  EXPECT_EQ(s->first_page(), first);
+  EXPECT_EQ(s->num_pages(), kHalf);
+  EXPECT_EQ(pagemap->GetDescriptor(s->last_page()), s);
+  CheckStats(ph, kMinSpanLength, kHalf, 0);
+
+  // Growing takes it back, in parts.
+  ASSERT_TRUE(Resize(ph, s, kHalf + 1));
+  CheckStats(ph, kMinSpanLength, kHalf - 1, 0);
+  ASSERT_TRUE(Resize(ph, s, kMinSpanLength));
+  EXPECT_EQ(s->first_page(), first);
+  EXPECT_EQ(s->num_pages(), kMinSpanLength);
+  CheckStats(ph, kMinSpanLength, 0, 0);
+
+  // There is nothing free after the span.
+  EXPECT_FALSE(Resize(ph, s, kMinSpanLength + 1));
+  EXPECT_EQ(s->num_pages(), kMinSpanLength);
+
+  Delete(ph, s);
+  CheckStats(ph, kMinSpanLength, kMinSpanLength, 0);
+
+  free(memory);
+}
+
 }  // namespace
 }  // namespace tcmalloc
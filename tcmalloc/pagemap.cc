@@ -16,20 +16,42 @@
 
 #include <sys/mman.h>
 
+#include <algorithm>
+
 #include "tcmalloc/common.h"
+#include "tcmalloc/internal/mincore.h"
 #include "tcmalloc/span.h"
 #include "tcmalloc/static_vars.h"
 
 namespace tcmalloc {
 
+bool PageMap::Ensure(PageID p, size_t n) {
+  ASSERT(n > 0);
+  const PageID end = p + n;
+  const PageID low_end = PageID{1} << kLowBits;
+  if (!kHasHighRange || end <= low_end) {
+    return map_.Ensure(p, n);
+  }
+  if (p >= low_end) {
+    return high_map_.Ensure(p, n);
+  }
+  return map_.Ensure(p, low_end - p) &&
+         high_map_.Ensure(low_end, end - low_end);
+}
+
 void PageMap::RegisterSizeClass(Span* span, size_t sc) {
   ASSERT(span->location() == Span::IN_USE);
   const PageID first = span->first_page();
   const PageID last = span->last_page();
   ASSERT(GetDescriptor(first) == span);
   for (PageID p = first; p <= last; ++p) {
-    map_.set_with_sizeclass(p, span, sc);
+    if (IsHigh(p)) {
+      high_map_.set_with_sizeclass(p, span, sc);
+    } else {
+      map_.set_with_sizeclass(p, span, sc);
+    }
   }
+  SetFlatSizeClass(first, last, sc);
 }
 
 void PageMap::UnregisterSizeClass(Span* span) {
@@ -38,8 +60,23 @@ void PageMap::UnregisterSizeClass(Span* span) {
   const PageID last = span->last_page();
   ASSERT(GetDescriptor(first) == span);
   for (PageID p = first; p <= last; ++p) {
-    map_.clear_sizeclass(p);
+    if (IsHigh(p)) {
+      high_map_.clear_sizeclass(p);
+    } else {
+      map_.clear_sizeclass(p);
+    }
   }
+  SetFlatSizeClass(first, last, 0);
+}
+
+void PageMap::SetFlatSizeClass(PageID first, PageID last, uint8_t sc) {
+#ifdef TCMALLOC_FLAT_SIZECLASS_MAP
+  // The array only covers the low address range.
+  const PageID end = std::min(last + 1, PageID{1} << kLowBits);
+  if (first < end) {
+    flat_.set_range(first, end - first, sc);
+  }
+#endif
 }
 
 void PageMap::MapRootWithSmallPages() {
@@ -62,8 +99,36 @@ void PageMap::MapRootWithSmallPages() {
   }
 }
 
+void PageMap::InitFlatSizeClassMap() {
+#ifdef TCMALLOC_FLAT_SIZECLASS_MAP
+  void* base = mmap(nullptr, flat_.kReservedBytes, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (base == MAP_FAILED) {
+    // Lookups read the array unconditionally, so there is nothing to fall
+    // back to.
+    Log(kCrash, __FILE__, __LINE__,
+        "Failed to reserve the flat size class map (bytes)",
+        flat_.kReservedBytes);
+  }
+  // A hugepage of the array covers far more address space than the heap
+  // typically uses in one place, so back it with small pages only.
+  madvise(base, flat_.kReservedBytes, MADV_NOHUGEPAGE);
+  flat_.Init(base);
+#endif
+}
+
+size_t PageMap::FlatSizeClassResidence() const {
+  size_t total = 0;
+#ifdef TCMALLOC_FLAT_SIZECLASS_MAP
+  flat_.ForEachTouchedChunk([&](const void* addr, size_t bytes) {
+    total += MInCore::residence(const_cast<void*>(addr), bytes);
+  });
+#endif
+  return total;
+}
+
 void* MetaDataAlloc(size_t bytes) EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
-  return Static::arena()->Alloc(bytes);
+  return Static::arena()->Alloc(bytes, kMetadataPageMap);
 }
 
 }  // namespace tcmalloc
@@ -29,7 +29,11 @@
 #include <stdint.h>
 #include <string.h>
 
+#include <atomic>
+#include <type_traits>
+
 #include "absl/base/attributes.h"
+#include "absl/base/optimization.h"
 #include "absl/base/thread_annotations.h"
 #include "tcmalloc/common.h"
 #include "tcmalloc/internal/logging.h"
@@ -350,23 +354,133 @@ class PageMap3 {
   const void* RootAddress() { return root_; }
 };
 
+// A flat array holding the size class of every page number, for the unsized
+// free path.  Looking up a size class is a single load at a fixed offset from
+// the base, rather than a walk down a radix tree.  The array covers the whole
+// address space, so it is reserved as demand-zero memory: only the parts that
+// cover pages registered with a size class are ever backed.  Those parts are
+// tracked in chunks of kChunkBytes, for the stats.
+//
+// PageMap only keeps one in TCMALLOC_FLAT_SIZECLASS_MAP builds.  Elsewhere
+// the reservation, and the bitmap, would be paid for a lookup that could not
+// rely on them being there.
+template <int BITS>
+class FlatSizeClassMap {
+ public:
+  typedef uintptr_t Number;
+
+  static constexpr size_t kReservedBytes = size_t{1} << BITS;
+
+  constexpr FlatSizeClassMap() : sizeclass_(nullptr), touched_{} {}
+
+  // Uses kReservedBytes of demand-zero memory at "base" for the array.
+  void Init(void* base) { sizeclass_ = static_cast<uint8_t*>(base); }
+
+  bool enabled() const { return sizeclass_ != nullptr; }
+
+  const void* base() const { return sizeclass_; }
+
+  // No locks required.  See SYNCHRONIZATION explanation at top of tcmalloc.cc.
+  // REQUIRES: enabled()
+  uint8_t ABSL_ATTRIBUTE_ALWAYS_INLINE
+  get(Number k) const NO_THREAD_SAFETY_ANALYSIS {
+    ASSERT((k >> BITS) == 0);
+    return sizeclass_[k];
+  }
+
+  // Sets the size class of pages [start, start + n).
+  // REQUIRES: enabled()
+  // Concurrent calls are safe unless their ranges overlap.
+  void set_range(Number start, size_t n, uint8_t sc) {
+    ASSERT(n > 0);
+    ASSERT(((start + n - 1) >> BITS) == 0);
+    for (Number c = start >> kChunkBits; c <= (start + n - 1) >> kChunkBits;
+         ++c) {
+      std::atomic<uint64_t>& word = touched_[c / 64];
+      const uint64_t bit = uint64_t{1} << (c % 64);
+      if ((word.load(std::memory_order_relaxed) & bit) == 0) {
+        word.fetch_or(bit, std::memory_order_relaxed);
+      }
+    }
+    memset(sizeclass_ + start, sc, n);
+  }
+
+  // Calls f(addr, bytes) for each chunk of the array that was ever written.
+  template <typename F>
+  void ForEachTouchedChunk(F f) const {
+    for (size_t i = 0; i < kTouchedWords; ++i) {
+      uint64_t word = touched_[i].load(std::memory_order_relaxed);
+      while (word != 0) {
+        const size_t c = i * 64 + __builtin_ctzll(word);
+        word &= word - 1;
+        f(sizeclass_ + (c << kChunkBits), kChunkBytes);
+      }
+    }
+  }
+
+  // The bytes of the array that may be backed by memory.
+  size_t bytes_used() const {
+    size_t bytes = 0;
+    ForEachTouchedChunk([&](const void*, size_t n) { bytes += n; });
+    return bytes;
+  }
+
+ private:
+  static constexpr int kChunkBits = BITS < 15 ? BITS : 15;
+  static constexpr size_t kChunkBytes = size_t{1} << kChunkBits;
+  static constexpr size_t kNumChunks = size_t{1} << (BITS - kChunkBits);
+  static constexpr size_t kTouchedWords = (kNumChunks + 63) / 64;
+
+  uint8_t* sizeclass_;
+  std::atomic<uint64_t> touched_[kTouchedWords];
+};
+
 class PageMap {
  public:
-  constexpr PageMap() : map_{} {}
+  constexpr PageMap() : map_{}, high_map_{} {}
 
   // Return the size class for p, or 0 if it is not known to tcmalloc
   // or is a page containing large objects.
   // No locks required.  See SYNCHRONIZATION explanation at top of tcmalloc.cc.
-  uint8_t sizeclass(PageID p) NO_THREAD_SAFETY_ANALYSIS {
-    return map_.sizeclass(p);
+  uint8_t ABSL_ATTRIBUTE_ALWAYS_INLINE sizeclass(PageID p) {
+    return entry(p) & ~kSlowFreeBit;
+  }
+
+  // Like sizeclass(), but returns 0 if p's span holds sampled objects (see
+  // SetHoldsSamples()) or cold ones (see RegisterColdSizeClass()), so that
+  // frees of its objects take the slow path.
+  // No locks required.  See SYNCHRONIZATION explanation at top of tcmalloc.cc.
+  uint8_t ABSL_ATTRIBUTE_ALWAYS_INLINE sizeclass_for_free(PageID p) {
+    const uint8_t sc = entry(p);
+    return static_cast<int8_t>(sc) > 0 ? sc : 0;
   }
 
-  void Set(PageID p, Span* span) { map_.set(p, span); }
+  // Marks (or unmarks) the pages of "span", a span of small objects of size
+  // class "sc", as holding sampled objects.
+  // REQUIRES: span was registered with size class "sc".
+  void SetHoldsSamples(Span* span, size_t sc, bool v)
+      EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
+    ASSERT(sc != 0);
+    RegisterSizeClass(span, v ? sc | kSlowFreeBit : sc);
+  }
+
+  // Like RegisterSizeClass(), for a span of cold objects, whose pages are
+  // marked like those of spans holding samples until it is unregistered.
+  void RegisterColdSizeClass(Span* span, size_t sc) {
+    ASSERT(sc != 0);
+    RegisterSizeClass(span, sc | kSlowFreeBit);
+  }
 
-  bool Ensure(PageID p, size_t n) EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
-    return map_.Ensure(p, n);
+  void Set(PageID p, Span* span) {
+    if (IsHigh(p)) {
+      high_map_.set(p, span);
+      return;
+    }
+    map_.set(p, span);
   }
 
+  bool Ensure(PageID p, size_t n) EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+
   // Mark an allocated span as being used for small objects of the
   // specified size-class.
   // REQUIRES: span was returned by an earlier call to PageAllocator::New()
@@ -384,6 +498,9 @@ class PageMap {
   // this PageID was not allocated previously.
   // No locks required.  See SYNCHRONIZATION explanation at top of tcmalloc.cc.
   inline Span* GetDescriptor(PageID p) const NO_THREAD_SAFETY_ANALYSIS {
+    if (IsHigh(p)) {
+      return reinterpret_cast<Span*>(high_map_.get(p));
+    }
     return reinterpret_cast<Span*>(map_.get(p));
   }
 
@@ -392,18 +509,40 @@ class PageMap {
   // No locks required.  See SYNCHRONIZATION explanation at top of tcmalloc.cc.
   ABSL_ATTRIBUTE_RETURNS_NONNULL inline Span* GetExistingDescriptor(
       PageID p) const NO_THREAD_SAFETY_ANALYSIS {
-    Span* span = reinterpret_cast<Span*>(map_.get_existing(p));
+    Span* span = reinterpret_cast<Span*>(
+        IsHigh(p) ? high_map_.get_existing(p) : map_.get_existing(p));
     ASSERT(span != nullptr);
     return span;
   }
 
   size_t bytes() const EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
-    return map_.bytes_used();
+    return map_.bytes_used() + high_map_.bytes_used() + flat_sizeclass_bytes();
   }
 
-  void* GetHugepage(PageID p) { return map_.get_hugepage(p); }
+  // Bytes of the flat size class array that may be backed by memory.  These
+  // are not allocated from the arena.
+  size_t flat_sizeclass_bytes() const {
+#ifdef TCMALLOC_FLAT_SIZECLASS_MAP
+    return flat_.bytes_used();
+#else
+    return 0;
+#endif
+  }
+
+  // Returns the resident bytes of the flat size class array.
+  size_t FlatSizeClassResidence() const;
+
+  void* GetHugepage(PageID p) {
+    return IsHigh(p) ? high_map_.get_hugepage(p) : map_.get_hugepage(p);
+  }
 
-  void SetHugepage(PageID p, void* v) { map_.set_hugepage(p, v); }
+  void SetHugepage(PageID p, void* v) {
+    if (IsHigh(p)) {
+      high_map_.set_hugepage(p, v);
+      return;
+    }
+    map_.set_hugepage(p, v);
+  }
 
   // The PageMap root node can be quite large and sparsely used. If this
   // gets mapped with hugepages we potentially end up holding a large
@@ -411,11 +550,61 @@ class PageMap {
   // small pages to minimise the amount of unused memory.
   void MapRootWithSmallPages();
 
+  // Reserves the flat size class array in TCMALLOC_FLAT_SIZECLASS_MAP builds.
+  // REQUIRES: no span has been registered with a size class yet.
+  void InitFlatSizeClassMap();
+
  private:
+  // Pages below 1 << kLowAddressBits, the address space of every host, are
+  // mapped by map_.  Where the build allows a larger address space (see
+  // TCMALLOC_57BIT_ADDRESSES), pages above that are mapped by a deeper tree,
+  // high_map_, so that the common case keeps its shallow lookups.  Otherwise
+  // IsHigh() is constant false and lookups compile to those of map_ alone.
+  static constexpr int kLowBits = kLowAddressBits - kPageShift;
+  static constexpr int kHighBits = kAddressBits - kPageShift;
+  static constexpr bool kHasHighRange = kHighBits > kLowBits;
+
+  // Set in the size class of the pages of spans holding sampled or cold
+  // objects.
+  static constexpr uint8_t kSlowFreeBit = 0x80;
+  static_assert(kNumClasses <= kSlowFreeBit,
+                "size classes overlap kSlowFreeBit");
+
+  // The size class of p, with kSlowFreeBit.
+  uint8_t ABSL_ATTRIBUTE_ALWAYS_INLINE
+  entry(PageID p) NO_THREAD_SAFETY_ANALYSIS {
+    if (IsHigh(p)) {
+      return high_map_.sizeclass(p);
+    }
+#ifdef TCMALLOC_FLAT_SIZECLASS_MAP
+    return flat_.get(p);
+#else
+    return map_.sizeclass(p);
+#endif
+  }
+
+  // Writes "sc" into the flat size class array, if any, for [first, last].
+  void SetFlatSizeClass(PageID first, PageID last, uint8_t sc);
+
+  static bool IsHigh(PageID p) {
+    return kHasHighRange && ABSL_PREDICT_FALSE((p >> kLowBits) != 0);
+  }
+
 #ifdef TCMALLOC_USE_PAGEMAP3
-  PageMap3<kAddressBits - kPageShift, MetaDataAlloc> map_;
+  PageMap3<kLowBits, MetaDataAlloc> map_;
 #else
-  PageMap2<kAddressBits - kPageShift, MetaDataAlloc> map_;
+  PageMap2<kLowBits, MetaDataAlloc> map_;
+#endif
+  // A PageMap2<0> takes up next to no space, and maps nothing.
+  typename std::conditional<kHasHighRange,
+                            PageMap3<kHighBits, MetaDataAlloc>,
+                            PageMap2<0, MetaDataAlloc>>::type high_map_;
+#ifdef TCMALLOC_FLAT_SIZECLASS_MAP
+  // Keep the reservation of the flat size class array to at most 32GiB.
+  static_assert(kLowBits <= 35,
+                "TCMALLOC_FLAT_SIZECLASS_MAP needs pages of at least 8KiB");
+  // Mirrors the size classes of map_, which stay authoritative.
+  FlatSizeClassMap<kLowBits> flat_;
 #endif
 };
 
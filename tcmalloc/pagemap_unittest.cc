@@ -25,8 +25,10 @@
 #include <vector>
 
 #include "gtest/gtest.h"
+#include "absl/base/internal/spinlock.h"
 #include "absl/random/random.h"
 #include "tcmalloc/common.h"
+#include "tcmalloc/span.h"
 
 // Note: we leak memory every time a map is constructed, so do not
 // create too many maps.
@@ -136,6 +138,119 @@ TEST_P(PageMapTest, RandomAccess) {
 
 INSTANTIATE_TEST_SUITE_P(Limits, PageMapTest, ::testing::Values(100, 1 << 20));
 
+void* LeakingAlloc(size_t n) { return ::operator new(n); }
+
+// A map as used for the address space above 48 bits, with 8KiB pages.
+TEST(PageMap3Test, HighAddresses) {
+  using Map = tcmalloc::PageMap3<44, LeakingAlloc>;
+  static Map map;
+  const uintptr_t base = uintptr_t{1} << 43;
+  for (uintptr_t k :
+       {base, base + 1, base + (1 << 20), (uintptr_t{1} << 44) - 1}) {
+    ASSERT_TRUE(map.Ensure(k, 1));
+    EXPECT_EQ(map.get(k), nullptr);
+    map.set_with_sizeclass(k, span(k), sc(k));
+    EXPECT_EQ(map.get(k), span(k));
+    EXPECT_EQ(map.sizeclass(k), sc(k));
+  }
+  EXPECT_EQ(map.get(base + 2), nullptr);
+  EXPECT_EQ(map.get(uintptr_t{1} << 44), nullptr);
+  EXPECT_FALSE(map.Ensure(uintptr_t{1} << 44, 1));
+}
+
+// Size classes registered for a span are seen by sizeclass(), whichever array
+// it reads.
+TEST(PageMapSizeClassTest, RegisterAndUnregister) {
+  static PageMap map;
+  const PageID first = 12345;
+  Span span;
+  span.Init(first, 3);
+
+  absl::base_internal::SpinLockHolder h(&pageheap_lock);
+  map.InitFlatSizeClassMap();
+  ASSERT_TRUE(map.Ensure(first, 4));
+  for (PageID p = first; p < first + 3; ++p) {
+    map.Set(p, &span);
+  }
+  map.RegisterSizeClass(&span, 9);
+  for (PageID p = first; p < first + 3; ++p) {
+    EXPECT_EQ(map.GetDescriptor(p), &span);
+    EXPECT_EQ(map.sizeclass(p), 9);
+  }
+  EXPECT_EQ(map.sizeclass(first - 1), 0);
+  EXPECT_EQ(map.sizeclass(first + 3), 0);
+
+  map.UnregisterSizeClass(&span);
+  for (PageID p = first; p < first + 3; ++p) {
+    EXPECT_EQ(map.GetDescriptor(p), &span);
+    EXPECT_EQ(map.sizeclass(p), 0);
+  }
+}
+
+// Pages above the low address range are mapped by the deeper tree.
+TEST(PageMapHighTest, SetAndLookUp) {
+  if (kAddressBits <= kLowAddressBits) {
+    GTEST_SKIP() << "no address space above " << kLowAddressBits << " bits";
+  }
+  static PageMap map;
+  const PageID high = (uintptr_t{1} << kLowAddressBits) >> kPageShift;
+  const PageID low = high - 1;
+  Span high_span, low_span;
+  high_span.Init(high + 10, 2);
+  low_span.Init(low, 1);
+
+  absl::base_internal::SpinLockHolder h(&pageheap_lock);
+  ASSERT_TRUE(map.Ensure(low, 20));
+  EXPECT_EQ(map.GetDescriptor(high + 10), nullptr);
+  map.Set(low, &low_span);
+  map.Set(high + 10, &high_span);
+  map.Set(high + 11, &high_span);
+  map.RegisterSizeClass(&high_span, 7);
+
+  EXPECT_EQ(map.GetDescriptor(low), &low_span);
+  EXPECT_EQ(map.GetDescriptor(high), nullptr);
+  EXPECT_EQ(map.GetDescriptor(high + 10), &high_span);
+  EXPECT_EQ(map.GetExistingDescriptor(high + 11), &high_span);
+  EXPECT_EQ(map.sizeclass(high + 10), 7);
+  EXPECT_EQ(map.sizeclass(high + 11), 7);
+  EXPECT_EQ(map.sizeclass(low), 0);
+
+  map.UnregisterSizeClass(&high_span);
+  EXPECT_EQ(map.sizeclass(high + 11), 0);
+}
+
+TEST(FlatSizeClassMapTest, SetRange) {
+  using Map = tcmalloc::FlatSizeClassMap<20>;
+  static Map map;
+  std::vector<uint8_t> storage(Map::kReservedBytes);
+  map.Init(storage.data());
+  ASSERT_TRUE(map.enabled());
+  EXPECT_EQ(map.bytes_used(), 0);
+
+  map.set_range(100, 1000, 7);
+  map.set_range(1 << 19, 1, 3);
+  EXPECT_EQ(map.get(99), 0);
+  EXPECT_EQ(map.get(100), 7);
+  EXPECT_EQ(map.get(1099), 7);
+  EXPECT_EQ(map.get(1100), 0);
+  EXPECT_EQ(map.get(1 << 19), 3);
+
+  // Two chunks were written to.
+  size_t chunks = 0;
+  map.ForEachTouchedChunk([&](const void* addr, size_t bytes) {
+    EXPECT_GE(addr, storage.data());
+    EXPECT_LE(static_cast<const uint8_t*>(addr) + bytes,
+              storage.data() + storage.size());
+    chunks++;
+  });
+  EXPECT_EQ(chunks, 2);
+  EXPECT_GT(map.bytes_used(), 0);
+
+  map.set_range(100, 1000, 0);
+  EXPECT_EQ(map.get(100), 0);
+  EXPECT_EQ(map.get(1099), 0);
+}
+
 // Surround pagemap with unused memory. This isolates it so that it does not
 // share pages with any other structures. This avoids the risk that adjacent
 // objects might cause it to be mapped in. The padding is of sufficient size
@@ -71,6 +71,8 @@ ABSL_CONST_INIT std::atomic<bool> Parameters::per_cpu_caches_enabled_(
 ABSL_CONST_INIT std::atomic<int64_t> Parameters::profile_sampling_rate_(
     kDefaultProfileSamplingRate
 );
+ABSL_CONST_INIT std::atomic<int64_t>
+    Parameters::profile_sampling_target_rate_(0);
 
 }  // namespace tcmalloc
 
@@ -186,6 +188,11 @@ void TCMalloc_Internal_SetProfileSamplingRate(int64_t v) {
                                                      std::memory_order_relaxed);
 }
 
+void TCMalloc_Internal_SetProfileSamplingTargetRate(int64_t v) {
+  tcmalloc::Parameters::profile_sampling_target_rate_.store(
+      v, std::memory_order_relaxed);
+}
+
 }  // extern "C"
 
 
@@ -90,6 +90,17 @@ class Parameters {
     TCMalloc_Internal_SetProfileSamplingRate(value);
   }
 
+  // Target number of sampled allocations per second.  If positive, the
+  // sampler adjusts its mean interval to approach it, starting from
+  // profile_sampling_rate().
+  static int64_t profile_sampling_target_rate() {
+    return profile_sampling_target_rate_.load(std::memory_order_relaxed);
+  }
+
+  static void set_profile_sampling_target_rate(int64_t value) {
+    TCMalloc_Internal_SetProfileSamplingTargetRate(value);
+  }
+
  private:
   friend void ::TCMalloc_Internal_SetGuardedSamplingRate(int64_t v);
   friend void ::TCMalloc_Internal_SetHPAASubrelease(bool v);
@@ -99,6 +110,7 @@ class Parameters {
   friend void ::TCMalloc_Internal_SetPeakSamplingHeapGrowthFraction(double v);
   friend void ::TCMalloc_Internal_SetPerCpuCachesEnabled(bool v);
   friend void ::TCMalloc_Internal_SetProfileSamplingRate(int64_t v);
+  friend void ::TCMalloc_Internal_SetProfileSamplingTargetRate(int64_t v);
 
   static std::atomic<int64_t> guarded_sampling_rate_;
   static std::atomic<bool> hpaa_subrelease_;
@@ -108,6 +120,7 @@ class Parameters {
   static std::atomic<double> peak_sampling_heap_growth_fraction_;
   static std::atomic<bool> per_cpu_caches_enabled_;
   static std::atomic<int64_t> profile_sampling_rate_;
+  static std::atomic<int64_t> profile_sampling_target_rate_;
 };
 
 }  // namespace tcmalloc
@@ -50,31 +50,33 @@ void PeakHeapTracker::MaybeSaveSample() {
   peak_sampled_heap_size_.LossyAdd(Static::sampled_objects_size_.value() -
                                    peak_sampled_heap_size_.value());
 
-  StackTrace *t = peak_sampled_span_stacks_, *next = nullptr;
+  SavedSample *t = peak_sampled_samples_, *next = nullptr;
   while (t != nullptr) {
-    next = reinterpret_cast<StackTrace*>(t->stack[kMaxStackDepth - 1]);
-    Static::stacktrace_allocator()->Delete(t);
+    next = t->next;
+    Static::stack_depot()->Unref(t->record.stack_id);
+    saved_sample_allocator_.Delete(t);
     t = next;
   }
 
   next = nullptr;
-  for (Span* s : Static::sampled_objects_) {
-    t = Static::stacktrace_allocator()->New();
-    if (t == nullptr) {
-      Log(kLog, __FILE__, __LINE__, "tcmalloc: could not allocate stack trace",
-          sizeof(*t));
-      t = next;
-      break;
-    }
+  bool out_of_memory = false;
+  Static::sampled_allocations()->ForEach(
+      [&](void*, const SampleRecord& sampled) {
+        if (out_of_memory) return;
+        t = saved_sample_allocator_.New();
+        if (t == nullptr) {
+          Log(kLog, __FILE__, __LINE__, "tcmalloc: could not allocate sample",
+              sizeof(*t));
+          out_of_memory = true;
+          return;
+        }
 
-    *t = *s->sampled_stack();
-    if (t->depth == kMaxStackDepth) {
-      t->depth = kMaxStackDepth - 1;
-    }
-    t->stack[kMaxStackDepth - 1] = reinterpret_cast<void*>(next);
-    next = t;
-  }
-  peak_sampled_span_stacks_ = t;
+        t->record = sampled;
+        Static::stack_depot()->Ref(sampled.stack_id);
+        t->next = next;
+        next = t;
+      });
+  peak_sampled_samples_ = next;
 }
 
 std::unique_ptr<tcmalloc_internal::ProfileBase> PeakHeapTracker::DumpSample()
@@ -83,10 +85,9 @@ std::unique_ptr<tcmalloc_internal::ProfileBase> PeakHeapTracker::DumpSample()
       ProfileType::kPeakHeap, Sampler::GetSamplePeriod(), true, true);
 
   absl::base_internal::SpinLockHolder h(&pageheap_lock);
-  for (StackTrace* t = peak_sampled_span_stacks_; t != nullptr;
-       t = reinterpret_cast<StackTrace*>(
-           t->stack[tcmalloc::kMaxStackDepth - 1])) {
-    profile->AddTrace(1.0, *t);
+  for (const SavedSample* t = peak_sampled_samples_; t != nullptr;
+       t = t->next) {
+    profile->AddTrace(1.0, t->record);
   }
   return profile;
 }
@@ -16,10 +16,12 @@
 #define TCMALLOC_PEAK_HEAP_TRACKER_H_
 
 #include "absl/base/thread_annotations.h"
+#include "tcmalloc/arena.h"
 #include "tcmalloc/common.h"
 #include "tcmalloc/internal/atomic_stats_counter.h"
 #include "tcmalloc/internal/logging.h"
 #include "tcmalloc/malloc_extension.h"
+#include "tcmalloc/page_heap_allocator.h"
 
 namespace tcmalloc {
 
@@ -31,8 +33,9 @@ class PeakHeapTracker {
 
   // Explicit Init is required because constructor for our single static
   // instance may not have run by the time it is used
-  void Init() {
-    peak_sampled_span_stacks_ = nullptr;
+  void Init(Arena* arena) EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
+    saved_sample_allocator_.Init(arena, kMetadataSampling);
+    peak_sampled_samples_ = nullptr;
     peak_sampled_heap_size_.Clear();
   }
 
@@ -47,12 +50,19 @@ class PeakHeapTracker {
       LOCKS_EXCLUDED(pageheap_lock);
 
  private:
-  // Linked list of stack traces from sampled allocations saved (from
-  // sampled_objects_ above) when we allocate memory from the system. The
-  // linked list pointer is stored in StackTrace::stack[kMaxStackDepth-1].
-  StackTrace* peak_sampled_span_stacks_;
+  struct SavedSample {
+    SampleRecord record;
+    SavedSample* next;
+  };
 
-  // Sampled heap size last time peak_sampled_span_stacks_ was saved. Only
+  // Linked list of sampled allocations saved (from
+  // Static::sampled_allocations()) when we allocate memory from the system.
+  // Each holds a reference on its stack in Static::stack_depot().
+  SavedSample* peak_sampled_samples_ GUARDED_BY(pageheap_lock);
+  PageHeapAllocator<SavedSample> saved_sample_allocator_
+      GUARDED_BY(pageheap_lock);
+
+  // Sampled heap size last time peak_sampled_samples_ was saved. Only
   // written under pageheap_lock; may be read without it.
   tcmalloc_internal::StatsCounter peak_sampled_heap_size_;
 
@@ -0,0 +1,384 @@
+// Copyright 2019 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/profile_dumper.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "absl/base/internal/spinlock.h"
+#include "absl/strings/str_format.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "tcmalloc/internal/logging.h"
+#include "tcmalloc/internal/util.h"
+#include "tcmalloc/static_vars.h"
+
+namespace tcmalloc {
+namespace {
+
+// Guards the policy's prefix and serializes changes to the policy.
+absl::base_internal::SpinLock policy_lock(
+    absl::base_internal::kLinkerInitialized);
+// Serializes claiming a dump (its sequence number and the growth trigger
+// reset) between the background thread, Dump() and the exit dump.  The
+// snapshot and I/O run without it: each dump writes its own files.
+absl::base_internal::SpinLock dump_lock(
+    absl::base_internal::kLinkerInitialized);
+
+constexpr char kMagic[] = "TCMPROF";
+constexpr uint8_t kVersion = 1;
+
+void PutVarint(uint64_t v, std::string* out) {
+  while (v >= 0x80) {
+    out->push_back(static_cast<char>(v | 0x80));
+    v >>= 7;
+  }
+  out->push_back(static_cast<char>(v));
+}
+
+void PutZigZag(int64_t v, std::string* out) {
+  PutVarint((static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63),
+            out);
+}
+
+bool GetVarint(absl::string_view* in, uint64_t* v) {
+  uint64_t result = 0;
+  for (int shift = 0; shift < 64 && !in->empty(); shift += 7) {
+    const uint8_t byte = static_cast<uint8_t>(in->front());
+    in->remove_prefix(1);
+    result |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      *v = result;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool GetZigZag(absl::string_view* in, int64_t* v) {
+  uint64_t u;
+  if (!GetVarint(in, &u)) return false;
+  *v = static_cast<int64_t>((u >> 1) ^ -(u & 1));
+  return true;
+}
+
+// Returns the contents of /proc/self/maps, so that dumps can be symbolized
+// offline.
+std::string ReadMappings() {
+  std::string result;
+  int fd = tcmalloc_internal::signal_safe_open("/proc/self/maps", O_RDONLY);
+  if (fd < 0) return result;
+  char buf[4096];
+  while (true) {
+    size_t n = 0;
+    if (tcmalloc_internal::signal_safe_read(fd, buf, sizeof(buf), &n) < 0 ||
+        n == 0) {
+      break;
+    }
+    result.append(buf, n);
+  }
+  tcmalloc_internal::signal_safe_close(fd);
+  return result;
+}
+
+}  // namespace
+
+void ProfileDumper::Serialize(const Profile& profile,
+                              absl::string_view mappings, std::string* out) {
+  out->append(kMagic, sizeof(kMagic) - 1);
+  out->push_back(static_cast<char>(kVersion));
+  PutVarint(static_cast<uint64_t>(profile.Type()), out);
+  PutVarint(profile.Period(), out);
+  PutVarint(mappings.size(), out);
+  out->append(mappings.data(), mappings.size());
+  profile.Iterate([&](const Profile::Sample& s) {
+    PutZigZag(s.count, out);
+    PutZigZag(s.sum, out);
+    PutVarint(s.requested_size, out);
+    PutVarint(s.requested_alignment, out);
+    PutVarint(s.allocated_size, out);
+    PutVarint(s.depth, out);
+    uintptr_t prev = 0;
+    for (int i = 0; i < s.depth; ++i) {
+      const uintptr_t pc = reinterpret_cast<uintptr_t>(s.stack[i]);
+      if (i == 0) {
+        PutVarint(pc, out);
+      } else {
+        PutZigZag(static_cast<int64_t>(pc - prev), out);
+      }
+      prev = pc;
+    }
+  });
+}
+
+bool ProfileDumper::Deserialize(absl::string_view data, DecodedProfile* out) {
+  const size_t magic_length = sizeof(kMagic) - 1;
+  if (data.size() < magic_length + 1 ||
+      data.substr(0, magic_length) != absl::string_view(kMagic) ||
+      static_cast<uint8_t>(data[magic_length]) != kVersion) {
+    return false;
+  }
+  data.remove_prefix(magic_length + 1);
+
+  uint64_t type, period, mappings_length;
+  if (!GetVarint(&data, &type) || !GetVarint(&data, &period) ||
+      !GetVarint(&data, &mappings_length) || mappings_length > data.size()) {
+    return false;
+  }
+  out->type = static_cast<ProfileType>(type);
+  out->period = period;
+  out->mappings = std::string(data.substr(0, mappings_length));
+  data.remove_prefix(mappings_length);
+
+  out->samples.clear();
+  while (!data.empty()) {
+    Profile::Sample s;
+    uint64_t requested_size, requested_alignment, allocated_size, depth;
+    if (!GetZigZag(&data, &s.count) || !GetZigZag(&data, &s.sum) ||
+        !GetVarint(&data, &requested_size) ||
+        !GetVarint(&data, &requested_alignment) ||
+        !GetVarint(&data, &allocated_size) || !GetVarint(&data, &depth) ||
+        depth > Profile::Sample::kMaxStackDepth) {
+      return false;
+    }
+    s.requested_size = requested_size;
+    s.requested_alignment = requested_alignment;
+    s.allocated_size = allocated_size;
+    s.depth = depth;
+    uintptr_t pc = 0;
+    for (int i = 0; i < s.depth; ++i) {
+      if (i == 0) {
+        uint64_t first;
+        if (!GetVarint(&data, &first)) return false;
+        pc = first;
+      } else {
+        int64_t delta;
+        if (!GetZigZag(&data, &delta)) return false;
+        pc += delta;
+      }
+      s.stack[i] = reinterpret_cast<void*>(pc);
+    }
+    out->samples.push_back(s);
+  }
+  return true;
+}
+
+void ProfileDumper::InitFromEnvironment() {
+  const char* prefix =
+      tcmalloc_internal::thread_safe_getenv("TCMALLOC_PROFILE_DUMP_PREFIX");
+  if (prefix == nullptr || prefix[0] == '\0') return;
+
+  MallocExtension::ProfileDumpPolicy policy;
+  policy.prefix = prefix;
+  if (const char* interval = tcmalloc_internal::thread_safe_getenv(
+          "TCMALLOC_PROFILE_DUMP_INTERVAL_SECONDS")) {
+    policy.interval = absl::Seconds(strtod(interval, nullptr));
+  }
+  if (const char* growth = tcmalloc_internal::thread_safe_getenv(
+          "TCMALLOC_PROFILE_DUMP_HEAP_GROWTH_BYTES")) {
+    policy.heap_growth_bytes = strtoll(growth, nullptr, 10);
+  }
+  if (const char* at_exit = tcmalloc_internal::thread_safe_getenv(
+          "TCMALLOC_PROFILE_DUMP_AT_EXIT")) {
+    policy.at_exit = at_exit[0] != '\0' && strcmp(at_exit, "0") != 0;
+  }
+  SetPolicy(policy);
+}
+
+MallocExtension::ProfileDumpPolicy ProfileDumper::GetPolicy() const {
+  MallocExtension::ProfileDumpPolicy policy;
+  {
+    absl::base_internal::SpinLockHolder h(&policy_lock);
+    if (!enabled_.load(std::memory_order_relaxed)) return policy;
+    policy.prefix = prefix_;
+  }
+  policy.interval =
+      absl::Nanoseconds(interval_ns_.load(std::memory_order_relaxed));
+  policy.heap_growth_bytes =
+      heap_growth_bytes_.load(std::memory_order_relaxed);
+  policy.at_exit = at_exit_.load(std::memory_order_relaxed);
+  return policy;
+}
+
+void ProfileDumper::SetPolicy(
+    const MallocExtension::ProfileDumpPolicy& policy) {
+  const bool enable = !policy.prefix.empty();
+  if (policy.prefix.size() >= kMaxPrefixLength) {
+    Log(kLog, __FILE__, __LINE__, "Profile dump prefix too long, ignoring",
+        policy.prefix.size());
+    return;
+  }
+
+  {
+    absl::base_internal::SpinLockHolder h(&policy_lock);
+    memcpy(prefix_, policy.prefix.data(), policy.prefix.size());
+    prefix_[policy.prefix.size()] = '\0';
+    interval_ns_.store(
+        policy.interval > absl::ZeroDuration()
+            ? absl::ToInt64Nanoseconds(policy.interval)
+            : 0,
+        std::memory_order_relaxed);
+    heap_growth_bytes_.store(
+        policy.heap_growth_bytes > 0 ? policy.heap_growth_bytes : 0,
+        std::memory_order_relaxed);
+    at_exit_.store(policy.at_exit, std::memory_order_relaxed);
+    enabled_.store(enable, std::memory_order_release);
+  }
+  ResetGrowthThreshold();
+
+  if (!enable) return;
+  if (policy.at_exit && !atexit_registered_.exchange(true)) {
+    atexit(&ProfileDumper::AtExit);
+  }
+  if (interval_ns_.load(std::memory_order_relaxed) > 0 ||
+      heap_growth_bytes_.load(std::memory_order_relaxed) > 0) {
+    StartThreadIfNeeded();
+  }
+}
+
+void ProfileDumper::ResetGrowthThreshold() {
+  const int64_t growth = heap_growth_bytes_.load(std::memory_order_relaxed);
+  if (!enabled_.load(std::memory_order_relaxed) || growth <= 0) {
+    next_growth_dump_.store(0, std::memory_order_relaxed);
+    return;
+  }
+  next_growth_dump_.store(Static::sampled_objects_size_.value() + growth,
+                          std::memory_order_relaxed);
+}
+
+void ProfileDumper::StartThreadIfNeeded() {
+  if (thread_started_.exchange(true)) return;
+  if (!atfork_registered_.exchange(true)) {
+    pthread_atfork(nullptr, nullptr, &ProfileDumper::AtForkChild);
+  }
+
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  pthread_t thread;
+  if (pthread_create(&thread, &attr, &ProfileDumper::ThreadMain, this) != 0) {
+    Log(kLog, __FILE__, __LINE__, "Unable to start profile dump thread");
+    thread_started_.store(false);
+  }
+  pthread_attr_destroy(&attr);
+}
+
+void* ProfileDumper::ThreadMain(void* arg) {
+  ProfileDumper* dumper = static_cast<ProfileDumper*>(arg);
+  absl::Time last_dump = absl::Now();
+  while (true) {
+    absl::SleepFor(absl::Milliseconds(kPollIntervalMs));
+    if (!dumper->enabled_.load(std::memory_order_acquire)) continue;
+
+    const absl::Time now = absl::Now();
+    const int64_t interval_ns =
+        dumper->interval_ns_.load(std::memory_order_relaxed);
+    const bool requested =
+        dumper->dump_requested_.exchange(false, std::memory_order_relaxed);
+    if (requested || (interval_ns > 0 &&
+                      now - last_dump >= absl::Nanoseconds(interval_ns))) {
+      dumper->Dump();
+      last_dump = now;
+    }
+  }
+  return nullptr;
+}
+
+void ProfileDumper::AtForkChild() {
+  // Only the forking thread survives in the child.  Starting a thread is not
+  // safe from here, so the next sampled allocation starts it instead, if the
+  // inherited policy needs it; SetPolicy() would start it too.
+  ProfileDumper* dumper = Static::profile_dumper();
+  dumper->thread_started_.store(false, std::memory_order_relaxed);
+  dumper->restart_thread_.store(
+      dumper->enabled_.load(std::memory_order_relaxed) &&
+          (dumper->interval_ns_.load(std::memory_order_relaxed) > 0 ||
+           dumper->heap_growth_bytes_.load(std::memory_order_relaxed) > 0),
+      std::memory_order_relaxed);
+}
+
+void ProfileDumper::AtExit() {
+  ProfileDumper* dumper = Static::profile_dumper();
+  if (dumper->at_exit_.load(std::memory_order_relaxed)) {
+    dumper->Dump();
+  }
+}
+
+bool ProfileDumper::WriteProfile(const std::string& path, ProfileType type,
+                                 absl::string_view mappings) {
+  std::string data;
+  Serialize(MallocExtension::SnapshotCurrent(type), mappings, &data);
+
+  // Write to a temporary file and rename it into place, so that readers never
+  // observe a partial dump.
+  const std::string tmp_path = path + ".tmp";
+  int fd = tcmalloc_internal::signal_safe_open(
+      tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    Log(kLog, __FILE__, __LINE__, "Unable to open profile dump", errno);
+    return false;
+  }
+  bool ok = tcmalloc_internal::signal_safe_write(fd, data.data(), data.size(),
+                                                 nullptr) >= 0;
+  ok = tcmalloc_internal::signal_safe_close(fd) == 0 && ok;
+  ok = ok && rename(tmp_path.c_str(), path.c_str()) == 0;
+  if (!ok) {
+    Log(kLog, __FILE__, __LINE__, "Unable to write profile dump", errno);
+    unlink(tmp_path.c_str());
+  }
+  return ok;
+}
+
+bool ProfileDumper::Dump() {
+  char prefix[kMaxPrefixLength];
+  {
+    absl::base_internal::SpinLockHolder h(&policy_lock);
+    if (!enabled_.load(std::memory_order_relaxed)) return false;
+    memcpy(prefix, prefix_, sizeof(prefix));
+  }
+
+  int64_t seq;
+  {
+    absl::base_internal::SpinLockHolder h(&dump_lock);
+    // Reset the trigger first, so that growth during the dump is measured from
+    // the heap size we are about to record.
+    ResetGrowthThreshold();
+    dump_requested_.store(false, std::memory_order_relaxed);
+    seq = seq_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  const std::string base = absl::StrFormat("%s.%d.%d", prefix, getpid(), seq);
+  const std::string mappings = ReadMappings();
+  bool ok = WriteProfile(base + ".heap", ProfileType::kHeap, mappings);
+  ok = WriteProfile(base + ".peakheap", ProfileType::kPeakHeap, mappings) && ok;
+  if (ok) dumps_.fetch_add(1, std::memory_order_relaxed);
+  return ok;
+}
+
+// Applies a policy given through the environment as the library loads.
+class ProfileDumperInitializer {
+ public:
+  ProfileDumperInitializer() {
+    Static::profile_dumper()->InitFromEnvironment();
+  }
+};
+static ProfileDumperInitializer profile_dumper_initializer;
+
+}  // namespace tcmalloc
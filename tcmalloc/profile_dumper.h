@@ -0,0 +1,141 @@
+// Copyright 2019 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef TCMALLOC_PROFILE_DUMPER_H_
+#define TCMALLOC_PROFILE_DUMPER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "absl/base/optimization.h"
+#include "absl/strings/string_view.h"
+#include "tcmalloc/malloc_extension.h"
+
+namespace tcmalloc {
+
+// Writes kHeap and kPeakHeap profiles to disk according to a
+// MallocExtension::ProfileDumpPolicy.
+//
+// Dumps are written by a background thread, started when a policy is first
+// enabled, that wakes up every kPollIntervalMs.  The only work done on the
+// allocation path is MaybeRequestDump(), which compares the sampled heap size
+// against a threshold and sets a flag; allocating threads never block on
+// snapshotting or I/O.  The exit dump is written synchronously from an atexit
+// handler.
+//
+// Each dump writes <prefix>.<pid>.<seq>.heap and <prefix>.<pid>.<seq>.peakheap,
+// renaming them into place once complete.
+class ProfileDumper {
+ public:
+  // Constructor should do nothing since we rely on zero-initialization of
+  // our single static instance, which may be used before constructors run.
+  ProfileDumper() {}
+
+  // Applies the TCMALLOC_PROFILE_DUMP_* environment variables, if set.
+  void InitFromEnvironment();
+
+  MallocExtension::ProfileDumpPolicy GetPolicy() const;
+  void SetPolicy(const MallocExtension::ProfileDumpPolicy& policy);
+
+  // Called after each sampled allocation.  Requests a dump from the background
+  // thread if the sampled heap grew by the policy's heap_growth_bytes since
+  // the last dump.  In a child made by fork(), the first call also starts the
+  // child's own background thread.
+  void MaybeRequestDump(size_t sampled_heap_size) {
+    if (ABSL_PREDICT_FALSE(
+            restart_thread_.load(std::memory_order_relaxed)) &&
+        restart_thread_.exchange(false, std::memory_order_relaxed)) {
+      StartThreadIfNeeded();
+    }
+    const size_t next = next_growth_dump_.load(std::memory_order_relaxed);
+    if (ABSL_PREDICT_FALSE(next != 0 && sampled_heap_size >= next)) {
+      dump_requested_.store(true, std::memory_order_relaxed);
+    }
+  }
+
+  // Writes a dump now, on the calling thread.  Returns false if dumping is
+  // disabled or a file could not be written.
+  bool Dump();
+
+  // Number of dumps written so far.
+  int64_t dumps() const { return dumps_.load(std::memory_order_relaxed); }
+
+  // Serializes "profile" in the compact binary dump format:
+  //
+  //   "TCMPROF" version:u8
+  //   type:varint period:varint
+  //   mappings_length:varint mappings:bytes  (contents of /proc/self/maps)
+  //   sample*
+  //
+  // where each sample is
+  //
+  //   count:zigzag sum:zigzag requested_size:varint
+  //   requested_alignment:varint allocated_size:varint depth:varint
+  //   pc[0]:varint (pc[i] - pc[i-1]):zigzag ...
+  //
+  // and samples continue to the end of the file.
+  static void Serialize(const Profile& profile, absl::string_view mappings,
+                        std::string* out);
+
+  struct DecodedProfile {
+    ProfileType type;
+    int64_t period;
+    std::string mappings;
+    std::vector<Profile::Sample> samples;
+  };
+
+  // Parses the output of Serialize().  Returns false if "data" is malformed.
+  static bool Deserialize(absl::string_view data, DecodedProfile* out);
+
+  static constexpr int kPollIntervalMs = 100;
+  static constexpr size_t kMaxPrefixLength = 4096;
+
+ private:
+  static void* ThreadMain(void* arg);
+  static void AtExit();
+  static void AtForkChild();
+
+  void StartThreadIfNeeded();
+  void ResetGrowthThreshold();
+  bool WriteProfile(const std::string& path, ProfileType type,
+                    absl::string_view mappings);
+
+  // Guarded by policy_lock in profile_dumper.cc.
+  char prefix_[kMaxPrefixLength];
+  std::atomic<bool> enabled_;
+  std::atomic<int64_t> interval_ns_;
+  std::atomic<int64_t> heap_growth_bytes_;
+  std::atomic<bool> at_exit_;
+
+  std::atomic<bool> dump_requested_;
+  // Sampled heap size at which MaybeRequestDump() requests a dump, or 0 if
+  // the heap growth trigger is disabled.
+  std::atomic<size_t> next_growth_dump_;
+  std::atomic<int64_t> seq_;
+  std::atomic<int64_t> dumps_;
+  std::atomic<bool> thread_started_;
+  // Set in a child made by fork() when the parent's policy needs the
+  // background thread, which the child does not inherit.
+  std::atomic<bool> restart_thread_;
+  std::atomic<bool> atexit_registered_;
+  std::atomic<bool> atfork_registered_;
+};
+
+}  // namespace tcmalloc
+
+#endif  // TCMALLOC_PROFILE_DUMPER_H_
@@ -0,0 +1,182 @@
+// Copyright 2019 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/profile_dumper.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include "gtest/gtest.h"
+#include "absl/strings/str_cat.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "tcmalloc/malloc_extension.h"
+#include "tcmalloc/static_vars.h"
+
+namespace tcmalloc {
+namespace {
+
+int64_t TotalSize(const ProfileDumper::DecodedProfile& p) {
+  int64_t total = 0;
+  for (const auto& s : p.samples) total += s.sum;
+  return total;
+}
+
+// Waits for the dumper to write more than "dumps" dumps and reads the newest
+// file of the given kind written with "prefix".
+bool ReadLatestDump(const std::string& prefix, int64_t dumps,
+                    absl::string_view suffix,
+                    ProfileDumper::DecodedProfile* out) {
+  const absl::Time deadline = absl::Now() + absl::Seconds(10);
+  while (Static::profile_dumper()->dumps() <= dumps) {
+    if (absl::Now() > deadline) return false;
+    absl::SleepFor(absl::Milliseconds(10));
+  }
+
+  std::string data;
+  for (int seq = 0; seq < 1000; ++seq) {
+    std::ifstream f(absl::StrCat(prefix, ".", getpid(), ".", seq, suffix),
+                    std::ios::binary);
+    if (!f) continue;
+    std::stringstream ss;
+    ss << f.rdbuf();
+    data = ss.str();
+  }
+  return !data.empty() && ProfileDumper::Deserialize(data, out);
+}
+
+TEST(ProfileDumperTest, RoundTrip) {
+  void* ptr = malloc(50 << 20);
+  Profile profile = MallocExtension::SnapshotCurrent(ProfileType::kHeap);
+  free(ptr);
+
+  std::string data;
+  ProfileDumper::Serialize(profile, "mappings", &data);
+  ProfileDumper::DecodedProfile decoded;
+  ASSERT_TRUE(ProfileDumper::Deserialize(data, &decoded));
+  EXPECT_EQ(decoded.type, ProfileType::kHeap);
+  EXPECT_EQ(decoded.period, profile.Period());
+  EXPECT_EQ(decoded.mappings, "mappings");
+
+  size_t i = 0;
+  profile.Iterate([&](const Profile::Sample& s) {
+    ASSERT_LT(i, decoded.samples.size());
+    const Profile::Sample& d = decoded.samples[i++];
+    EXPECT_EQ(d.count, s.count);
+    EXPECT_EQ(d.sum, s.sum);
+    EXPECT_EQ(d.requested_size, s.requested_size);
+    EXPECT_EQ(d.requested_alignment, s.requested_alignment);
+    EXPECT_EQ(d.allocated_size, s.allocated_size);
+    ASSERT_EQ(d.depth, s.depth);
+    for (int j = 0; j < s.depth; ++j) {
+      EXPECT_EQ(d.stack[j], s.stack[j]);
+    }
+  });
+  EXPECT_EQ(i, decoded.samples.size());
+  EXPECT_GE(TotalSize(decoded), 50 << 20);
+
+  EXPECT_FALSE(ProfileDumper::Deserialize(data.substr(0, data.size() - 1),
+                                          &decoded));
+  EXPECT_FALSE(ProfileDumper::Deserialize("garbage", &decoded));
+}
+
+TEST(ProfileDumperTest, Policy) {
+  MallocExtension::ProfileDumpPolicy policy;
+  policy.prefix = absl::StrCat(testing::TempDir(), "/policy");
+  policy.heap_growth_bytes = int64_t{1} << 40;
+  policy.at_exit = true;
+  MallocExtension::SetProfileDumpPolicy(policy);
+
+  MallocExtension::ProfileDumpPolicy actual =
+      MallocExtension::GetProfileDumpPolicy();
+  EXPECT_EQ(actual.prefix, policy.prefix);
+  EXPECT_EQ(actual.interval, absl::ZeroDuration());
+  EXPECT_EQ(actual.heap_growth_bytes, policy.heap_growth_bytes);
+  EXPECT_TRUE(actual.at_exit);
+
+  MallocExtension::SetProfileDumpPolicy({});
+  EXPECT_EQ(MallocExtension::GetProfileDumpPolicy().prefix, "");
+}
+
+TEST(ProfileDumperTest, HeapGrowth) {
+  const std::string prefix = absl::StrCat(testing::TempDir(), "/growth");
+  MallocExtension::ProfileDumpPolicy policy;
+  policy.prefix = prefix;
+  policy.heap_growth_bytes = 10 << 20;
+  MallocExtension::SetProfileDumpPolicy(policy);
+
+  const int64_t dumps = Static::profile_dumper()->dumps();
+  void* ptr = malloc(50 << 20);
+  ProfileDumper::DecodedProfile heap;
+  ASSERT_TRUE(ReadLatestDump(prefix, dumps, ".heap", &heap));
+  MallocExtension::SetProfileDumpPolicy({});
+  free(ptr);
+
+  EXPECT_EQ(heap.type, ProfileType::kHeap);
+  EXPECT_GE(TotalSize(heap), 50 << 20);
+  EXPECT_FALSE(heap.mappings.empty());
+
+  ProfileDumper::DecodedProfile peak;
+  ASSERT_TRUE(ReadLatestDump(prefix, dumps, ".peakheap", &peak));
+  EXPECT_EQ(peak.type, ProfileType::kPeakHeap);
+}
+
+TEST(ProfileDumperTest, Interval) {
+  const std::string prefix = absl::StrCat(testing::TempDir(), "/interval");
+  MallocExtension::ProfileDumpPolicy policy;
+  policy.prefix = prefix;
+  policy.interval = absl::Milliseconds(200);
+  MallocExtension::SetProfileDumpPolicy(policy);
+
+  const int64_t dumps = Static::profile_dumper()->dumps();
+  ProfileDumper::DecodedProfile heap;
+  ASSERT_TRUE(ReadLatestDump(prefix, dumps + 1, ".heap", &heap));
+  MallocExtension::SetProfileDumpPolicy({});
+  EXPECT_EQ(heap.type, ProfileType::kHeap);
+}
+
+TEST(ProfileDumperTest, Fork) {
+  const std::string prefix = absl::StrCat(testing::TempDir(), "/fork");
+  MallocExtension::ProfileDumpPolicy policy;
+  policy.prefix = prefix;
+  policy.interval = absl::Milliseconds(200);
+  MallocExtension::SetProfileDumpPolicy(policy);
+
+  // The child keeps dumping under its own pid, from a thread of its own,
+  // once it allocates.
+  const pid_t pid = fork();
+  ASSERT_GE(pid, 0);
+  if (pid == 0) {
+    const int64_t dumps = Static::profile_dumper()->dumps();
+    void* ptr = malloc(50 << 20);
+    ProfileDumper::DecodedProfile heap;
+    const bool ok = ReadLatestDump(prefix, dumps + 1, ".heap", &heap);
+    free(ptr);
+    _exit(ok && heap.type == ProfileType::kHeap ? 0 : 1);
+  }
+  int status;
+  ASSERT_EQ(waitpid(pid, &status, 0), pid);
+  MallocExtension::SetProfileDumpPolicy({});
+  ASSERT_TRUE(WIFEXITED(status));
+  EXPECT_EQ(WEXITSTATUS(status), 0);
+}
+
+}  // namespace
+}  // namespace tcmalloc
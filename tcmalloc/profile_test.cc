@@ -15,11 +15,13 @@
 #include <stddef.h>
 
 #include <algorithm>
+#include <atomic>
 #include <cstdint>
 #include <limits>
 #include <memory>
 #include <new>
 #include <set>
+#include <thread>
 #include <utility>
 #include <vector>
 
@@ -51,6 +53,99 @@ TEST(AllocationSampleTest, TokenAbuse) {
   { MallocExtension::StartAllocationProfiling(); }
 }
 
+TEST(AllocationSampleTest, OverlappingSessions) {
+  // Sizes that are unlikely to be allocated elsewhere, so we can find them.
+  static const size_t kFirstSize = 300 * 1024 * 1024 + 17;
+  static const size_t kSecondSize = 200 * 1024 * 1024 + 17;
+
+  auto sizes = [](const Profile &profile) {
+    std::set<size_t> result;
+    profile.Iterate([&](const Profile::Sample &e) {
+      if (e.requested_size == kFirstSize || e.requested_size == kSecondSize) {
+        result.insert(e.requested_size);
+      }
+    });
+    return result;
+  };
+
+  auto first = MallocExtension::StartAllocationProfiling();
+  ::operator delete(::operator new(kFirstSize));
+  auto second = MallocExtension::StartAllocationProfiling();
+  ::operator delete(::operator new(kSecondSize));
+
+  // Each session sees exactly the allocations made while it ran, whatever
+  // order they are stopped in.
+  EXPECT_THAT(sizes(std::move(first).Stop()),
+              testing::ElementsAre(kSecondSize, kFirstSize));
+  EXPECT_THAT(sizes(std::move(second).Stop()),
+              testing::ElementsAre(kSecondSize));
+
+  auto third = MallocExtension::StartAllocationProfiling();
+  EXPECT_THAT(sizes(std::move(third).Stop()), testing::IsEmpty());
+}
+
+TEST(AllocationSampleTest, ConcurrentSessions) {
+  std::atomic<bool> stop{false};
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 4; ++i) {
+    threads.emplace_back([&]() {
+      while (!stop.load(std::memory_order_relaxed)) {
+        ::operator delete(::operator new(64 * 1024));
+      }
+    });
+  }
+
+  for (int i = 0; i < 100; ++i) {
+    std::vector<MallocExtension::AllocationProfilingToken> tokens;
+    for (int j = 0; j < 4; ++j) {
+      tokens.push_back(MallocExtension::StartAllocationProfiling());
+    }
+    for (auto &token : tokens) {
+      int64_t total = 0;
+      std::move(token).Stop().Iterate(
+          [&](const Profile::Sample &e) { total += e.sum; });
+      EXPECT_GE(total, 0);
+    }
+  }
+
+  stop.store(true, std::memory_order_relaxed);
+  for (auto &t : threads) {
+    t.join();
+  }
+}
+
+TEST(AllocationSampleTest, RepeatedSamplesAreMerged) {
+  static const size_t kSize = 12345;
+  static const int kAllocations = 200000;
+  const int64_t old_rate = MallocExtension::GetProfileSamplingRate();
+  MallocExtension::SetProfileSamplingRate(1);
+  MallocExtension::SetGuardedSamplingRate(-1);
+  // The new rate applies from the next sample point on.
+  ::operator delete(::operator new(256 * 1024 * 1024));
+
+  auto metadata_bytes = []() {
+    return MallocExtension::GetNumericProperty("tcmalloc.metadata_bytes")
+        .value_or(0);
+  };
+  auto token = MallocExtension::StartAllocationProfiling();
+  const size_t before = metadata_bytes();
+  for (int i = 0; i < kAllocations; ++i) {
+    ::operator delete(::operator new(kSize));
+  }
+  // Samples of one stack and size share an entry in the log, rather than
+  // taking one each.
+  EXPECT_LT(metadata_bytes(), before + (1 << 20));
+
+  int64_t count = 0;
+  std::move(token).Stop().Iterate([&](const Profile::Sample &e) {
+    if (e.requested_size == kSize) count += e.count;
+  });
+  EXPECT_GE(count, kAllocations * 9 / 10);
+  EXPECT_LE(count, kAllocations * 11 / 10);
+
+  MallocExtension::SetProfileSamplingRate(old_rate);
+}
+
 TEST(AllocationSampleTest, SampleAccuracy) {
   // Disable GWP-ASan, since it allocates different sizes than normal samples.
   MallocExtension::SetGuardedSamplingRate(-1);
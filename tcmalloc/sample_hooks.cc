@@ -0,0 +1,77 @@
+// Copyright 2019 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/sample_hooks.h"
+
+#include "absl/base/attributes.h"
+#include "absl/base/internal/spinlock.h"
+
+namespace tcmalloc {
+namespace {
+
+// Set while the thread runs hooks, so that samples taken by the hooks' own
+// allocations are not reported to them.
+__thread bool in_sample_hook ABSL_ATTRIBUTE_INITIAL_EXEC;
+
+// Serializes Add() and Remove(), so that the duplicate check and the insert
+// of Add() are atomic.
+ABSL_CONST_INIT absl::base_internal::SpinLock hooks_lock(
+    absl::base_internal::kLinkerInitialized);
+
+}  // namespace
+
+ABSL_CONST_INIT std::atomic<MallocExtension::SampleHook>
+    SampleHooks::hooks_[kMaxHooks] = {};
+ABSL_CONST_INIT std::atomic<int> SampleHooks::num_hooks_{0};
+
+bool SampleHooks::Add(MallocExtension::SampleHook hook) {
+  if (hook == nullptr) return false;
+  absl::base_internal::SpinLockHolder h(&hooks_lock);
+  std::atomic<MallocExtension::SampleHook>* free_slot = nullptr;
+  for (auto& slot : hooks_) {
+    const MallocExtension::SampleHook current =
+        slot.load(std::memory_order_relaxed);
+    if (current == hook) return false;
+    if (current == nullptr && free_slot == nullptr) free_slot = &slot;
+  }
+  if (free_slot == nullptr) return false;
+  free_slot->store(hook, std::memory_order_release);
+  num_hooks_.fetch_add(1, std::memory_order_relaxed);
+  return true;
+}
+
+bool SampleHooks::Remove(MallocExtension::SampleHook hook) {
+  if (hook == nullptr) return false;
+  absl::base_internal::SpinLockHolder h(&hooks_lock);
+  for (auto& slot : hooks_) {
+    if (slot.load(std::memory_order_relaxed) == hook) {
+      slot.store(nullptr, std::memory_order_relaxed);
+      num_hooks_.fetch_sub(1, std::memory_order_relaxed);
+      return true;
+    }
+  }
+  return false;
+}
+
+void SampleHooks::Invoke(const MallocExtension::SampleEvent& event) {
+  if (in_sample_hook) return;
+  in_sample_hook = true;
+  for (auto& slot : hooks_) {
+    MallocExtension::SampleHook hook = slot.load(std::memory_order_acquire);
+    if (hook != nullptr) hook(event);
+  }
+  in_sample_hook = false;
+}
+
+}  // namespace tcmalloc
@@ -0,0 +1,53 @@
+// Copyright 2019 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef TCMALLOC_SAMPLE_HOOKS_H_
+#define TCMALLOC_SAMPLE_HOOKS_H_
+
+#include <atomic>
+
+#include "absl/base/optimization.h"
+#include "tcmalloc/malloc_extension.h"
+
+namespace tcmalloc {
+
+// The hooks registered with MallocExtension::AddSampleHook().
+//
+// Hooks live in a small fixed array of atomics, so that registering them never
+// allocates, and invoking them never allocates or takes a lock.  Registration
+// is serialized by a spinlock.
+class SampleHooks {
+ public:
+  static constexpr int kMaxHooks = 8;
+
+  static bool Add(MallocExtension::SampleHook hook);
+  static bool Remove(MallocExtension::SampleHook hook);
+
+  // True if any hook is registered.
+  static bool active() {
+    return ABSL_PREDICT_FALSE(num_hooks_.load(std::memory_order_relaxed) > 0);
+  }
+
+  // Calls every registered hook with "event", unless the calling thread is
+  // already running a hook.  Must be called without any allocator lock held.
+  static void Invoke(const MallocExtension::SampleEvent& event);
+
+ private:
+  static std::atomic<MallocExtension::SampleHook> hooks_[kMaxHooks];
+  static std::atomic<int> num_hooks_;
+};
+
+}  // namespace tcmalloc
+
+#endif  // TCMALLOC_SAMPLE_HOOKS_H_
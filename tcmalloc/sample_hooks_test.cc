@@ -0,0 +1,118 @@
+// Copyright 2019 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stddef.h>
+
+#include <atomic>
+#include <new>
+#include <thread>  // NOLINT(build/c++11)
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "tcmalloc/malloc_extension.h"
+
+namespace tcmalloc {
+namespace {
+
+// An allocation size that is unlikely to happen elsewhere, and is always
+// sampled.
+constexpr size_t kSize = 300 * 1024 * 1024 + 17;
+
+struct Seen {
+  int allocations;
+  int frees;
+  void* ptr;
+  size_t requested_size;
+  int depth;
+  void* first_frame;
+};
+
+Seen seen;
+
+void RecordHook(const MallocExtension::SampleEvent& event) {
+  if (event.requested_size != kSize) return;
+  if (event.type == MallocExtension::SampleEvent::kAllocation) {
+    seen.allocations++;
+    seen.ptr = event.ptr;
+    seen.requested_size = event.requested_size;
+    seen.depth = event.depth;
+    seen.first_frame = event.depth > 0 ? event.stack[0] : nullptr;
+  } else {
+    seen.frees++;
+    EXPECT_EQ(event.ptr, seen.ptr);
+    EXPECT_EQ(event.depth, seen.depth);
+    EXPECT_EQ(event.depth > 0 ? event.stack[0] : nullptr, seen.first_frame);
+  }
+}
+
+TEST(SampleHooksTest, AllocationAndFree) {
+  seen = {};
+  ASSERT_TRUE(MallocExtension::AddSampleHook(&RecordHook));
+  EXPECT_FALSE(MallocExtension::AddSampleHook(&RecordHook));
+
+  void* ptr = ::operator new(kSize);
+  EXPECT_EQ(seen.allocations, 1);
+  EXPECT_EQ(seen.ptr, ptr);
+  EXPECT_EQ(seen.requested_size, kSize);
+  ::operator delete(ptr);
+  EXPECT_EQ(seen.frees, 1);
+
+  EXPECT_TRUE(MallocExtension::RemoveSampleHook(&RecordHook));
+  EXPECT_FALSE(MallocExtension::RemoveSampleHook(&RecordHook));
+
+  ::operator delete(::operator new(kSize));
+  EXPECT_EQ(seen.allocations, 1);
+  EXPECT_EQ(seen.frees, 1);
+}
+
+std::atomic<int> allocating_hook_calls{0};
+
+void AllocatingHook(const MallocExtension::SampleEvent& event) {
+  if (event.requested_size != kSize) return;
+  allocating_hook_calls++;
+  // Sampled, but must not be reported to us again.
+  ::operator delete(::operator new(kSize));
+}
+
+TEST(SampleHooksTest, NoRecursion) {
+  ASSERT_TRUE(MallocExtension::AddSampleHook(&AllocatingHook));
+  ::operator delete(::operator new(kSize));
+  EXPECT_TRUE(MallocExtension::RemoveSampleHook(&AllocatingHook));
+
+  // One allocation and one free.
+  EXPECT_EQ(allocating_hook_calls, 2);
+}
+
+void IgnoringHook(const MallocExtension::SampleEvent& event) {}
+
+TEST(SampleHooksTest, RacingAdds) {
+  for (int iter = 0; iter < 100; ++iter) {
+    std::atomic<int> added{0};
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i) {
+      threads.emplace_back([&]() {
+        if (MallocExtension::AddSampleHook(&IgnoringHook)) added++;
+      });
+    }
+    for (auto& t : threads) {
+      t.join();
+    }
+    EXPECT_EQ(added, 1);
+    EXPECT_TRUE(MallocExtension::RemoveSampleHook(&IgnoringHook));
+    EXPECT_FALSE(MallocExtension::RemoveSampleHook(&IgnoringHook));
+  }
+}
+
+}  // namespace
+}  // namespace tcmalloc
@@ -0,0 +1,156 @@
+// Copyright 2019 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/sampled_allocation_table.h"
+
+#include "tcmalloc/internal/atomic_stats_counter.h"
+#include "tcmalloc/sampler.h"
+#include "tcmalloc/static_vars.h"
+
+namespace tcmalloc {
+
+// Like a constructor and hence we disable thread safety analysis.
+void SampledAllocationTable::Init(Arena* arena) NO_THREAD_SAFETY_ANALYSIS {
+  arena_ = arena;
+  for (Shard& shard : shards_) {
+    for (Entry*& bucket : shard.initial_buckets) {
+      bucket = nullptr;
+    }
+    shard.buckets = shard.initial_buckets;
+    shard.bucket_bits = kInitialBucketBits;
+    shard.size = 0;
+  }
+  entry_allocator_.Init(arena, kMetadataSampling);
+}
+
+void SampledAllocationTable::Insert(const void* ptr,
+                                    const SampleRecord& record) {
+  const uintptr_t key = reinterpret_cast<uintptr_t>(ptr);
+  const uint64_t h = Hash(key);
+  Shard& shard = ShardFor(h);
+
+  Entry* e = entry_allocator_.New();
+  e->key = key;
+  e->record = record;
+  bool grow;
+  {
+    absl::base_internal::SpinLockHolder l(&shard.lock);
+    Entry** bucket = Bucket(shard, h);
+    e->next = *bucket;
+    *bucket = e;
+    ++shard.size;
+    grow = shard.size > (kMaxLoad << shard.bucket_bits);
+  }
+  if (ABSL_PREDICT_FALSE(grow)) Grow(shard);
+
+  Static::sampled_objects_size_.LossyAdd(
+      static_cast<tcmalloc_internal::StatsCounter::Value>(
+          AllocatedBytes(record, true)));
+}
+
+bool SampledAllocationTable::Remove(const void* ptr, SampleRecord* record) {
+  const uintptr_t key = reinterpret_cast<uintptr_t>(ptr);
+  const uint64_t h = Hash(key);
+  Shard& shard = ShardFor(h);
+  Entry* e;
+  {
+    absl::base_internal::SpinLockHolder l(&shard.lock);
+    Entry** link = Bucket(shard, h);
+    for (e = *link; e != nullptr && e->key != key; e = e->next) {
+      link = &e->next;
+    }
+    if (e == nullptr) {
+      return false;
+    }
+    *link = e->next;
+    --shard.size;
+  }
+  *record = e->record;
+  entry_allocator_.Delete(e);
+
+  // The cast to Value ensures no funny business happens during the negation if
+  // sizeof(size_t) != sizeof(Value).
+  Static::sampled_objects_size_.LossyAdd(
+      -static_cast<tcmalloc_internal::StatsCounter::Value>(
+          AllocatedBytes(*record, true)));
+  return true;
+}
+
+bool SampledAllocationTable::Lookup(const void* ptr,
+                                    SampleRecord* record) const {
+  const uintptr_t key = reinterpret_cast<uintptr_t>(ptr);
+  const uint64_t h = Hash(key);
+  const Shard& shard = ShardFor(h);
+  absl::base_internal::SpinLockHolder l(&shard.lock);
+  for (const Entry* e = *Bucket(shard, h); e != nullptr; e = e->next) {
+    if (e->key == key) {
+      *record = e->record;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool SampledAllocationTable::HasSampleIn(uintptr_t begin, uintptr_t end) const {
+  // Writers hold pageheap_lock, so the shards need not be locked.
+  for (uintptr_t page = begin >> kPageShift; page <= (end - 1) >> kPageShift;
+       ++page) {
+    const uint64_t h = Hash(page << kPageShift);
+    for (const Entry* e = *Bucket(ShardFor(h), h); e != nullptr;
+         e = e->next) {
+      if (e->key >= begin && e->key < end) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+size_t SampledAllocationTable::size() const {
+  size_t result = 0;
+  for (const Shard& shard : shards_) {
+    absl::base_internal::SpinLockHolder l(&shard.lock);
+    result += shard.size;
+  }
+  return result;
+}
+
+void SampledAllocationTable::Grow(Shard& shard) {
+  // The new buckets are allocated before taking the shard lock, so Lookup()
+  // is only held up while entries are relinked, each time a shard doubles.
+  const int bits = shard.bucket_bits + 1;
+  Entry** buckets = reinterpret_cast<Entry**>(
+      arena_->Alloc(sizeof(Entry*) << bits, kMetadataSampling));
+  for (size_t i = 0, n = size_t{1} << bits; i < n; ++i) {
+    buckets[i] = nullptr;
+  }
+  absl::base_internal::SpinLockHolder l(&shard.lock);
+  Entry** old = shard.buckets;
+  const size_t old_n = size_t{1} << shard.bucket_bits;
+  shard.buckets = buckets;
+  shard.bucket_bits = bits;
+  for (size_t i = 0; i < old_n; ++i) {
+    for (Entry* e = old[i]; e != nullptr;) {
+      Entry* next = e->next;
+      Entry** bucket = Bucket(shard, Hash(e->key));
+      e->next = *bucket;
+      *bucket = e;
+      e = next;
+    }
+  }
+  // The old buckets stay with the arena, which never frees; their total is
+  // bounded by the final size of the shard.
+}
+
+}  // namespace tcmalloc
@@ -0,0 +1,142 @@
+// Copyright 2019 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Side table mapping the address of every live sampled allocation to the
+// SampleRecord kept for it.
+//
+// Small sampled objects stay in their span, among unsampled objects of the
+// same size class, so a span can no longer carry the record of "its" sample.
+// Instead every sample, regardless of size, is registered here.
+
+#ifndef TCMALLOC_SAMPLED_ALLOCATION_TABLE_H_
+#define TCMALLOC_SAMPLED_ALLOCATION_TABLE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "absl/base/internal/spinlock.h"
+#include "absl/base/thread_annotations.h"
+#include "tcmalloc/arena.h"
+#include "tcmalloc/common.h"
+#include "tcmalloc/internal/logging.h"
+#include "tcmalloc/page_heap_allocator.h"
+
+namespace tcmalloc {
+
+class SampledAllocationTable {
+ public:
+  // The table may be used before its constructor runs, so the constructor must
+  // not touch any state; see Init().
+  SampledAllocationTable() {}
+
+  void Init(Arena* arena) EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+
+  // Records "record" as the sample for the allocation starting at "ptr".
+  // REQUIRES: ptr is not already present.
+  void Insert(const void* ptr, const SampleRecord& record)
+      EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+
+  // Removes the entry for "ptr", storing its record in "*record".  Returns
+  // false if "ptr" was not sampled.
+  bool Remove(const void* ptr, SampleRecord* record)
+      EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+
+  // Stores the record for "ptr" in "*record", or returns false if "ptr" was
+  // not sampled.  The caller must own "ptr" so that its entry cannot be
+  // removed concurrently.
+  bool Lookup(const void* ptr, SampleRecord* record) const;
+
+  // Returns true if some sample starts in [begin, end).
+  bool HasSampleIn(uintptr_t begin, uintptr_t end) const
+      EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+
+  // Invokes "f(ptr, record)" for each live sample.  "f" must not call back
+  // into the table.
+  template <typename F>
+  void ForEach(F f) const EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+
+  // Number of live samples.
+  size_t size() const;
+
+  struct Entry {
+    Entry* next;
+    uintptr_t key;
+    SampleRecord record;
+  };
+
+ private:
+  // The table changes only under pageheap_lock, the lock that also guards
+  // the stack depot and Static::heap_delta_tracker(), so a sample is added
+  // to or dropped from all of them at once.  Lookup() is on the path of
+  // every free from a span holding samples, so it does not take
+  // pageheap_lock but only the lock of the shard the key hashes to; writers
+  // take that lock too, always after pageheap_lock.
+  static const int kShardBits = 6;
+  static const int kNumShards = 1 << kShardBits;
+  static const int kInitialBucketBits = 6;
+  static const int kInitialBuckets = 1 << kInitialBucketBits;
+  // A shard doubles its buckets once it holds this many entries per bucket.
+  static const size_t kMaxLoad = 2;
+
+  struct Shard {
+    Shard() : lock(absl::base_internal::kLinkerInitialized) {}
+
+    mutable absl::base_internal::SpinLock lock;
+    // Points at initial_buckets until the shard first grows.
+    Entry** buckets;
+    int bucket_bits;
+    size_t size;
+    Entry* initial_buckets[kInitialBuckets];
+  };
+
+  static uint64_t Hash(uintptr_t key) {
+    // Samples on the same page share a bucket, so that HasSampleIn() only
+    // visits one bucket per page.  Samples are sparse enough for those
+    // chains to stay short.  A multiplicative hash spreads neighbouring
+    // pages over the shards.
+    return (key >> kPageShift) * UINT64_C(0x9E3779B97F4A7C15);
+  }
+
+  Shard& ShardFor(uint64_t h) { return shards_[h >> (64 - kShardBits)]; }
+  const Shard& ShardFor(uint64_t h) const {
+    return shards_[h >> (64 - kShardBits)];
+  }
+
+  // The bucket is chosen by the hash bits just below those of the shard.
+  static Entry** Bucket(const Shard& shard, uint64_t h) {
+    return &shard.buckets[(h << kShardBits) >> (64 - shard.bucket_bits)];
+  }
+
+  // Doubles the buckets of "shard".
+  void Grow(Shard& shard) EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+
+  Arena* arena_;
+  Shard shards_[kNumShards];
+  PageHeapAllocator<Entry> entry_allocator_ GUARDED_BY(pageheap_lock);
+};
+
+template <typename F>
+void SampledAllocationTable::ForEach(F f) const {
+  for (const Shard& shard : shards_) {
+    for (size_t i = 0, n = size_t{1} << shard.bucket_bits; i < n; ++i) {
+      for (const Entry* e = shard.buckets[i]; e != nullptr; e = e->next) {
+        f(reinterpret_cast<void*>(e->key), e->record);
+      }
+    }
+  }
+}
+
+}  // namespace tcmalloc
+
+#endif  // TCMALLOC_SAMPLED_ALLOCATION_TABLE_H_
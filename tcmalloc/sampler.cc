@@ -19,14 +19,94 @@
 #include <cmath>
 #include <limits>
 
+#include "absl/base/internal/cycleclock.h"
+#include "absl/base/internal/spinlock.h"
+#include "absl/base/thread_annotations.h"
 #include "tcmalloc/common.h"
 #include "tcmalloc/parameters.h"
 #include "tcmalloc/static_vars.h"
 
 namespace tcmalloc {
 
+namespace {
+
+// Bounds on the adaptive sample period, and on how much it may change at each
+// adjustment, to keep a burst or a lull from throwing it far off.
+constexpr int64_t kMinAdaptiveSamplePeriod = 4 << 10;
+constexpr int64_t kMaxAdaptiveSamplePeriod = int64_t{1} << 30;
+constexpr double kMaxAdaptiveStep = 8.0;
+
+// Adaptive sampling state, shared by all samplers.  The period is read on
+// every sampling point, so it is kept in an atomic; adjustments are serialized
+// by adaptive_lock.
+ABSL_CONST_INIT std::atomic<int64_t> adaptive_period(0);  // 0: not adapted yet
+ABSL_CONST_INIT std::atomic<int64_t> adaptive_window_start(0);
+ABSL_CONST_INIT std::atomic<int64_t> adaptive_window_samples(0);
+ABSL_CONST_INIT absl::base_internal::SpinLock adaptive_lock(
+    absl::base_internal::kLinkerInitialized);
+// Parameters the current adaptive period was derived from.
+int64_t adaptive_base GUARDED_BY(adaptive_lock);
+int64_t adaptive_target GUARDED_BY(adaptive_lock);
+
+// Whether "base" (profile_sampling_rate) can be adapted at all.  A period of 1
+// asks for every allocation to be sampled and is left alone.
+bool IsAdaptive(int64_t base, int64_t target) { return base > 1 && target > 0; }
+
+}  // namespace
+
 ssize_t Sampler::GetSamplePeriod() {
-  return Parameters::profile_sampling_rate();
+  const int64_t base = Parameters::profile_sampling_rate();
+  if (ABSL_PREDICT_TRUE(
+          !IsAdaptive(base, Parameters::profile_sampling_target_rate()))) {
+    return base;
+  }
+  const int64_t period = adaptive_period.load(std::memory_order_relaxed);
+  return period > 0 ? period : base;
+}
+
+void Sampler::UpdateAdaptiveSamplePeriod() {
+  adaptive_window_samples.fetch_add(1, std::memory_order_relaxed);
+  const int64_t now = absl::base_internal::CycleClock::Now();
+  const double frequency = absl::base_internal::CycleClock::Frequency();
+  int64_t start = adaptive_window_start.load(std::memory_order_relaxed);
+  if (start != 0 && now - start < frequency) {
+    return;
+  }
+  if (!adaptive_lock.TryLock()) {
+    // Someone else is adjusting the period.
+    return;
+  }
+
+  start = adaptive_window_start.load(std::memory_order_relaxed);
+  if (start != 0 && now - start < frequency) {
+    // Someone else just adjusted the period.
+    adaptive_lock.Unlock();
+    return;
+  }
+
+  const int64_t base = Parameters::profile_sampling_rate();
+  const int64_t target = Parameters::profile_sampling_target_rate();
+  if (start == 0 || base != adaptive_base || target != adaptive_target) {
+    // (Re)start from profile_sampling_rate.
+    adaptive_base = base;
+    adaptive_target = target;
+    adaptive_period.store(base, std::memory_order_relaxed);
+  } else if (IsAdaptive(base, target)) {
+    const double seconds = (now - start) / frequency;
+    const double observed =
+        adaptive_window_samples.load(std::memory_order_relaxed) / seconds;
+    const double step = std::min(
+        std::max(observed / target, 1.0 / kMaxAdaptiveStep), kMaxAdaptiveStep);
+    const double period = std::min<double>(
+        std::max<double>(adaptive_period.load(std::memory_order_relaxed) * step,
+                         kMinAdaptiveSamplePeriod),
+        kMaxAdaptiveSamplePeriod);
+    adaptive_period.store(static_cast<int64_t>(period),
+                          std::memory_order_relaxed);
+  }
+  adaptive_window_samples.store(0, std::memory_order_relaxed);
+  adaptive_window_start.store(now, std::memory_order_relaxed);
+  adaptive_lock.Unlock();
 }
 
 // Run this before using your sampler
@@ -77,7 +157,7 @@ ssize_t Sampler::PickNextSamplingPoint() {
 
 ssize_t Sampler::PickNextGuardedSamplingPoint() {
   double guarded_sample_rate = Parameters::guarded_sampling_rate();
-  double profile_sample_rate = Parameters::profile_sampling_rate();
+  double profile_sample_rate = GetSamplePeriod();
   if (guarded_sample_rate < 0 || profile_sample_rate <= 0) {
     // Guarded sampling is disabled but could be turned on at run time.  So we
     // return a sampling point (default mean=100) in case guarded sampling is
@@ -181,16 +261,35 @@ size_t Sampler::RecordAllocationSlow(size_t k) {
     true_bytes_until_sample_ = point;
     was_on_fast_path_ = false;
   }
-  return GetSamplePeriod() <= 0 ? 0 : weight;
+  if (GetSamplePeriod() <= 0) {
+    return 0;
+  }
+  if (Parameters::profile_sampling_target_rate() > 0) {
+    UpdateAdaptiveSamplePeriod();
+  }
+  return weight;
 }
 
-double AllocatedBytes(const StackTrace& stack, bool unsample) {
+namespace {
+
+template <typename T>
+double AllocatedBytesImpl(const T& sample, bool unsample) {
   if (unsample) {
-    return stack.weight * stack.allocated_size * 1.0 /
-           (stack.requested_size + 1);
+    return sample.weight * sample.allocated_size * 1.0 /
+           (sample.requested_size + 1);
   } else {
-    return stack.allocated_size;
+    return sample.allocated_size;
   }
 }
 
+}  // namespace
+
+double AllocatedBytes(const StackTrace& stack, bool unsample) {
+  return AllocatedBytesImpl(stack, unsample);
+}
+
+double AllocatedBytes(const SampleRecord& record, bool unsample) {
+  return AllocatedBytesImpl(record, unsample);
+}
+
 }  // namespace tcmalloc
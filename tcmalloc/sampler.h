@@ -78,6 +78,12 @@ namespace tcmalloc {
 // allocation until the next marked byte. This ensures that
 // very large allocations which would intersect many marked bytes
 // only result in a single call to PickNextSamplingPoint.
+//
+// If profile_sampling_target_rate is set, the mean of the geometric is
+// adjusted about once a second so that roughly that many samples are taken
+// per second.  Each sampling point remembers the mean it was drawn with
+// (sample_period_), so the weight of every sample stays unbiased across
+// adjustments.
 //-------------------------------------------------------------------
 
 class SamplerTest;
@@ -119,7 +125,8 @@ class Sampler {
   // Generates a geometric with mean guarded_sample_rate.
   ssize_t PickNextGuardedSamplingPoint();
 
-  // Returns the current sample period
+  // Returns the current sample period.  This is profile_sampling_rate, unless
+  // adaptive sampling (profile_sampling_target_rate) is enabled.
   static ssize_t GetSamplePeriod();
 
   // The following are public for the purposes of testing
@@ -168,6 +175,10 @@ class Sampler {
   void Init(uint64_t seed);
   size_t RecordAllocationSlow(size_t k);
   ssize_t GetGeometricVariable(ssize_t mean);
+  // Called for every sample taken while adaptive sampling is enabled.  About
+  // once a second, rescales the sample period by the ratio of the observed to
+  // the target sampling rate.
+  static void UpdateAdaptiveSamplePeriod();
 };
 
 inline size_t Sampler::RecordAllocation(size_t k) {
@@ -288,6 +299,7 @@ inline void Sampler::UpdateFastPathState() {
 //
 // If unsample is false, the caller will handle unsampling.
 double AllocatedBytes(const StackTrace &stack, bool unsample);
+double AllocatedBytes(const SampleRecord &record, bool unsample);
 
 }  // namespace tcmalloc
 
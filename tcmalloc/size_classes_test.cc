@@ -120,6 +120,34 @@ TEST_F(SizeClassesTest, DoubleCheckedConsistency) {
   }
 }
 
+TEST_F(SizeClassesTest, AlignedClasses) {
+  // Validate that the aligned lookup returns the smallest size class that can
+  // hold the size and whose objects are all suitably aligned.
+  for (size_t align = 1; align < kPageSize; align <<= 1) {
+    for (size_t size = 0; size <= kMaxSize; size += 8) {
+      uint32_t expected = m_.SizeClass(size);
+      while (expected < kNumClasses &&
+             (m_.class_to_size(expected) & (align - 1)) != 0) {
+        expected++;
+      }
+
+      uint32_t cl;
+      if (expected == kNumClasses) {
+        EXPECT_FALSE(m_.GetSizeClass(size, align, &cl)) << size << " " << align;
+        continue;
+      }
+      ASSERT_TRUE(m_.GetSizeClass(size, align, &cl)) << size << " " << align;
+      EXPECT_EQ(expected, cl) << size << " " << align;
+      EXPECT_LE(size, m_.class_to_size(cl));
+      EXPECT_EQ(0, (m_.class_to_size(cl) & (align - 1)));
+    }
+  }
+
+  // Page-aligned requests are served by whole spans.
+  uint32_t cl;
+  EXPECT_FALSE(m_.GetSizeClass(8, kPageSize, &cl));
+}
+
 class TestingSizeMap : public SizeMap {
  public:
   TestingSizeMap() {}
@@ -19,42 +19,24 @@
 #include <algorithm>
 
 #include "tcmalloc/common.h"
-#include "tcmalloc/internal/atomic_stats_counter.h"
 #include "tcmalloc/internal/logging.h"
 #include "tcmalloc/page_heap_allocator.h"
 #include "tcmalloc/pagemap.h"
-#include "tcmalloc/sampler.h"
 #include "tcmalloc/static_vars.h"
 
 namespace tcmalloc {
 
-void Span::Sample(StackTrace* stack) {
-  ASSERT(!sampled_ && stack);
+void Span::Sample() {
+  ASSERT(!sampled_);
   sampled_ = 1;
-  sampled_stack_ = stack;
-  Static::sampled_objects_.prepend(this);
-  // LossyAdd is ok: writes to sampled_objects_size_ guarded by pageheap_lock.
-  // The cast to value matches Unsample.
-  Static::sampled_objects_size_.LossyAdd(
-      static_cast<tcmalloc_internal::StatsCounter::Value>(
-          AllocatedBytes(*stack, true)));
 }
 
-StackTrace* Span::Unsample() {
+bool Span::Unsample() {
   if (!sampled_) {
-    return nullptr;
+    return false;
   }
   sampled_ = 0;
-  StackTrace* stack = sampled_stack_;
-  sampled_stack_ = nullptr;
-  RemoveFromList();  // from Static::sampled_objects_
-  // LossyAdd is ok: writes to sampled_objects_size_ guarded by pageheap_lock.
-  // The cast to Value ensures no funny business happens during the negation if
-  // sizeof(size_t) != sizeof(Value).
-  Static::sampled_objects_size_.LossyAdd(
-      -static_cast<tcmalloc_internal::StatsCounter::Value>(
-          AllocatedBytes(*stack, true)));
-  return stack;
+  return true;
 }
 
 double Span::Fragmentation() const {
@@ -66,7 +48,7 @@ double Span::Fragmentation() const {
   }
   const size_t obj_size = Static::sizemap()->class_to_size(cl);
   const size_t span_objects = bytes_in_span() / obj_size;
-  const size_t live = allocated_;
+  const size_t live = small_.allocated;
   if (live == 0) {
     // Avoid crashes in production mode code, but report in tests.
     ASSERT(live != 0);
@@ -88,7 +70,7 @@ void Span::AverageFreelistAddedTime(const Span* other) {
   freelist_added_time_ = static_cast<uint64_t>(
       (static_cast<double>(freelist_added_time_) * num_pages_ +
        static_cast<double>(other->freelist_added_time_) * other->num_pages_) /
-      (num_pages_ + other->num_pages_));
+      (static_cast<Length>(num_pages_) + other->num_pages_));
 }
 
 // Freelist organization.
@@ -105,7 +87,7 @@ void Span::AverageFreelistAddedTime(const Span* other) {
 // 2 bytes.
 //
 // The freelist has two components. First, we have a small array-based cache
-// (4 objects) embedded directly into the Span (cache_ and cache_size_). We can
+// (2 objects) embedded directly into the Span (cache_ and cache_size_). We can
 // access this without touching any objects themselves.
 //
 // The rest of the freelist is stored as arrays inside free objects themselves.
@@ -117,8 +99,8 @@ void Span::AverageFreelistAddedTime(const Span* other) {
 //
 // Graphically this can be depicted as follows:
 //
-//         freelist_  embed_count_         cache_        cache_size_
-// Span: [  |idx|         4          |idx|idx|---|---|        2      ]
+//         freelist_  embed_count      cache     cache_size_
+// Span: [  |idx|         4          |idx|idx|        2      ]
 //            |
 //            \/
 //            [idx|idx|idx|idx|idx|---|---|---]  16-byte object
@@ -140,11 +122,8 @@ Span::ObjIdx Span::PtrToIdx(void* ptr, size_t size) const {
   uintptr_t off;
   if (size <= SizeMap::kMultiPageSize) {
     // Generally we need to load first_page_ to compute the offset.
-    // But first_page_ can be in a different cache line then the fields that
-    // we use in FreelistPush otherwise (cache_, cache_size_, freelist_).
-    // So we avoid loading first_page_ for smaller sizes that have one page per
-    // span, instead we compute the offset by taking low kPageShift bits of the
-    // pointer.
+    // For smaller sizes that have one page per span we avoid the load, and the
+    // dependency on it, by taking the low kPageShift bits of the pointer.
     ASSERT(p - first_page_ * kPageSize < kPageSize);
     off = (p & (kPageSize - 1)) / kAlignment;
   } else {
@@ -169,20 +148,20 @@ Span::ObjIdx* Span::IdxToPtr(ObjIdx idx, size_t size) const {
 }
 
 bool Span::FreelistPush(void* ptr, size_t size) {
-  ASSERT(allocated_ > 0);
-  if (allocated_ == 1) {
+  ASSERT(small_.allocated > 0);
+  if (small_.allocated == 1) {
     return false;
   }
-  allocated_--;
+  small_.allocated--;
 
   ObjIdx idx = PtrToIdx(ptr, size);
   if (cache_size_ != kCacheSize) {
     // Have empty space in the cache, push there.
-    cache_[cache_size_] = idx;
+    small_.cache[cache_size_] = idx;
     cache_size_++;
   } else if (freelist_ != kListEnd &&
              // -1 because the first slot is used by freelist link.
-             embed_count_ != size / sizeof(ObjIdx) - 1) {
+             small_.embed_count != size / sizeof(ObjIdx) - 1) {
     // Push onto the first object on freelist.
     ObjIdx* host;
     if (size <= SizeMap::kMultiPageSize) {
@@ -195,13 +174,13 @@ bool Span::FreelistPush(void* ptr, size_t size) {
     } else {
       host = IdxToPtr(freelist_, size);
     }
-    embed_count_++;
-    host[embed_count_] = idx;
+    small_.embed_count++;
+    host[small_.embed_count] = idx;
   } else {
     // Push onto freelist.
     *reinterpret_cast<ObjIdx*>(ptr) = freelist_;
     freelist_ = idx;
-    embed_count_ = 0;
+    small_.embed_count = 0;
   }
   return true;
 }
@@ -215,9 +194,9 @@ size_t Span::FreelistPopBatch(void** __restrict batch, size_t N, size_t size) {
 }
 
 void Span::BuildFreelist(size_t size, size_t count) {
-  allocated_ = 0;
+  small_.allocated = 0;
   cache_size_ = 0;
-  embed_count_ = 0;
+  small_.embed_count = 0;
   freelist_ = kListEnd;
 
   ObjIdx idx = 0;
@@ -239,7 +218,7 @@ void Span::BuildFreelist(size_t size, size_t count) {
   ObjIdx idxEnd = count * idxStep;
   // First, push as much as we can into the cache_.
   for (; idx < idxEnd && cache_size_ < kCacheSize; idx += idxStep) {
-    cache_[cache_size_] = idx;
+    small_.cache[cache_size_] = idx;
     cache_size_++;
   }
   // Now, build freelist and stack other objects onto freelist objects.
@@ -251,17 +230,17 @@ void Span::BuildFreelist(size_t size, size_t count) {
   while (idx < idxEnd) {
     // Check the no idx can be confused with kListEnd.
     ASSERT(idx != kListEnd);
-    if (host && embed_count_ != max_embed) {
+    if (host && small_.embed_count != max_embed) {
       // Push onto first object on the freelist.
-      embed_count_++;
+      small_.embed_count++;
       idxEnd -= idxStep;
-      host[embed_count_] = idxEnd;
+      host[small_.embed_count] = idxEnd;
     } else {
       // The first object is full, push new object onto freelist.
       host = IdxToPtr(idx, size);
       host[0] = freelist_;
       freelist_ = idx;
-      embed_count_ = 0;
+      small_.embed_count = 0;
       idx += idxStep;
     }
   }
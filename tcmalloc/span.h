@@ -37,6 +37,11 @@ namespace tcmalloc {
 //    The span is owned by CentralFreeList and is generally on
 //    CentralFreeList::nonempty_ list (unless has no free objects).
 //    location_ == IN_USE.
+//  - SAMPLED_SMALL_OBJECTS: a SMALL_OBJECT span some of whose allocated
+//    objects are sampled.  The samples are recorded in
+//    Static::sampled_allocations(), and the span's pages are marked in the
+//    pagemap (see PageMap::SetHoldsSamples()).
+//    location_ == IN_USE.
 //  - LARGE_OBJECT: the span holds a single large object.
 //    The span can be considered to be owner by user until the object is freed.
 //    location_ == IN_USE.
@@ -75,24 +80,19 @@ class Span : public SpanList::Elem {
 
   // ---------------------------------------------------------------------------
   // Support for sampled allocations.
-  // There is one-to-one correspondence between a sampled allocation and a span.
+  // A sampled allocation that does not fit in a small size class (or that is
+  // guarded) gets a span of its own, in SAMPLED state.  Smaller sampled
+  // allocations stay in their SMALL_OBJECT span, which becomes
+  // SAMPLED_SMALL_OBJECTS.
   // ---------------------------------------------------------------------------
 
-  // Mark this span as sampling allocation at the stack. Sets state to SAMPLED.
-  void Sample(StackTrace* stack) EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+  // Mark this span as sampling an allocation. Sets state to SAMPLED.  The
+  // sample itself is recorded in Static::sampled_allocations().
+  void Sample() EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
 
   // Unmark this span as sampling an allocation.
-  // Returns stack trace previously passed to Sample,
-  // or nullptr if this is a non-sampling span.
-  // REQUIRES: this is a SAMPLED span.
-  StackTrace* Unsample() EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
-
-  // Returns stack for the sampled allocation.
-  // pageheap_lock is not required, but caller either needs to hold the lock or
-  // ensure by some other means that the sampling state can't be changed
-  // concurrently.
-  // REQUIRES: this is a SAMPLED span.
-  StackTrace* sampled_stack() const;
+  // Returns false if this is a non-sampling span.
+  bool Unsample() EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
 
   // Is it a sampling span?
   // For debug checks. pageheap_lock is not required, but caller needs to ensure
@@ -119,8 +119,12 @@ class Span : public SpanList::Elem {
   Length num_pages() const;
 
   // Sets number of pages in the span.
+  // REQUIRES: len <= kMaxPages.
   void set_num_pages(Length len);
 
+  // Largest number of pages a span can describe.
+  static constexpr Length kMaxPages = UINT32_MAX;
+
   // Total memory bytes in the span.
   size_t bytes_in_span() const;
 
@@ -166,9 +170,14 @@ class Span : public SpanList::Elem {
  private:
   // See the comment on freelist organization in cc file.
   typedef uint16_t ObjIdx;
-  static const size_t kCacheSize = 4;
+  static const size_t kCacheSize = 2;
   static const ObjIdx kListEnd = -1;
 
+  // There can be millions of spans, so they are kept to 40 bytes: the list
+  // links, then the fields used on every operation, then storage shared by
+  // the fields used only by the small object freelist (hot in
+  // CentralFreeList) and those used only by free spans in PageHeap (cold).
+  //
   // Use uint16_t or uint8_t for 16 bit and 8 bit fields instead of bitfields.
   // LLVM will generate widen load/store and bit masking operations to access
   // bitfields and this hurts performance. Although compiler flag
@@ -176,20 +185,23 @@ class Span : public SpanList::Elem {
   // are used here, but the flag could potentially hurt performance in other
   // cases so it is not enabled by default. For more information, please
   // look at b/35680381 and cl/199502226.
-  uint16_t allocated_;  // Number of non-free objects
-  uint16_t embed_count_;
+  PageID first_page_;   // Starting page number.
+  uint32_t num_pages_;  // Number of pages in span.
   uint16_t freelist_;
   uint8_t cache_size_;
   uint8_t location_ : 2;  // Is the span on a freelist, and if so, which?
   uint8_t sampled_ : 1;   // Sampled object?
 
-  union {
-    // Used only for spans in CentralFreeList (SMALL_OBJECT state).
+  // Used only for spans in CentralFreeList (SMALL_OBJECT state).
+  struct SmallObjectState {
+    uint16_t allocated;  // Number of non-free objects
+    uint16_t embed_count;
     // Embed cache of free objects.
-    ObjIdx cache_[kCacheSize];
+    ObjIdx cache[kCacheSize];
+  };
 
-    // Used only for sampled spans (SAMPLED state).
-    StackTrace* sampled_stack_;
+  union {
+    SmallObjectState small_;
 
     // Used only for spans in PageHeap
     // (ON_NORMAL_FREELIST or ON_RETURNED_FREELIST state).
@@ -199,9 +211,6 @@ class Span : public SpanList::Elem {
     uint64_t freelist_added_time_;
   };
 
-  PageID first_page_;  // Starting page number.
-  Length num_pages_;   // Number of pages in span.
-
   // Convert object pointer <-> freelist index.
   ObjIdx PtrToIdx(void* ptr, size_t size) const;
   ObjIdx* IdxToPtr(ObjIdx idx, size_t size) const;
@@ -215,6 +224,9 @@ class Span : public SpanList::Elem {
   enum Align { SMALL, LARGE };
 };
 
+static_assert(sizeof(void*) != 8 || sizeof(Span) <= 40,
+              "Span grew; every byte is paid once per span");
+
 template <unsigned int align>
 Span::ObjIdx* Span::IdxToPtrSized(ObjIdx idx, size_t size) const {
   ASSERT(idx != kListEnd);
@@ -238,7 +250,8 @@ size_t Span::FreelistPopBatchSized(void** __restrict batch, size_t N,
   auto csize = cache_size_;
   auto cache_reads = csize < N ? csize : N;
   for (; result < cache_reads; result++) {
-    batch[result] = IdxToPtrSized<align>(cache_[csize - result - 1], size);
+    batch[result] =
+        IdxToPtrSized<align>(small_.cache[csize - result - 1], size);
   }
 
   // Store this->cache_size_ one time.
@@ -250,7 +263,7 @@ size_t Span::FreelistPopBatchSized(void** __restrict batch, size_t N,
     }
 
     ObjIdx* const host = IdxToPtrSized<align>(freelist_, size);
-    uint16_t embed_count = embed_count_;
+    uint16_t embed_count = small_.embed_count;
     ObjIdx current = host[embed_count];
 
     size_t iter = embed_count;
@@ -268,7 +281,7 @@ size_t Span::FreelistPopBatchSized(void** __restrict batch, size_t N,
     current = host[embed_count];
 
     if (result == N) {
-      embed_count_ = embed_count;
+      small_.embed_count = embed_count;
       break;
     }
 
@@ -279,9 +292,9 @@ size_t Span::FreelistPopBatchSized(void** __restrict batch, size_t N,
     result++;
 
     freelist_ = current;
-    embed_count_ = size / sizeof(ObjIdx) - 1;
+    small_.embed_count = size / sizeof(ObjIdx) - 1;
   }
-  allocated_ += result;
+  small_.allocated += result;
   return result;
 }
 
@@ -293,11 +306,6 @@ inline void Span::set_location(Location loc) {
   location_ = static_cast<uint64_t>(loc);
 }
 
-inline StackTrace* Span::sampled_stack() const {
-  ASSERT(sampled_);
-  return sampled_stack_;
-}
-
 inline bool Span::sampled() const { return sampled_; }
 
 inline PageID Span::first_page() const { return first_page_; }
@@ -312,9 +320,14 @@ inline void* Span::start_address() const {
 
 inline Length Span::num_pages() const { return num_pages_; }
 
-inline void Span::set_num_pages(Length len) { num_pages_ = len; }
+inline void Span::set_num_pages(Length len) {
+  CHECK_CONDITION(len <= kMaxPages);
+  num_pages_ = len;
+}
 
-inline size_t Span::bytes_in_span() const { return num_pages_ << kPageShift; }
+inline size_t Span::bytes_in_span() const {
+  return static_cast<size_t>(num_pages_) << kPageShift;
+}
 
 inline void Span::set_freelist_added_time(uint64_t t) {
   freelist_added_time_ = t;
@@ -332,7 +345,7 @@ inline void Span::RemoveFromList() { SpanList::Elem::remove(); }
 
 inline void Span::Init(PageID p, Length n) {
   first_page_ = p;
-  num_pages_ = n;
+  set_num_pages(n);
   location_ = IN_USE;
   sampled_ = 0;
 #ifndef NDEBUG
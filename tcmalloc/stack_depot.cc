@@ -0,0 +1,137 @@
+// Copyright 2019 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/stack_depot.h"
+
+#include <string.h>
+
+#include "absl/base/optimization.h"
+
+namespace tcmalloc {
+
+// Like a constructor and hence we disable thread safety analysis.
+void StackDepot::Init(Arena* arena) NO_THREAD_SAFETY_ANALYSIS {
+  arena_ = arena;
+  // The hash table is allocated by the first Intern(), so that processes
+  // which never sample do not fault it in at startup.
+  buckets_ = nullptr;
+  memset(chunks_, 0, sizeof(chunks_));
+  free_list_ = nullptr;
+  // Id 0 is reserved to signal failure.
+  next_id_ = 1;
+  stats_.in_use = 0;
+  stats_.total = 0;
+}
+
+uint64_t StackDepot::Hash(void* const* stack, int depth) {
+  uint64_t h = depth;
+  for (int i = 0; i < depth; ++i) {
+    h = (h ^ reinterpret_cast<uintptr_t>(stack[i])) *
+        UINT64_C(0x9E3779B97F4A7C15);
+  }
+  return h ^ (h >> 29);
+}
+
+StackDepot::Entry* StackDepot::Find(uint32_t id) const {
+  ASSERT(id != 0 && id < next_id_);
+  Entry* e = chunks_[id >> kChunkBits][id & (kChunkSize - 1)];
+  ASSERT(e != nullptr && e->id == id);
+  return e;
+}
+
+uint32_t StackDepot::Intern(void* const* stack, int depth) {
+  ASSERT(0 <= depth && depth <= kMaxStackDepth);
+  if (ABSL_PREDICT_FALSE(buckets_ == nullptr)) {
+    buckets_ = reinterpret_cast<Entry**>(
+        arena_->Alloc(kNumBuckets * sizeof(*buckets_), kMetadataStackTraces));
+    memset(buckets_, 0, kNumBuckets * sizeof(*buckets_));
+  }
+  const uint64_t h = Hash(stack, depth);
+  Entry** bucket = &buckets_[h >> (64 - kHashBits)];
+  for (Entry* e = *bucket; e != nullptr; e = e->next) {
+    if (e->hash == h && e->depth == depth &&
+        memcmp(e->stack, stack, depth * sizeof(stack[0])) == 0) {
+      ++e->refs;
+      return e->id;
+    }
+  }
+
+  Entry* e = free_list_;
+  if (e != nullptr) {
+    free_list_ = e->next;
+  } else {
+    const uint32_t id = next_id_;
+    if ((id >> kChunkBits) >= kMaxChunks) {
+      return 0;
+    }
+    Entry**& chunk = chunks_[id >> kChunkBits];
+    if (chunk == nullptr) {
+      chunk = reinterpret_cast<Entry**>(
+          arena_->Alloc(kChunkSize * sizeof(*chunk), kMetadataStackTraces));
+      memset(chunk, 0, kChunkSize * sizeof(*chunk));
+    }
+    e = reinterpret_cast<Entry*>(
+        arena_->Alloc(sizeof(Entry), kMetadataStackTraces));
+    e->id = id;
+    chunk[id & (kChunkSize - 1)] = e;
+    ++next_id_;
+    ++stats_.total;
+  }
+
+  e->hash = h;
+  e->refs = 1;
+  e->depth = depth;
+  memcpy(e->stack, stack, depth * sizeof(stack[0]));
+  e->next = *bucket;
+  *bucket = e;
+  ++stats_.in_use;
+  return e->id;
+}
+
+void StackDepot::Ref(uint32_t id) {
+  Entry* e = Find(id);
+  ASSERT(e->refs > 0);
+  ++e->refs;
+}
+
+void StackDepot::Unref(uint32_t id, uint32_t n) {
+  Entry* e = Find(id);
+  ASSERT(e->refs >= n);
+  e->refs -= n;
+  if (e->refs > 0) {
+    return;
+  }
+
+  Entry** link = &buckets_[e->hash >> (64 - kHashBits)];
+  while (*link != e) {
+    ASSERT(*link != nullptr);
+    link = &(*link)->next;
+  }
+  *link = e->next;
+  e->next = free_list_;
+  free_list_ = e;
+  --stats_.in_use;
+}
+
+void StackDepot::Expand(const SampleRecord& record, StackTrace* t) const {
+  const Entry* e = Find(record.stack_id);
+  t->requested_size = record.requested_size;
+  t->requested_alignment = record.requested_alignment;
+  t->allocated_size = record.allocated_size;
+  t->weight = record.weight;
+  t->depth = e->depth;
+  memcpy(t->stack, e->stack, e->depth * sizeof(e->stack[0]));
+}
+
+}  // namespace tcmalloc
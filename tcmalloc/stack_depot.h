@@ -0,0 +1,96 @@
+// Copyright 2019 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Hash-consed storage for the call stacks of sampled allocations.
+//
+// Many live samples share a small number of distinct call stacks, so each
+// distinct stack is stored once and sampled allocations refer to it by a
+// 32-bit id (see SampleRecord).  Stacks are reference counted and their slots
+// are recycled once no sample refers to them.
+
+#ifndef TCMALLOC_STACK_DEPOT_H_
+#define TCMALLOC_STACK_DEPOT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "absl/base/thread_annotations.h"
+#include "tcmalloc/arena.h"
+#include "tcmalloc/common.h"
+#include "tcmalloc/internal/logging.h"
+#include "tcmalloc/page_heap_allocator.h"  // AllocatorStats
+
+namespace tcmalloc {
+
+class StackDepot {
+ public:
+  // Constructor should do nothing since we rely on explicit Init()
+  // call, which may or may not be called before the constructor runs.
+  StackDepot() {}
+
+  void Init(Arena* arena) EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+
+  // Returns the id of stack[0..depth-1], adding it if necessary, and takes a
+  // reference on it.  Returns 0 if no more ids are available.
+  uint32_t Intern(void* const* stack, int depth)
+      EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+
+  // Takes a reference on stack "id", or drops "n" of them.
+  void Ref(uint32_t id) EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+  void Unref(uint32_t id, uint32_t n = 1)
+      EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+
+  // Fills "t" with the sizes from "record" and the stack it refers to.
+  void Expand(const SampleRecord& record, StackTrace* t) const
+      EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+
+  // in_use is the number of distinct live stacks, total the number of slots
+  // ever created for them.
+  AllocatorStats stats() const EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
+    return stats_;
+  }
+
+  struct Entry {
+    Entry* next;  // Hash chain, or free list once refs drops to 0.
+    uint64_t hash;
+    uint32_t id;
+    uint32_t refs;
+    uint32_t depth;
+    void* stack[kMaxStackDepth];
+  };
+
+ private:
+  static constexpr int kHashBits = 12;
+  static constexpr int kNumBuckets = 1 << kHashBits;
+  // Ids map to entries through a directory of lazily allocated chunks.
+  static constexpr int kChunkBits = 12;
+  static constexpr int kChunkSize = 1 << kChunkBits;
+  static constexpr int kMaxChunks = 256;
+
+  static uint64_t Hash(void* const* stack, int depth);
+
+  Entry* Find(uint32_t id) const EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+
+  Arena* arena_;
+  Entry** buckets_ GUARDED_BY(pageheap_lock);
+  Entry** chunks_[kMaxChunks] GUARDED_BY(pageheap_lock);
+  // Entries whose refs dropped to 0; they keep their id.
+  Entry* free_list_ GUARDED_BY(pageheap_lock);
+  uint32_t next_id_ GUARDED_BY(pageheap_lock);
+  AllocatorStats stats_ GUARDED_BY(pageheap_lock);
+};
+
+}  // namespace tcmalloc
+
+#endif  // TCMALLOC_STACK_DEPOT_H_
@@ -0,0 +1,122 @@
+// Copyright 2019 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/stack_depot.h"
+
+#include <stdint.h>
+
+#include "gtest/gtest.h"
+#include "absl/base/internal/spinlock.h"
+#include "tcmalloc/arena.h"
+#include "tcmalloc/internal/logging.h"
+
+namespace tcmalloc {
+namespace {
+
+class StackDepotTest : public testing::Test {
+ protected:
+  StackDepotTest() {
+    absl::base_internal::SpinLockHolder h(&pageheap_lock);
+    arena_.Init();
+    depot_.Init(&arena_);
+  }
+
+  static void* Frame(uintptr_t pc) { return reinterpret_cast<void*>(pc); }
+
+  Arena arena_;
+  StackDepot depot_;
+};
+
+TEST_F(StackDepotTest, SharesIdenticalStacks) {
+  void* a[] = {Frame(1), Frame(2), Frame(3)};
+  void* b[] = {Frame(1), Frame(2), Frame(3)};
+  void* c[] = {Frame(1), Frame(2), Frame(4)};
+
+  absl::base_internal::SpinLockHolder h(&pageheap_lock);
+  const uint32_t id_a = depot_.Intern(a, 3);
+  const uint32_t id_b = depot_.Intern(b, 3);
+  const uint32_t id_c = depot_.Intern(c, 3);
+  // A prefix is a different stack.
+  const uint32_t id_prefix = depot_.Intern(a, 2);
+  EXPECT_NE(id_a, 0);
+  EXPECT_EQ(id_a, id_b);
+  EXPECT_NE(id_a, id_c);
+  EXPECT_NE(id_a, id_prefix);
+  EXPECT_NE(id_c, id_prefix);
+
+  EXPECT_EQ(depot_.stats().in_use, 3);
+  EXPECT_EQ(depot_.stats().total, 3);
+}
+
+TEST_F(StackDepotTest, Expand) {
+  void* stack[] = {Frame(10), Frame(20), Frame(30), Frame(40)};
+
+  absl::base_internal::SpinLockHolder h(&pageheap_lock);
+  SampleRecord r;
+  r.requested_size = 100;
+  r.requested_alignment = 16;
+  r.allocated_size = 112;
+  r.weight = 2 << 20;
+  r.stack_id = depot_.Intern(stack, 4);
+  ASSERT_NE(r.stack_id, 0);
+
+  StackTrace t;
+  depot_.Expand(r, &t);
+  EXPECT_EQ(t.requested_size, 100);
+  EXPECT_EQ(t.requested_alignment, 16);
+  EXPECT_EQ(t.allocated_size, 112);
+  EXPECT_EQ(t.weight, 2 << 20);
+  ASSERT_EQ(t.depth, 4);
+  for (int i = 0; i < 4; ++i) {
+    EXPECT_EQ(t.stack[i], stack[i]);
+  }
+}
+
+TEST_F(StackDepotTest, RecyclesUnreferencedStacks) {
+  void* a[] = {Frame(1), Frame(2)};
+  void* b[] = {Frame(3), Frame(4)};
+
+  absl::base_internal::SpinLockHolder h(&pageheap_lock);
+  const uint32_t id_a = depot_.Intern(a, 2);
+  depot_.Ref(id_a);
+  EXPECT_EQ(depot_.Intern(a, 2), id_a);
+
+  // Three references are held on "a".
+  depot_.Unref(id_a);
+  depot_.Unref(id_a);
+  EXPECT_EQ(depot_.stats().in_use, 1);
+  depot_.Unref(id_a);
+  EXPECT_EQ(depot_.stats().in_use, 0);
+
+  // The slot, including its id, is reused for the next new stack.
+  const uint32_t id_b = depot_.Intern(b, 2);
+  EXPECT_EQ(id_b, id_a);
+  EXPECT_EQ(depot_.stats().in_use, 1);
+  EXPECT_EQ(depot_.stats().total, 1);
+
+  StackTrace t;
+  SampleRecord r = {};
+  r.stack_id = id_b;
+  depot_.Expand(r, &t);
+  ASSERT_EQ(t.depth, 2);
+  EXPECT_EQ(t.stack[0], Frame(3));
+  EXPECT_EQ(t.stack[1], Frame(4));
+
+  // "a" is no longer present, so it gets a fresh slot.
+  EXPECT_NE(depot_.Intern(a, 2), id_b);
+  EXPECT_EQ(depot_.stats().total, 2);
+}
+
+}  // namespace
+}  // namespace tcmalloc
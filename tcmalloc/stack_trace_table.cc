@@ -17,6 +17,8 @@
 #include <stddef.h>
 #include <string.h>
 
+#include <tuple>
+
 #include "absl/base/internal/spinlock.h"
 #include "absl/hash/hash.h"
 #include "tcmalloc/common.h"
@@ -34,7 +36,8 @@ bool StackTraceTable::Bucket::KeyEqual(uintptr_t h, const StackTrace& t) const {
   // the size-class size for small objects, or a multiple of pages for
   // big objects).  So the number of distinct buckets kept per stack
   // trace should be fairly small.
-  if (this->hash != h || this->trace.depth != t.depth ||
+  if (this->hash != h || this->stack_id != 0 ||
+      this->trace.depth != t.depth ||
       this->trace.requested_size != t.requested_size ||
       this->trace.requested_alignment != t.requested_alignment ||
       // These could theoretically differ due to e.g. memalign choices.
@@ -50,6 +53,15 @@ bool StackTraceTable::Bucket::KeyEqual(uintptr_t h, const StackTrace& t) const {
   return true;
 }
 
+bool StackTraceTable::Bucket::KeyEqual(uintptr_t h,
+                                       const SampleRecord& r) const {
+  // Same sizes as above, but samples with the same stack share an id.
+  return this->hash == h && this->stack_id == r.stack_id &&
+         this->trace.requested_size == r.requested_size &&
+         this->trace.requested_alignment == r.requested_alignment &&
+         this->trace.allocated_size == r.allocated_size;
+}
+
 StackTraceTable::StackTraceTable(ProfileType type, int64_t period, bool merge,
                                  bool unsample)
     : type_(type),
@@ -79,39 +91,79 @@ StackTraceTable::~StackTraceTable() {
   delete[] table_;
 }
 
+template <typename Key>
+StackTraceTable::Bucket* StackTraceTable::FindBucket(uintptr_t h,
+                                                     const Key& key) const {
+  if (!merge_) {
+    return nullptr;
+  }
+  Bucket* b = table_[h & bucket_mask_];
+  while (b != nullptr && !b->KeyEqual(h, key)) {
+    b = b->next;
+  }
+  return b;
+}
+
+StackTraceTable::Bucket* StackTraceTable::NewBucket(uintptr_t h, double count,
+                                                    size_t weight) {
+  bucket_total_++;
+  Bucket* b = Static::bucket_allocator()->New();
+  if (b == nullptr) {
+    Log(kLog, __FILE__, __LINE__, "tcmalloc: could not allocate bucket",
+        sizeof(*b));
+    error_ = true;
+    return nullptr;
+  }
+  const int idx = h & bucket_mask_;
+  b->hash = h;
+  b->stack_id = 0;
+  b->count = count;
+  b->total_weight = weight * count;
+  b->next = table_[idx];
+  table_[idx] = b;
+  return b;
+}
+
+void StackTraceTable::MergeInto(Bucket* b, double count, size_t weight) {
+  b->count += count;
+  b->total_weight += count * weight;
+  b->trace.weight = b->total_weight / b->count + 0.5;
+}
+
 void StackTraceTable::AddTrace(double count, const StackTrace& t) {
   if (error_) {
     return;
   }
 
   uintptr_t h = absl::Hash<StackTrace>()(t);
+  if (Bucket* b = FindBucket(h, t)) {
+    MergeInto(b, count, t.weight);
+    return;
+  }
 
-  const int idx = h & bucket_mask_;
+  depth_total_ += t.depth;
+  if (Bucket* b = NewBucket(h, count, t.weight)) {
+    b->trace = t;
+  }
+}
 
-  Bucket* b = merge_ ? table_[idx] : nullptr;
-  while (b != nullptr && !b->KeyEqual(h, t)) {
-    b = b->next;
+void StackTraceTable::AddTrace(double count, const SampleRecord& r) {
+  if (error_) {
+    return;
   }
-  if (b != nullptr) {
-    b->count += count;
-    b->total_weight += count * t.weight;
-    b->trace.weight = b->total_weight / b->count + 0.5;
-  } else {
-    depth_total_ += t.depth;
-    bucket_total_++;
-    b = Static::bucket_allocator()->New();
-    if (b == nullptr) {
-      Log(kLog, __FILE__, __LINE__, "tcmalloc: could not allocate bucket",
-          sizeof(*b));
-      error_ = true;
-    } else {
-      b->hash = h;
-      b->trace = t;
-      b->count = count;
-      b->total_weight = t.weight * count;
-      b->next = table_[idx];
-      table_[idx] = b;
-    }
+
+  uintptr_t h = absl::Hash<std::tuple<uint32_t, uintptr_t, uintptr_t,
+                                      uintptr_t>>()(std::make_tuple(
+      r.stack_id, r.requested_size, r.requested_alignment, r.allocated_size));
+  if (Bucket* b = FindBucket(h, r)) {
+    MergeInto(b, count, r.weight);
+    return;
+  }
+
+  if (Bucket* b = NewBucket(h, count, r.weight)) {
+    b->stack_id = r.stack_id;
+    Static::stack_depot()->Expand(r, &b->trace);
+    depth_total_ += b->trace.depth;
   }
 }
 
@@ -54,10 +54,17 @@ class StackTraceTable : public tcmalloc_internal::ProfileBase {
   void AddTrace(double count, const StackTrace& t)
       EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
 
+  // As above, but for a sample whose stack is kept in Static::stack_depot().
+  // Samples are matched by stack id, so the stack is only copied out of the
+  // depot the first time it is seen.
+  void AddTrace(double count, const SampleRecord& r)
+      EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+
   // Exposed for PageHeapAllocator
   struct Bucket {
     // Key
     uintptr_t hash;
+    uint32_t stack_id;  // 0 unless added from a SampleRecord.
     StackTrace trace;
 
     // Payload
@@ -66,6 +73,7 @@ class StackTraceTable : public tcmalloc_internal::ProfileBase {
     Bucket* next;
 
     bool KeyEqual(uintptr_t h, const StackTrace& t) const;
+    bool KeyEqual(uintptr_t h, const SampleRecord& r) const;
   };
 
   // For testing
@@ -75,6 +83,18 @@ class StackTraceTable : public tcmalloc_internal::ProfileBase {
  private:
   static const int kHashTableSize = 1 << 14; // => table_ is 128k
 
+  // Returns the bucket matching "key" (with hash "h"), or nullptr if there is
+  // none or merging is disabled.
+  template <typename Key>
+  Bucket* FindBucket(uintptr_t h, const Key& key) const;
+
+  // Creates a bucket for hash "h" holding "count" samples of "weight".  The
+  // caller fills in the trace.  Returns nullptr, and sets error_, on failure.
+  Bucket* NewBucket(uintptr_t h, double count, size_t weight)
+      EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
+
+  static void MergeInto(Bucket* b, double count, size_t weight);
+
   ProfileType type_;
   int64_t period_;
   int bucket_mask_;
@@ -0,0 +1,159 @@
+// Copyright 2019 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/stack_unwinder.h"
+
+#include <inttypes.h>
+
+#include <atomic>
+
+#include "absl/base/attributes.h"
+#include "absl/base/internal/cycleclock.h"
+#include "absl/debugging/stacktrace.h"
+
+namespace tcmalloc {
+namespace {
+
+// Written with relaxed atomic increments: unwinding happens on the allocation
+// path without any lock held.
+std::atomic<uint64_t> frame_pointer_unwinds;
+std::atomic<uint64_t> fallback_unwinds;
+std::atomic<uint64_t> unwind_cycles;
+std::atomic<uint64_t> unwind_histogram[UnwindStats::kBuckets];
+
+int HistogramBucket(uint64_t cycles) {
+  if (cycles == 0) return 0;
+  const int bucket = 64 - __builtin_clzll(cycles);
+  return bucket < UnwindStats::kBuckets ? bucket : UnwindStats::kBuckets - 1;
+}
+
+#if defined(TCMALLOC_HAVE_FRAME_POINTERS) && \
+    (defined(__x86_64__) || defined(__aarch64__))
+#define TCMALLOC_FRAME_POINTER_UNWIND 1
+
+// The frame record the function prologue pushes on both x86-64 and AArch64.
+struct Frame {
+  const Frame* next;
+  void* return_address;
+};
+
+// Frames farther apart than this are assumed to be garbage.
+constexpr uintptr_t kMaxFrameSize = 100000;
+
+// Walks the frame pointer chain starting at fp.  Stops at the first frame
+// record that does not look sane, e.g. because some caller was built without
+// frame pointers.
+inline int FramePointerUnwind(const Frame* fp, void** result, int max_depth,
+                              int skip_count) {
+  int depth = 0;
+  while (depth < max_depth) {
+    void* const ret = fp->return_address;
+    if (ret == nullptr) break;
+    if (skip_count > 0) {
+      --skip_count;
+    } else {
+      result[depth++] = ret;
+    }
+
+    const uintptr_t cur = reinterpret_cast<uintptr_t>(fp);
+    const uintptr_t next = reinterpret_cast<uintptr_t>(fp->next);
+    if (next <= cur || next - cur > kMaxFrameSize ||
+        next % sizeof(void*) != 0) {
+      break;
+    }
+    fp = fp->next;
+  }
+  return depth;
+}
+#endif
+
+}  // namespace
+
+ABSL_ATTRIBUTE_NOINLINE
+int GetSampledStackTrace(void** result, int max_depth, int skip_count) {
+  const int64_t start = absl::base_internal::CycleClock::Now();
+  int depth = 0;
+#ifdef TCMALLOC_FRAME_POINTER_UNWIND
+  // Our own frame record holds the return address into our caller, which
+  // absl::GetStackTrace does not report when called from there: skip it, as
+  // the fallback below does.
+  depth = FramePointerUnwind(
+      static_cast<const Frame*>(__builtin_frame_address(0)), result, max_depth,
+      skip_count + 1);
+#endif
+  if (depth > 0) {
+    frame_pointer_unwinds.fetch_add(1, std::memory_order_relaxed);
+  } else {
+    // Skip our own frame.
+    depth = absl::GetStackTrace(result, max_depth, skip_count + 1);
+    fallback_unwinds.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  const int64_t elapsed = absl::base_internal::CycleClock::Now() - start;
+  const uint64_t cycles = elapsed > 0 ? elapsed : 0;
+  unwind_cycles.fetch_add(cycles, std::memory_order_relaxed);
+  unwind_histogram[HistogramBucket(cycles)].fetch_add(
+      1, std::memory_order_relaxed);
+  return depth;
+}
+
+UnwindStats GetUnwindStats() {
+  UnwindStats stats;
+  stats.frame_pointer_unwinds =
+      frame_pointer_unwinds.load(std::memory_order_relaxed);
+  stats.fallback_unwinds = fallback_unwinds.load(std::memory_order_relaxed);
+  stats.cycles = unwind_cycles.load(std::memory_order_relaxed);
+  for (int i = 0; i < UnwindStats::kBuckets; ++i) {
+    stats.histogram[i] = unwind_histogram[i].load(std::memory_order_relaxed);
+  }
+  return stats;
+}
+
+void PrintUnwindStats(TCMalloc_Printer* out) {
+  const UnwindStats stats = GetUnwindStats();
+  const uint64_t unwinds = stats.frame_pointer_unwinds + stats.fallback_unwinds;
+  out->printf(
+      "\n"
+      "------------------------------------------------\n"
+      "Sampled Allocation Stack Unwinding\n"
+      "------------------------------------------------\n"
+      "Frame Pointer Unwinds: %" PRIu64 "\n"
+      "Fallback Unwinds: %" PRIu64 "\n"
+      "Average Cost: %.1f cycles\n",
+      stats.frame_pointer_unwinds, stats.fallback_unwinds,
+      unwinds > 0 ? static_cast<double>(stats.cycles) / unwinds : 0.0);
+  for (int i = 0; i < UnwindStats::kBuckets; ++i) {
+    if (stats.histogram[i] == 0) continue;
+    out->printf("Unwind: %12" PRIu64 " <= cycles < %12" PRIu64 ": %" PRIu64
+                "\n",
+                i == 0 ? uint64_t{0} : uint64_t{1} << (i - 1),
+                uint64_t{1} << i, stats.histogram[i]);
+  }
+}
+
+void PrintUnwindStatsInPbtxt(PbtxtRegion* region) {
+  const UnwindStats stats = GetUnwindStats();
+  region->PrintI64("frame_pointer_unwinds", stats.frame_pointer_unwinds);
+  region->PrintI64("fallback_unwinds", stats.fallback_unwinds);
+  region->PrintI64("cycles", stats.cycles);
+  for (int i = 0; i < UnwindStats::kBuckets; ++i) {
+    if (stats.histogram[i] == 0) continue;
+    auto hist = region->CreateSubRegion("cost_histogram");
+    hist.PrintI64("lower_bound", i == 0 ? 0 : int64_t{1} << (i - 1));
+    hist.PrintI64("upper_bound", (int64_t{1} << i) - 1);
+    hist.PrintI64("value", stats.histogram[i]);
+  }
+}
+
+}  // namespace tcmalloc
@@ -0,0 +1,59 @@
+// Copyright 2019 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Stack unwinding for sampled allocations.
+//
+// If the whole binary is built with frame pointers, define
+// TCMALLOC_HAVE_FRAME_POINTERS so that stacks of sampled allocations are
+// collected by walking the frame pointer chain, which costs a couple of loads
+// per frame.  Otherwise, and whenever the chain does not look sane, we fall
+// back to absl::GetStackTrace.
+//
+// The cost of every unwind is recorded so that sampling overhead can be
+// monitored through MallocExtension::GetStats().
+
+#ifndef TCMALLOC_STACK_UNWINDER_H_
+#define TCMALLOC_STACK_UNWINDER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "tcmalloc/internal/logging.h"
+
+namespace tcmalloc {
+
+// Fills result[0..max_depth-1] with the return addresses on the current call
+// stack and returns the number of entries written.  The arguments and result
+// have the same meaning as for absl::GetStackTrace.
+int GetSampledStackTrace(void** result, int max_depth, int skip_count);
+
+struct UnwindStats {
+  // Bucket i counts unwinds that took [2^(i-1), 2^i) cycles; bucket 0 counts
+  // unwinds that took no measurable time.
+  static constexpr int kBuckets = 32;
+
+  uint64_t frame_pointer_unwinds;
+  uint64_t fallback_unwinds;
+  uint64_t cycles;
+  uint64_t histogram[kBuckets];
+};
+
+UnwindStats GetUnwindStats();
+
+void PrintUnwindStats(TCMalloc_Printer* out);
+void PrintUnwindStatsInPbtxt(PbtxtRegion* region);
+
+}  // namespace tcmalloc
+
+#endif  // TCMALLOC_STACK_UNWINDER_H_
@@ -0,0 +1,104 @@
+// Copyright 2019 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "tcmalloc/stack_unwinder.h"
+
+#include <stdint.h>
+
+#include <algorithm>
+
+#include "gtest/gtest.h"
+#include "absl/base/attributes.h"
+#include "absl/debugging/stacktrace.h"
+#include "tcmalloc/internal/logging.h"
+
+namespace tcmalloc {
+namespace {
+
+uint64_t TotalUnwinds(const UnwindStats& stats) {
+  return stats.frame_pointer_unwinds + stats.fallback_unwinds;
+}
+
+uint64_t HistogramTotal(const UnwindStats& stats) {
+  uint64_t total = 0;
+  for (uint64_t count : stats.histogram) {
+    total += count;
+  }
+  return total;
+}
+
+TEST(StackUnwinderTest, RecordsEveryUnwind) {
+  const UnwindStats before = GetUnwindStats();
+  void* stack[kMaxStackDepth];
+  for (int i = 0; i < 10; ++i) {
+    GetSampledStackTrace(stack, kMaxStackDepth, 0);
+  }
+  const UnwindStats after = GetUnwindStats();
+
+  EXPECT_EQ(TotalUnwinds(before) + 10, TotalUnwinds(after));
+  EXPECT_EQ(HistogramTotal(before) + 10, HistogramTotal(after));
+  EXPECT_GE(after.cycles, before.cycles);
+}
+
+ABSL_ATTRIBUTE_NOINLINE void Capture(void** ours, int* our_depth,
+                                     void** theirs, int* their_depth) {
+  *our_depth = GetSampledStackTrace(ours, kMaxStackDepth, 0);
+  *their_depth = absl::GetStackTrace(theirs, kMaxStackDepth, 0);
+}
+
+TEST(StackUnwinderTest, MatchesAbsl) {
+  void* ours[kMaxStackDepth];
+  void* theirs[kMaxStackDepth];
+  int our_depth, their_depth;
+  Capture(ours, &our_depth, theirs, &their_depth);
+
+  // Both start at the caller of Capture().  The outermost frames may differ,
+  // as the frame pointer walk stops at the first frame it cannot trust.
+  if (our_depth == 0 || their_depth == 0) return;
+  const int depth = std::min(our_depth, their_depth);
+  for (int i = 0; i < depth; ++i) {
+    EXPECT_EQ(theirs[i], ours[i]) << i;
+  }
+}
+
+#if defined(TCMALLOC_HAVE_FRAME_POINTERS) && \
+    (defined(__x86_64__) || defined(__aarch64__))
+// Only the stack_unwinder_frame_pointer_test target is built this way, so
+// that the frame pointer walk is covered even though no other target uses it.
+TEST(StackUnwinderTest, UsesFramePointers) {
+  const UnwindStats before = GetUnwindStats();
+  void* stack[kMaxStackDepth];
+  EXPECT_GT(GetSampledStackTrace(stack, kMaxStackDepth, 0), 0);
+  const UnwindStats after = GetUnwindStats();
+
+  EXPECT_EQ(before.frame_pointer_unwinds + 1, after.frame_pointer_unwinds);
+  EXPECT_EQ(before.fallback_unwinds, after.fallback_unwinds);
+}
+#endif
+
+TEST(StackUnwinderTest, SkipCount) {
+  void* full[kMaxStackDepth];
+  void* skipped[kMaxStackDepth];
+  const int full_depth = GetSampledStackTrace(full, kMaxStackDepth, 0);
+  const int skipped_depth = GetSampledStackTrace(skipped, kMaxStackDepth, 1);
+  if (full_depth == 0) return;
+
+  ASSERT_EQ(full_depth - 1, skipped_depth);
+  for (int i = 0; i < skipped_depth; ++i) {
+    EXPECT_EQ(full[i + 1], skipped[i]) << i;
+  }
+}
+
+}  // namespace
+}  // namespace tcmalloc
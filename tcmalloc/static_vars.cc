@@ -41,15 +41,21 @@ namespace tcmalloc {
 absl::base_internal::SpinLock pageheap_lock(
     absl::base_internal::kLinkerInitialized);
 Arena Static::arena_;
+Arena Static::span_arena_;
 SizeMap ABSL_CACHELINE_ALIGNED Static::sizemap_;
 TransferCache Static::transfer_cache_[kNumClasses];
+CentralFreeList Static::cold_freelist_[kNumClasses];
 CPUCache ABSL_CACHELINE_ALIGNED Static::cpu_cache_;
+DeferredFreeList Static::deferred_free_list_;
 PageHeapAllocator<Span> Static::span_allocator_;
-PageHeapAllocator<StackTrace> Static::stacktrace_allocator_;
+StackDepot Static::stack_depot_;
 PageHeapAllocator<ThreadCache> Static::threadcache_allocator_;
-SpanList Static::sampled_objects_;
+SampledAllocationTable Static::sampled_allocations_;
 ABSL_CONST_INIT tcmalloc_internal::StatsCounter Static::sampled_objects_size_;
 PeakHeapTracker Static::peak_heap_tracker_;
+HeapDeltaTracker Static::heap_delta_tracker_;
+ProfileDumper Static::profile_dumper_;
+AllocationSampleLog Static::allocation_sample_log_;
 PageHeapAllocator<StackTraceTable::Bucket> Static::bucket_allocator_;
 ABSL_CONST_INIT std::atomic<bool> Static::inited_{false};
 bool Static::cpu_cache_active_;
@@ -64,23 +70,32 @@ size_t Static::metadata_bytes() {
   // -- I'd like to put all the above in a struct and take that
   // struct's size.  But we can't due to linking issues.
   const size_t static_var_size =
-      sizeof(pageheap_lock) + sizeof(arena_) + sizeof(sizemap_) +
-      sizeof(transfer_cache_) + sizeof(cpu_cache_) + sizeof(span_allocator_) +
-      sizeof(stacktrace_allocator_) + sizeof(threadcache_allocator_) +
-      sizeof(sampled_objects_) + sizeof(bucket_allocator_) +
+      sizeof(pageheap_lock) + sizeof(arena_) + sizeof(span_arena_) +
+      sizeof(sizemap_) +
+      sizeof(transfer_cache_) + sizeof(cold_freelist_) + sizeof(cpu_cache_) +
+      sizeof(deferred_free_list_) +
+      sizeof(span_allocator_) + sizeof(stack_depot_) +
+      sizeof(threadcache_allocator_) + sizeof(sampled_allocations_) +
+      sizeof(bucket_allocator_) +
       sizeof(inited_) + sizeof(cpu_cache_active_) + sizeof(page_allocator_) +
       sizeof(pagemap_) + sizeof(sampled_objects_size_) +
-      sizeof(peak_heap_tracker_) + sizeof(guarded_page_lock) +
+      sizeof(peak_heap_tracker_) + sizeof(heap_delta_tracker_) +
+      sizeof(profile_dumper_) + sizeof(allocation_sample_log_) +
+      sizeof(guarded_page_lock) +
       sizeof(guardedpage_allocator_);
 
   const size_t allocated = arena()->bytes_allocated() +
-                           AddressRegionFactory::InternalBytesAllocated();
+                           span_arena_.bytes_allocated() +
+                           AddressRegionFactory::InternalBytesAllocated() +
+                           pagemap_.flat_sizeclass_bytes();
   return allocated + static_var_size;
 }
 
 size_t Static::pagemap_residence() {
-  // Determine residence of the root node of the pagemap.
+  // Determine residence of the root node of the pagemap, and of the flat
+  // size class array.
   size_t total = MInCore::residence(&pagemap_, sizeof(pagemap_));
+  total += pagemap_.FlatSizeClassResidence();
   return total;
 }
 
@@ -92,23 +107,27 @@ ABSL_ATTRIBUTE_COLD ABSL_ATTRIBUTE_NOINLINE void Static::SlowInitIfNecessary() {
     tracking::Init();
     arena_.Init();
     sizemap_.Init();
-    span_allocator_.Init(&arena_);
+    span_arena_.Init();
+    span_allocator_.Init(&span_arena_, kMetadataSpans);
     span_allocator_.New();  // Reduce cache conflicts
     span_allocator_.New();  // Reduce cache conflicts
-    stacktrace_allocator_.Init(&arena_);
-    bucket_allocator_.Init(&arena_);
-    peak_heap_tracker_.Init();
+    stack_depot_.Init(&arena_);
+    bucket_allocator_.Init(&arena_, kMetadataSampling);
+    peak_heap_tracker_.Init(&arena_);
+    heap_delta_tracker_.Init(&arena_);
+    allocation_sample_log_.Init(&arena_);
     // Do a bit of sanitizing: make sure central_cache is aligned properly
     CHECK_CONDITION((sizeof(transfer_cache_[0]) % 64) == 0);
     for (int i = 0; i < kNumClasses; ++i) {
       transfer_cache_[i].Init(i);
+      cold_freelist_[i].Init(i, /*cold=*/true);
     }
     new (page_allocator_.memory) PageAllocator;
-    sampled_objects_.Init();
-    threadcache_allocator_.Init(&arena_);
+    sampled_allocations_.Init(&arena_);
+    threadcache_allocator_.Init(&arena_, kMetadataThreadCaches);
     cpu_cache_active_ = false;
     pagemap_.MapRootWithSmallPages();
-    guardedpage_allocator_.Init(/*max_alloced_pages=*/64, /*total_pages=*/128);
+    pagemap_.InitFlatSizeClassMap();
     inited_.store(true, std::memory_order_release);
   }
 }
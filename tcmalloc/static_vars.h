@@ -26,9 +26,13 @@
 #include "absl/base/attributes.h"
 #include "absl/base/optimization.h"
 #include "absl/base/thread_annotations.h"
+#include "tcmalloc/allocation_sample_log.h"
 #include "tcmalloc/arena.h"
+#include "tcmalloc/central_freelist.h"
 #include "tcmalloc/common.h"
+#include "tcmalloc/deferred_free.h"
 #include "tcmalloc/guarded_page_allocator.h"
+#include "tcmalloc/heap_delta_tracker.h"
 #include "tcmalloc/internal/atomic_stats_counter.h"
 #include "tcmalloc/internal/logging.h"
 #include "tcmalloc/internal/percpu.h"
@@ -36,7 +40,10 @@
 #include "tcmalloc/page_heap.h"
 #include "tcmalloc/page_heap_allocator.h"
 #include "tcmalloc/peak_heap_tracker.h"
+#include "tcmalloc/profile_dumper.h"
+#include "tcmalloc/sampled_allocation_table.h"
 #include "tcmalloc/span.h"
+#include "tcmalloc/stack_depot.h"
 #include "tcmalloc/stack_trace_table.h"
 #include "tcmalloc/transfer_cache.h"
 
@@ -58,17 +65,37 @@ class Static {
   // We have a separate lock per free-list to reduce contention.
   static TransferCache* transfer_cache() { return transfer_cache_; }
 
+  // Free-lists, one per size-class, that hand out cold objects from
+  // tcmalloc_hot_cold_new().  They are not fronted by any cache.
+  static CentralFreeList* cold_freelist() { return cold_freelist_; }
+
   static SizeMap* sizemap() { return &sizemap_; }
 
+  // Objects passed to MallocExtension::DeferredFree(), until their grace
+  // period ends.
+  static DeferredFreeList* deferred_free_list() {
+    return &deferred_free_list_;
+  }
+
   static CPUCache* cpu_cache() { return &cpu_cache_; }
 
   static PeakHeapTracker* peak_heap_tracker() { return &peak_heap_tracker_; }
 
+  static HeapDeltaTracker* heap_delta_tracker() { return &heap_delta_tracker_; }
+
+  static ProfileDumper* profile_dumper() { return &profile_dumper_; }
+
+  // Sampled allocations for the running allocation profiling sessions.
+  static AllocationSampleLog* allocation_sample_log() {
+    return &allocation_sample_log_;
+  }
+
   //////////////////////////////////////////////////////////////////////
   // In addition to the explicit initialization comment, the variables below
   // must be protected by pageheap_lock.
 
   static Arena* arena() { return &arena_; }
+  static Arena* span_arena() { return &span_arena_; }
 
   // Page-level allocator.
   static PageAllocator* page_allocator() {
@@ -83,9 +110,9 @@ class Static {
 
   static PageHeapAllocator<Span>* span_allocator() { return &span_allocator_; }
 
-  static PageHeapAllocator<StackTrace>* stacktrace_allocator() {
-    return &stacktrace_allocator_;
-  }
+  // Call stacks of sampled allocations, shared by all samples with the same
+  // stack.
+  static StackDepot* stack_depot() { return &stack_depot_; }
 
   static PageHeapAllocator<ThreadCache>* threadcache_allocator() {
     return &threadcache_allocator_;
@@ -94,7 +121,9 @@ class Static {
   // State kept for sampled allocations (/heapz support). The StatsCounter is
   // only written while holding pageheap_lock, so writes can safely use
   // LossyAdd and reads do not require locking.
-  static SpanList sampled_objects_ GUARDED_BY(pageheap_lock);
+  static SampledAllocationTable* sampled_allocations() {
+    return &sampled_allocations_;
+  }
   static tcmalloc_internal::StatsCounter sampled_objects_size_;
   static PageHeapAllocator<StackTraceTable::Bucket>* bucket_allocator() {
     return &bucket_allocator_;
@@ -122,6 +151,12 @@ class Static {
 
   static size_t metadata_bytes() EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock);
 
+  // Bytes of metadata allocated from the arenas for "type".
+  static size_t arena_bytes(MetadataType type)
+      EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
+    return arena_.bytes_allocated(type) + span_arena_.bytes_allocated(type);
+  }
+
   // The root of the pagemap is potentially a large poorly utilized
   // structure, so figure out how much of it is actually resident.
   static size_t pagemap_residence();
@@ -139,17 +174,26 @@ class Static {
   // can run their constructors.
 
   static Arena arena_;
+  // Spans get an arena of their own so that they are packed together rather
+  // than interleaved with other metadata.
+  static Arena span_arena_;
   static SizeMap sizemap_;
   static TransferCache transfer_cache_[kNumClasses];
+  static CentralFreeList cold_freelist_[kNumClasses];
   static CPUCache cpu_cache_;
+  static DeferredFreeList deferred_free_list_;
   static GuardedPageAllocator guardedpage_allocator_;
   static PageHeapAllocator<Span> span_allocator_;
-  static PageHeapAllocator<StackTrace> stacktrace_allocator_;
+  static StackDepot stack_depot_;
   static PageHeapAllocator<ThreadCache> threadcache_allocator_;
   static PageHeapAllocator<StackTraceTable::Bucket> bucket_allocator_;
+  static SampledAllocationTable sampled_allocations_;
   static std::atomic<bool> inited_;
   static bool cpu_cache_active_;
   static PeakHeapTracker peak_heap_tracker_;
+  static HeapDeltaTracker heap_delta_tracker_;
+  static ProfileDumper profile_dumper_;
+  static AllocationSampleLog allocation_sample_log_;
 
   // PageHeap uses a constructor for initialization.  Like the members above,
   // we can't depend on initialization order, so pageheap is new'd
@@ -293,6 +293,7 @@ void InitSystemAllocatorIfNecessary() {
 }
 
 ABSL_CONST_INIT std::atomic<int> system_release_errors = ATOMIC_VAR_INIT(0);
+ABSL_CONST_INIT std::atomic<int64_t> system_memory_calls = ATOMIC_VAR_INIT(0);
 
 }  // namespace
 
@@ -309,6 +310,7 @@ void* SystemAlloc(size_t bytes, size_t* actual_bytes, size_t alignment,
   // require callers to know the true amount allocated.
   ASSERT(actual_bytes != nullptr);
 
+  system_memory_calls.fetch_add(1, std::memory_order_relaxed);
   absl::base_internal::SpinLockHolder lock_holder(&spinlock);
 
   InitSystemAllocatorIfNecessary();
@@ -325,6 +327,28 @@ void* SystemAlloc(size_t bytes, size_t* actual_bytes, size_t alignment,
   return result;
 }
 
+AddressRegion* SystemReserveRegion(size_t size, size_t alignment,
+                                   bool tagged, AddressRegionFactory* factory,
+                                   void** start) {
+  system_memory_calls.fetch_add(1, std::memory_order_relaxed);
+  absl::base_internal::SpinLockHolder lock_holder(&spinlock);
+
+  InitSystemAllocatorIfNecessary();
+
+  alignment = std::max(alignment, preferred_alignment);
+  void* ptr = MmapAligned(size, alignment, tagged);
+  if (!ptr) return nullptr;
+  if (factory == nullptr) factory = region_factory;
+  AddressRegion* region =
+      factory->Create(ptr, size, AddressRegionFactory::UsageHint::kNormal);
+  if (!region) {
+    munmap(ptr, size);
+    return nullptr;
+  }
+  *start = ptr;
+  return region;
+}
+
 static bool ReleasePages(void* start, size_t length) {
   int ret;
   // Note -- ignoring most return codes, because if this fails it
@@ -360,7 +384,12 @@ int SystemReleaseErrors() {
   return system_release_errors.load(std::memory_order_relaxed);
 }
 
+int64_t SystemMemoryCalls() {
+  return system_memory_calls.load(std::memory_order_relaxed);
+}
+
 void SystemRelease(void* start, size_t length) {
+  system_memory_calls.fetch_add(1, std::memory_order_relaxed);
   int saved_errno = errno;
 #if defined(MADV_DONTNEED) || defined(MADV_REMOVE)
   const size_t pagemask = pagesize - 1;
@@ -443,6 +472,23 @@ void SetRegionFactory(AddressRegionFactory* factory) {
   region_factory = factory;
 }
 
+int AddressBits() {
+  static const int bits = []() {
+    if (kAddressBits == kLowAddressBits) return kLowAddressBits;
+    // The kernel only places a mapping above the low range when the hint
+    // asks for it, and ignores such hints if it cannot.
+    void* hint = reinterpret_cast<void*>(uintptr_t{1} << (kAddressBits - 2));
+    void* probe =
+        mmap(hint, kPageSize, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (probe == MAP_FAILED) return kLowAddressBits;
+    munmap(probe, kPageSize);
+    return (reinterpret_cast<uintptr_t>(probe) >> kLowAddressBits) != 0
+               ? kAddressBits
+               : kLowAddressBits;
+  }();
+  return bits;
+}
+
 static uintptr_t RandomMmapHint(size_t size, size_t alignment, bool tagged) {
   // Rely on kernel's mmap randomization to seed our RNG.
   static uintptr_t rnd = []() {
@@ -465,9 +511,9 @@ static uintptr_t RandomMmapHint(size_t size, size_t alignment, bool tagged) {
   // MSan and TSan use up all of the lower address space, so we allow use of
   // mid-upper address space when they're active.  This only matters for
   // TCMalloc-internal tests, since sanitizers install their own malloc/free.
-  constexpr uintptr_t kAddrMask = (uintptr_t{3} << (kAddressBits - 3)) - 1;
+  const uintptr_t addr_mask = (uintptr_t{3} << (AddressBits() - 3)) - 1;
 #else
-  constexpr uintptr_t kAddrMask = (uintptr_t{1} << (kAddressBits - 2)) - 1;
+  const uintptr_t addr_mask = (uintptr_t{1} << (AddressBits() - 2)) - 1;
 #endif
 
   // Ensure alignment >= size so we're guaranteed the full mapping has the same
@@ -475,7 +521,7 @@ static uintptr_t RandomMmapHint(size_t size, size_t alignment, bool tagged) {
   alignment = RoundUpPowerOf2(std::max(alignment, size));
 
   rnd = Sampler::NextRandom(rnd);
-  uintptr_t addr = rnd & kAddrMask & ~(alignment - 1) & ~kTagMask;
+  uintptr_t addr = rnd & addr_mask & ~(alignment - 1) & ~kTagMask;
   if (!tagged) {
     addr |= kTagMask;
   }
@@ -19,6 +19,7 @@
 #define TCMALLOC_SYSTEM_ALLOC_H_
 
 #include <stddef.h>
+#include <stdint.h>
 
 #include "tcmalloc/malloc_extension.h"
 #include "tcmalloc/span.h"
@@ -44,10 +45,25 @@ namespace tcmalloc {
 void *SystemAlloc(size_t bytes, size_t *actual_bytes, size_t alignment,
                   bool tagged);
 
+// REQUIRES: "alignment" is a power of two
+// REQUIRES: "alignment" and "size" <= kTagMask
+//
+// Reserves "size" bytes of address space aligned to "alignment", and returns
+// the region "factory" (if nullptr, the current AddressRegionFactory) created
+// over it, for a caller that allocates from the region itself.  The start of
+// the reservation is stored in *start.  Returns nullptr on failure.
+AddressRegion *SystemReserveRegion(size_t size, size_t alignment, bool tagged,
+                                   AddressRegionFactory *factory,
+                                   void **start);
+
 // Returns the number of times we failed to give pages back to the OS after a
 // call to SystemRelease.
 int SystemReleaseErrors();
 
+// Returns the number of calls made to SystemAlloc and SystemRelease so far.
+// Each of them makes at least one system call.
+int64_t SystemMemoryCalls();
+
 // This call is a hint to the operating system that the pages
 // contained in the specified range of memory will not be used for a
 // while, and can be released for use by other processes or the OS.
@@ -72,6 +88,11 @@ AddressRegionFactory *GetRegionFactory();
 // Sets the current address region factory to factory.
 void SetRegionFactory(AddressRegionFactory *factory);
 
+// Returns the number of address bits tcmalloc places its memory in: either
+// kLowAddressBits, or kAddressBits if the host provides the larger address
+// space (e.g. x86-64 with 5-level paging).  Determined on first use.
+int AddressBits();
+
 // Reserves using mmap() a region of memory of the requested size and alignment,
 // with the bits specified by kTagMask set to 0 if tagged is true and 1
 // otherwise.
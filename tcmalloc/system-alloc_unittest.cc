@@ -41,6 +41,9 @@ class MmapAlignedTest : public testing::TestWithParam<size_t> {
       EXPECT_EQ(tcmalloc::IsTaggedMemory(p), tagged);
       EXPECT_EQ(tcmalloc::IsTaggedMemory(static_cast<char*>(p) + size - 1),
                 tagged);
+      EXPECT_EQ((reinterpret_cast<uintptr_t>(p) + size - 1) >>
+                    tcmalloc::AddressBits(),
+                0);
       EXPECT_EQ(munmap(p, size), 0);
     }
   }
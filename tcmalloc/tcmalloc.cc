@@ -52,6 +52,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
 #include <unistd.h>
 
 #include <algorithm>
@@ -69,24 +71,27 @@
 #include "absl/base/attributes.h"
 #include "absl/base/config.h"
 #include "absl/base/dynamic_annotations.h"
+#include "absl/base/internal/cycleclock.h"
 #include "absl/base/internal/spinlock.h"
 #include "absl/base/internal/sysinfo.h"
 #include "absl/base/macros.h"
 #include "absl/base/optimization.h"
 #include "absl/base/thread_annotations.h"
-#include "absl/debugging/stacktrace.h"
 #include "absl/memory/memory.h"
 #include "absl/strings/match.h"
 #include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
 #include "absl/strings/strip.h"
 #include "tcmalloc/common.h"
 #include "tcmalloc/cpu_cache.h"
 #include "tcmalloc/experiment.h"
 #include "tcmalloc/guarded_page_allocator.h"
+#include "tcmalloc/heap_instance.h"
 #include "tcmalloc/internal/linked_list.h"
 #include "tcmalloc/internal/logging.h"
 #include "tcmalloc/internal/memory_stats.h"
 #include "tcmalloc/internal/percpu.h"
+#include "tcmalloc/internal/util.h"
 #include "tcmalloc/internal_malloc_extension.h"
 #include "tcmalloc/malloc_extension.h"
 #include "tcmalloc/page_allocator.h"
@@ -94,9 +99,11 @@
 #include "tcmalloc/page_heap_allocator.h"
 #include "tcmalloc/pagemap.h"
 #include "tcmalloc/parameters.h"
+#include "tcmalloc/sample_hooks.h"
 #include "tcmalloc/sampler.h"
 #include "tcmalloc/span.h"
 #include "tcmalloc/stack_trace_table.h"
+#include "tcmalloc/stack_unwinder.h"
 #include "tcmalloc/static_vars.h"
 #include "tcmalloc/stats.h"
 #include "tcmalloc/system-alloc.h"
@@ -118,12 +125,15 @@ using tcmalloc::kCrash;
 using tcmalloc::kCrashWithStats;
 using tcmalloc::kLog;
 using tcmalloc::kLogWithStack;
+using tcmalloc::kNumMetadataTypes;
 using tcmalloc::Log;
 using tcmalloc::MallocPolicy;
+using tcmalloc::MetadataType;
+using tcmalloc::MetadataTypeName;
 using tcmalloc::pageheap_lock;
 using tcmalloc::Sampler;
 using tcmalloc::Span;
-using tcmalloc::StackTrace;
+using tcmalloc::SampleRecord;
 using tcmalloc::StackTraceTable;
 using tcmalloc::Static;
 using tcmalloc::ThreadCache;
@@ -135,17 +145,24 @@ struct TCMallocStats {
   uint64_t thread_bytes;            // Bytes in thread caches
   uint64_t central_bytes;           // Bytes in central cache
   uint64_t transfer_bytes;          // Bytes in central transfer cache
+  uint64_t cold_free_bytes;         // Bytes in cold free lists; included in
+                                    // central cache bytes
   uint64_t metadata_bytes;          // Bytes alloced for metadata
   uint64_t per_cpu_bytes;           // Bytes in per-CPU cache
   uint64_t pagemap_root_bytes_res;  // Resident bytes of pagemap root node
   uint64_t percpu_metadata_bytes_res;  // Resident bytes of the per-CPU metadata
   AllocatorStats tc_stats;          // ThreadCache objects
   AllocatorStats span_stats;        // Span objects
-  AllocatorStats stack_stats;       // StackTrace objects
+  AllocatorStats stack_stats;       // StackDepot entries
   AllocatorStats bucket_stats;      // StackTraceTable::Bucket objects
   size_t pagemap_bytes;             // included in metadata bytes
+  // Bytes allocated from the metadata arenas, by consumer; included in
+  // metadata bytes.
+  uint64_t arena_bytes[kNumMetadataTypes];
   size_t percpu_metadata_bytes;     // included in metadata bytes
   tcmalloc::BackingStats pageheap;  // Stats from page heap
+  tcmalloc::BackingStats cold_pageheap;  // Of the tagged page heap alone,
+                                         // which holds cold objects
 };
 
 // Get stats into "r".  Also, if class_count != NULL, class_count[k]
@@ -161,22 +178,27 @@ static void ExtractStats(TCMallocStats* r, uint64_t* class_count,
                          bool report_residence) {
   r->central_bytes = 0;
   r->transfer_bytes = 0;
+  r->cold_free_bytes = 0;
   for (int cl = 0; cl < kNumClasses; ++cl) {
     const size_t length = Static::transfer_cache()[cl].central_length();
     const size_t tc_length = Static::transfer_cache()[cl].tc_length();
     const size_t cache_overhead = Static::transfer_cache()[cl].OverheadBytes();
+    const size_t cold_length = Static::cold_freelist()[cl].length();
+    const size_t cold_overhead = Static::cold_freelist()[cl].OverheadBytes();
     const size_t size = Static::sizemap()->class_to_size(cl);
+    r->cold_free_bytes += (size * cold_length) + cold_overhead;
     r->central_bytes += (size * length) + cache_overhead;
     r->transfer_bytes += (size * tc_length);
     if (class_count) {
       // Sum the lengths of all per-class freelists, except the per-thread
       // freelists, which get counted when we call GetThreadStats(), below.
-      class_count[cl] = length + tc_length;
+      class_count[cl] = length + tc_length + cold_length;
       if (tcmalloc::UsePerCpuCache()) {
         class_count[cl] += Static::cpu_cache()->TotalObjectsOfClass(cl);
       }
     }
   }
+  r->central_bytes += r->cold_free_bytes;
 
   // Add stats from per-thread heaps
   r->thread_bytes = 0;
@@ -185,11 +207,15 @@ static void ExtractStats(TCMallocStats* r, uint64_t* class_count,
     ThreadCache::GetThreadStats(&r->thread_bytes, class_count);
     r->tc_stats = ThreadCache::HeapStats();
     r->span_stats = Static::span_allocator()->stats();
-    r->stack_stats = Static::stacktrace_allocator()->stats();
+    r->stack_stats = Static::stack_depot()->stats();
     r->bucket_stats = Static::bucket_allocator()->stats();
     r->metadata_bytes = Static::metadata_bytes();
     r->pagemap_bytes = Static::pagemap()->bytes();
+    for (int i = 0; i < kNumMetadataTypes; ++i) {
+      r->arena_bytes[i] = Static::arena_bytes(static_cast<MetadataType>(i));
+    }
     r->pageheap = Static::page_allocator()->stats();
+    r->cold_pageheap = Static::page_allocator()->stats(/*tagged=*/true);
     if (small_spans != nullptr) {
       Static::page_allocator()->GetSmallSpanStats(small_spans);
     }
@@ -253,12 +279,198 @@ static uint64_t PhysicalMemoryUsed(const TCMallocStats& stats) {
   return StatSub(VirtualMemoryUsed(stats), stats.pageheap.unmapped_bytes);
 }
 
+// Bytes of cold objects in use by the app (see tcmalloc_hot_cold_new()).
+static uint64_t ColdInUseByApp(const TCMallocStats& stats) {
+  return StatSub(stats.cold_pageheap.system_bytes,
+                 stats.cold_free_bytes +
+                 stats.cold_pageheap.free_bytes +
+                 stats.cold_pageheap.unmapped_bytes);
+}
+
+// Bytes of memory backing the tagged page heap, which holds cold objects.
+static uint64_t ColdMemoryUsed(const TCMallocStats& stats) {
+  return StatSub(stats.cold_pageheap.system_bytes,
+                 stats.cold_pageheap.unmapped_bytes);
+}
+
 // The number of bytes either in use by the app or fragmented so that
 // it cannot be (arbitrarily) reused.
 static uint64_t RequiredBytes(const TCMallocStats& stats) {
   return StatSub(PhysicalMemoryUsed(stats), stats.pageheap.free_bytes);
 }
 
+// Internal fragmentation of a size class: bytes lost to rounding requests up
+// to the class size, estimated from the live samples, and bytes at the end of
+// the class's spans that are too small to hold another object.
+struct SizeClassWaste {
+  int cl;
+  double requested_bytes;
+  double allocated_bytes;
+  uint64_t span_slack_bytes;
+
+  double rounding_bytes() const { return allocated_bytes - requested_bytes; }
+  double wasted_bytes() const { return rounding_bytes() + span_slack_bytes; }
+};
+
+// Fills "waste" for the size classes with live samples or spans, sorted by
+// decreasing wasted bytes, and returns how many there are.
+static int ExtractSizeClassWaste(SizeClassWaste waste[kNumClasses]) {
+  for (int cl = 0; cl < kNumClasses; ++cl) {
+    waste[cl].cl = cl;
+    waste[cl].requested_bytes = 0;
+    waste[cl].allocated_bytes = 0;
+    waste[cl].span_slack_bytes = Static::transfer_cache()[cl].OverheadBytes();
+  }
+  {
+    absl::base_internal::SpinLockHolder h(&pageheap_lock);
+    Static::sampled_allocations()->ForEach(
+        [&](void*, const SampleRecord& r) {
+          // Charge samples to the size class that served them, which for
+          // guarded samples need not be SizeClass(allocated_size).
+          if (r.cl == 0 || r.allocated_size == 0) return;
+          const double allocated = AllocatedBytes(r, true);
+          waste[r.cl].allocated_bytes += allocated;
+          waste[r.cl].requested_bytes +=
+              allocated * r.requested_size / r.allocated_size;
+        });
+  }
+
+  SizeClassWaste* end = std::partition(
+      waste, waste + kNumClasses, [](const SizeClassWaste& w) {
+        return w.cl != 0 && (w.allocated_bytes > 0 || w.span_slack_bytes > 0);
+      });
+  std::sort(waste, end, [](const SizeClassWaste& a, const SizeClassWaste& b) {
+    return a.wasted_bytes() > b.wasted_bytes();
+  });
+  return end - waste;
+}
+
+// The free bytes of a size class in each cache tier, front end first.  For
+// the transfer and central caches, the idle bytes are those that were never
+// drawn on since the previous report: shrinking the tier by that much would
+// not have cost a single miss.
+struct SizeClassWaterfall {
+  int cl;
+  uint64_t cpu_bytes;
+  uint64_t thread_bytes;
+  uint64_t transfer_bytes;
+  uint64_t transfer_idle_bytes;
+  uint64_t central_bytes;
+  uint64_t central_idle_bytes;
+
+  uint64_t total_bytes() const {
+    return cpu_bytes + thread_bytes + transfer_bytes + central_bytes;
+  }
+};
+
+// CycleClock::Now() at the previous ResetMemoryWaterfall(), or 0 before the
+// first.
+ABSL_CONST_INIT static std::atomic<int64_t> waterfall_window_start(0);
+
+// Fills "waterfall" for the size classes with free objects, sorted by
+// decreasing total bytes, and returns how many there are.  Sets
+// "*window_seconds" to the time since the interval over which the idle bytes
+// are measured was started.  Until the first ResetMemoryWaterfall() there is
+// no interval, and no idle bytes are shown.
+static int ExtractMemoryWaterfall(SizeClassWaterfall waterfall[kNumClasses],
+                                  double* window_seconds) {
+  const int64_t now = absl::base_internal::CycleClock::Now();
+  const int64_t start = waterfall_window_start.load(std::memory_order_acquire);
+  *window_seconds =
+      start == 0
+          ? 0.0
+          : (now - start) / absl::base_internal::CycleClock::Frequency();
+
+  uint64_t thread_count[kNumClasses] = {0};
+  {
+    absl::base_internal::SpinLockHolder h(&pageheap_lock);
+    uint64_t thread_bytes = 0;
+    ThreadCache::GetThreadStats(&thread_bytes, thread_count);
+  }
+
+  for (int cl = 0; cl < kNumClasses; ++cl) {
+    const size_t size = Static::sizemap()->class_to_size(cl);
+    tcmalloc::TransferCache& tc = Static::transfer_cache()[cl];
+    SizeClassWaterfall& w = waterfall[cl];
+    w.cl = cl;
+    w.cpu_bytes = tcmalloc::UsePerCpuCache()
+                      ? size * Static::cpu_cache()->TotalObjectsOfClass(cl)
+                      : 0;
+    w.thread_bytes = size * thread_count[cl];
+    w.transfer_bytes = size * tc.tc_length();
+    w.central_bytes = size * tc.central_length();
+    if (start == 0) {
+      w.transfer_idle_bytes = 0;
+      w.central_idle_bytes = 0;
+    } else {
+      w.transfer_idle_bytes = size * tc.tc_low_water_mark();
+      w.central_idle_bytes = size * tc.central_low_water_mark();
+    }
+  }
+
+  SizeClassWaterfall* end = std::partition(
+      waterfall, waterfall + kNumClasses, [](const SizeClassWaterfall& w) {
+        return w.cl != 0 && w.total_bytes() > 0;
+      });
+  std::sort(waterfall, end,
+            [](const SizeClassWaterfall& a, const SizeClassWaterfall& b) {
+              return a.total_bytes() > b.total_bytes();
+            });
+  return end - waterfall;
+}
+
+extern "C" void MallocExtension_Internal_ResetMemoryWaterfall() {
+  Static::InitIfNecessary();
+  for (int cl = 1; cl < kNumClasses; ++cl) {
+    Static::transfer_cache()[cl].ResetLowWaterMarks();
+  }
+  waterfall_window_start.store(absl::base_internal::CycleClock::Now(),
+                               std::memory_order_release);
+}
+
+// Real-time mode bookkeeping (see MallocExtension::EnterRealTimeMode).
+struct RealTimeState {
+  size_t heap_bytes;          // Reserved heap.
+  int64_t base_system_calls;  // SystemMemoryCalls() on entry.
+  int64_t base_page_faults;   // ProcessPageFaults() on entry.
+};
+ABSL_CONST_INIT static RealTimeState realtime_state GUARDED_BY(pageheap_lock);
+
+static int64_t ProcessPageFaults() {
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+  return usage.ru_minflt + usage.ru_majflt;
+}
+
+struct RealTimeStats {
+  size_t heap_bytes;
+  int64_t system_calls;
+  int64_t page_faults;
+  int64_t failed_allocations;
+};
+
+// Fills "stats" with what happened since real-time mode was entered.
+// Returns false if it was not.
+static bool GetRealTimeStats(RealTimeStats* stats) {
+  {
+    absl::base_internal::SpinLockHolder h(&pageheap_lock);
+    if (!Static::page_allocator()->realtime()) return false;
+    stats->heap_bytes = realtime_state.heap_bytes;
+    stats->system_calls = realtime_state.base_system_calls;
+    stats->page_faults = realtime_state.base_page_faults;
+    stats->failed_allocations = Static::page_allocator()->realtime_failures();
+  }
+  stats->system_calls = tcmalloc::SystemMemoryCalls() - stats->system_calls;
+  stats->page_faults = ProcessPageFaults() - stats->page_faults;
+  return true;
+}
+
+// tcmalloc_hot_cold_new() serves hints below kColdHint from cold spans (see
+// do_malloc_cold()).
+static constexpr int kColdHint = 128;
+// Bytes requested through tcmalloc_hot_cold_new(), by hint.
+static std::atomic<uint64_t> hot_cold_requested_bytes[256];
+
 // WRITE stats to "out"
 static void DumpStats(TCMalloc_Printer* out, int level) {
   TCMallocStats stats;
@@ -328,7 +540,7 @@ static void DumpStats(TCMalloc_Printer* out, int level) {
       (stats.tc_stats.total * sizeof(ThreadCache)) / MiB,
       uint64_t(stats.stack_stats.in_use),
       uint64_t(stats.stack_stats.total),
-      (stats.stack_stats.total * sizeof(StackTrace)) / MiB,
+      (stats.stack_stats.total * sizeof(tcmalloc::StackDepot::Entry)) / MiB,
       uint64_t(stats.bucket_stats.in_use),
       uint64_t(stats.bucket_stats.total),
       (stats.bucket_stats.total * sizeof(StackTraceTable::Bucket)) / MiB,
@@ -341,6 +553,11 @@ static void DumpStats(TCMalloc_Printer* out, int level) {
       uint64_t(kPageSize),
       uint64_t(tcmalloc::kHugePageSize));
   // clang-format on
+  for (int i = 0; i < kNumMetadataTypes; ++i) {
+    out->printf("MALLOC:   %12" PRIu64 " (%7.1f MiB) Arena bytes for %s\n",
+                stats.arena_bytes[i], stats.arena_bytes[i] / MiB,
+                MetadataTypeName(static_cast<MetadataType>(i)));
+  }
 
   tcmalloc::PrintExperiments(out);
 
@@ -382,6 +599,72 @@ static void DumpStats(TCMalloc_Printer* out, int level) {
       }
     }
 
+    out->printf("------------------------------------------------\n");
+    out->printf("Internal fragmentation by size class, estimated from live\n");
+    out->printf("samples, by decreasing wasted bytes\n");
+    out->printf("------------------------------------------------\n");
+    SizeClassWaste waste[kNumClasses];
+    const int num_waste = ExtractSizeClassWaste(waste);
+    for (int i = 0; i < num_waste; ++i) {
+      const SizeClassWaste& w = waste[i];
+      out->printf(
+          "class %3d [ %8zu bytes ] : "
+          "%8.1f MiB requested; %8.1f MiB allocated; "
+          "%7.1f MiB rounding (%4.1f%%); %7.1f MiB span slack; "
+          "%7.1f MiB wasted\n",
+          w.cl, Static::sizemap()->class_to_size(w.cl),
+          w.requested_bytes / MiB, w.allocated_bytes / MiB,
+          w.rounding_bytes() / MiB,
+          w.allocated_bytes > 0
+              ? 100.0 * w.rounding_bytes() / w.allocated_bytes
+              : 0.0,
+          w.span_slack_bytes / MiB, w.wasted_bytes() / MiB);
+    }
+
+    out->printf("------------------------------------------------\n");
+    out->printf("Free bytes by size class and cache tier, largest first\n");
+    SizeClassWaterfall waterfall[kNumClasses];
+    double window_seconds;
+    const int num_waterfall =
+        ExtractMemoryWaterfall(waterfall, &window_seconds);
+    out->printf("(idle: not drawn on in the last %.1f seconds)\n",
+                window_seconds);
+    out->printf("------------------------------------------------\n");
+    for (int i = 0; i < num_waterfall; ++i) {
+      const SizeClassWaterfall& w = waterfall[i];
+      out->printf(
+          "class %3d [ %8zu bytes ] : "
+          "%7.1f MiB per-CPU; %7.1f MiB per-thread; "
+          "%7.1f MiB transfer (%7.1f MiB idle); "
+          "%7.1f MiB central (%7.1f MiB idle); %7.1f MiB total\n",
+          w.cl, Static::sizemap()->class_to_size(w.cl), w.cpu_bytes / MiB,
+          w.thread_bytes / MiB, w.transfer_bytes / MiB,
+          w.transfer_idle_bytes / MiB, w.central_bytes / MiB,
+          w.central_idle_bytes / MiB, w.total_bytes() / MiB);
+    }
+    out->printf(
+        "page heap : %7.1f MiB free; %7.1f MiB unmapped "
+        "(see the page heap age histograms below)\n",
+        stats.pageheap.free_bytes / MiB, stats.pageheap.unmapped_bytes / MiB);
+
+    out->printf("------------------------------------------------\n");
+    out->printf("Bytes requested by hot/cold hint (cold below %d)\n",
+                kColdHint);
+    out->printf("------------------------------------------------\n");
+    for (int hint = 0; hint < 256; ++hint) {
+      const uint64_t bytes =
+          hot_cold_requested_bytes[hint].load(std::memory_order_relaxed);
+      if (bytes > 0) {
+        out->printf("hint %3d: %12" PRIu64 " bytes (%7.1f MiB)\n", hint,
+                    bytes, bytes / MiB);
+      }
+    }
+    out->printf(
+        "cold      : %7.1f MiB in use; %7.1f MiB free in cold free lists; "
+        "%7.1f MiB in the tagged page heap\n",
+        ColdInUseByApp(stats) / MiB, stats.cold_free_bytes / MiB,
+        ColdMemoryUsed(stats) / MiB);
+
     if (tcmalloc::UsePerCpuCache()) {
       out->printf("------------------------------------------------\n");
       out->printf(
@@ -412,6 +695,7 @@ static void DumpStats(TCMalloc_Printer* out, int level) {
     Static::page_allocator()->Print(out, /*tagged=*/true);
     tcmalloc::tracking::Print(out);
     Static::guardedpage_allocator()->Print(out);
+    tcmalloc::PrintUnwindStats(out);
 
     uint64_t limit_bytes;
     bool is_hard;
@@ -421,6 +705,16 @@ static void DumpStats(TCMalloc_Printer* out, int level) {
     long long limit_hits = Static::page_allocator()->limit_hits();
     out->printf("Number of times limit was hit: %lld\n", limit_hits);
 
+    RealTimeStats realtime;
+    if (GetRealTimeStats(&realtime)) {
+      out->printf(
+          "Real-time mode: %zu bytes reserved; since then %lld system calls, "
+          "%lld page faults (whole process), %lld failed page allocations\n",
+          realtime.heap_bytes, static_cast<long long>(realtime.system_calls),
+          static_cast<long long>(realtime.page_faults),
+          static_cast<long long>(realtime.failed_allocations));
+    }
+
     out->printf("PARAMETER tcmalloc_per_cpu_caches %d\n",
                 tcmalloc::Parameters::per_cpu_caches() ? 1 : 0);
     out->printf("PARAMETER tcmalloc_max_per_cpu_cache_size %d\n",
@@ -429,6 +723,11 @@ static void DumpStats(TCMalloc_Printer* out, int level) {
         tcmalloc::Parameters::max_total_thread_cache_bytes();
     out->printf("PARAMETER tcmalloc_max_total_thread_cache_bytes %lld\n",
                 thread_cache_max);
+    out->printf("PARAMETER tcmalloc_profile_sampling_target_rate %lld\n",
+                static_cast<long long>(
+                    tcmalloc::Parameters::profile_sampling_target_rate()));
+    out->printf("Current profile sampling period: %lld bytes\n",
+                static_cast<long long>(Sampler::GetSamplePeriod()));
   }
 }
 
@@ -474,6 +773,13 @@ namespace {
   region.PrintI64("percpu_slab_residence", stats.percpu_metadata_bytes_res);
   region.PrintI64("tcmalloc_page_size", uint64_t(kPageSize));
   region.PrintI64("tcmalloc_huge_page_size", uint64_t(tcmalloc::kHugePageSize));
+  {
+    auto arena = region.CreateSubRegion("metadata_arena_bytes");
+    for (int i = 0; i < kNumMetadataTypes; ++i) {
+      arena.PrintI64(MetadataTypeName(static_cast<MetadataType>(i)),
+                     stats.arena_bytes[i]);
+    }
+  }
 
   // Print total process stats (inclusive of non-malloc sources).
   tcmalloc::tcmalloc_internal::MemoryStats memstats;
@@ -495,6 +801,39 @@ namespace {
       }
     }
 
+    {
+      SizeClassWaste waste[kNumClasses];
+      const int num_waste = ExtractSizeClassWaste(waste);
+      for (int i = 0; i < num_waste; ++i) {
+        const SizeClassWaste& w = waste[i];
+        PbtxtRegion entry = region.CreateSubRegion("size_class_waste");
+        entry.PrintI64("sizeclass", Static::sizemap()->class_to_size(w.cl));
+        entry.PrintI64("requested_bytes", w.requested_bytes);
+        entry.PrintI64("allocated_bytes", w.allocated_bytes);
+        entry.PrintI64("rounding_bytes", w.rounding_bytes());
+        entry.PrintI64("span_slack_bytes", w.span_slack_bytes);
+      }
+    }
+
+    {
+      SizeClassWaterfall waterfall[kNumClasses];
+      double window_seconds;
+      const int num_waterfall =
+          ExtractMemoryWaterfall(waterfall, &window_seconds);
+      region.PrintDouble("memory_waterfall_window_seconds", window_seconds);
+      for (int i = 0; i < num_waterfall; ++i) {
+        const SizeClassWaterfall& w = waterfall[i];
+        PbtxtRegion entry = region.CreateSubRegion("memory_waterfall");
+        entry.PrintI64("sizeclass", Static::sizemap()->class_to_size(w.cl));
+        entry.PrintI64("per_cpu_bytes", w.cpu_bytes);
+        entry.PrintI64("per_thread_bytes", w.thread_bytes);
+        entry.PrintI64("transfer_bytes", w.transfer_bytes);
+        entry.PrintI64("transfer_idle_bytes", w.transfer_idle_bytes);
+        entry.PrintI64("central_bytes", w.central_bytes);
+        entry.PrintI64("central_idle_bytes", w.central_idle_bytes);
+      }
+    }
+
     if (tcmalloc::UsePerCpuCache()) {
       cpu_set_t allowed_cpus;
       if (sched_getaffinity(0, sizeof(allowed_cpus), &allowed_cpus) != 0) {
@@ -526,11 +865,25 @@ namespace {
   region.PrintBool("hard_limit", is_hard);
   region.PrintI64("limit_hits", Static::page_allocator()->limit_hits());
 
+  RealTimeStats realtime;
+  if (GetRealTimeStats(&realtime)) {
+    auto rt = region.CreateSubRegion("realtime");
+    rt.PrintI64("heap_bytes", realtime.heap_bytes);
+    rt.PrintI64("system_calls", realtime.system_calls);
+    rt.PrintI64("page_faults", realtime.page_faults);
+    rt.PrintI64("failed_allocations", realtime.failed_allocations);
+  }
+
   {
     auto gwp_asan = region.CreateSubRegion("gwp_asan");
     Static::guardedpage_allocator()->PrintInPbtxt(&gwp_asan);
   }
 
+  {
+    auto unwind = region.CreateSubRegion("sampled_stack_unwind");
+    tcmalloc::PrintUnwindStatsInPbtxt(&unwind);
+  }
+
   region.PrintI64("memory_release_failures", tcmalloc::SystemReleaseErrors());
 
   region.PrintBool("tcmalloc_per_cpu_caches",
@@ -539,6 +892,9 @@ namespace {
                   tcmalloc::Parameters::max_per_cpu_cache_size());
   region.PrintI64("tcmalloc_max_total_thread_cache_bytes",
                   tcmalloc::Parameters::max_total_thread_cache_bytes());
+  region.PrintI64("tcmalloc_profile_sampling_target_rate",
+                  tcmalloc::Parameters::profile_sampling_target_rate());
+  region.PrintI64("profile_sampling_period", Sampler::GetSamplePeriod());
 }
 
 }  // namespace
@@ -600,31 +956,31 @@ DumpFragmentationProfile() {
 
   {
     absl::base_internal::SpinLockHolder h(&pageheap_lock);
-    for (Span* s : Static::sampled_objects_) {
+    Static::sampled_allocations()->ForEach([&](void* ptr,
+                                               const SampleRecord& r) {
       // Compute fragmentation to charge to this sample:
-      StackTrace* const t = s->sampled_stack();
-      if (t->proxy == nullptr) {
-        // There is just one object per-span, and neighboring spans
+      if (r.cl == 0 || Static::guardedpage_allocator()->PointerIsMine(ptr)) {
+        // The sample has a span of its own, and neighboring spans
         // can be released back to the system, so we charge no
         // fragmentation to this sampled object.
-        continue;
+        return;
       }
 
-      // Fetch the span on which the proxy lives so we can examine its
+      // Fetch the span on which the sample lives so we can examine its
       // co-residents.
-      const PageID p = reinterpret_cast<uintptr_t>(t->proxy) >> kPageShift;
+      const PageID p = reinterpret_cast<uintptr_t>(ptr) >> kPageShift;
       Span* span = Static::pagemap()->GetDescriptor(p);
       if (span == nullptr) {
         // Avoid crashes in production mode code, but report in tests.
         ASSERT(span != nullptr);
-        continue;
+        return;
       }
 
       const double frag = span->Fragmentation();
       if (frag > 0) {
-        profile->AddTrace(frag, *t);
+        profile->AddTrace(frag, r);
       }
-    }
+    });
   }
   return profile;
 }
@@ -638,14 +994,14 @@ DumpHeapProfile(bool unsample) {
   auto profile = absl::make_unique<StackTraceTable>(
       tcmalloc::ProfileType::kHeap, Sampler::GetSamplePeriod(), true, unsample);
   absl::base_internal::SpinLockHolder h(&pageheap_lock);
-  for (Span* s : Static::sampled_objects_) {
-    profile->AddTrace(1.0, *s->sampled_stack());
-  }
+  Static::sampled_allocations()->ForEach(
+      [&](void*, const SampleRecord& r) { profile->AddTrace(1.0, r); });
   return profile;
 }
 
-class AllocationSampleList;
-
+// An allocation profiling session.  Sampled allocations are recorded once in
+// Static::allocation_sample_log(), however many sessions are running, and each
+// session collects its share of them when it stops.
 class AllocationSample
     : public tcmalloc::tcmalloc_internal::AllocationProfilingTokenBase {
  public:
@@ -659,48 +1015,14 @@ class AllocationSample
 
  private:
   std::unique_ptr<StackTraceTable> mallocs_;
-  AllocationSample* next GUARDED_BY(pageheap_lock);
-  friend class AllocationSampleList;
+  tcmalloc::AllocationSampleLog::Session session_;
 };
 
-class AllocationSampleList {
- public:
-  void Add(AllocationSample* as) EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
-    as->next = first_;
-    first_ = as;
-  }
-
-  // This list is very short and we're nowhere near a hot path, just walk
-  void Remove(AllocationSample* as) EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
-    AllocationSample** link = &first_;
-    AllocationSample* cur = first_;
-    while (cur != as) {
-      CHECK_CONDITION(cur != nullptr);
-      link = &cur->next;
-      cur = cur->next;
-    }
-    *link = as->next;
-  }
-
-  void ReportMalloc(const struct StackTrace& sample)
-      EXCLUSIVE_LOCKS_REQUIRED(pageheap_lock) {
-    AllocationSample* cur = first_;
-    while (cur != nullptr) {
-      cur->mallocs_->AddTrace(1.0, sample);
-      cur = cur->next;
-    }
-  }
-
- private:
-  AllocationSample* first_;
-} allocation_samples_ GUARDED_BY(pageheap_lock);
-
 AllocationSample::AllocationSample() {
   mallocs_ = absl::make_unique<StackTraceTable>(
       tcmalloc::ProfileType::kAllocations, Sampler::GetSamplePeriod(), true,
       true);
-  absl::base_internal::SpinLockHolder h(&pageheap_lock);
-  allocation_samples_.Add(this);
+  Static::allocation_sample_log()->StartSession(&session_);
 }
 
 AllocationSample::~AllocationSample() {
@@ -709,32 +1031,25 @@ AllocationSample::~AllocationSample() {
   }
 
   // deleted before ending profile, do it for them
-  {
-    absl::base_internal::SpinLockHolder h(&pageheap_lock);
-    allocation_samples_.Remove(this);
-  }
+  Static::allocation_sample_log()->StopSession(
+      &session_, [](const SampleRecord&, size_t) {});
 }
 
 std::unique_ptr<const tcmalloc::tcmalloc_internal::ProfileBase>
     AllocationSample::StopInternal() && LOCKS_EXCLUDED(pageheap_lock) {
-  // We need to remove ourselves from the allocation_samples_ list before we
-  // mutate mallocs_;
   if (mallocs_) {
-    absl::base_internal::SpinLockHolder h(&pageheap_lock);
-    allocation_samples_.Remove(this);
+    Static::allocation_sample_log()->StopSession(
+        &session_,
+        [&](const SampleRecord& r, size_t count) {
+          mallocs_->AddTrace(count, r);
+        });
   }
   return std::move(mallocs_);
 }
 
 tcmalloc::Profile AllocationSample::Stop() && LOCKS_EXCLUDED(pageheap_lock) {
-  // We need to remove ourselves from the allocation_samples_ list before we
-  // mutate mallocs_;
-  if (mallocs_) {
-    absl::base_internal::SpinLockHolder h(&pageheap_lock);
-    allocation_samples_.Remove(this);
-  }
   return tcmalloc::tcmalloc_internal::ProfileAccessor::MakeProfile(
-      std::move(mallocs_));
+      std::move(*this).StopInternal());
 }
 
 extern "C" void MallocExtension_Internal_GetStats(std::string* ret) {
@@ -793,6 +1108,8 @@ TCMalloc_Internal_SnapshotCurrent(tcmalloc::ProfileType type) {
       return DumpFragmentationProfile().release();
     case tcmalloc::ProfileType::kPeakHeap:
       return Static::peak_heap_tracker()->DumpSample().release();
+    case tcmalloc::ProfileType::kHeapDelta:
+      return Static::heap_delta_tracker()->Checkpoint().release();
     default:
       return nullptr;
   }
@@ -803,6 +1120,11 @@ TCMalloc_Internal_StartAllocationProfiling() {
   return new AllocationSample();
 }
 
+extern "C" tcmalloc::tcmalloc_internal::HeapBase* TCMalloc_Internal_NewHeap(
+    const tcmalloc::Heap::Options* options) {
+  return new tcmalloc::HeapInstance(*options);
+}
+
 namespace tcmalloc {
 
 bool GetNumericProperty(const char* name_data, size_t name_size,
@@ -889,6 +1211,25 @@ bool GetNumericProperty(const char* name_data, size_t name_size,
     return true;
   }
 
+  if (name == "tcmalloc.deferred_free_bytes") {
+    *value = Static::deferred_free_list()->pending_bytes();
+    return true;
+  }
+
+  if (name == "tcmalloc.cold_bytes_in_use") {
+    TCMallocStats stats;
+    ExtractStats(&stats, nullptr, nullptr, nullptr, false);
+    *value = ColdInUseByApp(stats);
+    return true;
+  }
+
+  if (name == "tcmalloc.cold_bytes_mapped") {
+    TCMallocStats stats;
+    ExtractStats(&stats, nullptr, nullptr, nullptr, false);
+    *value = ColdMemoryUsed(stats);
+    return true;
+  }
+
   if (name == "tcmalloc.max_total_thread_cache_bytes") {
     absl::base_internal::SpinLockHolder l(&pageheap_lock);
     *value = ThreadCache::overall_thread_cache_size();
@@ -940,6 +1281,27 @@ bool GetNumericProperty(const char* name_data, size_t name_size,
     return true;
   }
 
+  if (absl::StartsWith(name, "tcmalloc.realtime_")) {
+    RealTimeStats realtime = {};
+    GetRealTimeStats(&realtime);
+    if (name == "tcmalloc.realtime_heap_bytes") {
+      *value = realtime.heap_bytes;
+      return true;
+    }
+    if (name == "tcmalloc.realtime_system_calls") {
+      *value = realtime.system_calls;
+      return true;
+    }
+    if (name == "tcmalloc.realtime_page_faults") {
+      *value = realtime.page_faults;
+      return true;
+    }
+    if (name == "tcmalloc.realtime_failed_allocations") {
+      *value = realtime.failed_allocations;
+      return true;
+    }
+  }
+
   bool want_hard_limit = (name == "tcmalloc.hard_usage_limit_bytes");
   if (want_hard_limit || name == "tcmalloc.desired_usage_limit_bytes") {
     size_t amount;
@@ -974,7 +1336,8 @@ bool GetNumericProperty(const char* name_data, size_t name_size,
 
 tcmalloc::MallocExtension::Ownership GetOwnership(const void* ptr) {
   const PageID p = reinterpret_cast<uintptr_t>(ptr) >> kPageShift;
-  return Static::pagemap()->GetDescriptor(p)
+  return (Static::pagemap()->GetDescriptor(p) != nullptr ||
+          HeapInstance::Owner(ptr) != nullptr)
              ? tcmalloc::MallocExtension::Ownership::kOwned
              : tcmalloc::MallocExtension::Ownership::kNotOwned;
 }
@@ -1012,6 +1375,123 @@ extern "C" void MallocExtension_Internal_SetMemoryLimit(
   }
 }
 
+// Writes to every 4 KiB page of "span" so that it is faulted in.
+static void PrefaultSpan(Span* span) {
+  static const size_t kHardwarePageSize = 4 * 1024;
+  char* start = static_cast<char*>(span->start_address());
+  for (size_t offset = 0; offset < span->bytes_in_span();
+       offset += kHardwarePageSize) {
+    reinterpret_cast<volatile char*>(start)[offset] = 0;
+  }
+}
+
+extern "C" bool MallocExtension_Internal_EnterRealTimeMode(
+    const tcmalloc::MallocExtension::RealTimeConfig* config) {
+  ASSERT(config != nullptr);
+  if (config->heap_bytes == 0) return false;
+  Static::InitIfNecessary();
+
+  static absl::base_internal::SpinLock realtime_lock(
+      absl::base_internal::kLinkerInitialized);
+  absl::base_internal::SpinLockHolder rh(&realtime_lock);
+  {
+    absl::base_internal::SpinLockHolder h(&pageheap_lock);
+    if (Static::page_allocator()->realtime()) return false;
+  }
+
+  // Sampled allocations are served from the tagged heap; it gets a small
+  // share of its own.  Whole hugepages keep the reservation in one piece.
+  const size_t bytes[2] = {
+      config->heap_bytes,
+      std::max<size_t>(tcmalloc::kHugePageSize, config->heap_bytes / 64)};
+  Span* spans[2] = {nullptr, nullptr};
+  bool locked[2] = {false, false};
+  bool ok = true;
+  for (int tagged = 0; ok && tagged < 2; ++tagged) {
+    const size_t rounded = tcmalloc::HLFromBytes(bytes[tagged]).in_bytes();
+    spans[tagged] = Static::page_allocator()->New(rounded >> kPageShift,
+                                                  /*tagged=*/tagged == 1);
+    if (spans[tagged] == nullptr) {
+      ok = false;
+      break;
+    }
+    PrefaultSpan(spans[tagged]);
+    if (config->lock_memory) {
+      locked[tagged] = mlock(spans[tagged]->start_address(),
+                             spans[tagged]->bytes_in_span()) == 0;
+      ok = locked[tagged];
+    }
+  }
+
+  if (!ok) {
+    for (int tagged = 0; tagged < 2; ++tagged) {
+      if (spans[tagged] == nullptr) continue;
+      if (locked[tagged]) {
+        munlock(spans[tagged]->start_address(),
+                spans[tagged]->bytes_in_span());
+      }
+      absl::base_internal::SpinLockHolder h(&pageheap_lock);
+      Static::page_allocator()->Delete(spans[tagged], /*tagged=*/tagged == 1);
+    }
+    return false;
+  }
+
+  size_t heap_bytes = 0;
+  absl::base_internal::SpinLockHolder h(&pageheap_lock);
+  // The reserved heap could at worst be cut into a span per page; make room
+  // for those, and some slack for other metadata, so that they do not have to
+  // be mapped later.
+  for (Span* span : spans) {
+    heap_bytes += span->bytes_in_span();
+  }
+  Static::span_arena()->Reserve((heap_bytes >> kPageShift) * sizeof(Span));
+  Static::arena()->Reserve(tcmalloc::kHugePageSize);
+
+  // Release is off from here on, so the spans stay backed once freed.
+  Static::page_allocator()->EnterRealTimeMode(config->crash_on_exhaustion);
+  for (int tagged = 0; tagged < 2; ++tagged) {
+    Static::page_allocator()->Delete(spans[tagged], /*tagged=*/tagged == 1);
+  }
+
+  realtime_state.heap_bytes = heap_bytes;
+  realtime_state.base_system_calls = tcmalloc::SystemMemoryCalls();
+  realtime_state.base_page_faults = ProcessPageFaults();
+  return true;
+}
+
+extern "C" int64_t MallocExtension_Internal_GetProfileSamplingTargetRate() {
+  return tcmalloc::Parameters::profile_sampling_target_rate();
+}
+
+extern "C" void MallocExtension_Internal_SetProfileSamplingTargetRate(
+    int64_t rate) {
+  tcmalloc::Parameters::set_profile_sampling_target_rate(rate > 0 ? rate : 0);
+}
+
+extern "C" bool MallocExtension_Internal_AddSampleHook(
+    tcmalloc::MallocExtension::SampleHook hook) {
+  return tcmalloc::SampleHooks::Add(hook);
+}
+
+extern "C" bool MallocExtension_Internal_RemoveSampleHook(
+    tcmalloc::MallocExtension::SampleHook hook) {
+  return tcmalloc::SampleHooks::Remove(hook);
+}
+
+extern "C" void MallocExtension_Internal_GetProfileDumpPolicy(
+    tcmalloc::MallocExtension::ProfileDumpPolicy* policy) {
+  ASSERT(policy != nullptr);
+
+  *policy = Static::profile_dumper()->GetPolicy();
+}
+
+extern "C" void MallocExtension_Internal_SetProfileDumpPolicy(
+    const tcmalloc::MallocExtension::ProfileDumpPolicy* policy) {
+  ASSERT(policy != nullptr);
+
+  Static::profile_dumper()->SetPolicy(*policy);
+}
+
 extern "C" void MallocExtension_MarkThreadIdle() { ThreadCache::BecomeIdle(); }
 
 extern "C" tcmalloc::AddressRegionFactory*
@@ -1071,6 +1551,145 @@ extern "C" void MallocExtension_Internal_ReleaseMemoryToSystem(
   }
 }
 
+// Writes to every page of batch[0...n), each object being <size> bytes, so
+// that the memory behind them is faulted in before the application needs it.
+static void PrefaultObjects(void** batch, size_t n, size_t size) {
+  static const size_t page_size = getpagesize();
+  for (size_t i = 0; i < n; ++i) {
+    char* p = static_cast<char*>(batch[i]);
+    for (size_t offset = 0; offset < size; offset += page_size) {
+      *reinterpret_cast<volatile char*>(p + offset) = 0;
+    }
+  }
+}
+
+// Takes up to <n> objects of class <cl> from the central caches, faults them
+// in and pushes them onto the calling thread's per-CPU cache.  Returns the
+// number of objects that stayed in the per-CPU cache.
+static size_t WarmUpCurrentCpu(size_t cl, size_t n) {
+  const size_t size = Static::sizemap()->class_to_size(cl);
+  const size_t batch_length = Static::sizemap()->num_objects_to_move(cl);
+  void* batch[kMaxObjectsToMove];
+  size_t total = 0;
+  while (total < n) {
+    const size_t want = std::min(batch_length, n - total);
+    const size_t got = Static::transfer_cache()[cl].RemoveRange(batch, want);
+    if (got == 0) break;
+    PrefaultObjects(batch, got, size);
+    const size_t pushed = Static::cpu_cache()->WarmUp(cl, batch, got);
+    total += pushed;
+    if (pushed < got) {
+      // The list is at its capacity.
+      Static::transfer_cache()[cl].InsertRange(absl::Span<void*>(batch),
+                                               got - pushed);
+      break;
+    }
+  }
+  return total;
+}
+
+// Faults in <n> objects of class <cl> and returns them to the transfer cache.
+// The objects are all taken out before any is put back, so that the spans
+// holding them are carved rather than the same batch cycling through the
+// transfer cache.  Spans that end up entirely free go back to the page heap,
+// which keeps their memory backed.
+static void WarmUpCentral(size_t cl, size_t n) {
+  const size_t size = Static::sizemap()->class_to_size(cl);
+  const size_t batch_length = Static::sizemap()->num_objects_to_move(cl);
+  void* batch[kMaxObjectsToMove];
+  // Objects we hold are chained through their first word.
+  void* held = nullptr;
+  size_t total = 0;
+  while (total < n) {
+    const size_t want = std::min(batch_length, n - total);
+    const size_t got = Static::transfer_cache()[cl].RemoveRange(batch, want);
+    if (got == 0) break;
+    PrefaultObjects(batch, got, size);
+    for (size_t i = 0; i < got; ++i) {
+      *static_cast<void**>(batch[i]) = held;
+      held = batch[i];
+    }
+    total += got;
+  }
+  while (held != nullptr) {
+    size_t count = 0;
+    while (held != nullptr && count < batch_length) {
+      batch[count++] = held;
+      held = *static_cast<void**>(held);
+    }
+    Static::transfer_cache()[cl].InsertRange(absl::Span<void*>(batch), count);
+  }
+}
+
+extern "C" void MallocExtension_Internal_WarmUp(
+    const tcmalloc::MallocExtension::WarmUpSize* sizes, size_t num_sizes,
+    size_t num_bytes) {
+  Static::InitIfNecessary();
+  if (num_bytes == 0) return;
+
+  double total_weight = 0;
+  for (size_t i = 0; i < num_sizes; ++i) {
+    if (sizes[i].weight > 0) total_weight += sizes[i].weight;
+  }
+  if (total_weight <= 0) return;
+
+  // Number of objects to warm up, per size class.
+  size_t objects[kNumClasses] = {0};
+  for (size_t i = 0; i < num_sizes; ++i) {
+    uint32_t cl;
+    if (sizes[i].weight <= 0 ||
+        !Static::sizemap()->GetSizeClass(sizes[i].size, &cl) || cl == 0) {
+      continue;
+    }
+    const size_t size = Static::sizemap()->class_to_size(cl);
+    const double bytes = num_bytes * (sizes[i].weight / total_weight);
+    objects[cl] += std::max<size_t>(1, static_cast<size_t>(bytes / size));
+  }
+
+  // Split each class evenly between the CPUs we may run on, visiting each of
+  // them in turn: a slab can only be pushed to from its own CPU.
+  if (tcmalloc::UsePerCpuCache()) {
+    const std::vector<int> cpus = tcmalloc::tcmalloc_internal::AllowedCpus();
+    cpu_set_t original;
+    if (!cpus.empty() &&
+        sched_getaffinity(0, sizeof(original), &original) == 0) {
+      size_t remaining[kNumClasses];
+      std::copy(objects, objects + kNumClasses, remaining);
+      for (int cpu : cpus) {
+        cpu_set_t only;
+        CPU_ZERO(&only);
+        CPU_SET(cpu, &only);
+        if (sched_setaffinity(0, sizeof(only), &only) != 0) continue;
+        for (size_t cl = 1; cl < kNumClasses; ++cl) {
+          const size_t share = (objects[cl] + cpus.size() - 1) / cpus.size();
+          const size_t want = std::min(share, remaining[cl]);
+          if (want == 0) continue;
+          remaining[cl] -= WarmUpCurrentCpu(cl, want);
+        }
+      }
+      sched_setaffinity(0, sizeof(original), &original);
+      std::copy(remaining, remaining + kNumClasses, objects);
+    }
+  }
+
+  // Whatever did not fit (or all of it, without per-CPU caches) is left to
+  // the central caches.
+  for (size_t cl = 1; cl < kNumClasses; ++cl) {
+    if (objects[cl] != 0) WarmUpCentral(cl, objects[cl]);
+  }
+}
+
+// The flags of the jemalloc-style *allocx functions hold the log2 of the
+// alignment in their low bits, 0 asking for malloc's, and MALLOCX_ZERO.  Other
+// bits (jemalloc's tcache and arena selection) are ignored.
+static constexpr int kMallocxLgAlignMask = 0x3f;
+static constexpr int kMallocxZero = 0x40;
+
+static inline size_t MallocxAlignment(int flags) {
+  const int lg_align = flags & kMallocxLgAlignMask;
+  return lg_align == 0 ? alignof(std::max_align_t) : size_t{1} << lg_align;
+}
+
 // nallocx slow path.
 // Moved to a separate function because size_class_with_alignment is not inlined
 // which would cause nallocx to become non-leaf function with stack frame and
@@ -1079,7 +1698,7 @@ extern "C" void MallocExtension_Internal_ReleaseMemoryToSystem(
 // somewhere.
 static ABSL_ATTRIBUTE_NOINLINE size_t nallocx_slow(size_t size, int flags) {
   Static::InitIfNecessary();
-  size_t align = static_cast<size_t>(1ull << (flags & 0x3f));
+  size_t align = MallocxAlignment(flags);
   uint32_t cl;
   if (ABSL_PREDICT_TRUE(Static::sizemap()->GetSizeClass(size, align, &cl))) {
     ASSERT(cl != 0);
@@ -1098,8 +1717,10 @@ extern "C" size_t nallocx(size_t size, int flags) noexcept {
   if (ABSL_PREDICT_FALSE(!Static::IsInited() || flags != 0)) {
     return nallocx_slow(size, flags);
   }
+  // Without flags, round like mallocx() and malloc(), to std::max_align_t.
   uint32_t cl;
-  if (ABSL_PREDICT_TRUE(Static::sizemap()->GetSizeClass(size, &cl))) {
+  if (ABSL_PREDICT_TRUE(Static::sizemap()->GetSizeClass(
+          size, alignof(std::max_align_t), &cl))) {
     ASSERT(cl != 0);
     return Static::sizemap()->class_to_size(cl);
   } else {
@@ -1112,6 +1733,38 @@ MallocExtension_Internal_GetOwnership(const void* ptr) {
   return tcmalloc::GetOwnership(ptr);
 }
 
+extern "C" bool MallocExtension_Internal_GetSharedMemoryLocation(
+    const void* ptr,
+    tcmalloc::MallocExtension::SharedMemoryLocation* location) {
+  return tcmalloc::HeapInstance::GetSharedMemoryLocation(ptr, &location->fd,
+                                                         &location->offset);
+}
+
+extern "C" uint64_t MallocExtension_Internal_EnterEpoch() {
+  return Static::deferred_free_list()->Enter();
+}
+
+extern "C" void MallocExtension_Internal_ExitEpoch(uint64_t epoch) {
+  Static::deferred_free_list()->Exit(epoch);
+}
+
+extern "C" bool MallocExtension_Internal_AdvanceEpoch() {
+  return Static::deferred_free_list()->Advance();
+}
+
+extern "C" void MallocExtension_Internal_DeferredFree(void* p, size_t size) {
+  if (p == nullptr) return;
+  // The memory of tcmalloc::Heaps is tagged, and it and sampled objects must
+  // go through free().
+  size_t cl = 0;
+  if (!tcmalloc::IsTaggedMemory(p)) {
+    cl = Static::pagemap()->sizeclass_for_free(
+        reinterpret_cast<uintptr_t>(p) >> kPageShift);
+  }
+  ASSERT(cl == 0 || size <= Static::sizemap()->class_to_size(cl));
+  Static::deferred_free_list()->Retire(p, cl);
+}
+
 extern "C" void MallocExtension_Internal_GetProperties(
     std::map<std::string, tcmalloc::MallocExtension::Property>* result) {
   TCMallocStats stats;
@@ -1152,6 +1805,20 @@ extern "C" void MallocExtension_Internal_GetProperties(
   (*result)["tcmalloc.page_algorithm"].value =
       Static::page_allocator()->algorithm();
 
+  (*result)["tcmalloc.deferred_free_bytes"].value =
+      Static::deferred_free_list()->pending_bytes();
+
+  (*result)["tcmalloc.cold_bytes_in_use"].value = ColdInUseByApp(stats);
+  (*result)["tcmalloc.cold_bytes_mapped"].value = ColdMemoryUsed(stats);
+  for (int hint = 0; hint < 256; ++hint) {
+    const uint64_t bytes =
+        hot_cold_requested_bytes[hint].load(std::memory_order_relaxed);
+    if (bytes > 0) {
+      (*result)[absl::StrCat("tcmalloc.hot_cold_requested_bytes.", hint)]
+          .value = bytes;
+    }
+  }
+
   tcmalloc::FillExperimentProperties(result);
   tcmalloc::tracking::GetProperties(result);
 }
@@ -1318,34 +1985,31 @@ static void* TrySampleGuardedAllocation(size_t size, size_t alignment,
 
 // Performs sampling for already occurred allocation of object.
 //
-// For very small object sizes, object is used as 'proxy' and full
-// page with sampled marked is allocated instead.
-//
-// For medium-sized objects that have single instance per span,
-// they're simply freed and fresh page span is allocated to represent
-// sampling.
+// Small objects stay where they are.  Their span is marked as holding
+// samples in the pagemap (see PageMap::SetHoldsSamples()), which sends frees
+// of its objects to do_free_pages, where the samples among them are found in
+// Static::sampled_allocations().  Guarded samples instead replace the object,
+// which is simply freed.
 //
 // For large objects (i.e. allocated with do_malloc_pages) they are
 // also fully reused and their span is marked as sampled.
 //
-// Note that do_free_with_size assumes sampled objects have
-// page-aligned addresses. Please change both functions if need to
-// invalidate the assumption.
+// Every sample is recorded in Static::sampled_allocations(), keyed by the
+// address returned to the user, under the same pageheap_lock section that
+// reports it to Static::heap_delta_tracker().
 //
 // Note that cl might not match requested_size in case of
 // memalign. I.e. when larger than requested allocation is done to
 // satisfy alignment constraint.
 //
-// In case of out-of-memory condition when allocating span or
-// stacktrace struct, this function simply cheats and returns original
-// object. As if no sampling was requested.
+// In case the stack depot runs out of ids, this function simply cheats and
+// returns the original object. As if no sampling was requested.
 static void* SampleifyAllocation(size_t requested_size, size_t weight,
                                  size_t requested_alignment, size_t cl,
                                  void* obj, Span* span, size_t* capacity) {
   CHECK_CONDITION((cl != 0 && obj != nullptr && span == nullptr) ||
                   (cl == 0 && obj == nullptr && span != nullptr));
 
-  void* proxy = nullptr;
   void* guarded_alloc = nullptr;
   size_t allocated_size;
   bool success = false;
@@ -1362,7 +2026,6 @@ static void* SampleifyAllocation(size_t requested_size, size_t weight,
 
     allocated_size = Static::sizemap()->class_to_size(cl);
 
-    // If the caller didn't provide a span, allocate one:
     Length num_pages = tcmalloc::pages(allocated_size);
     if ((guarded_alloc = TrySampleGuardedAllocation(
              requested_size, requested_alignment, num_pages))) {
@@ -1377,19 +2040,6 @@ static void* SampleifyAllocation(size_t requested_size, size_t weight,
       // returned size from size returning allocations. So in that case, we
       // report the requested size for both capacity and GetAllocatedSize().
       if (capacity) allocated_size = requested_size;
-    } else if ((span = Static::page_allocator()->New(
-                    num_pages, /*tagged=*/true)) == nullptr) {
-      if (capacity) *capacity = allocated_size;
-      return obj;
-    }
-
-    size_t span_size = Static::sizemap()->class_to_pages(cl) << kPageShift;
-    size_t objects_per_span = span_size / allocated_size;
-
-    if (objects_per_span != 1) {
-      ASSERT(objects_per_span > 1);
-      proxy = obj;
-      obj = nullptr;
     }
   } else {
     // Set allocated_size to the exact size for a page allocation.
@@ -1401,48 +2051,82 @@ static void* SampleifyAllocation(size_t requested_size, size_t weight,
   }
   if (capacity) *capacity = allocated_size;
 
-  ASSERT(span != nullptr);
+  void* const result = guarded_alloc ? guarded_alloc
+                       : span        ? span->start_address()
+                                     : obj;
 
   // Grab the stack trace outside the heap lock
-  StackTrace tmp;
-  tmp.proxy = proxy;
-  tmp.depth = absl::GetStackTrace(tmp.stack, tcmalloc::kMaxStackDepth, 1);
-  tmp.requested_size = requested_size;
-  tmp.requested_alignment = requested_alignment;
-  tmp.allocated_size = allocated_size;
-  tmp.weight = weight;
-
+  void* stack[tcmalloc::kMaxStackDepth];
+  const int depth =
+      tcmalloc::GetSampledStackTrace(stack, tcmalloc::kMaxStackDepth, 1);
+  SampleRecord record;
+  record.requested_size = requested_size;
+  record.requested_alignment = requested_alignment;
+  record.allocated_size = allocated_size;
+  record.weight = weight;
+  record.cl = cl;
+
+  bool log_sample = false;
+  uint64_t log_epoch = 0;
   {
     absl::base_internal::SpinLockHolder h(&pageheap_lock);
-    // Allocate stack trace
-    StackTrace *stack = Static::stacktrace_allocator()->New();
-    if (stack != nullptr) {
-      allocation_samples_.ReportMalloc(tmp);
-      *stack = tmp;
-      span->Sample(stack);
+    record.stack_id = Static::stack_depot()->Intern(stack, depth);
+    if (record.stack_id != 0) {
+      if (Static::allocation_sample_log()->active()) {
+        // The log's reference; it is appended below, outside the lock.
+        Static::stack_depot()->Ref(record.stack_id);
+        log_epoch = Static::allocation_sample_log()->epoch();
+        log_sample = true;
+      }
+      Static::sampled_allocations()->Insert(result, record);
+      Static::heap_delta_tracker()->ReportMalloc(record);
+      if (span != nullptr) {
+        span->Sample();
+      } else {
+        const PageID p = reinterpret_cast<uintptr_t>(obj) >> kPageShift;
+        if (Static::pagemap()->sizeclass_for_free(p) != 0) {
+          Static::pagemap()->SetHoldsSamples(
+              Static::pagemap()->GetExistingDescriptor(p), cl, true);
+        }
+      }
       // lets flag success and release the pageheap_lock
       success = true;
     }
   }
 
   if (success) {
+    if (log_sample) {
+      Static::allocation_sample_log()->Append(record, log_epoch);
+    }
     Static::peak_heap_tracker()->MaybeSaveSample();
+    Static::profile_dumper()->MaybeRequestDump(
+        Static::sampled_objects_size_.value());
+    if (tcmalloc::SampleHooks::active()) {
+      tcmalloc::MallocExtension::SampleEvent event;
+      event.type = tcmalloc::MallocExtension::SampleEvent::kAllocation;
+      event.ptr = result;
+      event.requested_size = requested_size;
+      event.requested_alignment = requested_alignment;
+      event.allocated_size = allocated_size;
+      event.weight = weight;
+      event.depth = depth;
+      event.stack = stack;
+      tcmalloc::SampleHooks::Invoke(event);
+    }
   }
 
-  if (!success) {
-    // We couldn't allocate a stack trace. We have a perfectly good
-    // span.  Use it (getting rid of any proxy/small object.)
-    if (proxy != nullptr) obj = proxy;
-  }
-
-  if (obj != nullptr) {
+  if (guarded_alloc != nullptr) {
     // We delete directly into central cache to avoid tracking this as
     // purely internal deletion. We've already (correctly) tracked
     // this allocation as either malloc hit or malloc miss, and we
     // must not count anything else for this allocation.
-    Static::transfer_cache()[cl].InsertRange(absl::Span<void*>(&obj, 1), 1);
+    if (tcmalloc::IsTaggedMemory(obj)) {
+      Static::cold_freelist()[cl].InsertRange(&obj, 1);
+    } else {
+      Static::transfer_cache()[cl].InsertRange(absl::Span<void*>(&obj, 1), 1);
+    }
   }
-  return guarded_alloc ? guarded_alloc : span->start_address();
+  return result;
 }
 
 // ShouldSampleAllocation() is called when an allocation of the given requested
@@ -1476,6 +2160,39 @@ inline void* do_malloc_pages(size_t size, size_t alignment) {
   return result;
 }
 
+// Allocates a cold object, from spans of tagged memory that hot objects never
+// share: small objects come from Static::cold_freelist(), larger ones from
+// the tagged page allocator.  Cold objects are sampled, and counted in the
+// page heap stats, like any others.  Returns nullptr if out of memory.
+//
+// There is no per-CPU cache in front of the cold free lists, so every cold
+// allocation and free takes the lock of its size class.
+static void* do_malloc_cold(size_t size) {
+  Static::InitIfNecessary();
+  uint32_t cl;
+  if (Static::sizemap()->GetSizeClass(size, CppPolicy().align(), &cl)) {
+    void* result;
+    if (Static::cold_freelist()[cl].RemoveRange(&result, 1) != 1) {
+      return nullptr;
+    }
+    if (size_t weight = ShouldSampleAllocation(size)) {
+      return SampleifyAllocation(size, weight, CppPolicy().align(), cl, result,
+                                 nullptr, nullptr);
+    }
+    return result;
+  }
+
+  Span* span = Static::page_allocator()->New(
+      std::max<Length>(tcmalloc::pages(size), 1), /*tagged=*/true);
+  if (span == nullptr) return nullptr;
+  void* result = span->start_address();
+  if (size_t weight = ShouldSampleAllocation(size)) {
+    CHECK_CONDITION(result == SampleifyAllocation(size, weight, 0, 0, nullptr,
+                                                  span, nullptr));
+  }
+  return result;
+}
+
 template <typename Policy, typename CapacityPtr>
 inline void* ABSL_ATTRIBUTE_ALWAYS_INLINE AllocSmall(Policy policy, size_t cl,
                                                      size_t size,
@@ -1506,56 +2223,112 @@ inline void* ABSL_ATTRIBUTE_ALWAYS_INLINE AllocSmall(Policy policy, size_t cl,
   return result;
 }
 
+// Drops the sample "ptr", whose span is "span", and reports its free to
+// sample hooks.  "cl" is the size class of a small sample, which stays in
+// its span, or 0 for a sample with a span of its own.  Kept out of line so
+// that only sampled frees pay for the stack trace handed to the hooks.
+ABSL_ATTRIBUTE_NOINLINE
+static void FreeSample(void* ptr, Span* span, size_t cl) {
+  tcmalloc::StackTrace hook_trace;
+  bool notify_hooks = false;
+  {
+    absl::base_internal::SpinLockHolder h(&pageheap_lock);
+    SampleRecord record;
+    const bool found = Static::sampled_allocations()->Remove(ptr, &record);
+    ASSERT(found);
+    (void)found;
+    if (cl != 0) {
+      // Cold spans stay marked whether or not they hold samples.
+      const uintptr_t start =
+          reinterpret_cast<uintptr_t>(span->start_address());
+      if (!tcmalloc::IsTaggedMemory(ptr) &&
+          !Static::sampled_allocations()->HasSampleIn(
+              start, start + span->bytes_in_span())) {
+        Static::pagemap()->SetHoldsSamples(span, cl, false);
+      }
+    } else {
+      span->Unsample();
+      if (record.cl != 0) {
+        // A guarded sample, whose original object was freed when it was
+        // sampled.
+        tcmalloc::tracking::Report(tcmalloc::kFreeMiss, record.cl, 1);
+      }
+    }
+    if (tcmalloc::SampleHooks::active()) {
+      Static::stack_depot()->Expand(record, &hook_trace);
+      notify_hooks = true;
+    }
+    Static::heap_delta_tracker()->ReportFree(record);
+    Static::stack_depot()->Unref(record.stack_id);
+  }
+
+  if (notify_hooks) {
+    tcmalloc::MallocExtension::SampleEvent event;
+    event.type = tcmalloc::MallocExtension::SampleEvent::kFree;
+    event.ptr = ptr;
+    event.requested_size = hook_trace.requested_size;
+    event.requested_alignment = hook_trace.requested_alignment;
+    event.allocated_size = hook_trace.allocated_size;
+    event.weight = hook_trace.weight;
+    event.depth = hook_trace.depth;
+    event.stack = hook_trace.stack;
+    tcmalloc::SampleHooks::Invoke(event);
+  }
+}
+
 // Handles freeing object that doesn't have size class, i.e. which
-// is either large or sampled. We explicitly prevent inlining it to
+// is either large or sampled, or which shares its span with sampled
+// objects, or which is cold. We explicitly prevent inlining it to
 // keep it out of fast-path. This helps avoid expensive
 // prologue/epiloge for fast-path freeing functions.
 ABSL_ATTRIBUTE_NOINLINE
 static void do_free_pages(void* ptr, const PageID p) {
   GetThreadSampler()->UpdateFastPathState();
 
-  void* proxy = nullptr;
-  size_t size;
-  bool notify_sampled_alloc = false;
-
-  Span* span = Static::pagemap()->GetExistingDescriptor(p);
-  ASSERT(span != nullptr);
-  {
-    absl::base_internal::SpinLockHolder h(&pageheap_lock);
-    ASSERT(span->first_page() == p);
-    if (StackTrace* st = span->Unsample()) {
-      proxy = st->proxy;
-      size = st->allocated_size;
-      if (proxy == nullptr && size <= kMaxSize) {
-        tcmalloc::tracking::Report(tcmalloc::kFreeMiss,
-                                   Static::sizemap()->SizeClass(size), 1);
-      }
-      notify_sampled_alloc = true;
-      Static::stacktrace_allocator()->Delete(st);
+  Span* span = Static::pagemap()->GetDescriptor(p);
+  if (ABSL_PREDICT_FALSE(span == nullptr)) {
+    // Pages without a span may belong to a tcmalloc::Heap.
+    tcmalloc::HeapInstance* heap = tcmalloc::HeapInstance::Owner(ptr);
+    CHECK_CONDITION(heap != nullptr);
+    heap->Deallocate(ptr);
+    return;
+  }
+  if (const size_t cl = Static::pagemap()->sizeclass(p)) {
+    // A small object in a span that holds samples, or in a cold span.  Most
+    // of these objects are not sampled, and are told apart without taking
+    // pageheap_lock.
+    SampleRecord record;
+    if (Static::sampled_allocations()->Lookup(ptr, &record)) {
+      FreeSample(ptr, span, cl);
     }
     if (tcmalloc::IsTaggedMemory(ptr)) {
-      if (Static::guardedpage_allocator()->PointerIsMine(ptr)) {
-        // Release lock while calling Deallocate() since it does a system call.
-        pageheap_lock.Unlock();
-        Static::guardedpage_allocator()->Deallocate(ptr);
-        pageheap_lock.Lock();
-        Span::Delete(span);
-      } else {
-        ASSERT(reinterpret_cast<uintptr_t>(ptr) % kPageSize == 0);
-        Static::page_allocator()->Delete(span, /*tagged=*/true);
-      }
-    } else {
-      ASSERT(reinterpret_cast<uintptr_t>(ptr) % kPageSize == 0);
-      Static::page_allocator()->Delete(span, /*tagged=*/false);
+      Static::cold_freelist()[cl].InsertRange(&ptr, 1);
+      return;
     }
+    FreeSmall<FreeFastPath::DISABLED>(ptr, cl);
+    return;
   }
 
-  if (notify_sampled_alloc) {
+  // Drop the sample before the span, and so its address, can be reused.
+  if (span->sampled()) {
+    FreeSample(ptr, span, 0);
   }
-
-  if (proxy) {
-    FreeSmall<FreeFastPath::DISABLED>(proxy,
-                                      Static::sizemap()->SizeClass(size));
+  absl::base_internal::SpinLockHolder h(&pageheap_lock);
+  ASSERT(span->first_page() == p);
+  if (tcmalloc::IsTaggedMemory(ptr)) {
+    if (Static::guardedpage_allocator()->PointerIsMine(ptr)) {
+      // Release lock while calling Deallocate() since it does a system call.
+      pageheap_lock.Unlock();
+      Static::guardedpage_allocator()->Deallocate(ptr);
+      pageheap_lock.Lock();
+      Span::Delete(span);
+    } else {
+      ASSERT(reinterpret_cast<uintptr_t>(ptr) % kPageSize == 0);
+      Static::page_allocator()->Delete(span, /*tagged=*/true);
+    }
+  } else {
+    ASSERT(reinterpret_cast<uintptr_t>(ptr) % kPageSize == 0);
+    Static::page_allocator()->Delete(span, /*tagged=*/false);
   }
 }
 
@@ -1599,7 +2372,7 @@ inline ABSL_ATTRIBUTE_ALWAYS_INLINE void do_free_with_cl(void* ptr, size_t cl) {
   ASSERT(Static::IsInited());
 
   if (!have_cl) {
-    cl = Static::pagemap()->sizeclass(p);
+    cl = Static::pagemap()->sizeclass_for_free(p);
   }
   if (have_cl || ABSL_PREDICT_TRUE(cl != 0)) {
     ASSERT(cl == GetSizeClass(ptr));
@@ -1650,8 +2423,9 @@ inline ABSL_ATTRIBUTE_ALWAYS_INLINE void do_free_with_size(void* ptr,
   // without any cache misses by doing a plain computation that
   // maps from size to size-class.
   //
-  // The optimized path doesn't work with sampled objects, whose deletions
-  // trigger more operations and require to visit metadata.
+  // The optimized path doesn't work with guarded objects and the memory of
+  // tcmalloc::Heaps, which are tagged, nor with sampled objects (see below),
+  // whose deletions trigger more operations and require to visit metadata.
   if (ABSL_PREDICT_FALSE(tcmalloc::IsTaggedMemory(ptr))) {
     // we don't know true class size of the ptr
     if (ptr == nullptr) return;
@@ -1674,6 +2448,14 @@ inline ABSL_ATTRIBUTE_ALWAYS_INLINE void do_free_with_size(void* ptr,
     return FreePages(ptr);
   }
 
+  // Sampled small objects stay in their span (see SampleifyAllocation()), so
+  // unlike the size class, whether ptr may be sampled can only be read from
+  // the pagemap.
+  const PageID p = reinterpret_cast<uintptr_t>(ptr) >> kPageShift;
+  if (ABSL_PREDICT_FALSE(Static::pagemap()->sizeclass_for_free(p) == 0)) {
+    return do_free_pages(ptr, p);
+  }
+
   return do_free_with_cl<true, FreeFastPath::ENABLED>(ptr, cl);
 }
 
@@ -1684,13 +2466,17 @@ inline size_t GetSize(const void* ptr) {
   if (cl != 0) {
     return Static::sizemap()->class_to_size(cl);
   } else {
-    const Span* span = Static::pagemap()->GetExistingDescriptor(p);
-    if (span->sampled()) {
-      if (Static::guardedpage_allocator()->PointerIsMine(ptr)) {
-        return Static::guardedpage_allocator()->GetRequestedSize(ptr);
-      }
-      return span->sampled_stack()->allocated_size;
+    const Span* span = Static::pagemap()->GetDescriptor(p);
+    if (ABSL_PREDICT_FALSE(span == nullptr)) {
+      const tcmalloc::HeapInstance* heap = tcmalloc::HeapInstance::Owner(ptr);
+      CHECK_CONDITION(heap != nullptr);
+      return heap->GetAllocatedSize(ptr);
+    }
+    if (span->sampled() &&
+        Static::guardedpage_allocator()->PointerIsMine(ptr)) {
+      return Static::guardedpage_allocator()->GetRequestedSize(ptr);
     } else {
+      // Other sampled objects fill their span, like any large object.
       return span->bytes_in_span();
     }
   }
@@ -1711,6 +2497,12 @@ bool CorrectSize(void* ptr, size_t size, AlignPolicy align) {
     size = Static::sizemap()->class_to_size(cl);
   } else {
     size = tcmalloc::pages(size) << kPageShift;
+    // Objects freed by page are found through the pagemap, and realloc() may
+    // leave them larger than the size last asked for.
+    const PageID p = reinterpret_cast<uintptr_t>(ptr) >> kPageShift;
+    if (Static::pagemap()->sizeclass(p) == 0 && GetSize(ptr) >= size) {
+      return true;
+    }
   }
   size_t actual = GetSize(ptr);
   if (actual == size) return true;
@@ -1933,13 +2725,22 @@ extern "C" void TCMallocInternalSdallocx(void* ptr, size_t size,
   size_t alignment = alignof(std::max_align_t);
 
   if (ABSL_PREDICT_FALSE(flags != 0)) {
-    ASSERT((flags & ~0x3f) == 0);
-    alignment = static_cast<size_t>(1ull << (flags & 0x3f));
+    alignment = MallocxAlignment(flags);
   }
 
   return do_free_with_size(ptr, size, tcmalloc::AlignAsPolicy(alignment));
 }
 
+extern "C" void TCMallocInternalFreeSized(void* ptr, size_t size) noexcept {
+  do_free_with_size(ptr, size, tcmalloc::MallocAlignPolicy());
+}
+
+extern "C" void TCMallocInternalFreeAlignedSized(void* ptr, size_t alignment,
+                                                 size_t size) noexcept {
+  ASSERT(alignment != 0 && (alignment & (alignment - 1)) == 0);
+  do_free_with_size(ptr, size, tcmalloc::AlignAsPolicy(alignment));
+}
+
 extern "C" void* TCMallocInternalCalloc(size_t n, size_t elem_size) noexcept {
   // Overflow check
   const size_t size = n * elem_size;
@@ -1965,6 +2766,52 @@ extern "C" void TCMallocInternalCfree(void* ptr) noexcept
 }
 #endif  // TCMALLOC_ALIAS
 
+// Returns the size class that free_sized() and sdallocx() derive from "size"
+// and "align", or 0 if they free by page.
+static inline uint32_t SizedFreeClass(
+    size_t size, size_t align = alignof(std::max_align_t)) {
+  uint32_t cl;
+  if (!Static::sizemap()->GetSizeClass(size, align, &cl)) {
+    return 0;
+  }
+  return cl;
+}
+
+extern "C" void* TCMallocInternalMallocx(size_t size, int flags) noexcept {
+  size_t capacity;
+  void* result =
+      fast_alloc(MallocPolicy().AlignAs(MallocxAlignment(flags)), size,
+                 &capacity);
+  // Like jemalloc, zero all of the object, so that rallocx() and xallocx()
+  // only need to zero what lies beyond its old size.
+  if (result != nullptr && (flags & kMallocxZero)) {
+    memset(result, 0, capacity);
+  }
+  return result;
+}
+
+// Whether "ptr", of usable size "old_size", may be kept for "new_size" bytes,
+// whose size class (see SizedFreeClass()) is "new_cl".  The result may be
+// freed with free_sized(new_size) or sdallocx(), which take the size class
+// from new_size, so an object is only kept if new_size still describes it
+// (see CorrectSize).  Only guarded objects, which are checked loosely, are
+// always kept.
+static bool KeepsSizedFreeClass(void* ptr, size_t old_size, size_t new_size,
+                                uint32_t new_cl) {
+  if (tcmalloc::IsTaggedMemory(ptr) &&
+      Static::guardedpage_allocator()->PointerIsMine(ptr)) {
+    return true;
+  }
+  const uint32_t old_cl = Static::pagemap()->sizeclass(
+      reinterpret_cast<uintptr_t>(ptr) >> kPageShift);
+  if (new_cl != 0) {
+    return old_cl == new_cl ||
+           (old_cl == 0 &&
+            old_size == Static::sizemap()->class_to_size(new_cl));
+  }
+  return old_cl == 0 && old_size >= (tcmalloc::pages(new_size) << kPageShift);
+}
+
 static inline void* do_realloc(void* old_ptr, size_t new_size) {
   Static::InitIfNecessary();
   // Get the size of the old entry
@@ -1981,11 +2828,15 @@ static inline void* do_realloc(void* old_ptr, size_t new_size) {
       std::numeric_limits<size_t>::max() - old_size);  // Avoid overflow.
   const size_t lower_bound_to_grow = old_size + min_growth;
   const size_t upper_bound_to_shrink = old_size / 2;
-  if ((new_size > old_size) || (new_size < upper_bound_to_shrink)) {
+  // Growth with hysteresis likewise stays within new_size's size class.
+  const uint32_t new_cl = SizedFreeClass(new_size);
+  if ((new_size > old_size) || (new_size < upper_bound_to_shrink) ||
+      !KeepsSizedFreeClass(old_ptr, old_size, new_size, new_cl)) {
     // Need to reallocate.
     void* new_ptr = nullptr;
 
-    if (new_size > old_size && new_size < lower_bound_to_grow) {
+    if (new_size > old_size && new_size < lower_bound_to_grow &&
+        SizedFreeClass(lower_bound_to_grow) == new_cl) {
       // Avoid fast_alloc() reporting a hook with the lower bound size
       // as we the expectation for pointer returning allocation functions
       // is that malloc hooks are invoked with the requested_size.
@@ -2024,6 +2875,73 @@ extern "C" void* TCMallocInternalRealloc(void* old_ptr,
   return do_realloc(old_ptr, new_size);
 }
 
+extern "C" void* TCMallocInternalRallocx(void* ptr, size_t size,
+                                         int flags) noexcept {
+  if (ABSL_PREDICT_TRUE(flags == 0)) {
+    return do_realloc(ptr, size);
+  }
+
+  const size_t alignment = MallocxAlignment(flags);
+  const size_t old_size = GetSize(ptr);
+  // As in do_realloc(), shrink in place only if sdallocx() can still free
+  // the object with the new size.
+  if (reinterpret_cast<uintptr_t>(ptr) % alignment == 0 && size <= old_size &&
+      size >= old_size / 2 &&
+      KeepsSizedFreeClass(ptr, old_size, size,
+                          SizedFreeClass(size, alignment))) {
+    return ptr;
+  }
+
+  size_t capacity;
+  void* result =
+      fast_alloc(MallocPolicy().AlignAs(alignment), size, &capacity);
+  if (result == nullptr) return nullptr;
+  memcpy(result, ptr, std::min(old_size, size));
+  if ((flags & kMallocxZero) && capacity > old_size) {
+    memset(static_cast<char*>(result) + old_size, 0, capacity - old_size);
+  }
+  do_free(ptr);
+  return result;
+}
+
+extern "C" size_t TCMallocInternalXallocx(void* ptr, size_t size, size_t extra,
+                                          int flags) noexcept {
+  const size_t old_size = GetSize(ptr);
+  // Only objects freed by page can change size in place, and only to sizes
+  // that sdallocx() still frees by page.  Sampled objects keep the size they
+  // were recorded with.
+  if (tcmalloc::IsTaggedMemory(ptr) ||
+      SizedFreeClass(size, MallocxAlignment(flags)) != 0) {
+    return old_size;
+  }
+  const PageID p = reinterpret_cast<uintptr_t>(ptr) >> kPageShift;
+  if (Static::pagemap()->sizeclass(p) != 0) return old_size;
+  Span* span = Static::pagemap()->GetDescriptor(p);
+  if (span == nullptr || span->sampled()) return old_size;
+
+  // Try for size + extra first, and settle for size.
+  const Length wanted = tcmalloc::pages(
+      size + std::min(extra, std::numeric_limits<size_t>::max() - size));
+  const Length needed = tcmalloc::pages(size);
+  size_t new_size;
+  {
+    absl::base_internal::SpinLockHolder h(&pageheap_lock);
+    if (!Static::page_allocator()->Resize(span, wanted, /*tagged=*/false) &&
+        needed > span->num_pages()) {
+      Static::page_allocator()->Resize(span, needed, /*tagged=*/false);
+    }
+    new_size = span->bytes_in_span();
+  }
+  if ((flags & kMallocxZero) && new_size > old_size) {
+    memset(static_cast<char*>(ptr) + old_size, 0, new_size - old_size);
+  }
+  return new_size;
+}
+
+extern "C" size_t TCMallocInternalSallocx(const void* ptr, int) noexcept {
+  return GetSize(ptr);
+}
+
 extern "C" void* TCMallocInternalNewNothrow(size_t size,
                                             const std::nothrow_t&) noexcept {
   return fast_alloc(CppPolicy().Nothrow(), size);
@@ -2036,6 +2954,16 @@ extern "C" tcmalloc::sized_ptr_t tcmalloc_size_returning_operator_new_nothrow(
   return {p, capacity};
 }
 
+extern "C" void* tcmalloc_hot_cold_new(size_t size, uint8_t hint) {
+  hot_cold_requested_bytes[hint].fetch_add(size, std::memory_order_relaxed);
+  if (hint < kColdHint) {
+    void* p = do_malloc_cold(size);
+    if (ABSL_PREDICT_TRUE(p != nullptr)) return p;
+    // Without tagged memory for cold spans, fall back to hot ones.
+  }
+  return fast_alloc(CppPolicy(), size);
+}
+
 extern "C" ABSL_CACHELINE_ALIGNED void TCMallocInternalDelete(void* p) noexcept
 #ifdef TCMALLOC_ALIAS
     TCMALLOC_ALIAS(TCMallocInternalFree);
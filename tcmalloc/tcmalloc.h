@@ -46,6 +46,20 @@ void TCMallocInternalFree(void* ptr) __THROW
     ABSL_ATTRIBUTE_SECTION(google_malloc);
 void TCMallocInternalSdallocx(void* ptr, size_t size, int flags) __THROW
     ABSL_ATTRIBUTE_SECTION(google_malloc);
+void TCMallocInternalFreeSized(void* ptr, size_t size) __THROW
+    ABSL_ATTRIBUTE_SECTION(google_malloc);
+void TCMallocInternalFreeAlignedSized(void* ptr, size_t align,
+                                      size_t size) __THROW
+    ABSL_ATTRIBUTE_SECTION(google_malloc);
+void* TCMallocInternalMallocx(size_t size, int flags) __THROW
+    ABSL_ATTRIBUTE_SECTION(google_malloc);
+void* TCMallocInternalRallocx(void* ptr, size_t size, int flags) __THROW
+    ABSL_ATTRIBUTE_SECTION(google_malloc);
+size_t TCMallocInternalXallocx(void* ptr, size_t size, size_t extra,
+                               int flags) __THROW
+    ABSL_ATTRIBUTE_SECTION(google_malloc);
+size_t TCMallocInternalSallocx(const void* ptr, int flags) __THROW
+    ABSL_ATTRIBUTE_SECTION(google_malloc);
 void* TCMallocInternalRealloc(void* ptr, size_t size) __THROW
     ABSL_ATTRIBUTE_SECTION(google_malloc);
 void* TCMallocInternalCalloc(size_t n, size_t size) __THROW
@@ -0,0 +1,123 @@
+// Copyright 2019 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <atomic>
+#include <new>
+#include <thread>  // NOLINT(build/c++11)
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "absl/types/optional.h"
+#include "tcmalloc/malloc_extension.h"
+
+namespace tcmalloc {
+namespace {
+
+size_t DeferredFreeBytes() {
+  absl::optional<size_t> bytes =
+      MallocExtension::GetNumericProperty("tcmalloc.deferred_free_bytes");
+  EXPECT_TRUE(bytes.has_value());
+  return bytes.value_or(0);
+}
+
+TEST(DeferredFreeTest, WaitsForReaders) {
+  // Start from an epoch with nothing pending.
+  MallocExtension::AdvanceEpoch();
+  MallocExtension::AdvanceEpoch();
+  const size_t before = DeferredFreeBytes();
+
+  const uint64_t epoch = MallocExtension::EnterEpoch();
+  void* p = ::operator new(64);
+  MallocExtension::DeferredFree(p, 64);
+  EXPECT_GE(DeferredFreeBytes(), before + 64);
+
+  // Readers of the epoch before ours are gone, so the epoch may advance once,
+  // but not past us.
+  EXPECT_TRUE(MallocExtension::AdvanceEpoch());
+  EXPECT_FALSE(MallocExtension::AdvanceEpoch());
+  EXPECT_GE(DeferredFreeBytes(), before + 64);
+
+  MallocExtension::ExitEpoch(epoch);
+  EXPECT_TRUE(MallocExtension::AdvanceEpoch());
+  EXPECT_EQ(DeferredFreeBytes(), before);
+}
+
+TEST(DeferredFreeTest, LargeAndSmall) {
+  std::vector<std::pair<void*, size_t>> ptrs;
+  for (size_t size : {size_t{8}, size_t{100}, size_t{4096}, size_t{1 << 20}}) {
+    for (int i = 0; i < 100; ++i) {
+      ptrs.emplace_back(malloc(size), size);
+    }
+  }
+  for (auto& p : ptrs) {
+    MallocExtension::DeferredFree(p.first, p.second);
+  }
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_TRUE(MallocExtension::AdvanceEpoch());
+  }
+  EXPECT_EQ(DeferredFreeBytes(), 0);
+}
+
+// Readers follow a shared pointer to a node and check its contents while a
+// writer keeps replacing the node and deferring the free of the old one.
+TEST(DeferredFreeTest, Concurrent) {
+  struct Node {
+    uint64_t value;
+    uint64_t check;
+  };
+  constexpr uint64_t kMagic = 0x5a5a5a5a5a5a5a5aULL;
+
+  std::atomic<Node*> head(new Node{0, kMagic});
+  std::atomic<bool> done(false);
+  std::atomic<size_t> reads(0);
+
+  std::vector<std::thread> readers;
+  for (int i = 0; i < 3; ++i) {
+    readers.emplace_back([&]() {
+      while (!done.load(std::memory_order_acquire)) {
+        const uint64_t epoch = MallocExtension::EnterEpoch();
+        Node* node = head.load(std::memory_order_acquire);
+        const uint64_t value = node->value;
+        ASSERT_EQ(node->check, value ^ kMagic);
+        MallocExtension::ExitEpoch(epoch);
+        reads.fetch_add(1, std::memory_order_relaxed);
+      }
+    });
+  }
+
+  for (uint64_t i = 1; i <= 100000; ++i) {
+    Node* node = new Node{i, i ^ kMagic};
+    Node* old = head.exchange(node, std::memory_order_acq_rel);
+    MallocExtension::DeferredFree(old, sizeof(Node));
+    if (i % 100 == 0) MallocExtension::AdvanceEpoch();
+  }
+  done.store(true, std::memory_order_release);
+  for (auto& t : readers) {
+    t.join();
+  }
+  EXPECT_GT(reads.load(), 0);
+
+  MallocExtension::DeferredFree(head.load(), sizeof(Node));
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_TRUE(MallocExtension::AdvanceEpoch());
+  }
+  EXPECT_EQ(DeferredFreeBytes(), 0);
+}
+
+}  // namespace
+}  // namespace tcmalloc
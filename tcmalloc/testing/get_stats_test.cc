@@ -67,6 +67,57 @@ TEST_F(GetStatsTest, Pbtxt) {
   EXPECT_THAT(buf, HasSubstr("limit_hits: 0"));
 }
 
+TEST_F(GetStatsTest, SizeClassWaste) {
+  // Keep enough objects that are rounded up to a larger size class alive for
+  // some of them to be sampled.
+  std::vector<std::unique_ptr<char[]>> objects;
+  for (int i = 0; i < 64 * 1024; ++i) {
+    objects.emplace_back(new char[1000]);
+  }
+
+  EXPECT_THAT(MallocExtension::GetStats(),
+              HasSubstr("Internal fragmentation by size class"));
+  const std::string pbtxt = GetStatsInPbTxt();
+  EXPECT_THAT(pbtxt, HasSubstr("size_class_waste {"));
+  EXPECT_THAT(pbtxt, ContainsRegex(R"(rounding_bytes: [1-9][0-9]*)"));
+}
+
+TEST_F(GetStatsTest, MemoryWaterfall) {
+  // Free many objects at once, so that the per-CPU or per-thread caches
+  // overflow into the transfer and central caches, where they then sit.
+  {
+    std::vector<std::unique_ptr<char[]>> objects;
+    for (int i = 0; i < 64 * 1024; ++i) {
+      objects.emplace_back(new char[1000]);
+    }
+  }
+
+  // Start the interval over which idle bytes are measured.  Reading the
+  // stats does not start a new one, so every reader sees the idle bytes.
+  MallocExtension::ResetMemoryWaterfall();
+  EXPECT_THAT(MallocExtension::GetStats(),
+              HasSubstr("Free bytes by size class and cache tier"));
+  for (int i = 0; i < 2; ++i) {
+    const std::string pbtxt = GetStatsInPbTxt();
+    EXPECT_THAT(pbtxt, HasSubstr("memory_waterfall {"));
+    EXPECT_THAT(pbtxt, ContainsRegex(R"(central_bytes: [1-9][0-9]*)"));
+    EXPECT_THAT(pbtxt, ContainsRegex(
+                           R"((transfer|central)_idle_bytes: [1-9][0-9]*)"));
+  }
+}
+
+TEST_F(GetStatsTest, MetadataArenaBytes) {
+  // Any allocation at all needs spans and pagemap leaves.
+  ::operator delete(::operator new(1000));
+
+  EXPECT_THAT(MallocExtension::GetStats(),
+              ContainsRegex(R"( [1-9][0-9]* \(.*\) Arena bytes for spans)"));
+  const std::string pbtxt = GetStatsInPbTxt();
+  EXPECT_THAT(pbtxt, HasSubstr("metadata_arena_bytes {"));
+  EXPECT_THAT(pbtxt, ContainsRegex(R"(spans: [1-9][0-9]*)"));
+  EXPECT_THAT(pbtxt, ContainsRegex(R"(pagemap: [1-9][0-9]*)"));
+}
+
 TEST_F(GetStatsTest, Parameters) {
 #ifdef __x86_64__
   // HPAA is not enabled by default for non-x86 platforms, so we do not print
@@ -0,0 +1,303 @@
+// Copyright 2019 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <new>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "tcmalloc/malloc_extension.h"
+
+namespace tcmalloc {
+namespace {
+
+TEST(HeapTest, AllocateAndDeallocate) {
+  Heap heap;
+  std::vector<void*> ptrs;
+  for (size_t size : {size_t{1}, size_t{8}, size_t{100}, size_t{4096},
+                      size_t{300000}, size_t{5 << 20}}) {
+    void* ptr = heap.Allocate(size);
+    ASSERT_NE(ptr, nullptr) << size;
+    if (size >= alignof(std::max_align_t)) {
+      EXPECT_EQ(reinterpret_cast<uintptr_t>(ptr) % alignof(std::max_align_t),
+                0);
+    }
+    EXPECT_TRUE(heap.Owns(ptr));
+    ASSERT_GE(MallocExtension::GetAllocatedSize(ptr), size);
+    memset(ptr, 0xab, size);
+    ptrs.push_back(ptr);
+  }
+
+  const Heap::Stats stats = heap.GetStats();
+  EXPECT_GE(stats.allocated_bytes, (5 << 20) + 300000 + 4096 + 100 + 8 + 1);
+  EXPECT_GE(stats.mapped_bytes, stats.allocated_bytes + stats.free_bytes);
+  EXPECT_GE(stats.reserved_bytes, stats.mapped_bytes);
+  EXPECT_GE(stats.regions, 1);
+
+  for (void* ptr : ptrs) {
+    heap.Deallocate(ptr);
+  }
+  EXPECT_EQ(heap.GetStats().allocated_bytes, 0);
+
+  // Freed memory is reused.
+  void* again = heap.Allocate(5 << 20);
+  EXPECT_EQ(again, ptrs.back());
+  heap.Deallocate(again);
+}
+
+TEST(HeapTest, Independent) {
+  Heap a, b;
+  void* ptr = a.Allocate(64);
+  ASSERT_NE(ptr, nullptr);
+  EXPECT_TRUE(a.Owns(ptr));
+  EXPECT_FALSE(b.Owns(ptr));
+  EXPECT_EQ(b.GetStats().allocated_bytes, 0);
+
+  void* global = malloc(64);
+  EXPECT_FALSE(a.Owns(global));
+  free(global);
+  a.Deallocate(ptr);
+}
+
+TEST(HeapTest, GlobalFree) {
+  Heap heap;
+  void* small = heap.Allocate(48);
+  void* large = heap.Allocate(1 << 20);
+  ASSERT_NE(small, nullptr);
+  ASSERT_NE(large, nullptr);
+  EXPECT_EQ(MallocExtension::GetOwnership(small),
+            MallocExtension::Ownership::kOwned);
+  const size_t allocated = heap.GetStats().allocated_bytes;
+
+  free(small);
+  ::operator delete(large, size_t{1} << 20);
+  EXPECT_LT(heap.GetStats().allocated_bytes, allocated);
+  EXPECT_EQ(heap.GetStats().allocated_bytes, 0);
+
+  // realloc() moves the memory to the global heap.
+  char* ptr = static_cast<char*>(heap.Allocate(16));
+  ASSERT_NE(ptr, nullptr);
+  memcpy(ptr, "0123456789abcde", 16);
+  ptr = static_cast<char*>(realloc(ptr, 1000));
+  ASSERT_NE(ptr, nullptr);
+  EXPECT_FALSE(heap.Owns(ptr));
+  EXPECT_EQ(memcmp(ptr, "0123456789abcde", 16), 0);
+  EXPECT_EQ(heap.GetStats().allocated_bytes, 0);
+  free(ptr);
+}
+
+TEST(HeapTest, Reset) {
+  Heap heap;
+  for (int i = 0; i < 10000; ++i) {
+    ASSERT_NE(heap.Allocate(i % 1000 + 1), nullptr);
+  }
+  ASSERT_NE(heap.Allocate(40 << 20), nullptr);
+  const Heap::Stats before = heap.GetStats();
+  EXPECT_GE(before.regions, 2);
+
+  heap.Reset();
+  const Heap::Stats after = heap.GetStats();
+  EXPECT_EQ(after.allocated_bytes, 0);
+  EXPECT_EQ(after.free_bytes, 0);
+  EXPECT_LT(after.mapped_bytes, before.mapped_bytes);
+  // Regions are kept for reuse.
+  EXPECT_EQ(after.regions, before.regions);
+
+  void* ptr = heap.Allocate(40 << 20);
+  ASSERT_NE(ptr, nullptr);
+  EXPECT_EQ(heap.GetStats().regions, before.regions);
+  // The memory was returned to the system, and comes back zeroed.
+  EXPECT_EQ(static_cast<char*>(ptr)[12345], 0);
+}
+
+TEST(HeapTest, Limit) {
+  constexpr size_t kLimit = 1 << 20;
+  Heap heap(kLimit);
+  size_t allocated = 0;
+  while (heap.Allocate(1000) != nullptr) {
+    allocated += 1000;
+    ASSERT_LE(allocated, kLimit);
+  }
+  EXPECT_GT(allocated, kLimit / 2);
+  EXPECT_LE(heap.GetStats().mapped_bytes, kLimit);
+  EXPECT_EQ(heap.Allocate(2 * kLimit), nullptr);
+
+  heap.Reset();
+  EXPECT_NE(heap.Allocate(1000), nullptr);
+}
+
+TEST(HeapTest, RegionsAreReused) {
+  size_t reserved;
+  {
+    Heap heap;
+    ASSERT_NE(heap.Allocate(100), nullptr);
+    reserved = heap.GetStats().reserved_bytes;
+  }
+  Heap heap;
+  void* ptr = heap.Allocate(100);
+  ASSERT_NE(ptr, nullptr);
+  EXPECT_EQ(heap.GetStats().reserved_bytes, reserved);
+  heap.Deallocate(ptr);
+}
+
+TEST(HeapTest, Caged) {
+  Heap::Options options;
+  options.caged = true;
+  Heap heap(options);
+  char* base = static_cast<char*>(heap.cage_base());
+  ASSERT_NE(base, nullptr);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(base) % Heap::kCageBytes, 0);
+
+  std::vector<uint32_t> offsets;
+  for (size_t size : {size_t{16}, size_t{1000}, size_t{200000},
+                      size_t{50 << 20}}) {
+    const uint32_t offset = heap.AllocateCompressed(size);
+    ASSERT_NE(offset, 0) << size;
+    char* ptr = static_cast<char*>(heap.Decompress(offset));
+    EXPECT_GE(ptr, base);
+    EXPECT_LE(ptr + size, base + Heap::kCageBytes);
+    EXPECT_EQ(heap.Compress(ptr), offset);
+    memset(ptr, 1, size);
+    offsets.push_back(offset);
+  }
+  EXPECT_EQ(heap.Compress(nullptr), 0);
+  EXPECT_EQ(heap.Decompress(0), nullptr);
+
+  // Memory of a caged heap may be freed globally too.
+  free(heap.Decompress(offsets.back()));
+  offsets.pop_back();
+  for (uint32_t offset : offsets) {
+    heap.DeallocateCompressed(offset);
+  }
+  EXPECT_EQ(heap.GetStats().allocated_bytes, 0);
+
+  // Nothing is allocated beyond the cage.
+  EXPECT_EQ(heap.Allocate(Heap::kCageBytes), nullptr);
+}
+
+TEST(HeapTest, CagesAreReused) {
+  Heap::Options options;
+  options.caged = true;
+  void* base;
+  {
+    Heap heap(options);
+    base = heap.cage_base();
+    ASSERT_NE(heap.Allocate(100), nullptr);
+  }
+  Heap heap(options);
+  EXPECT_EQ(heap.cage_base(), base);
+  EXPECT_GE(heap.GetStats().regions, 1);
+  void* ptr = heap.Allocate(100);
+  ASSERT_NE(ptr, nullptr);
+  EXPECT_TRUE(heap.Owns(ptr));
+}
+
+TEST(HeapTest, SharedMemory) {
+  Heap::Options options;
+  options.shared = true;
+  Heap heap(options);
+  constexpr size_t kSize = 100000;
+  char* ptr = static_cast<char*>(heap.Allocate(kSize));
+  ASSERT_NE(ptr, nullptr);
+  auto location = MallocExtension::GetSharedMemoryLocation(ptr);
+  ASSERT_TRUE(location.has_value());
+  memset(ptr, 'a', kSize);
+
+  Heap unshared;
+  void* other = unshared.Allocate(100);
+  ASSERT_NE(other, nullptr);
+  EXPECT_FALSE(MallocExtension::GetSharedMemoryLocation(other).has_value());
+  void* global = malloc(100);
+  EXPECT_FALSE(MallocExtension::GetSharedMemoryLocation(global).has_value());
+  free(global);
+
+  // Another process maps the allocation from the fd alone, checks what we
+  // wrote, and answers in place.
+  const pid_t pid = fork();
+  ASSERT_GE(pid, 0);
+  if (pid == 0) {
+    const size_t page = getpagesize();
+    const size_t start = location->offset & ~(page - 1);
+    const size_t length = location->offset - start + kSize;
+    void* map = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED,
+                     location->fd, start);
+    if (map == MAP_FAILED) _exit(1);
+    char* view = static_cast<char*>(map) + (location->offset - start);
+    for (size_t i = 0; i < kSize; ++i) {
+      if (view[i] != 'a') _exit(3);
+    }
+    memset(view, 'b', kSize);
+    _exit(0);
+  }
+  int status;
+  ASSERT_EQ(waitpid(pid, &status, 0), pid);
+  ASSERT_TRUE(WIFEXITED(status));
+  ASSERT_EQ(WEXITSTATUS(status), 0);
+  for (size_t i = 0; i < kSize; ++i) {
+    ASSERT_EQ(ptr[i], 'b') << i;
+  }
+  heap.Deallocate(ptr);
+}
+
+TEST(HeapTest, SharedMemoryIsNotInheritedByFork) {
+  Heap::Options options;
+  options.shared = true;
+  Heap heap(options);
+  constexpr size_t kSize = 100000;
+  char* ptr = static_cast<char*>(heap.Allocate(kSize));
+  ASSERT_NE(ptr, nullptr);
+  memset(ptr, 'a', kSize);
+
+  // The child would fault on the shared heap's memory, rather than write to
+  // the parent's pages through it; it still has its own global heap.
+  const pid_t pid = fork();
+  ASSERT_GE(pid, 0);
+  if (pid == 0) {
+    const size_t page = getpagesize();
+    void* ptr_page =
+        reinterpret_cast<void*>(reinterpret_cast<uintptr_t>(ptr) & ~(page - 1));
+    unsigned char vec;
+    if (mincore(ptr_page, page, &vec) == 0 || errno != ENOMEM) _exit(1);
+    char* global = static_cast<char*>(malloc(kSize));
+    if (global == nullptr) _exit(2);
+    memset(global, 'b', kSize);
+    free(global);
+    _exit(0);
+  }
+  int status;
+  ASSERT_EQ(waitpid(pid, &status, 0), pid);
+  ASSERT_TRUE(WIFEXITED(status));
+  ASSERT_EQ(WEXITSTATUS(status), 0);
+
+  // The parent's heap is untouched and keeps working.
+  for (size_t i = 0; i < kSize; ++i) {
+    ASSERT_EQ(ptr[i], 'a') << i;
+  }
+  void* more = heap.Allocate(kSize);
+  ASSERT_NE(more, nullptr);
+  memset(more, 'c', kSize);
+  heap.Deallocate(more);
+  heap.Deallocate(ptr);
+}
+
+}  // namespace
+}  // namespace tcmalloc
@@ -0,0 +1,182 @@
+// Copyright 2019 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <limits>
+#include <new>
+#include <set>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "absl/types/optional.h"
+#include "tcmalloc/malloc_extension.h"
+#include "tcmalloc/testing/testutil.h"
+
+namespace tcmalloc {
+namespace {
+
+constexpr uintptr_t kHugePage = uintptr_t{2} << 20;
+
+size_t NumericProperty(const char* name) {
+  absl::optional<size_t> bytes = MallocExtension::GetNumericProperty(name);
+  EXPECT_TRUE(bytes.has_value()) << name;
+  return bytes.value_or(0);
+}
+
+size_t ColdBytesInUse() {
+  return NumericProperty("tcmalloc.cold_bytes_in_use");
+}
+
+size_t ColdBytesMapped() {
+  return NumericProperty("tcmalloc.cold_bytes_mapped");
+}
+
+// Declared first, so that it runs before anything allocates cold memory.
+TEST(HotColdTest, NoColdBytesBeforeColdAllocations) {
+  MallocExtension::GetStats();
+  MallocExtension::GetProperties();
+  EXPECT_EQ(ColdBytesInUse(), 0);
+  EXPECT_EQ(ColdBytesMapped(), 0);
+}
+
+TEST(HotColdTest, ColdAllocationsAreSegregated) {
+  const size_t before = ColdBytesInUse();
+
+  std::vector<void*> hot, cold;
+  for (size_t size : {size_t{8}, size_t{100}, size_t{4096}, size_t{300000}}) {
+    void* h = tcmalloc_hot_cold_new(size, 255);
+    void* c = tcmalloc_hot_cold_new(size, 0);
+    ASSERT_NE(h, nullptr);
+    ASSERT_NE(c, nullptr);
+    ASSERT_GE(MallocExtension::GetAllocatedSize(c), size);
+    memset(h, 0xab, size);
+    memset(c, 0xcd, size);
+    hot.push_back(h);
+    cold.push_back(c);
+  }
+  EXPECT_GE(ColdBytesInUse(), before + 8 + 100 + 4096 + 300000);
+
+  // No hugepage holds both hot and cold objects.
+  std::set<uintptr_t> cold_hugepages;
+  for (void* c : cold) {
+    cold_hugepages.insert(reinterpret_cast<uintptr_t>(c) / kHugePage);
+  }
+  for (void* h : hot) {
+    EXPECT_EQ(cold_hugepages.count(reinterpret_cast<uintptr_t>(h) / kHugePage),
+              0);
+  }
+
+  for (void* h : hot) {
+    ::operator delete(h);
+  }
+  for (void* c : cold) {
+    ::operator delete(c);
+  }
+  EXPECT_EQ(ColdBytesInUse(), before);
+}
+
+TEST(HotColdTest, ColdMemoryIsReused) {
+  // A freed large cold allocation goes back to the tagged page heap, which
+  // serves the next one from it.
+  void* first = tcmalloc_hot_cold_new(1 << 20, 10);
+  ASSERT_NE(first, nullptr);
+  memset(first, 0xab, 1 << 20);
+  free(first);
+  void* second = tcmalloc_hot_cold_new(1 << 20, 10);
+  EXPECT_EQ(second, first);
+  ::operator delete(second, size_t{1} << 20);
+}
+
+TEST(HotColdTest, ColdBytesCountInHeapStats) {
+  constexpr size_t kSize = size_t{8} << 20;
+  const size_t before = NumericProperty("generic.current_allocated_bytes");
+  void* c = tcmalloc_hot_cold_new(kSize, 0);
+  ASSERT_NE(c, nullptr);
+  memset(c, 0xcd, kSize);
+  EXPECT_GE(NumericProperty("generic.current_allocated_bytes"),
+            before + kSize);
+  EXPECT_GE(NumericProperty("generic.physical_memory_used"),
+            ColdBytesMapped());
+  ::operator delete(c);
+}
+
+TEST(HotColdTest, ColdMemoryIsReleased) {
+  constexpr size_t kSize = size_t{32} << 20;
+  const size_t before = ColdBytesMapped();
+  void* c = tcmalloc_hot_cold_new(kSize, 0);
+  ASSERT_NE(c, nullptr);
+  memset(c, 0xcd, kSize);
+  EXPECT_GE(ColdBytesMapped(), before + kSize);
+  ::operator delete(c);
+  MallocExtension::ReleaseMemoryToSystem(std::numeric_limits<size_t>::max());
+  EXPECT_LT(ColdBytesMapped(), before + kSize);
+}
+
+TEST(HotColdTest, ColdAllocationsAreSampled) {
+  ScopedProfileSamplingRate s(1);
+  ScopedGuardedSamplingRate g(-1);
+  constexpr size_t kSmall = 1234;
+  constexpr size_t kLarge = 456789;
+
+  auto count_samples = []() {
+    int n = 0;
+    MallocExtension::SnapshotCurrent(ProfileType::kHeap)
+        .Iterate([&](const Profile::Sample& e) {
+          if (e.requested_size == kSmall || e.requested_size == kLarge) ++n;
+        });
+    return n;
+  };
+
+  void* small = tcmalloc_hot_cold_new(kSmall, 0);
+  void* large = tcmalloc_hot_cold_new(kLarge, 0);
+  ASSERT_NE(small, nullptr);
+  ASSERT_NE(large, nullptr);
+  EXPECT_EQ(count_samples(), 2);
+  ::operator delete(small);
+  ::operator delete(large, kLarge);
+  EXPECT_EQ(count_samples(), 0);
+
+  // Guarded samples hand the cold object they replace back to the cold free
+  // lists.
+  ScopedGuardedSamplingRate guard_all(0);
+  for (int i = 0; i < 100; ++i) {
+    void* p = tcmalloc_hot_cold_new(kSmall, 0);
+    ASSERT_NE(p, nullptr);
+    memset(p, 0xcd, kSmall);
+    ::operator delete(p, kSmall);
+  }
+}
+
+TEST(HotColdTest, RequestedBytesByHint) {
+  void* p = tcmalloc_hot_cold_new(1000, 42);
+  void* q = tcmalloc_hot_cold_new(2000, 200);
+  ::operator delete(p);
+  ::operator delete(q);
+
+  const auto properties = MallocExtension::GetProperties();
+  auto cold = properties.find("tcmalloc.hot_cold_requested_bytes.42");
+  ASSERT_NE(cold, properties.end());
+  EXPECT_GE(cold->second.value, 1000);
+  auto hot = properties.find("tcmalloc.hot_cold_requested_bytes.200");
+  ASSERT_NE(hot, properties.end());
+  EXPECT_GE(hot->second.value, 2000);
+  EXPECT_EQ(properties.count("tcmalloc.hot_cold_requested_bytes.43"), 0);
+}
+
+}  // namespace
+}  // namespace tcmalloc
@@ -50,5 +50,19 @@ TEST(LargeAllocSizeTest, Basic) {
       << "(+" << ((end_mem - start_mem) >> 20) << "MB)";
 }
 
+// Spans of 2^32 bytes or more must not have their size truncated.
+TEST(LargeAllocSizeTest, Over4GiB) {
+  const size_t kAllocSize = (size_t{4} << 30) + kPageSize;
+  void* ptr = malloc(kAllocSize);
+  ASSERT_NE(ptr, nullptr);
+  const absl::optional<size_t> allocated =
+      MallocExtension::GetAllocatedSize(ptr);
+  ASSERT_TRUE(allocated.has_value());
+  EXPECT_GE(*allocated, kAllocSize);
+  EXPECT_LT(*allocated, kAllocSize + kPageSize);
+  EXPECT_EQ(*allocated, nallocx(kAllocSize, 0));
+  sdallocx(ptr, kAllocSize, 0);
+}
+
 }  // namespace
 }  // namespace tcmalloc
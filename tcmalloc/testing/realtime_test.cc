@@ -0,0 +1,78 @@
+// Copyright 2019 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Real-time mode cannot be left, so everything runs in a single test.
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "absl/types/optional.h"
+#include "tcmalloc/malloc_extension.h"
+
+namespace tcmalloc {
+namespace {
+
+size_t Property(const char* name) {
+  absl::optional<size_t> value = MallocExtension::GetNumericProperty(name);
+  EXPECT_TRUE(value.has_value()) << name;
+  return value.has_value() ? *value : 0;
+}
+
+TEST(RealTimeTest, NoSystemCallsAfterEntering) {
+  constexpr size_t kHeap = 64 << 20;
+  EXPECT_EQ(Property("tcmalloc.realtime_heap_bytes"), 0);
+
+  MallocExtension::RealTimeConfig config;
+  config.heap_bytes = kHeap;
+  ASSERT_TRUE(MallocExtension::EnterRealTimeMode(config));
+  EXPECT_FALSE(MallocExtension::EnterRealTimeMode(config));
+  EXPECT_GE(Property("tcmalloc.realtime_heap_bytes"), kHeap);
+
+  // A quarter of the heap, in small and large pieces, allocated and freed
+  // twice.
+  std::vector<void*> ptrs;
+  for (int round = 0; round < 2; ++round) {
+    size_t total = 0;
+    for (size_t i = 0; total < kHeap / 4; ++i) {
+      const size_t size = (i % 16 == 0) ? (1 << 20) : 16 + (i % 64) * 32;
+      void* p = malloc(size);
+      ASSERT_NE(p, nullptr);
+      memset(p, 0, size);
+      ptrs.push_back(p);
+      total += size;
+    }
+    for (void* p : ptrs) free(p);
+    ptrs.clear();
+  }
+
+  // Releasing is a no-op.
+  const size_t unmapped = Property("tcmalloc.page_heap_unmapped");
+  MallocExtension::ReleaseMemoryToSystem(kHeap);
+  EXPECT_EQ(Property("tcmalloc.page_heap_unmapped"), unmapped);
+
+  // More than the heap holds is refused, not mapped.
+  EXPECT_EQ(Property("tcmalloc.realtime_failed_allocations"), 0);
+  void* big = malloc(2 * kHeap);
+  EXPECT_EQ(big, nullptr);
+  EXPECT_GE(Property("tcmalloc.realtime_failed_allocations"), 1);
+
+  EXPECT_EQ(Property("tcmalloc.realtime_system_calls"), 0);
+}
+
+}  // namespace
+}  // namespace tcmalloc
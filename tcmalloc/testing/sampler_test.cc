@@ -29,6 +29,8 @@
 
 #include "gtest/gtest.h"
 #include "absl/strings/str_cat.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
 #include "tcmalloc/malloc_extension.h"
 #include "tcmalloc/testing/testutil.h"
 
@@ -485,5 +487,31 @@ TEST(Sampler, weight_distribution) {
   }
 }
 
+// Tests that with a target rate the sample period grows when we sample much
+// more often than the target, and reverts once the target is cleared.
+TEST(Sampler, AdaptivePeriod) {
+  static constexpr int64_t kTargetRate = 10;
+  MallocExtension::SetProfileSamplingTargetRate(kTargetRate);
+  ASSERT_EQ(MallocExtension::GetProfileSamplingTargetRate(), kTargetRate);
+
+  tcmalloc::Sampler s;
+  SamplerTest::Init(&s, 1);
+  // "Allocate" ~2 samples worth of bytes per loop iteration, i.e. far more
+  // than kTargetRate samples per second, for a few adjustment windows.
+  const absl::Time deadline = absl::Now() + absl::Seconds(4);
+  int64_t samples = 0;
+  while (absl::Now() < deadline) {
+    for (int i = 0; i < 1000; ++i) {
+      if (s.RecordAllocation(2 * s.GetSamplePeriod()) != 0) ++samples;
+    }
+  }
+  EXPECT_GT(samples, 0);
+  EXPECT_GT(s.GetSamplePeriod(), static_cast<ssize_t>(kSamplingInterval));
+
+  MallocExtension::SetProfileSamplingTargetRate(0);
+  EXPECT_EQ(MallocExtension::GetProfileSamplingTargetRate(), 0);
+  EXPECT_EQ(s.GetSamplePeriod(), static_cast<ssize_t>(kSamplingInterval));
+}
+
 }  // namespace
 }  // namespace tcmalloc
@@ -0,0 +1,85 @@
+// Copyright 2019 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Compares the C deallocation functions: free(), which looks up the size
+// class of the object in the pagemap, against free_sized() and
+// free_aligned_sized(), which compute it from the size.
+//
+// Each iteration allocates a batch of objects and frees them in allocation
+// order, so that the pagemap lookups of free() are not all cache hits.
+
+#include <stddef.h>
+#include <stdlib.h>
+
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "tcmalloc/malloc_extension.h"
+
+namespace tcmalloc {
+namespace {
+
+constexpr int kBatch = 1000;
+constexpr size_t kAlignment = 64;
+
+enum class Free { kUnsized, kSized };
+
+template <Free kind>
+void BM_MallocFree(benchmark::State& state) {
+  const size_t size = state.range(0);
+  std::vector<void*> ptrs(kBatch);
+  for (auto s : state) {
+    for (void*& p : ptrs) {
+      p = malloc(size);
+    }
+    benchmark::DoNotOptimize(ptrs.data());
+    for (void* p : ptrs) {
+      if (kind == Free::kSized) {
+        free_sized(p, size);
+      } else {
+        free(p);
+      }
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * kBatch);
+}
+BENCHMARK_TEMPLATE(BM_MallocFree, Free::kUnsized)->Range(8, 256 << 10);
+BENCHMARK_TEMPLATE(BM_MallocFree, Free::kSized)->Range(8, 256 << 10);
+
+template <Free kind>
+void BM_AlignedAllocFree(benchmark::State& state) {
+  const size_t size = state.range(0);
+  std::vector<void*> ptrs(kBatch);
+  for (auto s : state) {
+    for (void*& p : ptrs) {
+      p = aligned_alloc(kAlignment, size);
+    }
+    benchmark::DoNotOptimize(ptrs.data());
+    for (void* p : ptrs) {
+      if (kind == Free::kSized) {
+        free_aligned_sized(p, kAlignment, size);
+      } else {
+        free(p);
+      }
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * kBatch);
+}
+BENCHMARK_TEMPLATE(BM_AlignedAllocFree, Free::kUnsized)
+    ->Range(kAlignment, 256 << 10);
+BENCHMARK_TEMPLATE(BM_AlignedAllocFree, Free::kSized)
+    ->Range(kAlignment, 256 << 10);
+
+}  // namespace
+}  // namespace tcmalloc
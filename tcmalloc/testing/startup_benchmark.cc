@@ -0,0 +1,199 @@
+// Copyright 2019 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Measures the cost of starting a short-lived process that uses TCMalloc.
+//
+//   startup_benchmark [runs] [allocations]
+//
+// starts itself "runs" times.  Each child makes "allocations" small
+// allocations and reports back:
+//
+// * the time from just before it was spawned until its first malloc in main()
+//   returned, which includes exec, dynamic loading and static initialization
+//   (where TCMalloc is usually initialized by the first allocation);
+// * the minor page faults taken by then, and after the allocations;
+// * its resident set size after the allocations.
+//
+// The median over all runs is printed.
+
+#include <fcntl.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/str_split.h"
+#include "tcmalloc/internal/logging.h"
+
+extern char** environ;
+
+namespace tcmalloc {
+namespace {
+
+constexpr char kChildFlag[] = "--child";
+
+int64_t MonotonicNanos() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+int64_t MinorFaults() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_minflt;
+}
+
+int64_t ResidentBytes() {
+  FILE* f = fopen("/proc/self/statm", "r");
+  if (f == nullptr) return -1;
+  long pages = 0, resident = 0;  // NOLINT(runtime/int)
+  const int n = fscanf(f, "%ld %ld", &pages, &resident);
+  fclose(f);
+  if (n != 2) return -1;
+  return static_cast<int64_t>(resident) * getpagesize();
+}
+
+struct Result {
+  int64_t first_malloc_nanos;
+  int64_t first_malloc_faults;
+  int64_t faults;
+  int64_t resident_bytes;
+};
+
+// Runs in the child; writes "<first malloc time> <faults at first malloc>
+// <faults> <resident bytes>" to stdout.
+int RunChild(int allocations) {
+  void* first = malloc(1);
+  const int64_t first_malloc_nanos = MonotonicNanos();
+  const int64_t first_malloc_faults = MinorFaults();
+
+  std::vector<void*> ptrs;
+  ptrs.reserve(allocations);
+  for (int i = 0; i < allocations; ++i) {
+    // Spread over the small size classes, as a typical program would.
+    ptrs.push_back(malloc(8 + 8 * (i % 64)));
+  }
+  const int64_t faults = MinorFaults();
+  const int64_t resident_bytes = ResidentBytes();
+  for (void* p : ptrs) free(p);
+  free(first);
+
+  absl::PrintF("%d %d %d %d\n", first_malloc_nanos, first_malloc_faults, faults,
+               resident_bytes);
+  return 0;
+}
+
+bool SpawnChild(int allocations, Result* result) {
+  int fds[2];
+  if (pipe(fds) != 0) return false;
+
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+  posix_spawn_file_actions_addclose(&actions, fds[0]);
+
+  std::string count = absl::StrCat(allocations);
+  char* argv[] = {const_cast<char*>("startup_benchmark"),
+                  const_cast<char*>(kChildFlag), &count[0], nullptr};
+  pid_t pid;
+  const int64_t start = MonotonicNanos();
+  const int err =
+      posix_spawn(&pid, "/proc/self/exe", &actions, nullptr, argv, environ);
+  posix_spawn_file_actions_destroy(&actions);
+  close(fds[1]);
+  if (err != 0) {
+    close(fds[0]);
+    return false;
+  }
+
+  std::string output;
+  char buf[256];
+  ssize_t n;
+  while ((n = read(fds[0], buf, sizeof(buf))) > 0) output.append(buf, n);
+  close(fds[0]);
+  int status;
+  if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+      WEXITSTATUS(status) != 0) {
+    return false;
+  }
+
+  std::vector<std::string> fields =
+      absl::StrSplit(output, ' ', absl::SkipWhitespace());
+  int64_t values[4];
+  if (fields.size() != 4) return false;
+  for (int i = 0; i < 4; ++i) {
+    if (!absl::SimpleAtoi(fields[i], &values[i])) return false;
+  }
+  result->first_malloc_nanos = values[0] - start;
+  result->first_malloc_faults = values[1];
+  result->faults = values[2];
+  result->resident_bytes = values[3];
+  return true;
+}
+
+int64_t Median(std::vector<Result>* results, int64_t Result::*field) {
+  std::sort(results->begin(), results->end(),
+            [field](const Result& a, const Result& b) {
+              return a.*field < b.*field;
+            });
+  return (*results)[results->size() / 2].*field;
+}
+
+int Run(int runs, int allocations) {
+  std::vector<Result> results;
+  for (int i = 0; i < runs; ++i) {
+    Result r;
+    if (!SpawnChild(allocations, &r)) {
+      Log(kLog, __FILE__, __LINE__, "child failed");
+      return 1;
+    }
+    results.push_back(r);
+  }
+
+  absl::PrintF("runs: %d, allocations per run: %d (medians)\n", runs,
+               allocations);
+  absl::PrintF("time to first malloc:        %10.1f us\n",
+               Median(&results, &Result::first_malloc_nanos) / 1000.0);
+  absl::PrintF("page faults at first malloc: %10d\n",
+               Median(&results, &Result::first_malloc_faults));
+  absl::PrintF("page faults after allocs:    %10d\n",
+               Median(&results, &Result::faults));
+  absl::PrintF("resident after allocs:       %10.1f KiB\n",
+               Median(&results, &Result::resident_bytes) / 1024.0);
+  return 0;
+}
+
+}  // namespace
+}  // namespace tcmalloc
+
+int main(int argc, char** argv) {
+  if (argc == 3 && strcmp(argv[1], tcmalloc::kChildFlag) == 0) {
+    return tcmalloc::RunChild(atoi(argv[2]));
+  }
+  const int runs = argc > 1 ? atoi(argv[1]) : 100;
+  const int allocations = argc > 2 ? atoi(argv[2]) : 1000;
+  return tcmalloc::Run(runs, allocations);
+}
@@ -646,6 +646,38 @@ TEST(TCMallocTest, SampleAllocatedSize) {
   }
 }
 
+// Sampled small objects stay among unsampled objects in their span; check
+// that frees of both, sized or not, drop exactly the samples.
+TEST(TCMallocTest, SampledObjectsInSpan) {
+  ScopedProfileSamplingRate s(1);  // Try to sample more.
+  ScopedGuardedSamplingRate gs(-1);
+
+  auto live_samples = []() {
+    int64_t count = 0;
+    MallocExtension::SnapshotCurrent(ProfileType::kHeap)
+        .Iterate([&](const Profile::Sample& e) {
+          if (e.allocated_size == 64) count += e.count;
+        });
+    return count;
+  };
+
+  const int64_t before = live_samples();
+  std::vector<void*> ptrs;
+  for (int i = 0; i < 64 * 1024; ++i) {
+    ptrs.push_back(::operator new(64));
+    ASSERT_EQ(64, MallocExtension::GetAllocatedSize(ptrs.back()));
+  }
+  EXPECT_GT(live_samples(), before);
+  for (size_t i = 0; i < ptrs.size(); ++i) {
+    if (i % 2 == 0) {
+      ::operator delete(ptrs[i], 64);
+    } else {
+      ::operator delete(ptrs[i]);
+    }
+  }
+  EXPECT_EQ(live_samples(), before);
+}
+
 // Ensure that nallocx works before main.
 struct GlobalNallocx {
   GlobalNallocx() { CHECK_CONDITION(nallocx(99, 0) >= 99); }
@@ -665,9 +697,9 @@ TEST(TCMallocTest, nallocx) {
   for (size_t size = 0; size <= (1 << 20); size += 7) {
     size_t rounded = nallocx(size, 0);
     ASSERT_GE(rounded, size);
-    void* ptr = operator new(size);
+    void* ptr = malloc(size);
     ASSERT_EQ(rounded, MallocExtension::GetAllocatedSize(ptr));
-    operator delete(ptr);
+    free(ptr);
   }
 }
 
@@ -681,7 +713,8 @@ TEST(TCMallocTest, nallocx_alignment) {
       size_t rounded = nallocx(size, MALLOCX_LG_ALIGN(align));
       ASSERT_GE(rounded, size);
       ASSERT_EQ(rounded % (1 << align), 0);
-      void* ptr = memalign(1 << align, size);
+      // Flags of 0 ask for malloc's alignment.
+      void* ptr = align == 0 ? malloc(size) : memalign(1 << align, size);
       ASSERT_EQ(rounded, MallocExtension::GetAllocatedSize(ptr));
       free(ptr);
     }
@@ -712,6 +745,195 @@ TEST(TCMallocTest, sdallocx_alignment) {
   }
 }
 
+TEST(TCMallocTest, free_sized) {
+  for (size_t size = 0; size <= 4096; size += 7) {
+    void* ptr = malloc(size);
+    memset(ptr, 0, size);
+    benchmark::DoNotOptimize(ptr);
+    free_sized(ptr, size);
+  }
+  free_sized(nullptr, 0);
+}
+
+static void CheckFreeSizedAfterRealloc() {
+  // The size to pass is the last one given to realloc, whether or not the
+  // object moved.
+  for (size_t size = 8; size <= 300000; size = size * 5 / 4) {
+    for (size_t new_size : {size - 1, size * 5 / 8, size + 1, size * 9 / 8}) {
+      void* ptr = malloc(size);
+      ASSERT_NE(ptr, nullptr);
+      ptr = realloc(ptr, new_size);
+      ASSERT_NE(ptr, nullptr);
+      memset(ptr, 0, new_size);
+      benchmark::DoNotOptimize(ptr);
+      free_sized(ptr, new_size);
+    }
+  }
+}
+
+TEST(TCMallocTest, free_sized_after_realloc) {
+  CheckFreeSizedAfterRealloc();
+}
+
+TEST(TCMallocTest, free_sized_after_realloc_sampled) {
+  ScopedProfileSamplingRate s(1);  // Try to sample more.
+  // Guarded allocations are checked against their requested size instead.
+  ScopedGuardedSamplingRate gs(-1);
+  // The new rate applies from the next sample point on, so allocate past it.
+  for (int i = 0; i < 1024 * 1024; ++i) {
+    void* ptr = malloc(64);
+    benchmark::DoNotOptimize(ptr);
+    free(ptr);
+  }
+  CheckFreeSizedAfterRealloc();
+}
+
+TEST(TCMallocTest, free_aligned_sized) {
+  for (size_t size = 0; size <= 4096; size += 7) {
+    for (size_t align = 3; align <= 10; align++) {
+      const size_t alignment = 1 << align;
+      // aligned_alloc requires the size to be a multiple of the alignment.
+      const size_t aligned_size = (size + alignment - 1) & ~(alignment - 1);
+      void* ptr = aligned_alloc(alignment, aligned_size);
+      ASSERT_NE(ptr, nullptr) << alignment << " " << aligned_size;
+      ASSERT_EQ(reinterpret_cast<uintptr_t>(ptr) & (alignment - 1), 0);
+      memset(ptr, 0, aligned_size);
+      benchmark::DoNotOptimize(ptr);
+      free_aligned_sized(ptr, alignment, aligned_size);
+    }
+  }
+}
+
+TEST(TCMallocTest, mallocx) {
+  ScopedProfileSamplingRate s(0);  // turn off sampling
+  for (size_t size = 0; size <= 300000; size = size * 3 / 2 + 1) {
+    for (int align = 0; align <= 12; align += 3) {
+      const int flags = MALLOCX_LG_ALIGN(align);
+      // Dirty memory for MALLOCX_ZERO to clear.
+      void* dirty = malloc(size);
+      memset(dirty, 0xff, size);
+      free(dirty);
+
+      char* ptr = static_cast<char*>(mallocx(size, flags | MALLOCX_ZERO));
+      ASSERT_NE(ptr, nullptr);
+      ASSERT_EQ(reinterpret_cast<uintptr_t>(ptr) % (size_t{1} << align), 0);
+      const size_t real_size = sallocx(ptr, 0);
+      EXPECT_EQ(real_size, nallocx(size, flags));
+      EXPECT_EQ(real_size, MallocExtension::GetAllocatedSize(ptr));
+      for (size_t i = 0; i < real_size; ++i) {
+        ASSERT_EQ(ptr[i], 0) << size << " " << i;
+      }
+      sdallocx(ptr, size, flags);
+    }
+  }
+}
+
+static void CheckRallocx() {
+  for (size_t size = 1; size <= 300000; size = size * 3 / 2 + 1) {
+    for (int align = 0; align <= 12; align += 3) {
+      const int flags = MALLOCX_LG_ALIGN(align);
+      char* ptr = static_cast<char*>(mallocx(size, 0));
+      ASSERT_NE(ptr, nullptr);
+      memset(ptr, 'a', size);
+      const size_t old_size = sallocx(ptr, 0);
+      memset(ptr + size, 0xff, old_size - size);
+
+      ptr = static_cast<char*>(rallocx(ptr, size * 2, flags | MALLOCX_ZERO));
+      ASSERT_NE(ptr, nullptr);
+      ASSERT_EQ(reinterpret_cast<uintptr_t>(ptr) % (size_t{1} << align), 0);
+      EXPECT_GE(sallocx(ptr, 0), size * 2);
+      for (size_t i = 0; i < size; ++i) {
+        ASSERT_EQ(ptr[i], 'a') << size << " " << i;
+      }
+      // What lies beyond the old real size was zeroed.
+      for (size_t i = old_size; i < size * 2; ++i) {
+        ASSERT_EQ(ptr[i], 0) << size << " " << i;
+      }
+
+      const size_t new_size = size / 2 + 1;
+      ptr = static_cast<char*>(rallocx(ptr, new_size, flags));
+      ASSERT_NE(ptr, nullptr);
+      ASSERT_EQ(reinterpret_cast<uintptr_t>(ptr) % (size_t{1} << align), 0);
+      EXPECT_GE(sallocx(ptr, 0), new_size);
+      for (size_t i = 0; i < new_size; ++i) {
+        ASSERT_EQ(ptr[i], 'a') << size << " " << i;
+      }
+      sdallocx(ptr, new_size, flags);
+    }
+  }
+}
+
+TEST(TCMallocTest, rallocx) {
+  ScopedProfileSamplingRate s(0);  // turn off sampling
+  CheckRallocx();
+}
+
+TEST(TCMallocTest, rallocx_sampled) {
+  ScopedProfileSamplingRate s(1);  // Try to sample more.
+  // Guarded allocations are checked against their requested size instead.
+  ScopedGuardedSamplingRate gs(-1);
+  // The new rate applies from the next sample point on, so allocate past it.
+  for (int i = 0; i < 1024 * 1024; ++i) {
+    void* ptr = malloc(64);
+    benchmark::DoNotOptimize(ptr);
+    free(ptr);
+  }
+  CheckRallocx();
+}
+
+TEST(TCMallocTest, xallocx) {
+  ScopedProfileSamplingRate s(0);  // turn off sampling
+
+  // Objects in size classes keep their size.
+  void* small = malloc(100);
+  const size_t small_size = sallocx(small, 0);
+  EXPECT_EQ(xallocx(small, 100, 1000, 0), small_size);
+  EXPECT_EQ(xallocx(small, 1 << 20, 0, 0), small_size);
+  free(small);
+
+  // Page-level objects shrink in place, and may grow in place if the page
+  // allocator can.
+  constexpr size_t kLarge = 1 << 20;
+  char* ptr = static_cast<char*>(malloc(kLarge));
+  ASSERT_NE(ptr, nullptr);
+  memset(ptr, 'a', kLarge);
+  const size_t shrunk = xallocx(ptr, kLarge / 2, 0, 0);
+  EXPECT_EQ(shrunk, kLarge / 2);
+  EXPECT_EQ(shrunk, sallocx(ptr, 0));
+
+  const size_t grown = xallocx(ptr, kLarge, 0, MALLOCX_ZERO);
+  EXPECT_EQ(grown, sallocx(ptr, 0));
+  for (size_t i = 0; i < kLarge / 2; ++i) {
+    ASSERT_EQ(ptr[i], 'a') << i;
+  }
+  for (size_t i = shrunk; i < grown; ++i) {
+    ASSERT_EQ(ptr[i], 0) << i;
+  }
+  if (grown >= kLarge) {
+    sdallocx(ptr, kLarge, 0);
+  } else {
+    sdallocx(ptr, kLarge / 2, 0);
+  }
+
+  // Objects of several hugepages shrink too, by whole hugepages and within
+  // the last one.
+  constexpr size_t kHuge = 5 << 20;
+  ptr = static_cast<char*>(malloc(kHuge));
+  ASSERT_NE(ptr, nullptr);
+  memset(ptr, 'a', kHuge);
+  size_t size = kHuge;
+  for (size_t smaller : {size_t{4 << 20} + 12345, size_t{4 << 20},
+                         size_t{3 << 20} + 1, size_t{1 << 20}}) {
+    EXPECT_EQ(xallocx(ptr, smaller, 0, 0), nallocx(smaller, 0)) << smaller;
+    EXPECT_EQ(sallocx(ptr, 0), nallocx(smaller, 0)) << smaller;
+    size = smaller;
+  }
+  for (size_t i = 0; i < size; ++i) {
+    ASSERT_EQ(ptr[i], 'a') << i;
+  }
+  sdallocx(ptr, size, 0);
+}
+
 // Parse out a line like:
 // <allocator_name>: xxx bytes allocated
 // Return xxx as an int, nullopt if it can't be found
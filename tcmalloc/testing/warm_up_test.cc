@@ -0,0 +1,75 @@
+// Copyright 2019 The TCMalloc Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <sched.h>
+#include <stddef.h>
+
+#include "gtest/gtest.h"
+#include "tcmalloc/malloc_extension.h"
+
+namespace tcmalloc {
+namespace {
+
+size_t Property(const char* name) {
+  absl::optional<size_t> value = MallocExtension::GetNumericProperty(name);
+  return value.has_value() ? *value : 0;
+}
+
+// Bytes of free objects held by the per-CPU, transfer and central caches.
+size_t CachedBytes() {
+  return Property("tcmalloc.cpu_free") +
+         Property("tcmalloc.transfer_cache_free") +
+         Property("tcmalloc.central_cache_free");
+}
+
+TEST(WarmUpTest, FillsCaches) {
+  constexpr size_t kBytes = 4 << 20;
+  const size_t allocated = Property("generic.current_allocated_bytes");
+  const size_t cached = CachedBytes();
+
+  const MallocExtension::WarmUpSize sizes[] = {{4000, 3}, {48, 1}};
+  MallocExtension::WarmUp(sizes, kBytes);
+
+  // Everything taken out of the caches went back into them.
+  EXPECT_EQ(Property("generic.current_allocated_bytes"), allocated);
+  // At least the transfer caches keep some of it; what they cannot hold is
+  // returned to the page heap.
+  EXPECT_GT(CachedBytes(), cached);
+  if (MallocExtension::PerCpuCachesActive()) {
+    EXPECT_GT(Property("tcmalloc.cpu_free"), 0);
+  }
+}
+
+TEST(WarmUpTest, IgnoresUnusableSizes) {
+  const size_t cached = CachedBytes();
+  const MallocExtension::WarmUpSize sizes[] = {{size_t{1} << 30, 1},
+                                               {64, 0},
+                                               {128, -1}};
+  MallocExtension::WarmUp(sizes, 1 << 20);
+  EXPECT_EQ(CachedBytes(), cached);
+}
+
+TEST(WarmUpTest, RestoresAffinity) {
+  cpu_set_t before, after;
+  ASSERT_EQ(sched_getaffinity(0, sizeof(before), &before), 0);
+
+  const MallocExtension::WarmUpSize sizes[] = {{256, 1}};
+  MallocExtension::WarmUp(sizes, 1 << 20);
+
+  ASSERT_EQ(sched_getaffinity(0, sizeof(after), &after), 0);
+  EXPECT_TRUE(CPU_EQUAL(&before, &after));
+}
+
+}  // namespace
+}  // namespace tcmalloc
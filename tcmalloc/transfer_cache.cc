@@ -69,9 +69,11 @@ void TransferCache::Init(size_t cl) {
                                            objs_to_move));
     cache_slots = std::min(cache_slots, max_cache_slots_);
     slots_ = reinterpret_cast<void **>(
-        Static::arena()->Alloc(max_cache_slots_ * sizeof(void *)));
+        Static::arena()->Alloc(max_cache_slots_ * sizeof(void *),
+                               kMetadataTransferCaches));
   }
   used_slots_.store(0, std::memory_order_relaxed);
+  low_water_slots_.store(0, std::memory_order_relaxed);
   cache_slots_.store(cache_slots, std::memory_order_relaxed);
   ASSERT(cache_slots <= max_cache_slots_);
 }
@@ -166,6 +168,7 @@ bool TransferCache::ShrinkCache(int locked_size_class, bool force) {
     used_slots -= num_to_free;
     cache_slots_.store(cache_slots, std::memory_order_relaxed);
     used_slots_.store(used_slots, std::memory_order_relaxed);
+    UpdateLowWaterMark(used_slots);
     // Our internal slot array may get overwritten as soon as we drop the lock,
     // so copy the items to free to an on stack buffer.
     memcpy(to_free, GetSlot(used_slots), sizeof(void *) * num_to_free);
@@ -221,6 +224,7 @@ void TransferCache::InsertRange(absl::Span<void *> batch, int N) {
       ASSERT(extra + N <= kMaxObjectsToMove);
       used_slots -= extra;
       used_slots_.store(used_slots, std::memory_order_relaxed);
+      UpdateLowWaterMark(used_slots);
 
       void **entry = GetSlot(used_slots);
       memcpy(batch.data() + N, entry, sizeof(void *) * extra);
@@ -249,6 +253,7 @@ int TransferCache::RemoveRange(void **batch, int N) {
     if (used_slots >= N) {
       used_slots -= N;
       used_slots_.store(used_slots, std::memory_order_relaxed);
+      UpdateLowWaterMark(used_slots);
       ASSERT(0 <= used_slots);
       void **entry = GetSlot(used_slots);
       memcpy(batch, entry, sizeof(void *) * N);
@@ -264,6 +269,7 @@ int TransferCache::RemoveRange(void **batch, int N) {
     used_slots -= fetch;
     ASSERT(0 <= used_slots);
     used_slots_.store(used_slots, std::memory_order_relaxed);
+    UpdateLowWaterMark(used_slots);
     void **entry = GetSlot(used_slots);
     memcpy(batch, entry, sizeof(void *) * fetch);
     tracking::Report(kTCRemoveHit, freelist_.size_class(), 1);
@@ -277,5 +283,20 @@ size_t TransferCache::tc_length() {
   return static_cast<size_t>(used_slots_.load(std::memory_order_relaxed));
 }
 
+size_t TransferCache::tc_low_water_mark() {
+  return static_cast<size_t>(
+      std::min(low_water_slots_.load(std::memory_order_relaxed),
+               used_slots_.load(std::memory_order_relaxed)));
+}
+
+void TransferCache::ResetLowWaterMarks() {
+  {
+    absl::base_internal::SpinLockHolder h(&lock_);
+    low_water_slots_.store(used_slots_.load(std::memory_order_relaxed),
+                           std::memory_order_relaxed);
+  }
+  freelist_.ResetLowWaterMark();
+}
+
 #endif
 }  // namespace tcmalloc
@@ -58,6 +58,16 @@ class TransferCache {
   // Returns the number of free objects in the transfer cache.
   size_t tc_length();
 
+  // Returns the smallest number of free objects the transfer and central
+  // caches have held since the last call to ResetLowWaterMarks().  Objects
+  // below the transfer cache mark have not moved at all in that time, since
+  // the slots are used as a stack.
+  size_t tc_low_water_mark();
+  size_t central_low_water_mark() { return freelist_.low_water_mark(); }
+
+  // Starts a new low water mark interval for both caches.
+  void ResetLowWaterMarks() LOCKS_EXCLUDED(lock_);
+
   // Returns the memory overhead (internal fragmentation) attributable
   // to the freelist.  This is memory lost when the size of elements
   // in a freelist doesn't exactly divide the page-size (an 8192-byte
@@ -89,6 +99,14 @@ class TransferCache {
   // concurrently which could lead to a deadlock.
   bool ShrinkCache(int locked_size_class, bool force) LOCKS_EXCLUDED(lock_);
 
+  // Lowers low_water_slots_ to used_slots, if needed.  Called whenever
+  // objects leave the slots.
+  void UpdateLowWaterMark(int32_t used_slots) EXCLUSIVE_LOCKS_REQUIRED(lock_) {
+    if (used_slots < low_water_slots_.load(std::memory_order_relaxed)) {
+      low_water_slots_.store(used_slots, std::memory_order_relaxed);
+    }
+  }
+
   // Returns first object of the i-th slot.
   void **GetSlot(size_t i) EXCLUSIVE_LOCKS_REQUIRED(lock_) {
     return slots_ + i;
@@ -102,6 +120,10 @@ class TransferCache {
   // updated under a lock but can be read without one.
   std::atomic<int32_t> used_slots_;
 
+  // Min of used_slots_ since the last ResetLowWaterMarks().  Updated under
+  // lock_ but can be read without it.
+  std::atomic<int32_t> low_water_slots_;
+
   // Pointer to array of free objects.  Use GetSlot() to get pointers to
   // entries.
   void **slots_ GUARDED_BY(lock_);
@@ -145,6 +167,11 @@ class TransferCache {
 
   size_t tc_length() { return 0; }
 
+  size_t tc_low_water_mark() { return 0; }
+  size_t central_low_water_mark() { return freelist_.low_water_mark(); }
+
+  void ResetLowWaterMarks() { freelist_.ResetLowWaterMark(); }
+
   size_t OverheadBytes() { return freelist_.OverheadBytes(); }
 
  private: